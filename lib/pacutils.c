@@ -70,6 +70,91 @@ alpm_file_t *pu_filelist_contains_path(alpm_filelist_t *files,
           (int(*)(const void *, const void *)) _pu_filelist_path_cmp);
 }
 
+/**
+ * @brief Remove repeated and trailing slashes from a path.
+ *
+ * @param path
+ *
+ * @return newly allocated path, NULL on error
+ */
+char *pu_path_normalize(const char *path) {
+  char *norm = strdup(path), *c, *d;
+  if (norm == NULL) { return NULL; }
+  for (c = d = norm; *c; c++) {
+    if (*c == '/' && d > norm && d[-1] == '/') { continue; }
+    *d++ = *c;
+  }
+  while (d > norm + 1 && d[-1] == '/') { d--; }
+  *d = '\0';
+  return norm;
+}
+
+/* first element in [lo, hi) not less than name */
+static size_t _pu_paths_lower_bound(const char **paths, size_t lo, size_t hi,
+    const char *name) {
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (strcmp(paths[mid], name) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static size_t _pu_files_lower_bound(alpm_file_t *files, size_t lo, size_t hi,
+    const char *name) {
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (strcmp(files[mid].name, name) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/**
+ * @brief Find many paths in a file list at once.
+ *
+ * The file list and paths are merged in a single pass, skipping ahead with
+ * a binary search over whichever side is behind.  Paths are compared
+ * exactly; directories in file lists end with a '/'.
+ *
+ * @param files sorted file list
+ * @param paths paths to find, sorted with strcmp, may contain duplicates
+ * @param count number of paths
+ * @param found called with each matching file and the index of the path it
+ * matched, a non-zero return stops the search
+ * @param ctx passed to found
+ *
+ * @return 0 on success, the value returned by found if it stopped the search
+ */
+int pu_filelist_find_paths(alpm_filelist_t *files, const char **paths,
+    size_t count, int (*found)(alpm_file_t *file, size_t idx, void *ctx),
+    void *ctx) {
+  size_t f = 0, k;
+
+  if (files == NULL || files->count == 0) { return 0; }
+  k = _pu_paths_lower_bound(paths, 0, count, files->files[0].name);
+  while (f < files->count && k < count) {
+    int cmp = strcmp(files->files[f].name, paths[k]);
+    if (cmp < 0) {
+      f = _pu_files_lower_bound(files->files, f + 1, files->count, paths[k]);
+    } else if (cmp > 0) {
+      k = _pu_paths_lower_bound(paths, k + 1, count, files->files[f].name);
+    } else {
+      int ret = found(&files->files[f], k, ctx);
+      if (ret != 0) { return ret; }
+      k++; /* the same path may be given more than once */
+    }
+  }
+
+  return 0;
+}
+
 static char *pu_fetch_pkgurl(alpm_handle_t *handle, const char *url) {
   alpm_list_t l = { .data = (void *)url }, *result = NULL;
   if (alpm_fetch_pkgurl(handle, &l, &result) == 0 && result) {
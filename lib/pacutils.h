@@ -31,13 +31,20 @@
 
 #include <alpm.h>
 
+#include "pacutils/bitmap.h"
+#include "pacutils/cacheindex.h"
 #include "pacutils/config.h"
 #include "pacutils/depends.h"
+#include "pacutils/digest.h"
+#include "pacutils/filesindex.h"
 #include "pacutils/log.h"
 #include "pacutils/mtree.h"
+#include "pacutils/statbatch.h"
+#include "pacutils/strmatch.h"
 #include "pacutils/ui.h"
 #include "pacutils/uix.h"
 #include "pacutils/util.h"
+#include "pacutils/version.h"
 
 char *pu_version(void);
 void pu_print_version(const char *progname, const char *progver);
@@ -45,6 +52,10 @@ void pu_print_version(const char *progname, const char *progver);
 int pu_pathcmp(const char *p1, const char *p2);
 alpm_file_t *pu_filelist_contains_path(alpm_filelist_t *files,
     const char *path);
+char *pu_path_normalize(const char *path);
+int pu_filelist_find_paths(alpm_filelist_t *files, const char **paths,
+    size_t count, int (*found)(alpm_file_t *file, size_t idx, void *ctx),
+    void *ctx);
 
 alpm_pkg_t *pu_find_pkgspec(alpm_handle_t *handle, const char *pkgspec);
 int pu_fprint_pkgspec(FILE *stream, alpm_pkg_t *pkg);
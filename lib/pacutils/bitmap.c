@@ -0,0 +1,137 @@
+/*
+ * Copyright 2012-2020 Andrew Gregory <andrew.gregory.8@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitmap.h"
+
+#define WORDBITS (sizeof(unsigned long) * 8)
+
+/* clear the unused bits of the last word so whole-word operations can be
+ * used on the full bitmap */
+static void _pu_bitmap_trim(pu_bitmap_t *bitmap) {
+  size_t used = bitmap->nbits % WORDBITS;
+  if (used) { bitmap->words[bitmap->nwords - 1] &= (1UL << used) - 1; }
+}
+
+pu_bitmap_t *pu_bitmap_new(size_t nbits) {
+  pu_bitmap_t *bitmap = malloc(sizeof(pu_bitmap_t));
+  if (bitmap == NULL) { return NULL; }
+  bitmap->nbits = nbits;
+  bitmap->nwords = (nbits + WORDBITS - 1) / WORDBITS;
+  if ((bitmap->words = calloc(bitmap->nwords + 1,
+              sizeof(unsigned long))) == NULL) {
+    free(bitmap);
+    return NULL;
+  }
+  return bitmap;
+}
+
+pu_bitmap_t *pu_bitmap_dup(const pu_bitmap_t *bitmap) {
+  pu_bitmap_t *dup = pu_bitmap_new(bitmap->nbits);
+  if (dup) { pu_bitmap_copy(dup, bitmap); }
+  return dup;
+}
+
+void pu_bitmap_free(pu_bitmap_t *bitmap) {
+  if (bitmap == NULL) { return; }
+  free(bitmap->words);
+  free(bitmap);
+}
+
+void pu_bitmap_set(pu_bitmap_t *bitmap, size_t bit) {
+  bitmap->words[bit / WORDBITS] |= 1UL << (bit % WORDBITS);
+}
+
+void pu_bitmap_clear(pu_bitmap_t *bitmap, size_t bit) {
+  bitmap->words[bit / WORDBITS] &= ~(1UL << (bit % WORDBITS));
+}
+
+int pu_bitmap_test(const pu_bitmap_t *bitmap, size_t bit) {
+  return (bitmap->words[bit / WORDBITS] >> (bit % WORDBITS)) & 1;
+}
+
+void pu_bitmap_fill(pu_bitmap_t *bitmap) {
+  memset(bitmap->words, 0xff, bitmap->nwords * sizeof(unsigned long));
+  _pu_bitmap_trim(bitmap);
+}
+
+void pu_bitmap_zero(pu_bitmap_t *bitmap) {
+  memset(bitmap->words, 0, bitmap->nwords * sizeof(unsigned long));
+}
+
+/* the binary operations require bitmaps of the same size */
+void pu_bitmap_copy(pu_bitmap_t *dest, const pu_bitmap_t *src) {
+  memcpy(dest->words, src->words, dest->nwords * sizeof(unsigned long));
+}
+
+void pu_bitmap_and(pu_bitmap_t *dest, const pu_bitmap_t *src) {
+  size_t i;
+  for (i = 0; i < dest->nwords; i++) { dest->words[i] &= src->words[i]; }
+}
+
+void pu_bitmap_or(pu_bitmap_t *dest, const pu_bitmap_t *src) {
+  size_t i;
+  for (i = 0; i < dest->nwords; i++) { dest->words[i] |= src->words[i]; }
+}
+
+void pu_bitmap_andnot(pu_bitmap_t *dest, const pu_bitmap_t *src) {
+  size_t i;
+  for (i = 0; i < dest->nwords; i++) { dest->words[i] &= ~src->words[i]; }
+}
+
+void pu_bitmap_not(pu_bitmap_t *bitmap) {
+  size_t i;
+  for (i = 0; i < bitmap->nwords; i++) { bitmap->words[i] = ~bitmap->words[i]; }
+  _pu_bitmap_trim(bitmap);
+}
+
+size_t pu_bitmap_count(const pu_bitmap_t *bitmap) {
+  size_t i, count = 0;
+  for (i = 0; i < bitmap->nwords; i++) {
+    count += __builtin_popcountl(bitmap->words[i]);
+  }
+  return count;
+}
+
+/**
+ * @brief Find the first set bit at or after a position.
+ *
+ * @param bitmap
+ * @param start position to start searching at
+ * @param bit set to the position found
+ *
+ * @return 0 if a set bit was found, -1 otherwise
+ */
+int pu_bitmap_next(const pu_bitmap_t *bitmap, size_t start, size_t *bit) {
+  size_t i = start / WORDBITS;
+  unsigned long word;
+  if (start >= bitmap->nbits) { return -1; }
+  word = bitmap->words[i] & (~0UL << (start % WORDBITS));
+  while (word == 0) {
+    if (++i >= bitmap->nwords) { return -1; }
+    word = bitmap->words[i];
+  }
+  *bit = i * WORDBITS + __builtin_ctzl(word);
+  return 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2012-2020 Andrew Gregory <andrew.gregory.8@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef PACUTILS_BITMAP_H
+#define PACUTILS_BITMAP_H
+
+#include <stddef.h>
+
+/* fixed-size set of bits, bits past nbits are always clear */
+typedef struct pu_bitmap_t {
+  unsigned long *words;
+  size_t nbits;
+  size_t nwords;
+} pu_bitmap_t;
+
+pu_bitmap_t *pu_bitmap_new(size_t nbits);
+pu_bitmap_t *pu_bitmap_dup(const pu_bitmap_t *bitmap);
+void pu_bitmap_free(pu_bitmap_t *bitmap);
+
+void pu_bitmap_set(pu_bitmap_t *bitmap, size_t bit);
+void pu_bitmap_clear(pu_bitmap_t *bitmap, size_t bit);
+int pu_bitmap_test(const pu_bitmap_t *bitmap, size_t bit);
+
+void pu_bitmap_fill(pu_bitmap_t *bitmap);
+void pu_bitmap_zero(pu_bitmap_t *bitmap);
+void pu_bitmap_copy(pu_bitmap_t *dest, const pu_bitmap_t *src);
+void pu_bitmap_and(pu_bitmap_t *dest, const pu_bitmap_t *src);
+void pu_bitmap_or(pu_bitmap_t *dest, const pu_bitmap_t *src);
+void pu_bitmap_andnot(pu_bitmap_t *dest, const pu_bitmap_t *src);
+void pu_bitmap_not(pu_bitmap_t *bitmap);
+
+size_t pu_bitmap_count(const pu_bitmap_t *bitmap);
+int pu_bitmap_next(const pu_bitmap_t *bitmap, size_t start, size_t *bit);
+
+#endif /* PACUTILS_BITMAP_H */
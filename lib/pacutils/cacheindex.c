@@ -0,0 +1,974 @@
+/*
+ * Copyright 2012-2020 Andrew Gregory <andrew.gregory.8@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 700 /* st_mtim */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "cacheindex.h"
+#include "util.h"
+
+/* Index layout, all numbers in decimal text:
+ *
+ *   PUCACHE <version>\n
+ *   <cache directory>\n
+ *   <directory mtime> <mtime nsec>\n
+ *   for each file, in file name order:
+ *     <isdir> <namelen> <size> <mtime> <mtime nsec> <pkginfolen> <fileslen>\n
+ *     <file name>\0<name>\0<version>\0<arch>\0<.PKGINFO contents><file list>
+ *
+ * namelen covers the four NUL-terminated strings, which are empty if
+ * unknown.  pkginfolen is -1 if the package has not been read, fileslen is -1
+ * if it was read without its file list, which is stored as NUL-terminated
+ * paths in sorted order. */
+
+#define PU_CACHE_INDEX_MAGIC "PUCACHE"
+#define PU_CACHE_INDEX_VERSION 2
+
+struct _pu_cache_buf {
+  char *data;
+  size_t len, size;
+};
+
+static int _pu_cache_buf_add(struct _pu_cache_buf *buf, const void *data,
+    size_t len) {
+  if (buf->len + len > buf->size) {
+    size_t newsize = buf->size ? buf->size * 2 : 4096;
+    char *newdata;
+    while (newsize < buf->len + len) { newsize *= 2; }
+    if ((newdata = realloc(buf->data, newsize)) == NULL) { return -1; }
+    buf->data = newdata;
+    buf->size = newsize;
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  return 0;
+}
+
+static int _pu_cache_pkg_set_str(char **dest, const char *value) {
+  char *dup = strdup(value);
+  if (dup == NULL) { return -1; }
+  free(*dest);
+  *dest = dup;
+  return 0;
+}
+
+static int _pu_cache_pkg_add_str(alpm_list_t **list, const char *value) {
+  char *dup = strdup(value);
+  if (dup == NULL || alpm_list_append(list, dup) == NULL) {
+    free(dup);
+    return -1;
+  }
+  return 0;
+}
+
+static int _pu_cache_pkg_add_dep(alpm_list_t **list, const char *value) {
+  alpm_depend_t *dep = alpm_dep_from_string(value);
+  if (dep == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (alpm_list_append(list, dep) == NULL) {
+    alpm_dep_free(dep);
+    return -1;
+  }
+  return 0;
+}
+
+/* fill in the package fields from the raw .PKGINFO */
+static int _pu_cache_pkg_parse(pu_cache_pkg_t *pkg) {
+  char *buf, *line, *save = NULL;
+  int ret = 0;
+
+  if ((buf = strdup(pkg->_pkginfo)) == NULL) { return -1; }
+  for (line = strtok_r(buf, "\n", &save); line && ret == 0;
+      line = strtok_r(NULL, "\n", &save)) {
+    char *key = line, *val;
+    if (line[0] == '#' || (val = strstr(line, " = ")) == NULL) { continue; }
+    *val = '\0';
+    val += 3;
+
+    if (strcmp(key, "pkgname") == 0) {
+      ret = _pu_cache_pkg_set_str(&pkg->name, val);
+    } else if (strcmp(key, "pkgbase") == 0) {
+      ret = _pu_cache_pkg_set_str(&pkg->base, val);
+    } else if (strcmp(key, "pkgver") == 0) {
+      ret = _pu_cache_pkg_set_str(&pkg->version, val);
+    } else if (strcmp(key, "pkgdesc") == 0) {
+      ret = _pu_cache_pkg_set_str(&pkg->desc, val);
+    } else if (strcmp(key, "url") == 0) {
+      ret = _pu_cache_pkg_set_str(&pkg->url, val);
+    } else if (strcmp(key, "packager") == 0) {
+      ret = _pu_cache_pkg_set_str(&pkg->packager, val);
+    } else if (strcmp(key, "arch") == 0) {
+      ret = _pu_cache_pkg_set_str(&pkg->arch, val);
+    } else if (strcmp(key, "size") == 0) {
+      pkg->isize = strtoll(val, NULL, 10);
+    } else if (strcmp(key, "builddate") == 0) {
+      pkg->builddate = strtoll(val, NULL, 10);
+    } else if (strcmp(key, "group") == 0) {
+      ret = _pu_cache_pkg_add_str(&pkg->groups, val);
+    } else if (strcmp(key, "license") == 0) {
+      ret = _pu_cache_pkg_add_str(&pkg->licenses, val);
+    } else if (strcmp(key, "provides") == 0) {
+      ret = _pu_cache_pkg_add_dep(&pkg->provides, val);
+    } else if (strcmp(key, "depend") == 0) {
+      ret = _pu_cache_pkg_add_dep(&pkg->depends, val);
+    } else if (strcmp(key, "optdepend") == 0) {
+      ret = _pu_cache_pkg_add_dep(&pkg->optdepends, val);
+    } else if (strcmp(key, "conflict") == 0) {
+      ret = _pu_cache_pkg_add_dep(&pkg->conflicts, val);
+    } else if (strcmp(key, "replaces") == 0) {
+      ret = _pu_cache_pkg_add_dep(&pkg->replaces, val);
+    }
+  }
+  free(buf);
+
+  if (ret == 0 && (pkg->name == NULL || pkg->version == NULL)) {
+    errno = EINVAL;
+    ret = -1;
+  }
+  return ret;
+}
+
+static int _pu_cache_strcmp(const void *p1, const void *p2) {
+  return strcmp(*(char * const *) p1, *(char * const *) p2);
+}
+
+/* sort the collected paths so the file list can be searched like alpm's */
+static int _pu_cache_pkg_sort_files(pu_cache_pkg_t *pkg) {
+  char **paths, *sorted, *c;
+  size_t count = 0, i;
+
+  for (c = pkg->_files; c < pkg->_files + pkg->_fileslen; c += strlen(c) + 1) {
+    count++;
+  }
+  if ((paths = malloc(sizeof(char *) * (count + 1))) == NULL) { return -1; }
+  if ((sorted = malloc(pkg->_fileslen + 1)) == NULL) {
+    free(paths);
+    return -1;
+  }
+  for (i = 0, c = pkg->_files; i < count; c += strlen(c) + 1) {
+    paths[i++] = c;
+  }
+  qsort(paths, count, sizeof(char *), _pu_cache_strcmp);
+  for (i = 0, c = sorted; i < count; i++) {
+    size_t len = strlen(paths[i]) + 1;
+    memcpy(c, paths[i], len);
+    c += len;
+  }
+  free(paths);
+  free(pkg->_files);
+  pkg->_files = sorted;
+  return 0;
+}
+
+static void _pu_cache_set_archive_errno(struct archive *a) {
+  int err = archive_errno(a);
+  /* format errors are reported as errno values that make no sense to
+   * users, call them invalid packages like alpm does */
+  errno = err > 0 && err != EILSEQ ? err : EINVAL;
+}
+
+/**
+ * @brief Read the metadata of a package file.
+ *
+ * Unlike alpm_pkg_load this does not need a handle and is safe to call from
+ * multiple threads.
+ *
+ * @param path package file
+ * @param needfiles read the package's file list, requires reading the
+ * entire archive
+ *
+ * @return package, NULL on error
+ */
+pu_cache_pkg_t *pu_cache_pkg_load(const char *path, int needfiles) {
+  struct archive *a = NULL;
+  struct archive_entry *entry;
+  struct _pu_cache_buf pkginfo = { 0 }, files = { 0 };
+  pu_cache_pkg_t *pkg = NULL;
+  struct stat st;
+  int fd, r, err;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) { return NULL; }
+  if (fstat(fd, &st) != 0) { goto error; }
+  if (S_ISDIR(st.st_mode)) {
+    errno = EISDIR;
+    goto error;
+  }
+  if ((pkg = calloc(1, sizeof(pu_cache_pkg_t))) == NULL
+      || (pkg->filename = strdup(path)) == NULL) {
+    goto error;
+  }
+  pkg->filesize = st.st_size;
+  pkg->mtime = st.st_mtim;
+
+  if ((a = archive_read_new()) == NULL) { goto error; }
+  archive_read_support_filter_all(a);
+  archive_read_support_format_all(a);
+  if (archive_read_open_fd(a, fd, 65536) != ARCHIVE_OK) {
+    _pu_cache_set_archive_errno(a);
+    goto error;
+  }
+
+  while ((r = archive_read_next_header(a, &entry)) == ARCHIVE_OK) {
+    const char *name = archive_entry_pathname(entry);
+    if (name == NULL) { continue; }
+    if (strcmp(name, ".PKGINFO") == 0) {
+      char block[8192];
+      ssize_t len;
+      while ((len = archive_read_data(a, block, sizeof(block))) > 0) {
+        if (_pu_cache_buf_add(&pkginfo, block, len) != 0) { goto error; }
+      }
+      if (len < 0 || _pu_cache_buf_add(&pkginfo, "", 1) != 0) {
+        if (len < 0) { _pu_cache_set_archive_errno(a); }
+        goto error;
+      }
+      if (!needfiles) { break; } /* nothing else needed from the archive */
+    } else if (needfiles && name[0] != '.') {
+      /* like alpm, entries starting with '.' are package metadata */
+      if (_pu_cache_buf_add(&files, name, strlen(name) + 1) != 0) {
+        goto error;
+      }
+    }
+  }
+  if (r != ARCHIVE_OK && r != ARCHIVE_EOF) {
+    _pu_cache_set_archive_errno(a);
+    goto error;
+  }
+  if (pkginfo.data == NULL) {
+    errno = EINVAL;
+    goto error;
+  }
+
+  pkg->_pkginfo = pkginfo.data;
+  pkginfo.data = NULL;
+  if (needfiles) {
+    pkg->_files = files.data ? files.data : strdup("");
+    pkg->_fileslen = files.len;
+    files.data = NULL;
+    if (pkg->_files == NULL || _pu_cache_pkg_sort_files(pkg) != 0) {
+      goto error;
+    }
+  }
+  if (_pu_cache_pkg_parse(pkg) != 0) { goto error; }
+
+  archive_read_free(a);
+  close(fd);
+  return pkg;
+
+error:
+  err = errno;
+  if (a) { archive_read_free(a); }
+  close(fd);
+  free(pkginfo.data);
+  free(files.data);
+  pu_cache_pkg_free(pkg);
+  errno = err;
+  return NULL;
+}
+
+/**
+ * @brief Get a package's file list.
+ *
+ * @param pkg
+ *
+ * @return file list, NULL if the package was loaded without it
+ */
+alpm_filelist_t *pu_cache_pkg_get_files(pu_cache_pkg_t *pkg) {
+  alpm_filelist_t *fl;
+  char *c;
+  size_t i = 0;
+
+  if (pkg->_filelist || pkg->_files == NULL) { return pkg->_filelist; }
+
+  if ((fl = calloc(1, sizeof(alpm_filelist_t))) == NULL) { return NULL; }
+  for (c = pkg->_files; c < pkg->_files + pkg->_fileslen; c += strlen(c) + 1) {
+    fl->count++;
+  }
+  if (fl->count
+      && (fl->files = calloc(fl->count, sizeof(alpm_file_t))) == NULL) {
+    free(fl);
+    return NULL;
+  }
+  for (c = pkg->_files; i < fl->count; c += strlen(c) + 1) {
+    fl->files[i++].name = c;
+  }
+  return pkg->_filelist = fl;
+}
+
+void pu_cache_pkg_free(pu_cache_pkg_t *pkg) {
+  if (pkg == NULL) { return; }
+  free(pkg->filename);
+  free(pkg->name);
+  free(pkg->base);
+  free(pkg->version);
+  free(pkg->desc);
+  free(pkg->url);
+  free(pkg->packager);
+  free(pkg->arch);
+  alpm_list_free_inner(pkg->groups, free);
+  alpm_list_free(pkg->groups);
+  alpm_list_free_inner(pkg->licenses, free);
+  alpm_list_free(pkg->licenses);
+  alpm_list_free_inner(pkg->provides, (alpm_list_fn_free) alpm_dep_free);
+  alpm_list_free(pkg->provides);
+  alpm_list_free_inner(pkg->depends, (alpm_list_fn_free) alpm_dep_free);
+  alpm_list_free(pkg->depends);
+  alpm_list_free_inner(pkg->optdepends, (alpm_list_fn_free) alpm_dep_free);
+  alpm_list_free(pkg->optdepends);
+  alpm_list_free_inner(pkg->conflicts, (alpm_list_fn_free) alpm_dep_free);
+  alpm_list_free(pkg->conflicts);
+  alpm_list_free_inner(pkg->replaces, (alpm_list_fn_free) alpm_dep_free);
+  alpm_list_free(pkg->replaces);
+  free(pkg->_pkginfo);
+  free(pkg->_files);
+  if (pkg->_filelist) {
+    free(pkg->_filelist->files);
+    free(pkg->_filelist);
+  }
+  free(pkg);
+}
+
+static const char *_pu_cache_basename(const char *path) {
+  const char *c = strrchr(path, '/');
+  return c ? c + 1 : path;
+}
+
+/* split "<name>-<pkgver>-<pkgrel>-<arch>.pkg.tar[.<ext>]" into its parts */
+static int _pu_cache_parse_filename(const char *filename, char **name,
+    char **version, char **arch) {
+  const char *ext = NULL, *c, *sep[3] = { NULL, NULL, NULL };
+  int found = 0;
+
+  for (c = filename; (c = strstr(c, ".pkg.tar")); c++) { ext = c; }
+  if (ext == NULL || (ext[8] != '\0' && (ext[8] != '.'
+            || strchr(ext + 9, '.') /* compressed signature or download */
+            || strcmp(ext + 9, "sig") == 0 || strcmp(ext + 9, "part") == 0))) {
+    return -1;
+  }
+  for (c = ext - 1; c > filename && found < 3; c--) {
+    if (*c == '-') { sep[found++] = c; }
+  }
+  /* sep[0] precedes the arch, sep[2] the version */
+  if (found < 3 || sep[0] + 1 == ext || sep[1] + 1 == sep[0]
+      || sep[2] + 1 == sep[1]) {
+    return -1;
+  }
+
+  *name = strndup(filename, sep[2] - filename);
+  *version = strndup(sep[2] + 1, sep[0] - sep[2] - 1);
+  *arch = strndup(sep[0] + 1, ext - sep[0] - 1);
+  if (*name == NULL || *version == NULL || *arch == NULL) {
+    free(*name);
+    free(*version);
+    free(*arch);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Get the path of the index for a cache directory.
+ *
+ * @param indexdir directory to keep the index in
+ * @param cachedir cache directory
+ *
+ * @return index path, NULL on error
+ */
+char *pu_cache_index_path(const char *indexdir, const char *cachedir) {
+  char *name = strdup(cachedir), *c, *path;
+  if (name == NULL) { return NULL; }
+  for (c = name; *c; c++) {
+    if (*c == '/') { *c = '_'; }
+  }
+  path = pu_asprintf("%s/pkgcache%s.idx", indexdir, name);
+  free(name);
+  return path;
+}
+
+static int _pu_cache_timespec_eq(const struct timespec *t1,
+    const struct timespec *t2) {
+  return t1->tv_sec == t2->tv_sec && t1->tv_nsec == t2->tv_nsec;
+}
+
+static int _pu_cache_index_serialize(struct _pu_cache_buf *buf,
+    const char *cachedir, const struct timespec *dirmtime,
+    const pu_cache_entry_t *entries, size_t count) {
+  char line[256];
+  size_t i;
+  int len;
+
+  len = snprintf(line, sizeof(line), "%s %d\n", PU_CACHE_INDEX_MAGIC,
+          PU_CACHE_INDEX_VERSION);
+  if (_pu_cache_buf_add(buf, line, len) != 0
+      || _pu_cache_buf_add(buf, cachedir, strlen(cachedir)) != 0) {
+    return -1;
+  }
+  len = snprintf(line, sizeof(line), "\n%lld %ld\n",
+          (long long) dirmtime->tv_sec, (long) dirmtime->tv_nsec);
+  if (_pu_cache_buf_add(buf, line, len) != 0) { return -1; }
+
+  for (i = 0; i < count; i++) {
+    const pu_cache_entry_t *e = &entries[i];
+    const char *strs[4] = {
+      e->filename,
+      e->name ? e->name : "",
+      e->version ? e->version : "",
+      e->arch ? e->arch : "",
+    };
+    size_t namelen = 0;
+    int s;
+
+    for (s = 0; s < 4; s++) { namelen += strlen(strs[s]) + 1; }
+    len = snprintf(line, sizeof(line), "%d %zu %lld %lld %ld %lld %lld\n",
+            e->isdir ? 1 : 0, namelen, (long long) e->filesize,
+            (long long) e->mtime.tv_sec, (long) e->mtime.tv_nsec,
+            e->_haspkginfo ? (long long) e->_pkginfolen : -1LL,
+            e->_hasfiles ? (long long) e->_fileslen : -1LL);
+    if (_pu_cache_buf_add(buf, line, len) != 0) { return -1; }
+    for (s = 0; s < 4; s++) {
+      if (_pu_cache_buf_add(buf, strs[s], strlen(strs[s]) + 1) != 0) {
+        return -1;
+      }
+    }
+    if ((e->_haspkginfo
+            && _pu_cache_buf_add(buf, e->_pkginfo, e->_pkginfolen) != 0)
+        || (e->_hasfiles
+            && _pu_cache_buf_add(buf, e->_files, e->_fileslen) != 0)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* read a header line from the map into buf, returns a pointer past it */
+static const char *_pu_cache_index_line(const char *pos, const char *end,
+    char *buf, size_t bufsize) {
+  const char *nl = memchr(pos, '\n', end - pos);
+  if (nl == NULL || (size_t) (nl - pos) >= bufsize) { return NULL; }
+  memcpy(buf, pos, nl - pos);
+  buf[nl - pos] = '\0';
+  return nl + 1;
+}
+
+static int _pu_cache_index_parse(pu_cache_index_t *index) {
+  const char *pos = index->_map, *end = index->_map + index->_mapsize, *nl;
+  size_t size = 0;
+  long long sec;
+  long nsec;
+  char line[256];
+  int version;
+
+  if ((pos = _pu_cache_index_line(pos, end, line, sizeof(line))) == NULL
+      || sscanf(line, PU_CACHE_INDEX_MAGIC " %d", &version) != 1
+      || version != PU_CACHE_INDEX_VERSION
+      || (nl = memchr(pos, '\n', end - pos)) == NULL
+      || (index->cachedir = strndup(pos, nl - pos)) == NULL) {
+    return -1;
+  }
+  if ((pos = _pu_cache_index_line(nl + 1, end, line, sizeof(line))) == NULL
+      || sscanf(line, "%lld %ld", &sec, &nsec) != 2) {
+    return -1;
+  }
+  index->dirmtime.tv_sec = sec;
+  index->dirmtime.tv_nsec = nsec;
+
+  while (pos < end) {
+    pu_cache_entry_t *e;
+    const char *strs[4], *s = pos;
+    long long filesize, pkginfolen, fileslen;
+    size_t namelen, avail;
+    int isdir, n;
+
+    if ((pos = _pu_cache_index_line(pos, end, line, sizeof(line))) == NULL
+        || sscanf(line, "%d %zu %lld %lld %ld %lld %lld", &isdir, &namelen,
+            &filesize, &sec, &nsec, &pkginfolen, &fileslen) != 7
+        || namelen == 0 || pkginfolen < -1 || fileslen < -1
+        || namelen > (size_t) (end - pos)) {
+      return -1;
+    }
+    avail = (size_t) (end - pos) - namelen;
+    if ((pkginfolen > 0 && (unsigned long long) pkginfolen > avail)
+        || (fileslen > 0 && (unsigned long long) fileslen
+            > avail - (pkginfolen > 0 ? pkginfolen : 0))) {
+      return -1;
+    }
+
+    /* file name, name, version, and arch, each NUL-terminated */
+    for (n = 0, s = pos; n < 4; n++) {
+      const char *nul = memchr(s, '\0', pos + namelen - s);
+      if (nul == NULL) { return -1; }
+      strs[n] = s;
+      s = nul + 1;
+    }
+    if (s != pos + namelen || strs[0][0] == '\0') { return -1; }
+
+    if (index->count == size) {
+      size_t newsize = size ? size * 2 : 256;
+      e = realloc(index->entries, sizeof(pu_cache_entry_t) * newsize);
+      if (e == NULL) { return -1; }
+      index->entries = e;
+      size = newsize;
+    }
+    e = &index->entries[index->count];
+    e->filename = strs[0];
+    e->name = strs[1][0] ? strs[1] : NULL;
+    e->version = strs[2][0] ? strs[2] : NULL;
+    e->arch = strs[3][0] ? strs[3] : NULL;
+    e->filesize = filesize;
+    e->mtime.tv_sec = sec;
+    e->mtime.tv_nsec = nsec;
+    e->isdir = isdir != 0;
+    e->_pkginfo = pos + namelen;
+    e->_pkginfolen = pkginfolen > 0 ? pkginfolen : 0;
+    e->_haspkginfo = pkginfolen != -1;
+    e->_files = e->_pkginfo + e->_pkginfolen;
+    e->_fileslen = fileslen > 0 ? fileslen : 0;
+    e->_hasfiles = fileslen != -1;
+    pos = e->_files + e->_fileslen;
+
+    /* lookups rely on the entries being in order */
+    if (index->count && strcmp(index->entries[index->count - 1].filename,
+            e->filename) >= 0) {
+      return -1;
+    }
+    index->count++;
+  }
+  return 0;
+}
+
+/* take ownership of a serialized index */
+static pu_cache_index_t *_pu_cache_index_from_buf(struct _pu_cache_buf *buf) {
+  pu_cache_index_t *index = calloc(1, sizeof(pu_cache_index_t));
+  if (index == NULL) { return NULL; }
+  index->_map = buf->data;
+  index->_mapsize = buf->len;
+  buf->data = NULL;
+  if (_pu_cache_index_parse(index) != 0) {
+    int err = errno == ENOMEM ? ENOMEM : EINVAL;
+    pu_cache_index_close(index);
+    errno = err;
+    return NULL;
+  }
+  return index;
+}
+
+static int _pu_cache_index_save(const char *path, const char *data,
+    size_t len) {
+  char *tmppath;
+  int fd, ret = -1;
+
+  if ((tmppath = pu_asprintf("%s.XXXXXX", path)) == NULL) { return -1; }
+  if ((fd = mkstemp(tmppath)) == -1) {
+    free(tmppath);
+    return -1;
+  }
+  if (fchmod(fd, 0644) == 0) {
+    while (len > 0) {
+      ssize_t wrote = write(fd, data, len);
+      if (wrote == -1) {
+        if (errno == EINTR) { continue; }
+        break;
+      }
+      data += wrote;
+      len -= wrote;
+    }
+    if (len == 0) { ret = 0; }
+  }
+  if (close(fd) != 0 || (ret == 0 && rename(tmppath, path) != 0)) {
+    ret = -1;
+  }
+  if (ret != 0) {
+    int err = errno;
+    unlink(tmppath);
+    errno = err;
+  }
+  free(tmppath);
+  return ret;
+}
+
+/**
+ * @brief Open a cache index.
+ *
+ * @param path index file
+ *
+ * @return index, NULL on error, errno is EINVAL if the file is not a valid
+ * index
+ */
+pu_cache_index_t *pu_cache_index_open(const char *path) {
+  pu_cache_index_t *index;
+  struct stat st;
+  int fd, err;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) { return NULL; }
+  if ((index = calloc(1, sizeof(pu_cache_index_t))) == NULL
+      || fstat(fd, &st) != 0) {
+    goto error;
+  }
+  if (st.st_size == 0) {
+    errno = EINVAL;
+    goto error;
+  }
+  index->_mapsize = st.st_size;
+  if ((index->_map = mmap(NULL, index->_mapsize, PROT_READ, MAP_PRIVATE, fd,
+              0)) == MAP_FAILED) {
+    index->_map = NULL;
+    goto error;
+  }
+  index->_mapped = 1;
+  close(fd);
+  fd = -1;
+
+  if (_pu_cache_index_parse(index) != 0) {
+    errno = errno == ENOMEM ? ENOMEM : EINVAL;
+    goto error;
+  }
+  return index;
+
+error:
+  err = errno;
+  if (fd != -1) { close(fd); }
+  pu_cache_index_close(index);
+  errno = err;
+  return NULL;
+}
+
+static int _pu_cache_entry_cmp(const void *p1, const void *p2) {
+  return strcmp(((const pu_cache_entry_t *) p1)->filename,
+          ((const pu_cache_entry_t *) p2)->filename);
+}
+
+static char *_pu_cache_keep(alpm_list_t **strs, char *str) {
+  if (str && alpm_list_append(strs, str) == NULL) {
+    free(str);
+    return NULL;
+  }
+  return str;
+}
+
+/**
+ * @brief Get an up to date index of a cache directory.
+ *
+ * The directory is only read if its modification time differs from the
+ * index's, files are considered unchanged as long as their size and
+ * modification time are.  Package metadata is not read, but is kept for
+ * unchanged files if it was previously written to the index with
+ * pu_cache_index_write().
+ *
+ * @param path index file, rewritten if it was missing or out of date, may be
+ * NULL to build the index without saving it
+ * @param cachedir cache directory
+ *
+ * @return index, NULL on error
+ */
+pu_cache_index_t *pu_cache_index_update(const char *path,
+    const char *cachedir) {
+  pu_cache_index_t *previous = NULL, *index = NULL;
+  pu_cache_entry_t *entries = NULL;
+  struct _pu_cache_buf buf = { 0 };
+  alpm_list_t *strs = NULL;
+  size_t count = 0, size = 0;
+  struct timespec dirmtime;
+  struct dirent *de;
+  struct stat st;
+  int changed = 0, err;
+  DIR *d;
+
+  if (path && (previous = pu_cache_index_open(path))
+      && strcmp(previous->cachedir, cachedir) != 0) {
+    /* a different directory with the same index name */
+    pu_cache_index_close(previous);
+    previous = NULL;
+  }
+
+  if ((d = opendir(cachedir)) == NULL || fstat(dirfd(d), &st) != 0) {
+    goto cleanup;
+  }
+  if (previous && _pu_cache_timespec_eq(&previous->dirmtime, &st.st_mtim)) {
+    closedir(d);
+    return previous;
+  }
+  dirmtime = st.st_mtim;
+  if (dirmtime.tv_sec >= time(NULL) - 1) {
+    /* the directory could still change without its modification time
+     * doing so, don't trust it next time */
+    dirmtime.tv_sec = 0;
+    dirmtime.tv_nsec = 0;
+  }
+
+  errno = 0;
+  while ((de = readdir(d))) {
+    pu_cache_entry_t *e, *old;
+    char *name = NULL, *version = NULL, *arch = NULL;
+
+    if (strcmp(".", de->d_name) == 0 || strcmp("..", de->d_name) == 0) {
+      continue;
+    }
+    if (fstatat(dirfd(d), de->d_name, &st, 0) != 0) {
+      /* removed since being read or a dangling symlink */
+      errno = 0;
+      continue;
+    }
+    if (count == size) {
+      size_t newsize = size ? size * 2 : 256;
+      if ((e = realloc(entries, sizeof(pu_cache_entry_t) * newsize)) == NULL) {
+        goto cleanup;
+      }
+      entries = e;
+      size = newsize;
+    }
+    e = &entries[count++];
+    memset(e, 0, sizeof(pu_cache_entry_t));
+
+    old = previous ? pu_cache_index_find(previous, de->d_name) : NULL;
+    if (old && old->isdir == (S_ISDIR(st.st_mode) != 0)
+        && old->filesize == st.st_size
+        && _pu_cache_timespec_eq(&old->mtime, &st.st_mtim)) {
+      *e = *old;
+      continue;
+    }
+
+    changed = 1;
+    e->isdir = S_ISDIR(st.st_mode) != 0;
+    e->filesize = st.st_size;
+    e->mtime = st.st_mtim;
+    if ((e->filename = _pu_cache_keep(&strs, strdup(de->d_name))) == NULL) {
+      goto cleanup;
+    }
+    if (!e->isdir && _pu_cache_parse_filename(de->d_name,
+            &name, &version, &arch) == 0) {
+      e->name = _pu_cache_keep(&strs, name);
+      e->version = _pu_cache_keep(&strs, version);
+      e->arch = _pu_cache_keep(&strs, arch);
+      if (!e->name || !e->version || !e->arch) { goto cleanup; }
+    }
+    errno = 0;
+  }
+  if (errno != 0) { goto cleanup; }
+
+  if (previous && !changed && previous->count == count
+      && _pu_cache_timespec_eq(&previous->dirmtime, &dirmtime)) {
+    index = previous;
+    previous = NULL;
+    goto cleanup;
+  }
+
+  if (count) {
+    qsort(entries, count, sizeof(pu_cache_entry_t), _pu_cache_entry_cmp);
+  }
+  if (_pu_cache_index_serialize(&buf, cachedir, &dirmtime, entries,
+          count) != 0
+      || (index = _pu_cache_index_from_buf(&buf)) == NULL) {
+    goto cleanup;
+  }
+  if (path) {
+    /* the index is still usable if it could not be saved */
+    err = errno;
+    _pu_cache_index_save(path, index->_map, index->_mapsize);
+    errno = err;
+  }
+
+cleanup:
+  err = errno;
+  if (d) { closedir(d); }
+  pu_cache_index_close(previous);
+  alpm_list_free_inner(strs, free);
+  alpm_list_free(strs);
+  free(entries);
+  free(buf.data);
+  errno = err;
+  return index;
+}
+
+/**
+ * @brief Find a file in a cache index.
+ *
+ * @param index
+ * @param filename name of the file within the cache directory
+ *
+ * @return entry, NULL if the file is not indexed
+ */
+pu_cache_entry_t *pu_cache_index_find(pu_cache_index_t *index,
+    const char *filename) {
+  size_t lo = 0, hi = index->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(index->entries[mid].filename, filename);
+    if (cmp == 0) {
+      return &index->entries[mid];
+    } else if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Get an indexed package without reading the package file.
+ *
+ * @param index
+ * @param entry entry from the index
+ * @param needfiles only return packages with their file list
+ *
+ * @return package, NULL with errno set to ENOENT if the package's metadata
+ * has not been indexed
+ */
+pu_cache_pkg_t *pu_cache_index_get(pu_cache_index_t *index,
+    pu_cache_entry_t *entry, int needfiles) {
+  size_t dirlen = strlen(index->cachedir);
+  pu_cache_pkg_t *pkg;
+
+  if (!entry->_haspkginfo || (needfiles && !entry->_hasfiles)) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  if ((pkg = calloc(1, sizeof(pu_cache_pkg_t))) == NULL) { return NULL; }
+  pkg->filename = pu_asprintf("%s%s%s", index->cachedir,
+          dirlen && index->cachedir[dirlen - 1] == '/' ? "" : "/",
+          entry->filename);
+  pkg->filesize = entry->filesize;
+  pkg->mtime = entry->mtime;
+  if (pkg->filename == NULL
+      || (pkg->_pkginfo = strndup(entry->_pkginfo,
+              entry->_pkginfolen)) == NULL) {
+    goto error;
+  }
+  if (needfiles) {
+    if ((pkg->_files = malloc(entry->_fileslen + 1)) == NULL) { goto error; }
+    memcpy(pkg->_files, entry->_files, entry->_fileslen);
+    pkg->_fileslen = entry->_fileslen;
+  }
+  if (_pu_cache_pkg_parse(pkg) != 0) { goto error; }
+  return pkg;
+
+error:
+  pu_cache_pkg_free(pkg);
+  return NULL;
+}
+
+static int _pu_cache_pkg_cmp(const void *p1, const void *p2) {
+  const pu_cache_pkg_t *pkg1 = *(pu_cache_pkg_t * const *) p1;
+  const pu_cache_pkg_t *pkg2 = *(pu_cache_pkg_t * const *) p2;
+  return strcmp(_pu_cache_basename(pkg1->filename),
+          _pu_cache_basename(pkg2->filename));
+}
+
+/**
+ * @brief Record the metadata of packages read from a cache directory.
+ *
+ * @param path index file to write
+ * @param index current index of the cache directory
+ * @param pkgs packages read from the directory, packages that are not in the
+ * index or have changed since it was updated are ignored
+ * @param count
+ *
+ * The metadata and file lists of packages not in @a pkgs, and the file lists
+ * of packages read without them, are carried over from @a index.
+ *
+ * @return 0 on success, -1 on error
+ */
+int pu_cache_index_write(const char *path, pu_cache_index_t *index,
+    pu_cache_pkg_t **pkgs, size_t count) {
+  pu_cache_pkg_t **sorted = NULL;
+  pu_cache_entry_t *entries = NULL;
+  struct _pu_cache_buf buf = { 0 };
+  size_t i, p = 0;
+  int ret = -1;
+
+  if ((count && (sorted = malloc(sizeof(pu_cache_pkg_t *) * count)) == NULL)
+      || (index->count && (entries = malloc(sizeof(pu_cache_entry_t)
+                  * index->count)) == NULL)) {
+    goto cleanup;
+  }
+  if (count) { memcpy(sorted, pkgs, sizeof(pu_cache_pkg_t *) * count); }
+  qsort(sorted, count, sizeof(pu_cache_pkg_t *), _pu_cache_pkg_cmp);
+
+  for (i = 0; i < index->count; i++) {
+    pu_cache_entry_t *e = &entries[i];
+    pu_cache_pkg_t *pkg;
+    *e = index->entries[i];
+
+    while (p < count && strcmp(_pu_cache_basename(sorted[p]->filename),
+            e->filename) < 0) {
+      p++;
+    }
+    if (p == count) { continue; }
+    pkg = sorted[p];
+    if (e->isdir || strcmp(_pu_cache_basename(pkg->filename), e->filename)
+        || pkg->filesize != e->filesize
+        || !_pu_cache_timespec_eq(&pkg->mtime, &e->mtime)) {
+      continue;
+    }
+
+    e->name = pkg->name;
+    e->version = pkg->version;
+    e->arch = pkg->arch;
+    e->_pkginfo = pkg->_pkginfo;
+    e->_pkginfolen = strlen(pkg->_pkginfo);
+    e->_haspkginfo = 1;
+    if (pkg->_files) {
+      e->_files = pkg->_files;
+      e->_fileslen = pkg->_fileslen;
+      e->_hasfiles = 1;
+    }
+  }
+
+  if (_pu_cache_index_serialize(&buf, index->cachedir, &index->dirmtime,
+          entries, index->count) == 0
+      && _pu_cache_index_save(path, buf.data, buf.len) == 0) {
+    ret = 0;
+  }
+
+cleanup:
+  free(sorted);
+  free(entries);
+  free(buf.data);
+  return ret;
+}
+
+void pu_cache_index_close(pu_cache_index_t *index) {
+  if (index == NULL) { return; }
+  if (index->_mapped) {
+    munmap(index->_map, index->_mapsize);
+  } else {
+    free(index->_map);
+  }
+  free(index->cachedir);
+  free(index->entries);
+  free(index);
+}
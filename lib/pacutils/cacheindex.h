@@ -0,0 +1,111 @@
+/*
+ * Copyright 2012-2020 Andrew Gregory <andrew.gregory.8@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef PACUTILS_CACHEINDEX_H
+#define PACUTILS_CACHEINDEX_H
+
+#include <sys/stat.h>
+#include <time.h>
+
+#include <alpm.h>
+
+/* metadata read from a package file, without the overhead of an alpm
+ * handle so files can be read in parallel; the file list is only available
+ * if it was requested when loading */
+typedef struct pu_cache_pkg_t {
+  char *filename;
+  off_t filesize;
+  struct timespec mtime;
+
+  char *name;
+  char *base;
+  char *version;
+  char *desc;
+  char *url;
+  char *packager;
+  char *arch;
+  off_t isize;
+  alpm_time_t builddate;
+  alpm_list_t *groups;
+  alpm_list_t *licenses;
+  alpm_list_t *provides;
+  alpm_list_t *depends;
+  alpm_list_t *optdepends;
+  alpm_list_t *conflicts;
+  alpm_list_t *replaces;
+
+  char *_pkginfo;
+  char *_files; /* NUL-separated paths, NULL if not loaded */
+  size_t _fileslen;
+  alpm_filelist_t *_filelist;
+} pu_cache_pkg_t;
+
+/* a file in a cache directory; name, version and arch are taken from the
+ * package metadata if it has been read, otherwise from the file name, and are
+ * NULL if neither is available */
+typedef struct pu_cache_entry_t {
+  const char *filename; /* within the cache directory */
+  const char *name;
+  const char *version;
+  const char *arch;
+  off_t filesize;
+  struct timespec mtime;
+  int isdir;
+
+  const char *_pkginfo;
+  size_t _pkginfolen;
+  int _haspkginfo;
+  const char *_files;
+  size_t _fileslen;
+  int _hasfiles;
+} pu_cache_entry_t;
+
+/* read-only record of the contents of a cache directory, along with the
+ * metadata of any packages previously read from it */
+typedef struct pu_cache_index_t {
+  char *cachedir;
+  struct timespec dirmtime;
+  pu_cache_entry_t *entries; /* in file name order */
+  size_t count;
+
+  char *_map;
+  size_t _mapsize;
+  int _mapped;
+} pu_cache_index_t;
+
+pu_cache_pkg_t *pu_cache_pkg_load(const char *path, int needfiles);
+alpm_filelist_t *pu_cache_pkg_get_files(pu_cache_pkg_t *pkg);
+void pu_cache_pkg_free(pu_cache_pkg_t *pkg);
+
+char *pu_cache_index_path(const char *indexdir, const char *cachedir);
+pu_cache_index_t *pu_cache_index_open(const char *path);
+pu_cache_index_t *pu_cache_index_update(const char *path,
+    const char *cachedir);
+pu_cache_entry_t *pu_cache_index_find(pu_cache_index_t *index,
+    const char *filename);
+pu_cache_pkg_t *pu_cache_index_get(pu_cache_index_t *index,
+    pu_cache_entry_t *entry, int needfiles);
+int pu_cache_index_write(const char *path, pu_cache_index_t *index,
+    pu_cache_pkg_t **pkgs, size_t count);
+void pu_cache_index_close(pu_cache_index_t *index);
+
+#endif /* PACUTILS_CACHEINDEX_H */
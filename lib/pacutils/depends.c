@@ -20,35 +20,66 @@
  * IN THE SOFTWARE.
  */
 
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "depends.h"
+#include "util.h"
 
-typedef enum pu_deptype_t {
-  PU_DEPTYPE_DEPEND   = (1 << 0),
-  PU_DEPTYPE_OPTIONAL = (1 << 1),
-  PU_DEPTYPE_MAKE     = (1 << 2),
-  PU_DEPTYPE_CHECK    = (1 << 3),
-} pu_deptype_t;
-
-static int pu_pkgver_satisfies_dep(const char *ver, alpm_depend_t *dep) {
-  switch (dep->mod) {
+static int _pu_vercmp_satisfies_mod(int cmp, alpm_depmod_t mod) {
+  switch (mod) {
     case ALPM_DEP_MOD_ANY:
       return 1;
     case ALPM_DEP_MOD_EQ:
-      return alpm_pkg_vercmp(ver, dep->version) == 0;
+      return cmp == 0;
     case ALPM_DEP_MOD_LE:
-      return alpm_pkg_vercmp(ver, dep->version) <= 0;
+      return cmp <= 0;
     case ALPM_DEP_MOD_GE:
-      return alpm_pkg_vercmp(ver, dep->version) >= 0;
+      return cmp >= 0;
     case ALPM_DEP_MOD_LT:
-      return alpm_pkg_vercmp(ver, dep->version) < 0;
+      return cmp < 0;
     case ALPM_DEP_MOD_GT:
-      return alpm_pkg_vercmp(ver, dep->version) > 0;
+      return cmp > 0;
   }
   return 0; /* should never reach this */
 }
 
+static int pu_pkgver_satisfies_dep(const char *ver, alpm_depend_t *dep) {
+  if (dep->mod == ALPM_DEP_MOD_ANY) { return 1; }
+  return _pu_vercmp_satisfies_mod(alpm_pkg_vercmp(ver, dep->version), dep->mod);
+}
+
+/**
+ * @brief Check a pre-parsed version against a dependency's constraint.
+ *
+ * Only the version is checked, not the dependency name.
+ *
+ * @param version version to check
+ * @param dep dependency
+ * @param depversion key for dep->version
+ */
+int pu_version_key_satisfies_dep(const pu_version_key_t *version,
+    alpm_depend_t *dep, const pu_version_key_t *depversion) {
+  if (dep->mod == ALPM_DEP_MOD_ANY) { return 1; }
+  return _pu_vercmp_satisfies_mod(pu_version_key_cmp(version, depversion),
+          dep->mod);
+}
+
+/* compare through the cache, falling back to strings if parsing fails */
+static int _pu_pkgver_satisfies_dep_cached(pu_version_cache_t *cache,
+    const char *ver, alpm_depend_t *dep) {
+  pu_version_key_t *k1, *k2;
+  if (dep->mod == ALPM_DEP_MOD_ANY) { return 1; }
+  if (ver == NULL || dep->version == NULL
+      || (k1 = pu_version_cache_get(cache, ver)) == NULL
+      || (k2 = pu_version_cache_get(cache, dep->version)) == NULL) {
+    return pu_pkgver_satisfies_dep(ver, dep);
+  }
+  return pu_version_key_satisfies_dep(k1, dep, k2);
+}
+
 int pu_provision_satisfies_dep(alpm_depend_t *provision, alpm_depend_t *dep) {
   /* alpm exposes the alpm_depend_t structure, but does not provide a method
    * for filling in the name_hash, only rely on it if both arguments have it
@@ -56,6 +87,8 @@ int pu_provision_satisfies_dep(alpm_depend_t *provision, alpm_depend_t *dep) {
   return (provision->name_hash == 0 || dep->name_hash == 0
           || provision->name_hash == dep->name_hash)
       && strcmp(provision->name, dep->name) == 0
+      /* like alpm, unversioned provisions only satisfy unversioned deps */
+      && (dep->mod == ALPM_DEP_MOD_ANY || provision->version != NULL)
       && pu_pkgver_satisfies_dep(provision->version, dep);
 }
 
@@ -73,6 +106,34 @@ int pu_pkg_satisfies_dep(alpm_pkg_t *pkg, alpm_depend_t *dep) {
   return 0;
 }
 
+int pu_provision_satisfies_dep_cached(pu_version_cache_t *cache,
+    alpm_depend_t *provision, alpm_depend_t *dep) {
+  return (provision->name_hash == 0 || dep->name_hash == 0
+          || provision->name_hash == dep->name_hash)
+      && strcmp(provision->name, dep->name) == 0
+      && (dep->mod == ALPM_DEP_MOD_ANY || provision->version != NULL)
+      && _pu_pkgver_satisfies_dep_cached(cache, provision->version, dep);
+}
+
+/**
+ * @brief Same as pu_pkg_satisfies_dep, with versions parsed once through a
+ * cache shared between calls.
+ */
+int pu_pkg_satisfies_dep_cached(pu_version_cache_t *cache, alpm_pkg_t *pkg,
+    alpm_depend_t *dep) {
+  alpm_list_t *p;
+  if (strcmp(alpm_pkg_get_name(pkg), dep->name) == 0 &&
+      _pu_pkgver_satisfies_dep_cached(cache, alpm_pkg_get_version(pkg), dep)) {
+    return 1;
+  }
+  for (p = alpm_pkg_get_provides(pkg); p; p = p->next) {
+    if (pu_provision_satisfies_dep_cached(cache, p->data, dep)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 static int _pu_pkg_satisfies_deplist(alpm_pkg_t *pkg, alpm_list_t *deps) {
   while (deps) {
     if (pu_pkg_satisfies_dep(pkg, deps->data)) { return 1; }
@@ -161,3 +222,788 @@ alpm_pkg_t *pu_dblist_find_dep_satisfier(alpm_list_t *dbs, alpm_depend_t *dep) {
   }
   return NULL;
 }
+
+struct _pu_provider_bucket {
+  const char *name;
+  unsigned long hash;
+  size_t first, count;
+};
+
+static const char *_pu_provider_name(const pu_provider_t *provider) {
+  return provider->provision ? provider->provision->name
+      : alpm_pkg_get_name(provider->pkg);
+}
+
+static int _pu_provider_cmp(const void *p1, const void *p2) {
+  const pu_provider_t *e1 = p1, *e2 = p2;
+  int c = strcmp(_pu_provider_name(e1), _pu_provider_name(e2));
+  if (c) { return c; }
+  if (e1->pkgidx != e2->pkgidx) { return e1->pkgidx < e2->pkgidx ? -1 : 1; }
+  /* the package name sorts before its provisions */
+  return e1->provision == NULL ? -(e2->provision != NULL)
+      : e2->provision == NULL ? 1 : 0;
+}
+
+static struct _pu_provider_bucket *_pu_provider_index_bucket(
+    pu_provider_index_t *index, const char *name, unsigned long hash) {
+  size_t mask = index->_bucketcount - 1, i = hash & mask;
+  while (index->_buckets[i].name != NULL) {
+    if (index->_buckets[i].hash == hash
+        && strcmp(index->_buckets[i].name, name) == 0) {
+      break;
+    }
+    i = (i + 1) & mask;
+  }
+  return &index->_buckets[i];
+}
+
+/**
+ * @brief Index package names and provisions for dependency resolution.
+ *
+ * The index references the packages and their provisions, it must not
+ * outlive them.  Once built, lookups do not modify the index and may be
+ * done from multiple threads.
+ *
+ * @param pkgs packages to index
+ *
+ * @return new index, NULL on error
+ */
+pu_provider_index_t *pu_provider_index_new(alpm_list_t *pkgs) {
+  pu_provider_index_t *index = calloc(1, sizeof(pu_provider_index_t));
+  size_t size = 0, names = 0, i, pkgidx;
+  alpm_list_t *p;
+
+  if (index == NULL) { return NULL; }
+
+  for (pkgidx = 0, p = pkgs; p; p = p->next, pkgidx++) {
+    alpm_list_t *prov = alpm_pkg_get_provides(p->data);
+    size_t need = index->count + 1 + alpm_list_count(prov);
+    if (need > size) {
+      pu_provider_t *newprov;
+      size_t newsize = size ? size * 2 : 256;
+      while (newsize < need) { newsize *= 2; }
+      if ((newprov = realloc(index->providers,
+                  newsize * sizeof(pu_provider_t))) == NULL) {
+        goto error;
+      }
+      index->providers = newprov;
+      size = newsize;
+    }
+    index->providers[index->count].pkg = p->data;
+    index->providers[index->count].provision = NULL;
+    index->providers[index->count++].pkgidx = pkgidx;
+    for (; prov; prov = prov->next) {
+      index->providers[index->count].pkg = p->data;
+      index->providers[index->count].provision = prov->data;
+      index->providers[index->count++].pkgidx = pkgidx;
+    }
+  }
+  qsort(index->providers, index->count, sizeof(pu_provider_t),
+      _pu_provider_cmp);
+
+  /* parse provided versions and the versions the indexed packages depend on
+   * up front, lookups only read from the cache */
+  if ((index->_versions = pu_version_cache_new()) == NULL) { goto error; }
+  for (i = 0; i < index->count; i++) {
+    pu_provider_t *pr = &index->providers[i];
+    const char *ver = pr->provision ? pr->provision->version
+        : alpm_pkg_get_version(pr->pkg);
+    pr->version = NULL;
+    if (ver && (pr->version = pu_version_cache_get(index->_versions,
+                ver)) == NULL) {
+      goto error;
+    }
+  }
+  for (p = pkgs; p; p = p->next) {
+    alpm_list_t *deps[] = {
+      alpm_pkg_get_depends(p->data), alpm_pkg_get_optdepends(p->data),
+    }, *d;
+    size_t n;
+    for (n = 0; n < sizeof(deps) / sizeof(deps[0]); n++) {
+      for (d = deps[n]; d; d = d->next) {
+        alpm_depend_t *dep = d->data;
+        if (dep->version && pu_version_cache_get(index->_versions,
+                dep->version) == NULL) {
+          goto error;
+        }
+      }
+    }
+  }
+
+  for (i = 0; i < index->count; i++) {
+    if (i == 0 || strcmp(_pu_provider_name(&index->providers[i]),
+            _pu_provider_name(&index->providers[i - 1])) != 0) {
+      names++;
+    }
+  }
+
+  /* keep the load factor at or below one half */
+  for (index->_bucketcount = 16; index->_bucketcount < names * 2;
+      index->_bucketcount *= 2);
+  if ((index->_buckets = calloc(index->_bucketcount,
+              sizeof(struct _pu_provider_bucket))) == NULL) {
+    goto error;
+  }
+
+  for (i = 0; i < index->count; i++) {
+    const char *name = _pu_provider_name(&index->providers[i]);
+    unsigned long hash = _pu_hash_sdbm(name);
+    struct _pu_provider_bucket *b
+        = _pu_provider_index_bucket(index, name, hash);
+    if (b->name == NULL) {
+      b->name = name;
+      b->hash = hash;
+      b->first = i;
+    }
+    b->count++;
+  }
+
+  return index;
+
+error:
+  pu_provider_index_free(index);
+  return NULL;
+}
+
+/**
+ * @brief Find the packages providing a name.
+ *
+ * @param count set to the number of providers found
+ *
+ * @return providers in the order of the indexed list, NULL if none
+ */
+pu_provider_t *pu_provider_index_find(pu_provider_index_t *index,
+    const char *name, size_t *count) {
+  struct _pu_provider_bucket *b
+      = _pu_provider_index_bucket(index, name, _pu_hash_sdbm(name));
+  *count = b->count;
+  return b->name ? &index->providers[b->first] : NULL;
+}
+
+/* providers are only ever checked against dependencies with their name */
+static int _pu_provider_satisfies_dep(pu_provider_t *provider,
+    alpm_depend_t *dep, pu_version_key_t *depversion) {
+  if (dep->mod == ALPM_DEP_MOD_ANY) {
+    return 1;
+  } else if (provider->version == NULL) {
+    /* like alpm, unversioned provisions only satisfy unversioned deps */
+    return 0;
+  } else if (depversion == NULL) {
+    return pu_pkgver_satisfies_dep(provider->version->str, dep);
+  } else {
+    return pu_version_key_satisfies_dep(provider->version, dep, depversion);
+  }
+}
+
+static pu_version_key_t *_pu_provider_index_depversion(
+    pu_provider_index_t *index, alpm_depend_t *dep, pu_version_key_t **tmp) {
+  pu_version_key_t *depversion;
+  if (dep->mod == ALPM_DEP_MOD_ANY || dep->version == NULL) { return NULL; }
+  if ((depversion = pu_version_cache_find(index->_versions, dep->version))) {
+    return depversion;
+  }
+  /* not one of ours, parse it without touching the shared cache */
+  return *tmp = pu_version_key_new(dep->version);
+}
+
+/**
+ * @brief Find an indexed package satisfying a dependency.
+ *
+ * Packages named after the dependency are preferred over providers, as in
+ * alpm_find_satisfier() on the indexed list, without the need
+ * to convert the dependency to a string or to check every package.
+ *
+ * @return satisfying package, NULL if none
+ */
+alpm_pkg_t *pu_provider_index_find_satisfier(pu_provider_index_t *index,
+    alpm_depend_t *dep) {
+  struct _pu_provider_bucket *b
+      = _pu_provider_index_bucket(index, dep->name, _pu_hash_sdbm(dep->name));
+  pu_version_key_t *tmp = NULL, *depversion;
+  alpm_pkg_t *pkg = NULL;
+  size_t i;
+  int pass;
+
+  if (b->name == NULL) { return NULL; }
+
+  depversion = _pu_provider_index_depversion(index, dep, &tmp);
+
+  /* like alpm, packages with a matching name are preferred over those that
+   * only provide it */
+  for (pass = 0; pass < 2 && pkg == NULL; pass++) {
+    for (i = b->first; i < b->first + b->count; i++) {
+      pu_provider_t *pr = &index->providers[i];
+      if ((pr->provision == NULL) == (pass == 0)
+          && _pu_provider_satisfies_dep(pr, dep, depversion)) {
+        pkg = pr->pkg;
+        break;
+      }
+    }
+  }
+
+  pu_version_key_free(tmp);
+  return pkg;
+}
+
+void pu_provider_index_free(pu_provider_index_t *index) {
+  if (index == NULL) { return; }
+  free(index->providers);
+  free(index->_buckets);
+  pu_version_cache_free(index->_versions);
+  free(index);
+}
+
+struct _pu_depgraph_pkgref {
+  alpm_pkg_t *pkg;
+  size_t idx;
+};
+
+static int _pu_depgraph_pkgref_cmp(const void *p1, const void *p2) {
+  uintptr_t a1 = (uintptr_t) ((const struct _pu_depgraph_pkgref *) p1)->pkg;
+  uintptr_t a2 = (uintptr_t) ((const struct _pu_depgraph_pkgref *) p2)->pkg;
+  return a1 < a2 ? -1 : a1 > a2;
+}
+
+/* orders edges by satisfier, keeping the original edge order within each */
+static int _pu_depgraph_in_cmp(const void *p1, const void *p2) {
+  const pu_depgraph_edge_t *e1 = *(pu_depgraph_edge_t * const *) p1;
+  const pu_depgraph_edge_t *e2 = *(pu_depgraph_edge_t * const *) p2;
+  if (e1->to != e2->to) { return e1->to < e2->to ? -1 : 1; }
+  return e1 < e2 ? -1 : e1 > e2;
+}
+
+static alpm_list_t *_pu_depgraph_deplist(alpm_pkg_t *pkg, pu_deptype_t type) {
+  switch (type) {
+    case PU_DEPTYPE_DEPEND:
+      return alpm_pkg_get_depends(pkg);
+    case PU_DEPTYPE_OPTIONAL:
+      return alpm_pkg_get_optdepends(pkg);
+    case PU_DEPTYPE_MAKE:
+      return alpm_pkg_get_makedepends(pkg);
+    case PU_DEPTYPE_CHECK:
+      return alpm_pkg_get_checkdepends(pkg);
+    default:
+      return NULL;
+  }
+}
+
+static int _pu_depgraph_add_edge(pu_depgraph_t *graph, size_t *size,
+    size_t from, size_t to, alpm_depend_t *dep, pu_deptype_t type) {
+  pu_depgraph_edge_t *e;
+  if (graph->edgecount == *size) {
+    size_t newsize = *size ? *size * 2 : 256;
+    pu_depgraph_edge_t *newedges = realloc(graph->edges,
+            newsize * sizeof(pu_depgraph_edge_t));
+    if (newedges == NULL) { return -1; }
+    graph->edges = newedges;
+    *size = newsize;
+  }
+  e = &graph->edges[graph->edgecount++];
+  e->from = from;
+  e->to = to;
+  e->dep = dep;
+  e->type = type;
+  return 0;
+}
+
+/**
+ * @brief Build a dependency graph over a package list.
+ *
+ * Every dependency of the requested types is resolved against the package
+ * list once, so forward and reverse lookups afterwards only visit the edges
+ * of the package in question.  An edge is added for every package satisfying
+ * a dependency.
+ *
+ * @param pkgs packages to include in the graph
+ * @param types bitmask of pu_deptype_t values to resolve
+ *
+ * @return new graph, NULL on error
+ */
+pu_depgraph_t *pu_depgraph_new(alpm_list_t *pkgs, int types) {
+  pu_depgraph_t *graph = calloc(1, sizeof(pu_depgraph_t));
+  pu_provider_index_t *providers = NULL;
+  size_t edgesize = 0, i, j;
+  alpm_list_t *p;
+
+  if (graph == NULL) { return NULL; }
+
+  graph->pkgcount = alpm_list_count(pkgs);
+  if ((graph->pkgs = calloc(graph->pkgcount + 1, sizeof(alpm_pkg_t *))) == NULL
+      || (graph->_byptr = calloc(graph->pkgcount + 1,
+              sizeof(struct _pu_depgraph_pkgref))) == NULL
+      || (graph->_out = calloc(graph->pkgcount + 1, sizeof(size_t))) == NULL
+      || (graph->_in_off = calloc(graph->pkgcount + 1,
+              sizeof(size_t))) == NULL
+      || (providers = pu_provider_index_new(pkgs)) == NULL) {
+    goto error;
+  }
+
+  for (i = 0, p = pkgs; p; p = p->next, i++) {
+    graph->pkgs[i] = p->data;
+    graph->_byptr[i].pkg = p->data;
+    graph->_byptr[i].idx = i;
+  }
+  qsort(graph->_byptr, graph->pkgcount, sizeof(struct _pu_depgraph_pkgref),
+      _pu_depgraph_pkgref_cmp);
+
+  for (i = 0; i < graph->pkgcount; i++) {
+    pu_deptype_t type;
+    graph->_out[i] = graph->edgecount;
+    for (type = PU_DEPTYPE_DEPEND; type & PU_DEPTYPE_ALL; type <<= 1) {
+      alpm_list_t *d;
+      if (!(types & type)) { continue; }
+      for (d = _pu_depgraph_deplist(graph->pkgs[i], type); d; d = d->next) {
+        alpm_depend_t *dep = d->data;
+        pu_version_key_t *tmp = NULL, *depversion;
+        size_t count, last = SIZE_MAX;
+        pu_provider_t *pr = pu_provider_index_find(providers, dep->name,
+                &count);
+        depversion = _pu_provider_index_depversion(providers, dep, &tmp);
+        for (j = 0; j < count; j++) {
+          size_t to = pr[j].pkgidx;
+          /* a package providing its own name is listed twice */
+          if (to == last
+              || !_pu_provider_satisfies_dep(&pr[j], dep, depversion)) {
+            continue;
+          }
+          last = to;
+          if (_pu_depgraph_add_edge(graph, &edgesize, i, to, dep, type) != 0) {
+            pu_version_key_free(tmp);
+            goto error;
+          }
+        }
+        pu_version_key_free(tmp);
+      }
+    }
+  }
+  graph->_out[graph->pkgcount] = graph->edgecount;
+  pu_provider_index_free(providers);
+  providers = NULL;
+
+  if ((graph->_in = calloc(graph->edgecount + 1,
+              sizeof(pu_depgraph_edge_t *))) == NULL) {
+    goto error;
+  }
+  for (i = 0; i < graph->edgecount; i++) {
+    graph->_in[i] = &graph->edges[i];
+  }
+  qsort(graph->_in, graph->edgecount, sizeof(pu_depgraph_edge_t *),
+      _pu_depgraph_in_cmp);
+  for (i = 0, j = 0; i < graph->pkgcount; i++) {
+    graph->_in_off[i] = j;
+    while (j < graph->edgecount && graph->_in[j]->to == i) { j++; }
+  }
+  graph->_in_off[graph->pkgcount] = graph->edgecount;
+
+  return graph;
+
+error:
+  pu_provider_index_free(providers);
+  pu_depgraph_free(graph);
+  return NULL;
+}
+
+/**
+ * @brief Look up the index of a package in a graph.
+ *
+ * @return 0 on success, -1 if the package is not part of the graph
+ */
+int pu_depgraph_pkg_index(pu_depgraph_t *graph, alpm_pkg_t *pkg, size_t *idx) {
+  struct _pu_depgraph_pkgref key = { .pkg = pkg }, *ref;
+  ref = bsearch(&key, graph->_byptr, graph->pkgcount,
+          sizeof(struct _pu_depgraph_pkgref), _pu_depgraph_pkgref_cmp);
+  if (ref == NULL) { return -1; }
+  *idx = ref->idx;
+  return 0;
+}
+
+/* edges from the package at idx to the packages satisfying its dependencies */
+pu_depgraph_edge_t *pu_depgraph_get_deps(pu_depgraph_t *graph, size_t idx,
+    size_t *count) {
+  *count = graph->_out[idx + 1] - graph->_out[idx];
+  return graph->edges + graph->_out[idx];
+}
+
+/* edges from packages with dependencies satisfied by the package at idx */
+pu_depgraph_edge_t **pu_depgraph_get_rdeps(pu_depgraph_t *graph, size_t idx,
+    size_t *count) {
+  *count = graph->_in_off[idx + 1] - graph->_in_off[idx];
+  return graph->_in + graph->_in_off[idx];
+}
+
+/**
+ * @brief Find packages with dependencies satisfied by pkg.
+ *
+ * Results match pu_pkg_find_requiredby and friends called with the package
+ * list the graph was built from.  Packages outside of the graph fall back to
+ * checking every package.
+ *
+ * @param types bitmask of pu_deptype_t values, only those the graph was built
+ * with will be found
+ *
+ * @return 0 on success, -1 on error
+ */
+int pu_depgraph_find_reversedeps(pu_depgraph_t *graph, alpm_pkg_t *pkg,
+    int types, alpm_list_t **ret) {
+  pu_depgraph_edge_t **in;
+  size_t idx, count, i, last = SIZE_MAX;
+
+  if (pu_depgraph_pkg_index(graph, pkg, &idx) != 0) {
+    alpm_list_t pkgs = { .data = NULL, .prev = NULL, .next = NULL };
+    for (i = 0; i < graph->pkgcount; i++) {
+      pkgs.data = graph->pkgs[i];
+      if (pu_pkg_find_reversedeps(pkg, types, &pkgs, ret) != 0) {
+        return -1;
+      }
+    }
+    return 0;
+  }
+
+  in = pu_depgraph_get_rdeps(graph, idx, &count);
+  for (i = 0; i < count; i++) {
+    if (!(in[i]->type & types) || in[i]->from == last) { continue; }
+    last = in[i]->from;
+    if (alpm_list_append(ret, graph->pkgs[last]) == NULL) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int pu_depgraph_find_requiredby(pu_depgraph_t *graph, alpm_pkg_t *pkg,
+    alpm_list_t **ret) {
+  return pu_depgraph_find_reversedeps(graph, pkg, PU_DEPTYPE_DEPEND, ret);
+}
+
+int pu_depgraph_find_optionalfor(pu_depgraph_t *graph, alpm_pkg_t *pkg,
+    alpm_list_t **ret) {
+  return pu_depgraph_find_reversedeps(graph, pkg, PU_DEPTYPE_OPTIONAL, ret);
+}
+
+int pu_depgraph_find_makedepfor(pu_depgraph_t *graph, alpm_pkg_t *pkg,
+    alpm_list_t **ret) {
+  return pu_depgraph_find_reversedeps(graph, pkg, PU_DEPTYPE_MAKE, ret);
+}
+
+int pu_depgraph_find_checkdepfor(pu_depgraph_t *graph, alpm_pkg_t *pkg,
+    alpm_list_t **ret) {
+  return pu_depgraph_find_reversedeps(graph, pkg, PU_DEPTYPE_CHECK, ret);
+}
+
+/**
+ * @brief Find the strongly connected components of a graph.
+ *
+ * Packages depending on each other, directly or indirectly, share a
+ * component.  Components are numbered in the order Tarjan's algorithm
+ * completes them, so packages a component depends on are always in a
+ * component with a lower number.
+ *
+ * @param graph dependency graph
+ * @param comp array of graph->pkgcount elements, set to the component of
+ * each package
+ * @param count set to the number of components
+ *
+ * @return 0 on success, -1 on error
+ */
+int pu_depgraph_scc(pu_depgraph_t *graph, size_t *comp, size_t *count) {
+  struct frame { size_t pkg, edge; } *calls;
+  size_t *index, *low, *stack, ncalls = 0, nstack = 0, next = 0, root, i;
+
+  *count = 0;
+  index = malloc(sizeof(size_t) * (graph->pkgcount + 1));
+  low = malloc(sizeof(size_t) * (graph->pkgcount + 1));
+  stack = malloc(sizeof(size_t) * (graph->pkgcount + 1));
+  calls = malloc(sizeof(struct frame) * (graph->pkgcount + 1));
+  if (!index || !low || !stack || !calls) {
+    free(index);
+    free(low);
+    free(stack);
+    free(calls);
+    return -1;
+  }
+
+  for (i = 0; i < graph->pkgcount; i++) {
+    index[i] = SIZE_MAX;
+    comp[i] = SIZE_MAX;
+  }
+
+  /* iterative to avoid recursing once per package in a dependency chain */
+  for (root = 0; root < graph->pkgcount; root++) {
+    if (index[root] != SIZE_MAX) { continue; }
+    index[root] = low[root] = next++;
+    stack[nstack++] = root;
+    calls[ncalls].pkg = root;
+    calls[ncalls++].edge = 0;
+
+    while (ncalls) {
+      struct frame *f = &calls[ncalls - 1];
+      size_t v = f->pkg, edgecount;
+      pu_depgraph_edge_t *edges = pu_depgraph_get_deps(graph, v, &edgecount);
+
+      if (f->edge < edgecount) {
+        size_t w = edges[f->edge++].to;
+        if (index[w] == SIZE_MAX) {
+          index[w] = low[w] = next++;
+          stack[nstack++] = w;
+          calls[ncalls].pkg = w;
+          calls[ncalls++].edge = 0;
+        } else if (comp[w] == SIZE_MAX && index[w] < low[v]) {
+          /* w is still on the stack */
+          low[v] = index[w];
+        }
+        continue;
+      }
+
+      if (low[v] == index[v]) {
+        size_t w;
+        do {
+          w = stack[--nstack];
+          comp[w] = *count;
+        } while (w != v);
+        (*count)++;
+      }
+      if (--ncalls && low[v] < low[calls[ncalls - 1].pkg]) {
+        low[calls[ncalls - 1].pkg] = low[v];
+      }
+    }
+  }
+
+  free(index);
+  free(low);
+  free(stack);
+  free(calls);
+  return 0;
+}
+
+/**
+ * @brief Find the components of a graph nothing outside of depends on.
+ *
+ * Only packages not marked in skip are considered; a component is a source
+ * if none of its packages are depended on by a package in another
+ * component.  Dependencies from skipped packages are expected to have been
+ * skipped themselves, they are not checked.
+ *
+ * @param graph dependency graph
+ * @param skip array of graph->pkgcount flags, packages to ignore
+ * @param issource array of graph->pkgcount elements, set to 1 for each
+ * package in a source component, 0 otherwise
+ *
+ * @return 0 on success, -1 on error
+ */
+int pu_depgraph_find_sources(pu_depgraph_t *graph, const unsigned char *skip,
+    unsigned char *issource) {
+  size_t *comp, ncomp, i, j;
+  unsigned char *source;
+
+  if ((comp = malloc(sizeof(size_t) * (graph->pkgcount + 1))) == NULL) {
+    return -1;
+  }
+  if (pu_depgraph_scc(graph, comp, &ncomp) != 0
+      || (source = malloc(ncomp + 1)) == NULL) {
+    free(comp);
+    return -1;
+  }
+
+  memset(source, 1, ncomp + 1);
+  for (i = 0; i < graph->pkgcount; i++) {
+    pu_depgraph_edge_t **in;
+    size_t count;
+    if (skip[i]) { continue; }
+    in = pu_depgraph_get_rdeps(graph, i, &count);
+    for (j = 0; j < count; j++) {
+      if (comp[in[j]->from] != comp[i]) { source[comp[i]] = 0; }
+    }
+  }
+  for (i = 0; i < graph->pkgcount; i++) {
+    issource[i] = !skip[i] && source[comp[i]];
+  }
+
+  free(source);
+  free(comp);
+  return 0;
+}
+
+struct _pu_depgraph_dom {
+  pu_depgraph_t *graph;
+  size_t *idom, *po, *order, norder;
+  unsigned char *isroot;
+  struct { size_t pkg, edge; } *calls;
+};
+
+/* depth-first search from a root, numbering packages in postorder */
+static void _pu_depgraph_dom_dfs(struct _pu_depgraph_dom *d, size_t root) {
+  size_t ncalls = 0;
+  d->po[root] = 0; /* visited, numbered once finished */
+  d->calls[ncalls].pkg = root;
+  d->calls[ncalls++].edge = 0;
+  while (ncalls) {
+    size_t v = d->calls[ncalls - 1].pkg, count;
+    pu_depgraph_edge_t *e = pu_depgraph_get_deps(d->graph, v, &count);
+    if (d->calls[ncalls - 1].edge < count) {
+      size_t w = e[d->calls[ncalls - 1].edge++].to;
+      if (d->po[w] == SIZE_MAX) {
+        d->po[w] = 0;
+        d->calls[ncalls].pkg = w;
+        d->calls[ncalls++].edge = 0;
+      }
+    } else {
+      d->po[v] = d->norder;
+      d->order[d->norder++] = v;
+      ncalls--;
+    }
+  }
+}
+
+static size_t _pu_depgraph_dom_intersect(struct _pu_depgraph_dom *d,
+    size_t a, size_t b) {
+  while (a != b) {
+    while (d->po[a] < d->po[b]) { a = d->idom[a]; }
+    while (d->po[b] < d->po[a]) { b = d->idom[b]; }
+  }
+  return a;
+}
+
+/* mark the packages that are kept regardless of what else is installed:
+ * explicitly installed packages, packages nothing depends on, and the
+ * members of cycles nothing outside of depends on */
+static int _pu_depgraph_find_roots(pu_depgraph_t *graph,
+    unsigned char *isroot) {
+  size_t n = graph->pkgcount, head = 0, tail = 0, i, j;
+  size_t *queue;
+  unsigned char *reached, *source = NULL;
+  int ret = -1;
+
+  queue = malloc(sizeof(size_t) * (n + 1));
+  reached = calloc(n + 1, 1);
+  if (!queue || !reached) { goto cleanup; }
+
+  for (i = 0; i < n; i++) {
+    size_t count;
+    pu_depgraph_get_rdeps(graph, i, &count);
+    isroot[i] = count == 0
+        || alpm_pkg_get_reason(graph->pkgs[i]) == ALPM_PKG_REASON_EXPLICIT;
+    if (isroot[i]) {
+      reached[i] = 1;
+      queue[tail++] = i;
+    }
+  }
+  while (head < tail) {
+    size_t count;
+    pu_depgraph_edge_t *e = pu_depgraph_get_deps(graph, queue[head++], &count);
+    for (j = 0; j < count; j++) {
+      if (!reached[e[j].to]) {
+        reached[e[j].to] = 1;
+        queue[tail++] = e[j].to;
+      }
+    }
+  }
+
+  if (tail < n) {
+    /* cycles that nothing else depends on are not reachable from any of the
+     * roots so far, the members of each cycle become roots themselves */
+    if ((source = malloc(n + 1)) == NULL
+        || pu_depgraph_find_sources(graph, reached, source) != 0) {
+      goto cleanup;
+    }
+    for (i = 0; i < n; i++) {
+      if (source[i]) { isroot[i] = 1; }
+    }
+  }
+  ret = 0;
+
+cleanup:
+  free(queue);
+  free(reached);
+  free(source);
+  return ret;
+}
+
+/**
+ * @brief Calculate how much space removing each package would free.
+ *
+ * A package's removable size is its own installed size plus that of every
+ * package only reachable through it: dependencies that are not installed
+ * explicitly and are not needed by anything else.  Sizes for all packages
+ * are calculated together from the dominator tree of the graph, with
+ * explicitly installed packages, packages nothing depends on, and cycles
+ * nothing outside of depends on as roots.
+ *
+ * @param graph dependency graph of installed packages
+ * @param sizes array of graph->pkgcount elements to store the sizes in
+ *
+ * @return 0 on success, -1 on error
+ */
+int pu_depgraph_removable_sizes(pu_depgraph_t *graph, off_t *sizes) {
+  struct _pu_depgraph_dom d = { .graph = graph, .norder = 0 };
+  size_t n = graph->pkgcount, vroot = graph->pkgcount, i, j;
+  int changed, ret = -1;
+
+  d.idom = malloc(sizeof(size_t) * (n + 1));
+  d.po = malloc(sizeof(size_t) * (n + 1));
+  d.order = malloc(sizeof(size_t) * (n + 1));
+  d.isroot = malloc(n + 1);
+  d.calls = malloc(sizeof(*d.calls) * (n + 1));
+  if (!d.idom || !d.po || !d.order || !d.isroot || !d.calls) { goto cleanup; }
+
+  for (i = 0; i <= n; i++) {
+    d.idom[i] = SIZE_MAX;
+    d.po[i] = SIZE_MAX;
+  }
+  if (_pu_depgraph_find_roots(graph, d.isroot) != 0) { goto cleanup; }
+  for (i = 0; i < n; i++) {
+    if (d.isroot[i] && d.po[i] == SIZE_MAX) { _pu_depgraph_dom_dfs(&d, i); }
+  }
+
+  /* the virtual root above all roots finishes last */
+  d.po[vroot] = d.norder;
+  d.idom[vroot] = vroot;
+
+  /* Cooper, Harvey, and Kennedy's iterative algorithm, packages are
+   * processed in reverse postorder */
+  do {
+    changed = 0;
+    for (i = d.norder; i-- > 0; ) {
+      size_t v = d.order[i], newidom = d.isroot[v] ? vroot : SIZE_MAX, count;
+      pu_depgraph_edge_t **in = pu_depgraph_get_rdeps(graph, v, &count);
+      for (j = 0; j < count; j++) {
+        size_t u = in[j]->from;
+        if (d.idom[u] == SIZE_MAX) { continue; }
+        newidom = newidom == SIZE_MAX ? u
+            : _pu_depgraph_dom_intersect(&d, u, newidom);
+      }
+      if (d.idom[v] != newidom) {
+        d.idom[v] = newidom;
+        changed = 1;
+      }
+    }
+  } while (changed);
+
+  for (i = 0; i < n; i++) {
+    sizes[i] = alpm_pkg_get_isize(graph->pkgs[i]);
+  }
+  /* dominators finish after the packages they dominate */
+  for (i = 0; i < d.norder; i++) {
+    size_t v = d.order[i];
+    if (d.idom[v] != vroot) { sizes[d.idom[v]] += sizes[v]; }
+  }
+  ret = 0;
+
+cleanup:
+  free(d.idom);
+  free(d.po);
+  free(d.order);
+  free(d.isroot);
+  free(d.calls);
+  return ret;
+}
+
+void pu_depgraph_free(pu_depgraph_t *graph) {
+  if (graph == NULL) { return; }
+  free(graph->pkgs);
+  free(graph->edges);
+  free(graph->_out);
+  free(graph->_in);
+  free(graph->_in_off);
+  free(graph->_byptr);
+  free(graph);
+}
@@ -25,8 +25,59 @@
 
 #include <alpm.h>
 
+#include "version.h"
+
+typedef enum pu_deptype_t {
+  PU_DEPTYPE_DEPEND   = (1 << 0),
+  PU_DEPTYPE_OPTIONAL = (1 << 1),
+  PU_DEPTYPE_MAKE     = (1 << 2),
+  PU_DEPTYPE_CHECK    = (1 << 3),
+  PU_DEPTYPE_ALL      = (1 << 4) - 1,
+} pu_deptype_t;
+
+typedef struct pu_provider_t {
+  alpm_pkg_t *pkg;
+  alpm_depend_t *provision; /* NULL if provided by the package name */
+  size_t pkgidx;            /* position of pkg in the indexed list */
+  pu_version_key_t *version; /* NULL for unversioned provisions */
+} pu_provider_t;
+
+typedef struct pu_provider_index_t {
+  pu_provider_t *providers; /* grouped by name, in list order within each */
+  size_t count;
+
+  struct _pu_provider_bucket *_buckets;
+  size_t _bucketcount;
+  pu_version_cache_t *_versions;
+} pu_provider_index_t;
+
+typedef struct pu_depgraph_edge_t {
+  size_t from;        /* index of the depending package */
+  size_t to;          /* index of the satisfying package */
+  alpm_depend_t *dep; /* dependency of the depending package */
+  pu_deptype_t type;
+} pu_depgraph_edge_t;
+
+typedef struct pu_depgraph_t {
+  alpm_pkg_t **pkgs;
+  size_t pkgcount;
+  pu_depgraph_edge_t *edges; /* grouped by depending package */
+  size_t edgecount;
+
+  size_t *_out;                /* edge offsets by depending package */
+  pu_depgraph_edge_t **_in;    /* edges grouped by satisfying package */
+  size_t *_in_off;             /* _in offsets by satisfying package */
+  struct _pu_depgraph_pkgref *_byptr;
+} pu_depgraph_t;
+
 int pu_provision_satisfies_dep(alpm_depend_t *provision, alpm_depend_t *dep);
 int pu_pkg_satisfies_dep(alpm_pkg_t *pkg, alpm_depend_t *dep);
+int pu_version_key_satisfies_dep(const pu_version_key_t *version,
+    alpm_depend_t *dep, const pu_version_key_t *depversion);
+int pu_provision_satisfies_dep_cached(pu_version_cache_t *cache,
+    alpm_depend_t *provision, alpm_depend_t *dep);
+int pu_pkg_satisfies_dep_cached(pu_version_cache_t *cache, alpm_pkg_t *pkg,
+    alpm_depend_t *dep);
 int pu_pkg_depends_on(alpm_pkg_t *pkg, alpm_pkg_t *dpkg);
 int pu_pkg_optdepends_on(alpm_pkg_t *pkg, alpm_pkg_t *dpkg);
 int pu_pkg_checkdepends_on(alpm_pkg_t *pkg, alpm_pkg_t *dpkg);
@@ -46,4 +97,33 @@ alpm_pkg_t *pu_pkglist_find_dep_satisfier(alpm_list_t *pkgs,
 alpm_pkg_t *pu_db_find_dep_satisfier(alpm_db_t *db, alpm_depend_t *dep);
 alpm_pkg_t *pu_dblist_find_dep_satisfier(alpm_list_t *dbs, alpm_depend_t *dep);
 
+pu_provider_index_t *pu_provider_index_new(alpm_list_t *pkgs);
+pu_provider_t *pu_provider_index_find(pu_provider_index_t *index,
+    const char *name, size_t *count);
+alpm_pkg_t *pu_provider_index_find_satisfier(pu_provider_index_t *index,
+    alpm_depend_t *dep);
+void pu_provider_index_free(pu_provider_index_t *index);
+
+pu_depgraph_t *pu_depgraph_new(alpm_list_t *pkgs, int types);
+int pu_depgraph_pkg_index(pu_depgraph_t *graph, alpm_pkg_t *pkg, size_t *idx);
+pu_depgraph_edge_t *pu_depgraph_get_deps(pu_depgraph_t *graph, size_t idx,
+    size_t *count);
+pu_depgraph_edge_t **pu_depgraph_get_rdeps(pu_depgraph_t *graph, size_t idx,
+    size_t *count);
+int pu_depgraph_find_reversedeps(pu_depgraph_t *graph, alpm_pkg_t *pkg,
+    int types, alpm_list_t **ret);
+int pu_depgraph_find_requiredby(pu_depgraph_t *graph, alpm_pkg_t *pkg,
+    alpm_list_t **ret);
+int pu_depgraph_find_optionalfor(pu_depgraph_t *graph, alpm_pkg_t *pkg,
+    alpm_list_t **ret);
+int pu_depgraph_find_makedepfor(pu_depgraph_t *graph, alpm_pkg_t *pkg,
+    alpm_list_t **ret);
+int pu_depgraph_find_checkdepfor(pu_depgraph_t *graph, alpm_pkg_t *pkg,
+    alpm_list_t **ret);
+int pu_depgraph_scc(pu_depgraph_t *graph, size_t *comp, size_t *count);
+int pu_depgraph_find_sources(pu_depgraph_t *graph, const unsigned char *skip,
+    unsigned char *issource);
+int pu_depgraph_removable_sizes(pu_depgraph_t *graph, off_t *sizes);
+void pu_depgraph_free(pu_depgraph_t *graph);
+
 #endif /* PACUTILS_DEPENDS_H */
@@ -0,0 +1,396 @@
+/*
+ * Copyright 2012-2020 Andrew Gregory <andrew.gregory.8@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 700 /* posix_fadvise/posix_memalign */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "digest.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PU_DIGEST_SHA_NI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#define PU_DIGEST_BUFSIZE (256 * 1024)
+#define PU_DIGEST_BUFALIGN 4096
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+typedef struct {
+  uint32_t state[4];
+  uint64_t len;
+  unsigned char buf[64];
+} _pu_md5_t;
+
+typedef struct {
+  uint32_t state[8];
+  uint64_t len;
+  unsigned char buf[64];
+  void (*compress)(uint32_t *state, const unsigned char *data, size_t blocks);
+} _pu_sha256_t;
+
+static const uint32_t _pu_md5_k[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+  0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+  0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+  0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+  0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+  0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const uint32_t _pu_md5_r[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+static const uint32_t _pu_sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t _pu_load_le32(const unsigned char *p) {
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8)
+    | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint32_t _pu_load_be32(const unsigned char *p) {
+  return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16)
+    | ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+static void _pu_md5_compress(uint32_t *state, const unsigned char *data,
+    size_t blocks) {
+  while (blocks--) {
+    uint32_t w[16], a = state[0], b = state[1], c = state[2], d = state[3];
+    int i;
+
+    for (i = 0; i < 16; i++) { w[i] = _pu_load_le32(data + i * 4); }
+
+    for (i = 0; i < 64; i++) {
+      uint32_t f, tmp;
+      int g;
+      if (i < 16) {
+        f = d ^ (b & (c ^ d));
+        g = i;
+      } else if (i < 32) {
+        f = c ^ (d & (b ^ c));
+        g = (5 * i + 1) & 15;
+      } else if (i < 48) {
+        f = b ^ c ^ d;
+        g = (3 * i + 5) & 15;
+      } else {
+        f = c ^ (b | ~d);
+        g = (7 * i) & 15;
+      }
+      tmp = d;
+      d = c;
+      c = b;
+      f += a + _pu_md5_k[i] + w[g];
+      b += ROTL(f, _pu_md5_r[i]);
+      a = tmp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    data += 64;
+  }
+}
+
+static void _pu_sha256_compress(uint32_t *state, const unsigned char *data,
+    size_t blocks) {
+  while (blocks--) {
+    uint32_t w[64], s[8];
+    int i;
+
+    for (i = 0; i < 16; i++) { w[i] = _pu_load_be32(data + i * 4); }
+    for (; i < 64; i++) {
+      uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    memcpy(s, state, sizeof(s));
+    for (i = 0; i < 64; i++) {
+      uint32_t S1 = ROTR(s[4], 6) ^ ROTR(s[4], 11) ^ ROTR(s[4], 25);
+      uint32_t ch = (s[4] & s[5]) ^ (~s[4] & s[6]);
+      uint32_t t1 = s[7] + S1 + ch + _pu_sha256_k[i] + w[i];
+      uint32_t S0 = ROTR(s[0], 2) ^ ROTR(s[0], 13) ^ ROTR(s[0], 22);
+      uint32_t maj = (s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]);
+      memmove(s + 1, s, 7 * sizeof(uint32_t));
+      s[4] += t1;
+      s[0] = t1 + S0 + maj;
+    }
+
+    for (i = 0; i < 8; i++) { state[i] += s[i]; }
+    data += 64;
+  }
+}
+
+#ifdef PU_DIGEST_SHA_NI
+static int _pu_cpu_has_sha_ni(void) {
+  unsigned int a, b, c, d;
+  if (!__get_cpuid(1, &a, &b, &c, &d)) { return 0; }
+  if (!(c & bit_SSSE3) || !(c & bit_SSE4_1)) { return 0; }
+  if (!__get_cpuid_count(7, 0, &a, &b, &c, &d)) { return 0; }
+  return (b & (1 << 29)) != 0;
+}
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void _pu_sha256_compress_ni(uint32_t *state, const unsigned char *data,
+    size_t blocks) {
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+          0x0405060700010203ULL);
+  __m128i state0, state1, msg, tmp, w[4];
+
+  tmp = _mm_loadu_si128((const __m128i *) &state[0]);
+  state1 = _mm_loadu_si128((const __m128i *) &state[4]);
+  tmp = _mm_shuffle_epi32(tmp, 0xB1);             /* CDAB */
+  state1 = _mm_shuffle_epi32(state1, 0x1B);       /* EFGH */
+  state0 = _mm_alignr_epi8(tmp, state1, 8);       /* ABEF */
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);    /* CDGH */
+
+  while (blocks--) {
+    __m128i abef = state0, cdgh = state1;
+    int g;
+
+    /* each iteration performs four rounds, the message schedule is kept in
+     * a four-vector ring that is extended as the rounds progress */
+    for (g = 0; g < 16; g++) {
+      if (g < 4) {
+        w[g] = _mm_shuffle_epi8(
+                _mm_loadu_si128((const __m128i *) (data + g * 16)), mask);
+      }
+      msg = _mm_add_epi32(w[g & 3],
+              _mm_loadu_si128((const __m128i *) &_pu_sha256_k[g * 4]));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+      if (g >= 3 && g < 15) {
+        tmp = _mm_alignr_epi8(w[g & 3], w[(g + 3) & 3], 4);
+        w[(g + 1) & 3] = _mm_add_epi32(w[(g + 1) & 3], tmp);
+        w[(g + 1) & 3] = _mm_sha256msg2_epu32(w[(g + 1) & 3], w[g & 3]);
+      }
+      msg = _mm_shuffle_epi32(msg, 0x0E);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+      if (g >= 1 && g < 13) {
+        w[(g + 3) & 3] = _mm_sha256msg1_epu32(w[(g + 3) & 3], w[g & 3]);
+      }
+    }
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+    data += 64;
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);          /* FEBA */
+  state1 = _mm_shuffle_epi32(state1, 0xB1);       /* DCHG */
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);    /* DCBA */
+  state1 = _mm_alignr_epi8(state1, tmp, 8);       /* ABEF */
+  _mm_storeu_si128((__m128i *) &state[0], state0);
+  _mm_storeu_si128((__m128i *) &state[4], state1);
+}
+#endif
+
+static void _pu_md5_init(_pu_md5_t *ctx) {
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xefcdab89;
+  ctx->state[2] = 0x98badcfe;
+  ctx->state[3] = 0x10325476;
+  ctx->len = 0;
+}
+
+static void _pu_sha256_init(_pu_sha256_t *ctx) {
+  static const uint32_t h[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+  memcpy(ctx->state, h, sizeof(h));
+  ctx->len = 0;
+  ctx->compress = _pu_sha256_compress;
+#ifdef PU_DIGEST_SHA_NI
+  /* the portable implementation can be forced for testing */
+  if (_pu_cpu_has_sha_ni() && getenv("PACUTILS_DISABLE_SHA_NI") == NULL) {
+    ctx->compress = _pu_sha256_compress_ni;
+  }
+#endif
+}
+
+/* feed data to a block function, buffering partial blocks in buf */
+static void _pu_digest_update(unsigned char *buf, uint64_t *len,
+    uint32_t *state, const unsigned char *data, size_t size,
+    void (*compress)(uint32_t *, const unsigned char *, size_t)) {
+  size_t used = *len & 63;
+  *len += size;
+  if (used) {
+    size_t need = 64 - used;
+    if (size < need) {
+      memcpy(buf + used, data, size);
+      return;
+    }
+    memcpy(buf + used, data, need);
+    compress(state, buf, 1);
+    data += need;
+    size -= need;
+  }
+  if (size >= 64) {
+    compress(state, data, size / 64);
+    data += size & ~(size_t) 63;
+    size &= 63;
+  }
+  memcpy(buf, data, size);
+}
+
+/* append padding and the message length in bits */
+static void _pu_digest_pad(unsigned char *buf, uint64_t len, uint32_t *state,
+    int bigendian,
+    void (*compress)(uint32_t *, const unsigned char *, size_t)) {
+  size_t used = len & 63;
+  uint64_t bits = len * 8;
+  int i;
+
+  buf[used++] = 0x80;
+  if (used > 56) {
+    memset(buf + used, 0, 64 - used);
+    compress(state, buf, 1);
+    used = 0;
+  }
+  memset(buf + used, 0, 56 - used);
+  for (i = 0; i < 8; i++) {
+    buf[bigendian ? 63 - i : 56 + i] = (unsigned char) (bits >> (i * 8));
+  }
+  compress(state, buf, 1);
+}
+
+static void _pu_digest_hex(char *dest, const uint32_t *state, size_t words,
+    int bigendian) {
+  static const char hex[] = "0123456789abcdef";
+  size_t i;
+  int j;
+  for (i = 0; i < words; i++) {
+    for (j = 0; j < 4; j++) {
+      unsigned char byte = state[i] >> (bigendian ? 24 - j * 8 : j * 8);
+      *(dest++) = hex[byte >> 4];
+      *(dest++) = hex[byte & 0xf];
+    }
+  }
+  *dest = '\0';
+}
+
+/**
+ * @brief Compute one or more digests of a file in a single pass.
+ *
+ * @param fd file descriptor to read from, not closed
+ * @param types bitmask of pu_digest_type_t values
+ * @param dest destination for the hex-encoded digests
+ *
+ * @return 0 on success, -1 on error with errno set
+ */
+int pu_digest_fd(int fd, int types, pu_digest_t *dest) {
+  _pu_md5_t md5;
+  _pu_sha256_t sha256;
+  unsigned char *buf;
+  ssize_t r;
+
+  if (dest == NULL || fd < 0) { errno = EINVAL; return -1; }
+  if (posix_memalign((void **) &buf, PU_DIGEST_BUFALIGN,
+          PU_DIGEST_BUFSIZE) != 0) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  if (types & PU_DIGEST_MD5) { _pu_md5_init(&md5); }
+  if (types & PU_DIGEST_SHA256) { _pu_sha256_init(&sha256); }
+
+  while ((r = read(fd, buf, PU_DIGEST_BUFSIZE)) != 0) {
+    if (r < 0) {
+      if (errno == EINTR) { continue; }
+      free(buf);
+      return -1;
+    }
+    if (types & PU_DIGEST_MD5) {
+      _pu_digest_update(md5.buf, &md5.len, md5.state, buf, r,
+          _pu_md5_compress);
+    }
+    if (types & PU_DIGEST_SHA256) {
+      _pu_digest_update(sha256.buf, &sha256.len, sha256.state, buf, r,
+          sha256.compress);
+    }
+  }
+  free(buf);
+
+  if (types & PU_DIGEST_MD5) {
+    _pu_digest_pad(md5.buf, md5.len, md5.state, 0, _pu_md5_compress);
+    _pu_digest_hex(dest->md5, md5.state, 4, 0);
+  }
+  if (types & PU_DIGEST_SHA256) {
+    _pu_digest_pad(sha256.buf, sha256.len, sha256.state, 1, sha256.compress);
+    _pu_digest_hex(dest->sha256, sha256.state, 8, 1);
+  }
+
+  return 0;
+}
+
+int pu_digest_file(const char *path, int types, pu_digest_t *dest) {
+  int fd, ret, err;
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) { return -1; }
+  ret = pu_digest_fd(fd, types, dest);
+  err = errno;
+  close(fd);
+  errno = err;
+  return ret;
+}
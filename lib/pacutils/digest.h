@@ -0,0 +1,40 @@
+/*
+ * Copyright 2012-2020 Andrew Gregory <andrew.gregory.8@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef PACUTILS_DIGEST_H
+#define PACUTILS_DIGEST_H
+
+typedef enum pu_digest_type_t {
+  PU_DIGEST_MD5    = (1 << 0),
+  PU_DIGEST_SHA256 = (1 << 1),
+} pu_digest_type_t;
+
+/* hex-encoded digests, only those requested are filled in */
+typedef struct pu_digest_t {
+  char md5[33];
+  char sha256[65];
+} pu_digest_t;
+
+int pu_digest_fd(int fd, int types, pu_digest_t *dest);
+int pu_digest_file(const char *path, int types, pu_digest_t *dest);
+
+#endif /* PACUTILS_DIGEST_H */
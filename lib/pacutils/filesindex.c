@@ -0,0 +1,684 @@
+/*
+ * Copyright 2012-2020 Andrew Gregory <andrew.gregory.8@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 700 /* st_mtim */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "filesindex.h"
+#include "util.h"
+
+/*
+ * Index layout, all integers are in native byte order:
+ *
+ *   header
+ *   uint64_t name offsets, one per package in name order
+ *   uint64_t block offsets, one per block plus the end of the last block
+ *   database path, then each package's name and version, NUL terminated
+ *   path blocks
+ *
+ * Paths are sorted and grouped into blocks of PU_FILES_INDEX_BLOCKSIZE.  Each
+ * path is stored as varints for the length of the prefix it shares with the
+ * previous path in the block and the length of the rest of the path, the rest
+ * of the path, then a varint count of owning packages followed by their ids,
+ * each stored as the difference from the previous one.  The first path in a
+ * block is always stored in full so blocks can be binary searched.
+ */
+
+#define PU_FILES_INDEX_MAGIC "PUFIDX1"
+#define PU_FILES_INDEX_VERSION 2
+#define PU_FILES_INDEX_BYTEORDER 0x01020304
+#define PU_FILES_INDEX_BLOCKSIZE 16
+
+struct _pu_files_index_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteorder;
+  uint64_t size;
+  uint64_t db_size;
+  uint64_t db_mtime;
+  uint64_t db_mtime_nsec;
+  uint64_t db_ino;
+  uint64_t dbfile;
+  uint64_t pkgcount;
+  uint64_t names;
+  uint64_t pathcount;
+  uint64_t blockcount;
+  uint64_t blocks;
+};
+
+struct _pu_files_index_buf {
+  unsigned char *data;
+  size_t len, size;
+};
+
+struct _pu_files_index_entry {
+  const char *path;
+  size_t id;
+};
+
+struct _pu_files_index_cursor {
+  pu_files_index_t *index;
+  size_t block;
+  const unsigned char *pos, *end;
+  char *path;
+  size_t len, size;
+  const unsigned char *postings;
+  uint64_t npostings;
+};
+
+static int _pu_files_index_buf_add(struct _pu_files_index_buf *buf,
+    const void *data, size_t len) {
+  if (buf->len + len > buf->size) {
+    size_t newsize = buf->size ? buf->size * 2 : 4096;
+    unsigned char *newdata;
+    while (newsize < buf->len + len) { newsize *= 2; }
+    if ((newdata = realloc(buf->data, newsize)) == NULL) { return -1; }
+    buf->data = newdata;
+    buf->size = newsize;
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  return 0;
+}
+
+static int _pu_files_index_buf_add_varint(struct _pu_files_index_buf *buf,
+    uint64_t value) {
+  unsigned char bytes[10];
+  size_t len = 0;
+  do {
+    bytes[len] = value & 0x7f;
+    value >>= 7;
+    if (value) { bytes[len] |= 0x80; }
+    len++;
+  } while (value);
+  return _pu_files_index_buf_add(buf, bytes, len);
+}
+
+static int _pu_files_index_varint(const unsigned char **pos,
+    const unsigned char *end, uint64_t *value) {
+  uint64_t v = 0;
+  int shift;
+  for (shift = 0; *pos < end && shift < 64; shift += 7) {
+    unsigned char c = *(*pos)++;
+    v |= (uint64_t) (c & 0x7f) << shift;
+    if (!(c & 0x80)) {
+      *value = v;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static int _pu_files_index_entry_cmp(const void *p1, const void *p2) {
+  const struct _pu_files_index_entry *e1 = p1, *e2 = p2;
+  int cmp = strcmp(e1->path, e2->path);
+  if (cmp) { return cmp; }
+  return e1->id < e2->id ? -1 : e1->id > e2->id;
+}
+
+static int _pu_files_index_write(const struct stat *st, const char *dbfile,
+    const char **pkgnames, const char **pkgvers, alpm_filelist_t **filelists,
+    size_t count, const char *path) {
+  struct _pu_files_index_header header;
+  struct _pu_files_index_buf data = { 0 };
+  struct _pu_files_index_entry *entries = NULL;
+  uint64_t *names = NULL, *blocks = NULL, base;
+  struct _pu_files_index_entry *order = NULL;
+  size_t *ids = NULL, nentries = 0, nblocks = 0, npaths = 0;
+  size_t i, j, k;
+  char *tmppath = NULL;
+  FILE *f = NULL;
+  int fd = -1, created = 0, ret = -1;
+
+  order = malloc(sizeof(*order) * (count + 1));
+  ids = malloc(sizeof(size_t) * (count + 1));
+  names = malloc(sizeof(uint64_t) * (count + 1));
+  if (!order || !ids || !names) { goto cleanup; }
+
+  /* package ids follow name order so they can be looked up by name */
+  for (i = 0; i < count; i++) {
+    order[i].path = pkgnames[i];
+    order[i].id = i;
+  }
+  qsort(order, count, sizeof(*order), _pu_files_index_entry_cmp);
+  for (i = 0; i < count; i++) { ids[order[i].id] = i; }
+
+  for (i = 0; i < count; i++) {
+    nentries += filelists[i] ? filelists[i]->count : 0;
+  }
+  if ((entries = malloc(sizeof(*entries) * (nentries + 1))) == NULL) {
+    goto cleanup;
+  }
+  for (i = 0, nentries = 0; i < count; i++) {
+    for (j = 0; filelists[i] && j < filelists[i]->count; j++) {
+      entries[nentries].path = filelists[i]->files[j].name;
+      entries[nentries++].id = ids[i];
+    }
+  }
+  qsort(entries, nentries, sizeof(*entries), _pu_files_index_entry_cmp);
+  for (i = 0; i < nentries; i++) {
+    if (i == 0 || strcmp(entries[i].path, entries[i - 1].path) != 0) {
+      npaths++;
+    }
+  }
+  nblocks = (npaths + PU_FILES_INDEX_BLOCKSIZE - 1) / PU_FILES_INDEX_BLOCKSIZE;
+  if ((blocks = malloc(sizeof(uint64_t) * (nblocks + 1))) == NULL) {
+    goto cleanup;
+  }
+
+  base = sizeof(header) + sizeof(uint64_t) * (count + nblocks + 1);
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PU_FILES_INDEX_MAGIC, sizeof(header.magic));
+  header.version = PU_FILES_INDEX_VERSION;
+  header.byteorder = PU_FILES_INDEX_BYTEORDER;
+  if (st) {
+    header.db_size = st->st_size;
+    header.db_mtime = st->st_mtim.tv_sec;
+    header.db_mtime_nsec = st->st_mtim.tv_nsec;
+    header.db_ino = st->st_ino;
+  }
+  header.dbfile = base + data.len;
+  if (_pu_files_index_buf_add(&data, dbfile ? dbfile : "",
+          dbfile ? strlen(dbfile) + 1 : 1) != 0) {
+    goto cleanup;
+  }
+  header.pkgcount = count;
+  header.names = sizeof(header);
+  for (i = 0; i < count; i++) {
+    const char *name = order[i].path, *ver = pkgvers[order[i].id];
+    names[i] = base + data.len;
+    if (_pu_files_index_buf_add(&data, name, strlen(name) + 1) != 0
+        || _pu_files_index_buf_add(&data, ver, strlen(ver) + 1) != 0) {
+      goto cleanup;
+    }
+  }
+
+  header.pathcount = npaths;
+  header.blockcount = nblocks;
+  header.blocks = sizeof(header) + sizeof(uint64_t) * count;
+  for (i = 0, npaths = 0; i < nentries; npaths++) {
+    const char *p = entries[i].path, *prev = i ? entries[i - 1].path : NULL;
+    size_t shared = 0, len = strlen(p), owners = 0, last = 0;
+
+    if (npaths % PU_FILES_INDEX_BLOCKSIZE == 0) {
+      blocks[npaths / PU_FILES_INDEX_BLOCKSIZE] = base + data.len;
+    } else {
+      while (prev[shared] && prev[shared] == p[shared]) { shared++; }
+    }
+    for (j = i; j < nentries && strcmp(entries[j].path, p) == 0; j++) {
+      if (j == i || entries[j].id != entries[j - 1].id) { owners++; }
+    }
+    if (_pu_files_index_buf_add_varint(&data, shared) != 0
+        || _pu_files_index_buf_add_varint(&data, len - shared) != 0
+        || _pu_files_index_buf_add(&data, p + shared, len - shared) != 0
+        || _pu_files_index_buf_add_varint(&data, owners) != 0) {
+      goto cleanup;
+    }
+    for (k = i; k < j; k++) {
+      if (k > i && entries[k].id == entries[k - 1].id) { continue; }
+      if (_pu_files_index_buf_add_varint(&data, entries[k].id - last) != 0) {
+        goto cleanup;
+      }
+      last = entries[k].id;
+    }
+    i = j;
+  }
+  blocks[nblocks] = base + data.len;
+  header.size = base + data.len;
+
+  if ((tmppath = pu_asprintf("%s.XXXXXX", path)) == NULL
+      || (fd = mkstemp(tmppath)) == -1) {
+    goto cleanup;
+  }
+  created = 1;
+  if (fchmod(fd, 0644) != 0 || (f = fdopen(fd, "w")) == NULL) {
+    goto cleanup;
+  }
+  fd = -1;
+  if (fwrite(&header, sizeof(header), 1, f) != 1
+      || fwrite(names, sizeof(uint64_t), count, f) != count
+      || fwrite(blocks, sizeof(uint64_t), nblocks + 1, f) != nblocks + 1
+      || fwrite(data.data, 1, data.len, f) != data.len) {
+    goto cleanup;
+  }
+  if (fclose(f) != 0) {
+    f = NULL;
+    goto cleanup;
+  }
+  f = NULL;
+  if (rename(tmppath, path) != 0) { goto cleanup; }
+  ret = 0;
+
+cleanup:
+  if (f) { fclose(f); }
+  if (fd != -1) { close(fd); }
+  if (ret != 0 && created) {
+    int err = errno;
+    unlink(tmppath);
+    errno = err;
+  }
+  free(tmppath);
+  free(order);
+  free(ids);
+  free(names);
+  free(blocks);
+  free(entries);
+  free(data.data);
+  return ret;
+}
+
+/**
+ * @brief Write a file ownership index for a database.
+ *
+ * The database file is checked before the package file lists are loaded so
+ * that changes while the index is being written leave it out of date rather
+ * than silently incomplete.
+ *
+ * @param db database registered with file lists available
+ * @param dbfile path to the database file
+ * @param path index file to write, replaced atomically
+ *
+ * @return 0 on success, -1 on error
+ */
+int pu_files_index_write(alpm_db_t *db, const char *dbfile, const char *path) {
+  alpm_list_t *p, *pkgs;
+  const char **names = NULL, **vers = NULL;
+  alpm_filelist_t **filelists = NULL;
+  size_t count, i;
+  struct stat st;
+  int ret = -1;
+
+  if (stat(dbfile, &st) != 0) { return -1; }
+
+  pkgs = alpm_db_get_pkgcache(db);
+  count = alpm_list_count(pkgs);
+  names = malloc(sizeof(char *) * (count + 1));
+  vers = malloc(sizeof(char *) * (count + 1));
+  filelists = malloc(sizeof(alpm_filelist_t *) * (count + 1));
+  if (names && vers && filelists) {
+    for (i = 0, p = pkgs; p; p = p->next, i++) {
+      names[i] = alpm_pkg_get_name(p->data);
+      vers[i] = alpm_pkg_get_version(p->data);
+      filelists[i] = alpm_pkg_get_files(p->data);
+    }
+    ret = _pu_files_index_write(&st, dbfile, names, vers, filelists, count,
+            path);
+  }
+
+  free(names);
+  free(vers);
+  free(filelists);
+  return ret;
+}
+
+/**
+ * @brief Write a file ownership index from package file lists.
+ *
+ * @param dbfile path to the database file the lists were read from, may be
+ * NULL
+ * @param pkgnames unique package names
+ * @param pkgvers package versions, in the same order as pkgnames
+ * @param filelists file lists, in the same order as pkgnames
+ * @param count number of packages
+ * @param path index file to write, replaced atomically
+ *
+ * @return 0 on success, -1 on error
+ */
+int pu_files_index_write_filelists(const char *dbfile, const char **pkgnames,
+    const char **pkgvers, alpm_filelist_t **filelists, size_t count,
+    const char *path) {
+  struct stat st;
+  if (dbfile && stat(dbfile, &st) != 0) { return -1; }
+  return _pu_files_index_write(dbfile ? &st : NULL, dbfile, pkgnames,
+          pkgvers, filelists, count, path);
+}
+
+static int _pu_files_index_valid(pu_files_index_t *index) {
+  const struct _pu_files_index_header *h = index->_header;
+  size_t size = index->_mapsize, i;
+
+  if (memcmp(h->magic, PU_FILES_INDEX_MAGIC, sizeof(h->magic)) != 0
+      || h->version != PU_FILES_INDEX_VERSION
+      || h->byteorder != PU_FILES_INDEX_BYTEORDER
+      || h->size != size
+      || h->pkgcount > size / sizeof(uint64_t)
+      || h->blockcount > size / sizeof(uint64_t)
+      || h->names != sizeof(*h)
+      || h->blocks != h->names + sizeof(uint64_t) * h->pkgcount
+      || h->blocks + sizeof(uint64_t) * (h->blockcount + 1) > size
+      || h->dbfile >= size
+      || !memchr(index->_map + h->dbfile, '\0', size - h->dbfile)) {
+    return 0;
+  }
+  index->_names = (const uint64_t *) (index->_map + h->names);
+  index->_blocks = (const uint64_t *) (index->_map + h->blocks);
+  for (i = 0; i < h->pkgcount; i++) {
+    const unsigned char *end = index->_map + size, *ver;
+    if (index->_names[i] >= size
+        || (ver = memchr(index->_map + index->_names[i], '\0',
+                size - index->_names[i])) == NULL
+        || ++ver == end || !memchr(ver, '\0', end - ver)) {
+      return 0;
+    }
+  }
+  for (i = 0; i <= h->blockcount; i++) {
+    if (index->_blocks[i] > size
+        || (i && index->_blocks[i] < index->_blocks[i - 1])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * @brief Map a file ownership index into memory.
+ *
+ * @param path index file
+ *
+ * @return NULL on error, errno is set to EINVAL if the file is not a valid
+ * index
+ */
+pu_files_index_t *pu_files_index_open(const char *path) {
+  pu_files_index_t *index;
+  struct stat st;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) { return NULL; }
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return NULL;
+  }
+  if ((size_t) st.st_size < sizeof(struct _pu_files_index_header)) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+  if ((index = calloc(1, sizeof(pu_files_index_t))) == NULL) {
+    close(fd);
+    return NULL;
+  }
+  index->_mapsize = st.st_size;
+  index->_map = mmap(NULL, index->_mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (index->_map == MAP_FAILED) {
+    free(index);
+    return NULL;
+  }
+  index->_header = (const struct _pu_files_index_header *) index->_map;
+  if (!_pu_files_index_valid(index)) {
+    munmap(index->_map, index->_mapsize);
+    free(index);
+    errno = EINVAL;
+    return NULL;
+  }
+  index->pkgcount = index->_header->pkgcount;
+  index->pathcount = index->_header->pathcount;
+  index->_blockcount = index->_header->blockcount;
+  return index;
+}
+
+/**
+ * @brief Check whether an index was written from the current database.
+ *
+ * @param index
+ * @param dbfile path to the database file
+ *
+ * @return 1 if the database is unchanged, 0 if it has changed, -1 on error
+ */
+int pu_files_index_is_current(pu_files_index_t *index, const char *dbfile) {
+  const struct _pu_files_index_header *h = index->_header;
+  struct stat st;
+  if (stat(dbfile, &st) != 0) { return -1; }
+  return strcmp((const char *) index->_map + h->dbfile, dbfile) == 0
+      && h->db_size == (uint64_t) st.st_size
+      && h->db_mtime == (uint64_t) st.st_mtim.tv_sec
+      && h->db_mtime_nsec == (uint64_t) st.st_mtim.tv_nsec
+      && h->db_ino == (uint64_t) st.st_ino;
+}
+
+const char *pu_files_index_pkgname(pu_files_index_t *index, size_t id) {
+  if (id >= index->pkgcount) { return NULL; }
+  return (const char *) index->_map + index->_names[id];
+}
+
+/* the version is stored right after the name */
+const char *pu_files_index_pkgver(pu_files_index_t *index, size_t id) {
+  const char *name = pu_files_index_pkgname(index, id);
+  return name ? name + strlen(name) + 1 : NULL;
+}
+
+int pu_files_index_pkg_id(pu_files_index_t *index, const char *pkgname,
+    size_t *id) {
+  size_t lo = 0, hi = index->pkgcount;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(pkgname, pu_files_index_pkgname(index, mid));
+    if (cmp == 0) {
+      *id = mid;
+      return 0;
+    } else if (cmp < 0) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return -1;
+}
+
+static void _pu_files_index_seek(struct _pu_files_index_cursor *c,
+    size_t block) {
+  c->block = block;
+  c->pos = c->index->_map + c->index->_blocks[block];
+  c->end = c->index->_map + c->index->_blocks[block + 1];
+  c->len = 0;
+}
+
+/* decode the next path, returns 1 on success, 0 at the end of the index, and
+ * -1 if the index is corrupt */
+static int _pu_files_index_next(struct _pu_files_index_cursor *c) {
+  uint64_t shared, len, i, id;
+  while (c->pos == c->end) {
+    if (c->block + 1 >= c->index->_blockcount) { return 0; }
+    _pu_files_index_seek(c, c->block + 1);
+  }
+  if (_pu_files_index_varint(&c->pos, c->end, &shared) != 0
+      || _pu_files_index_varint(&c->pos, c->end, &len) != 0
+      || shared > c->len || len > (uint64_t) (c->end - c->pos)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (shared + len + 1 > c->size) {
+    size_t newsize = shared + len + 256;
+    char *newpath = realloc(c->path, newsize);
+    if (newpath == NULL) { return -1; }
+    c->path = newpath;
+    c->size = newsize;
+  }
+  memcpy(c->path + shared, c->pos, len);
+  c->pos += len;
+  c->len = shared + len;
+  c->path[c->len] = '\0';
+
+  if (_pu_files_index_varint(&c->pos, c->end, &c->npostings) != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  c->postings = c->pos;
+  for (i = 0; i < c->npostings; i++) {
+    if (_pu_files_index_varint(&c->pos, c->end, &id) != 0) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+  return 1;
+}
+
+static int _pu_files_index_add_owners(struct _pu_files_index_cursor *c,
+    pu_bitmap_t *owners) {
+  const unsigned char *pos = c->postings;
+  uint64_t i, delta, id = 0;
+  for (i = 0; i < c->npostings; i++) {
+    _pu_files_index_varint(&pos, c->end, &delta);
+    id += delta;
+    if (id >= c->index->pkgcount || id >= owners->nbits) {
+      errno = EINVAL;
+      return -1;
+    }
+    pu_bitmap_set(owners, id);
+  }
+  return 0;
+}
+
+/* compare the first path of a block */
+static int _pu_files_index_block_cmp(pu_files_index_t *index, size_t block,
+    const char *path) {
+  const unsigned char *pos = index->_map + index->_blocks[block];
+  const unsigned char *end = index->_map + index->_blocks[block + 1];
+  size_t pathlen = strlen(path);
+  uint64_t shared, len;
+  int cmp;
+  if (_pu_files_index_varint(&pos, end, &shared) != 0
+      || _pu_files_index_varint(&pos, end, &len) != 0
+      || len > (uint64_t) (end - pos)) {
+    return 1; /* corruption is caught when the block is decoded */
+  }
+  cmp = memcmp(pos, path, len < pathlen ? len : pathlen);
+  if (cmp) { return cmp; }
+  return len < pathlen ? -1 : len > pathlen;
+}
+
+/* position a cursor at the last block starting at or before path */
+static void _pu_files_index_search(struct _pu_files_index_cursor *c,
+    const char *path) {
+  size_t lo = 0, hi = c->index->_blockcount;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (_pu_files_index_block_cmp(c->index, mid, path) <= 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  _pu_files_index_seek(c, lo ? lo - 1 : 0);
+}
+
+/**
+ * @brief Find the packages that own a path.
+ *
+ * @param index
+ * @param path path relative to the root, as stored in package file lists
+ * @param owners bitmap of at least index->pkgcount bits, the bits for
+ * owning packages are set
+ *
+ * @return 0 on success, -1 on error
+ */
+int pu_files_index_find(pu_files_index_t *index, const char *path,
+    pu_bitmap_t *owners) {
+  struct _pu_files_index_cursor c = { .index = index };
+  int ret = 0, cmp = -1, r = 0;
+  if (index->_blockcount == 0) { return 0; }
+  _pu_files_index_search(&c, path);
+  while (cmp < 0 && (r = _pu_files_index_next(&c)) == 1) {
+    if ((cmp = strcmp(c.path, path)) == 0) {
+      ret = _pu_files_index_add_owners(&c, owners);
+    }
+  }
+  if (r == -1) { ret = -1; }
+  free(c.path);
+  return ret;
+}
+
+/**
+ * @brief Find the packages that own paths starting with a prefix.
+ *
+ * @param index
+ * @param prefix
+ * @param owners bitmap of at least index->pkgcount bits, the bits for
+ * owning packages are set
+ *
+ * @return 0 on success, -1 on error
+ */
+int pu_files_index_find_prefix(pu_files_index_t *index, const char *prefix,
+    pu_bitmap_t *owners) {
+  struct _pu_files_index_cursor c = { .index = index };
+  size_t prefixlen = strlen(prefix);
+  int ret = 0, r;
+  if (index->_blockcount == 0) { return 0; }
+  _pu_files_index_search(&c, prefix);
+  while ((r = _pu_files_index_next(&c)) == 1) {
+    int cmp = strncmp(c.path, prefix, prefixlen);
+    if (cmp > 0) { break; }
+    if (cmp == 0 && _pu_files_index_add_owners(&c, owners) != 0) {
+      ret = -1;
+      break;
+    }
+  }
+  if (r == -1) { ret = -1; }
+  free(c.path);
+  return ret;
+}
+
+/**
+ * @brief Find the packages that own paths accepted by a callback.
+ *
+ * Every path in the index is checked, each only once regardless of how
+ * many packages own it.
+ *
+ * @param index
+ * @param match callback returning non-zero for matching paths
+ * @param ctx passed to match
+ * @param owners bitmap of at least index->pkgcount bits, the bits for
+ * owning packages are set
+ *
+ * @return 0 on success, -1 on error
+ */
+int pu_files_index_match(pu_files_index_t *index,
+    int (*match)(const char *path, void *ctx), void *ctx,
+    pu_bitmap_t *owners) {
+  struct _pu_files_index_cursor c = { .index = index };
+  int ret = 0, r;
+  if (index->_blockcount == 0) { return 0; }
+  _pu_files_index_seek(&c, 0);
+  while ((r = _pu_files_index_next(&c)) == 1) {
+    if (match(c.path, ctx) && _pu_files_index_add_owners(&c, owners) != 0) {
+      ret = -1;
+      break;
+    }
+  }
+  if (r == -1) { ret = -1; }
+  free(c.path);
+  return ret;
+}
+
+void pu_files_index_close(pu_files_index_t *index) {
+  if (index == NULL) { return; }
+  munmap(index->_map, index->_mapsize);
+  free(index);
+}
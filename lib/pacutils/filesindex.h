@@ -0,0 +1,65 @@
+/*
+ * Copyright 2012-2020 Andrew Gregory <andrew.gregory.8@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef PACUTILS_FILESINDEX_H
+#define PACUTILS_FILESINDEX_H
+
+#include <stdint.h>
+
+#include <alpm.h>
+
+#include "bitmap.h"
+
+/* read-only, memory-mapped index of the files owned by the packages in a
+ * database; packages are identified by their position in name order */
+typedef struct pu_files_index_t {
+  size_t pkgcount;
+  size_t pathcount;
+
+  unsigned char *_map;
+  size_t _mapsize;
+  const struct _pu_files_index_header *_header;
+  const uint64_t *_names;      /* package name offsets */
+  const uint64_t *_blocks;     /* path block offsets */
+  size_t _blockcount;
+} pu_files_index_t;
+
+int pu_files_index_write(alpm_db_t *db, const char *dbfile, const char *path);
+int pu_files_index_write_filelists(const char *dbfile, const char **pkgnames,
+    const char **pkgvers, alpm_filelist_t **filelists, size_t count,
+    const char *path);
+
+pu_files_index_t *pu_files_index_open(const char *path);
+int pu_files_index_is_current(pu_files_index_t *index, const char *dbfile);
+const char *pu_files_index_pkgname(pu_files_index_t *index, size_t id);
+const char *pu_files_index_pkgver(pu_files_index_t *index, size_t id);
+int pu_files_index_pkg_id(pu_files_index_t *index, const char *pkgname,
+    size_t *id);
+int pu_files_index_find(pu_files_index_t *index, const char *path,
+    pu_bitmap_t *owners);
+int pu_files_index_find_prefix(pu_files_index_t *index, const char *prefix,
+    pu_bitmap_t *owners);
+int pu_files_index_match(pu_files_index_t *index,
+    int (*match)(const char *path, void *ctx), void *ctx, pu_bitmap_t *owners);
+void pu_files_index_close(pu_files_index_t *index);
+
+#endif /* PACUTILS_FILESINDEX_H */
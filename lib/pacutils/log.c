@@ -20,7 +20,7 @@
  * IN THE SOFTWARE.
  */
 
-#define _XOPEN_SOURCE 700 /* strptime/strndup */
+#define _XOPEN_SOURCE 700 /* strndup */
 
 #include <errno.h>
 #include <stdio.h>
@@ -151,107 +151,266 @@ pu_log_reader_t *pu_log_reader_open_stream(FILE *stream) {
 void pu_log_reader_free(pu_log_reader_t *p) {
   if (p == NULL) { return; }
   if (p->_close_stream) { fclose(p->stream); }
+  free(p->_buf);
   free(p);
 }
 
-char *_pu_log_parse_iso8601(const char *buf, pu_log_timestamp_t *ts) {
-  int negative = 0;
-  int gmtofflen = 4;
-  char *p = strptime(buf, "[%Y-%m-%dT%H:%M:%S", &ts->tm);
-  if (p == NULL || (*p != '-' && *p != '+')) { return NULL; }
-  negative = *(p++) == '-';
-  ts->gmtoff = 0;
-  while (*p && gmtofflen--) {
-    ts->gmtoff = (ts->gmtoff * 10) + (*(p++) - '0');
+#define PU_ISDIGIT(c) ((unsigned char) ((c) - '0') <= 9)
+#define PU_2DIGIT(p) (((p)[0] - '0') * 10 + ((p)[1] - '0'))
+
+/* Parse a timestamp in one of the two fixed layouts written by pacman:
+ *   [YYYY-MM-DD HH:MM]
+ *   [YYYY-MM-DDTHH:MM:SS+hhmm]
+ * Returns a pointer just past the closing bracket, or NULL if buf does not
+ * begin with a valid timestamp. */
+char *_pu_log_parse_timestamp(const char *buf, const char *end,
+    pu_log_timestamp_t *ts) {
+  const char *p = buf;
+  struct tm *tm = &ts->tm;
+  int year;
+
+  /* bail out on non-timestamp lines as early as possible */
+  if (end - p < 18 || p[0] != '[') { return NULL; }
+  if (!PU_ISDIGIT(p[1]) || !PU_ISDIGIT(p[2])
+      || !PU_ISDIGIT(p[3]) || !PU_ISDIGIT(p[4]) || p[5] != '-'
+      || !PU_ISDIGIT(p[6]) || !PU_ISDIGIT(p[7]) || p[8] != '-'
+      || !PU_ISDIGIT(p[9]) || !PU_ISDIGIT(p[10])
+      || (p[11] != ' ' && p[11] != 'T')
+      || !PU_ISDIGIT(p[12]) || !PU_ISDIGIT(p[13]) || p[14] != ':'
+      || !PU_ISDIGIT(p[15]) || !PU_ISDIGIT(p[16])) {
+    return NULL;
+  }
+
+  memset(tm, 0, sizeof(struct tm));
+  year = PU_2DIGIT(p + 1) * 100 + PU_2DIGIT(p + 3);
+  tm->tm_year = year - 1900;
+  tm->tm_mon = PU_2DIGIT(p + 6) - 1;
+  tm->tm_mday = PU_2DIGIT(p + 9);
+  tm->tm_hour = PU_2DIGIT(p + 12);
+  tm->tm_min = PU_2DIGIT(p + 15);
+  tm->tm_isdst = -1;
+  if (tm->tm_mon < 0 || tm->tm_mon > 11 || tm->tm_mday < 1
+      || tm->tm_mday > 31 || tm->tm_hour > 23 || tm->tm_min > 59) {
+    return NULL;
+  }
+
+  if (p[11] == ' ') {
+    if (p[17] != ']') { return NULL; }
+    ts->has_seconds = 0;
+    ts->has_gmtoff = 0;
+    ts->gmtoff = 0;
+    return (char *) p + 18;
+  }
+
+  if (end - p < 26 || p[17] != ':'
+      || !PU_ISDIGIT(p[18]) || !PU_ISDIGIT(p[19])
+      || (p[20] != '+' && p[20] != '-')
+      || !PU_ISDIGIT(p[21]) || !PU_ISDIGIT(p[22])
+      || !PU_ISDIGIT(p[23]) || !PU_ISDIGIT(p[24]) || p[25] != ']') {
+    return NULL;
   }
-  if (gmtofflen != -1 || *p != ']') { return NULL; }
+  tm->tm_sec = PU_2DIGIT(p + 18);
+  if (tm->tm_sec > 61) { return NULL; }
 
+  ts->gmtoff = PU_2DIGIT(p + 21) * 100 + PU_2DIGIT(p + 23);
+  if (p[20] == '-') { ts->gmtoff *= -1; }
   ts->has_seconds = 1;
   ts->has_gmtoff = 1;
-  if (negative) {
-    ts->gmtoff *= -1 ;
+
+  return (char *) p + 26;
+}
+
+#undef PU_2DIGIT
+#undef PU_ISDIGIT
+
+#define PU_LOG_BUFSIZE (64 * 1024)
+
+/* Discard consumed data and read more from the stream, growing the buffer if
+ * less than a quarter of it is free.  One byte is always kept free so that
+ * the final line can be NUL-terminated.  Returns the number of bytes read, 0
+ * at eof, and -1 on error. */
+static ssize_t _pu_log_reader_fill(pu_log_reader_t *r) {
+  size_t n;
+
+  if (r->_start > 0) {
+    memmove(r->_buf, r->_buf + r->_start, r->_end - r->_start);
+    r->_end -= r->_start;
+    if (r->_next) { r->_next -= r->_start; }
+    r->_start = 0;
+  }
+
+  if (r->_end + 1 + r->_buflen / 4 > r->_buflen) {
+    size_t newlen = r->_buflen ? r->_buflen * 2 : PU_LOG_BUFSIZE;
+    char *newbuf = realloc(r->_buf, newlen);
+    if (newbuf == NULL) { errno = ENOMEM; return -1; }
+    r->_buf = newbuf;
+    r->_buflen = newlen;
   }
 
-  return p + 1;
+  n = fread(r->_buf + r->_end, 1, r->_buflen - r->_end - 1, r->stream);
+  r->_end += n;
+  if (n == 0 && ferror(r->stream)) { return -1; }
+  return n;
 }
 
-char *_pu_log_parse_timestamp(const char *buf, pu_log_timestamp_t *ts) {
-  char *p;
+/* Find the end of the line starting at pos.  Offsets are relative to
+ * r->_start, which may move as more data is read.  Sets *eol to the offset
+ * of the line's newline, or the end of data for a final unterminated line.
+ * Returns 1 if a line was found, 0 at eof, and -1 on error. */
+static int _pu_log_reader_line(pu_log_reader_t *r, size_t pos, size_t *eol) {
+  while (1) {
+    size_t avail = r->_end - r->_start;
+    const char *nl;
+    ssize_t n;
+
+    if (pos < avail
+        && (nl = memchr(r->_buf + r->_start + pos, '\n', avail - pos))) {
+      *eol = nl - (r->_buf + r->_start);
+      return 1;
+    }
+
+    if ((n = _pu_log_reader_fill(r)) < 0) {
+      return -1;
+    } else if (n == 0) {
+      if (pos < r->_end - r->_start) {
+        *eol = r->_end - r->_start;
+        return 1;
+      }
+      return 0;
+    }
+  }
+}
+
+/* Parse the timestamp at the start of a line and convert it to a time_t.
+ * Log entries arrive in order, so mktime() is only called once per hour of
+ * log and the result reused for the minutes and seconds within it. */
+static char *_pu_log_reader_parse_timestamp(pu_log_reader_t *r,
+    size_t pos, size_t eol, pu_log_timestamp_t *ts) {
+  char *line = r->_buf + r->_start + pos, *end = r->_buf + r->_start + eol;
   struct tm *tm = &ts->tm;
+  long key;
+  char *p;
 
-  if ((p = strptime(buf, "[%Y-%m-%d %H:%M]", tm))) {
-    ts->has_seconds = 0;
-    ts->has_gmtoff = 0;
-    ts->gmtoff = 0;
-    ts->tm.tm_isdst = -1;
-    return p;
-  } else if ((p = _pu_log_parse_iso8601(buf, ts))) {
-    ts->tm.tm_isdst = -1;
-    return p;
+  if ((p = _pu_log_parse_timestamp(line, end, ts)) == NULL) { return NULL; }
+
+  key = (((long) tm->tm_year * 12 + tm->tm_mon) * 32 + tm->tm_mday) * 24
+    + tm->tm_hour + 1;
+  if (key != r->_time_key) {
+    struct tm hour = *tm, next;
+    hour.tm_min = 0;
+    hour.tm_sec = 0;
+    next = hour;
+    next.tm_hour++;
+    r->_time_key = key;
+    r->_time_base = mktime(&hour);
+    /* hours containing a utc offset change are converted per entry */
+    if (r->_time_base != (time_t) -1 && mktime(&next) - r->_time_base != 3600) {
+      r->_time_base = (time_t) -1;
+    }
+  }
+  if (r->_time_base == (time_t) -1) {
+    struct tm tmp = *tm;
+    ts->time = mktime(&tmp);
+  } else {
+    ts->time = r->_time_base + tm->tm_min * 60 + tm->tm_sec;
   }
 
-  return NULL;
+  return p;
 }
 
-pu_log_entry_t *pu_log_reader_next(pu_log_reader_t *reader) {
-  char *p, *c;
-  pu_log_entry_t *entry = calloc(1, sizeof(pu_log_entry_t));
-
-  if (entry == NULL) { errno = ENOMEM; return NULL; }
+/**
+ * @brief Read the next log entry without copying it.
+ *
+ * The returned entry and its caller/message strings point into the reader's
+ * buffer and are only valid until the next call or until the reader is freed.
+ * Use pu_log_entry_copy() to keep an entry.
+ *
+ * @param reader log reader
+ *
+ * @return entry owned by the reader, NULL on eof or error
+ */
+pu_log_entry_t *pu_log_reader_next_view(pu_log_reader_t *reader) {
+  pu_log_entry_t *entry = &reader->_entry;
+  size_t msg, eol, pos, caller = 0, callerend = 0;
+  char *buf, *p;
+  int ret;
 
   if (reader->_next) {
-    memcpy(&entry->timestamp, &reader->_next_ts, sizeof(pu_log_timestamp_t));
-    p = reader->_next;
-  } else if (fgets(reader->_buf, 256, reader->stream) == NULL) {
-    free(entry);
-    reader->eof = feof(reader->stream);
+    entry->timestamp = reader->_next_ts;
+    msg = reader->_next - reader->_start;
+    reader->_next = 0;
+    if (_pu_log_reader_line(reader, msg, &eol) != 1) {
+      eol = msg;
+    }
+  } else if ((ret = _pu_log_reader_line(reader, 0, &eol)) != 1) {
+    reader->eof = (ret == 0);
     return NULL;
-  } else if (!(p = _pu_log_parse_timestamp(reader->_buf, &entry->timestamp))) {
-    free(entry);
+  } else if ((p = _pu_log_reader_parse_timestamp(reader, 0, eol,
+              &entry->timestamp)) == NULL) {
     errno = EINVAL;
     return NULL;
+  } else {
+    msg = p - (reader->_buf + reader->_start);
   }
 
-  if (p[0] == ' ' && p[1] == '[' && (c = strstr(p + 2, "] "))) {
-    entry->caller = strndup(p + 2, c - (p + 2));
-    p += strlen(entry->caller) + 4;
-  } else {
+  buf = reader->_buf + reader->_start;
+  if (msg + 1 < eol && buf[msg] == ' ' && buf[msg + 1] == '[') {
+    for (pos = msg + 2; pos + 1 < eol; pos++) {
+      if (buf[pos] == ']' && buf[pos + 1] == ' ') {
+        caller = msg + 2;
+        callerend = pos;
+        msg = pos + 2;
+        break;
+      }
+    }
+  }
+  if (!callerend && reader->_start + msg < reader->_end) {
     /* old style entries without caller information */
-    p += 1;
+    msg += 1;
   }
 
-  entry->message = strdup(p);
-
-  while ((reader->_next = fgets(reader->_buf, 256, reader->stream)) != NULL) {
-    if ((p = _pu_log_parse_timestamp(reader->_buf, &reader->_next_ts)) == NULL) {
-      size_t oldlen = strlen(entry->message);
-      size_t newlen = oldlen + strlen(reader->_buf) + 1;
-      char *newmessage = realloc(entry->message, newlen);
-      if (oldlen > newlen || newmessage == NULL) {
-        free(entry);
-        reader->_next = NULL;
-        errno = ENOMEM;
-        return NULL;
-      }
-      entry->message = newmessage;
-      strcpy(entry->message + oldlen, reader->_buf);
-    } else {
-      reader->_next = p;
+  /* append continuation lines until the next timestamp */
+  pos = eol < reader->_end - reader->_start ? eol + 1 : eol;
+  while ((ret = _pu_log_reader_line(reader, pos, &eol)) == 1) {
+    if ((p = _pu_log_reader_parse_timestamp(reader, pos, eol,
+                &reader->_next_ts)) != NULL) {
+      reader->_next = p - reader->_buf;
       break;
     }
+    pos = eol < reader->_end - reader->_start ? eol + 1 : eol;
+  }
+  if (ret < 0) { return NULL; }
+
+  /* entry spans [_start, _start + pos); the byte at pos is either free space
+   * or the '[' of the next entry's already parsed timestamp */
+  buf = reader->_buf + reader->_start;
+  buf[pos] = '\0';
+  if (callerend) {
+    buf[callerend] = '\0';
+    entry->caller = buf + caller;
+  } else {
+    entry->caller = NULL;
   }
+  entry->message = buf + msg;
+  reader->_start += pos;
 
   return entry;
 }
 
+pu_log_entry_t *pu_log_reader_next(pu_log_reader_t *reader) {
+  pu_log_entry_t *entry = pu_log_reader_next_view(reader);
+  return entry ? pu_log_entry_copy(entry) : NULL;
+}
+
 alpm_list_t *pu_log_parse_file(FILE *stream) {
   pu_log_reader_t *reader = pu_log_reader_open_stream(stream);
   pu_log_entry_t *entry;
   alpm_list_t *entries = NULL;
+  if (reader == NULL) { return NULL; }
   while ((entry = pu_log_reader_next(reader))) {
     entries = alpm_list_add(entries, entry);
   }
-  free(reader);
+  pu_log_reader_free(reader);
   return entries;
 }
 
@@ -279,6 +438,26 @@ pu_log_transaction_status_t pu_log_transaction_parse(const char *message) {
   return 0;
 }
 
+/**
+ * @brief Copy an entry, e.g. one returned by pu_log_reader_next_view().
+ *
+ * @param entry entry to copy
+ *
+ * @return new entry to be freed with pu_log_entry_free(), NULL on error
+ */
+pu_log_entry_t *pu_log_entry_copy(const pu_log_entry_t *entry) {
+  pu_log_entry_t *copy = calloc(1, sizeof(pu_log_entry_t));
+  if (copy == NULL) { errno = ENOMEM; return NULL; }
+  copy->timestamp = entry->timestamp;
+  if ((entry->caller && (copy->caller = strdup(entry->caller)) == NULL)
+      || (copy->message = strdup(entry->message)) == NULL) {
+    pu_log_entry_free(copy);
+    errno = ENOMEM;
+    return NULL;
+  }
+  return copy;
+}
+
 void pu_log_entry_free(pu_log_entry_t *entry) {
   if (!entry) { return; }
   free(entry->caller);
@@ -48,6 +48,7 @@ typedef struct {
   int gmtoff;
   unsigned int has_seconds: 1;
   unsigned int has_gmtoff: 1;
+  time_t time; /* tm as local time, as returned by mktime() */
 } pu_log_timestamp_t;
 
 typedef struct {
@@ -72,20 +73,28 @@ typedef struct {
   FILE *stream;
   int eof;
 
-  char _buf[256];    /* read buffer */
-  char *_next;       /* next line indicator */
+  char *_buf;        /* read buffer */
+  size_t _buflen;    /* read buffer size */
+  size_t _start;     /* offset of the first unconsumed line */
+  size_t _end;       /* offset of the end of buffered data */
+  size_t _next;      /* offset of the next entry's caller/message, or 0 */
   int _close_stream; /* close stream on free */
   pu_log_timestamp_t _next_ts;
+  long _time_key;    /* hour of the last mktime() conversion */
+  time_t _time_base; /* mktime() result for _time_key */
+  pu_log_entry_t _entry; /* entry returned by pu_log_reader_next_view */
 } pu_log_reader_t;
 
 pu_log_transaction_status_t pu_log_transaction_parse(const char *message);
 
 int pu_log_fprint_entry(FILE *stream, pu_log_entry_t *entry);
 pu_log_entry_t *pu_log_reader_next(pu_log_reader_t *reader);
+pu_log_entry_t *pu_log_reader_next_view(pu_log_reader_t *reader);
 pu_log_reader_t *pu_log_reader_open_stream(FILE *stream);
 pu_log_reader_t *pu_log_reader_open_file(const char *path);
 void pu_log_reader_free(pu_log_reader_t *p);
 alpm_list_t *pu_log_parse_file(FILE *stream);
+pu_log_entry_t *pu_log_entry_copy(const pu_log_entry_t *entry);
 void pu_log_entry_free(pu_log_entry_t *entry);
 
 pu_log_action_t *pu_log_action_parse(const char *message);
@@ -20,8 +20,11 @@
  * IN THE SOFTWARE.
  */
 
+#include <errno.h>
 #include <limits.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include <archive.h>
 
@@ -59,6 +62,7 @@ pu_mtree_t *pu_mtree_new(void) {
 void pu_mtree_free(pu_mtree_t *mtree) {
   if (mtree) {
     free(mtree->path);
+    free(mtree->link);
     free(mtree);
   }
 }
@@ -66,6 +70,7 @@ void pu_mtree_free(pu_mtree_t *mtree) {
 void pu_mtree_reader_free(pu_mtree_reader_t *reader) {
   if (reader == NULL) { return; }
   if (reader->_close_stream) { fclose(reader->stream); }
+  if (reader->_archive) { archive_read_free(reader->_archive); }
   free(reader->_buf);
   free(reader->_stream_buf);
   free(reader);
@@ -85,136 +90,386 @@ pu_mtree_reader_t *pu_mtree_reader_open_file(const char *path) {
   return r;
 }
 
+/* takes ownership of an archive positioned at its first entry */
+static pu_mtree_reader_t *_pu_mtree_reader_open_archive(struct archive *a) {
+  pu_mtree_reader_t *r = calloc(1, sizeof(pu_mtree_reader_t));
+  if (r == NULL) { archive_read_free(a); return NULL; }
+  r->_archive = a;
+  return r;
+}
+
 pu_mtree_reader_t *pu_mtree_reader_open_package( alpm_handle_t *h,
     alpm_pkg_t *p) {
-  pu_mtree_reader_t *reader;
   struct archive *mtree;
   char path[PATH_MAX];
   struct archive_entry *entry = NULL;
-  char *buf, rbuf[256];
-  size_t len;
-  FILE *fbuf;
   const char *dbpath = alpm_option_get_dbpath(h);
   const char *pkgname = alpm_pkg_get_name(p);
   const char *pkgver = alpm_pkg_get_version(p);
 
-  if ((fbuf = open_memstream(&buf, &len)) == NULL) { return NULL; }
-
-  sprintf(path, "%slocal/%s-%s/mtree", dbpath, pkgname, pkgver);
+  snprintf(path, PATH_MAX, "%slocal/%s-%s/mtree", dbpath, pkgname, pkgver);
 
   if ((mtree = archive_read_new()) == NULL) { return NULL; }
   archive_read_support_filter_all(mtree);
   archive_read_support_format_raw(mtree);
-  if (archive_read_open_filename(mtree, path, 64) != ARCHIVE_OK) {
+  if (archive_read_open_filename(mtree, path, 16384) != ARCHIVE_OK
+      || archive_read_next_header(mtree, &entry) != ARCHIVE_OK) {
+    errno = archive_errno(mtree) ? archive_errno(mtree) : EINVAL;
     archive_read_free(mtree);
     return NULL;
   }
 
-  if (archive_read_next_header(mtree, &entry) != ARCHIVE_OK) {
-    archive_read_free(mtree);
-    return NULL;
+  return _pu_mtree_reader_open_archive(mtree);
+}
+
+static int _pu_mtree_buf_append(pu_mtree_reader_t *reader, size_t off,
+    const char *data, size_t len) {
+  if (off + len + 1 > reader->_buflen) {
+    size_t newlen = reader->_buflen ? reader->_buflen : 256;
+    char *newbuf;
+    while (off + len + 1 > newlen) { newlen *= 2; }
+    if ((newbuf = realloc(reader->_buf, newlen)) == NULL) { return -1; }
+    reader->_buf = newbuf;
+    reader->_buflen = newlen;
   }
+  memcpy(reader->_buf + off, data, len);
+  return 0;
+}
 
-  while (1) {
-    ssize_t size;
-    while ((size = archive_read_data(mtree, rbuf, 256)) == ARCHIVE_RETRY);
-    if (size < 0) { fclose(fbuf); free(buf); return NULL; }
-    if (size == 0) { break; }
-    fwrite(rbuf, size, 1, fbuf);
+/* Sets [*line, *end) to the next line, without its newline.  Lines that lie
+ * entirely within a data block are returned directly from libarchive's
+ * buffer; only lines spanning blocks are copied into the line buffer.
+ * Returns 1 on success, 0 on eof, and -1 on error. */
+static int _pu_mtree_reader_getline(pu_mtree_reader_t *reader,
+    const char **line, const char **end) {
+  size_t buffered = 0;
+
+  if (reader->_archive == NULL) {
+    ssize_t len = getline(&reader->_buf, &reader->_buflen, reader->stream);
+    if (len == -1) {
+      reader->eof = feof(reader->stream);
+      return reader->eof ? 0 : -1;
+    }
+    if (len > 0 && reader->_buf[len - 1] == '\n') { len--; }
+    *line = reader->_buf;
+    *end = reader->_buf + len;
+    return 1;
   }
-  archive_read_free(mtree);
-  fclose(fbuf);
 
-  if ((fbuf = fmemopen(buf, len, "r")) == NULL) {
-    free(buf);
-    return NULL;
-  } else if ((reader = pu_mtree_reader_open_stream(fbuf)) == NULL) {
-    free(buf);
-    fclose(fbuf);
-    return NULL;
-  } else {
-    reader->_stream_buf = buf;
-    reader->_close_stream = 1;
-    return reader;
+  while (1) {
+    const char *nl;
+
+    if (reader->_blocklen == 0) {
+      const void *block;
+      size_t size;
+      la_int64_t offset;
+      int ret;
+
+      while ((ret = archive_read_data_block(reader->_archive,
+                  &block, &size, &offset)) == ARCHIVE_RETRY);
+      if (ret == ARCHIVE_EOF) {
+        if (buffered == 0) { reader->eof = 1; return 0; }
+        *line = reader->_buf;
+        *end = reader->_buf + buffered;
+        return 1;
+      } else if (ret < ARCHIVE_WARN) {
+        errno = archive_errno(reader->_archive);
+        return -1;
+      }
+      reader->_block = block;
+      reader->_blocklen = size;
+      continue;
+    }
+
+    if ((nl = memchr(reader->_block, '\n', reader->_blocklen)) == NULL) {
+      if (_pu_mtree_buf_append(reader, buffered,
+              reader->_block, reader->_blocklen) != 0) {
+        return -1;
+      }
+      buffered += reader->_blocklen;
+      reader->_blocklen = 0;
+      continue;
+    }
+
+    if (buffered == 0) {
+      *line = reader->_block;
+      *end = nl;
+    } else {
+      if (_pu_mtree_buf_append(reader, buffered,
+              reader->_block, nl - reader->_block) != 0) {
+        return -1;
+      }
+      buffered += nl - reader->_block;
+      *line = reader->_buf;
+      *end = reader->_buf + buffered;
+    }
+    reader->_blocklen -= nl + 1 - reader->_block;
+    reader->_block = nl + 1;
+    return 1;
   }
 }
 
-static char *_pu_mtree_path(const char *mpath, const char *end) {
-  char oct[4], *path = malloc(end - mpath), *c = path;
-  if (mpath[0] == '.' && mpath[1] == '/') { mpath += 2; }
-  oct[3] = '\0';
+/* decode an mtree path or link target into dest, which must hold at least
+ * end - mpath + 1 bytes */
+static void _pu_mtree_unescape(char *dest, const char *mpath, const char *end) {
   while (mpath < end) {
     if (*mpath == '\\' && mpath + 3 < end) {
-      strncpy(oct, mpath + 1, 3);
-      *(c++) = (int) strtol(oct, NULL, 8);
+      int i, val = 0;
+      for (i = 1; i <= 3 && mpath[i] >= '0' && mpath[i] <= '7'; i++) {
+        val = val * 8 + (mpath[i] - '0');
+      }
+      *(dest++) = (char) val;
       mpath += 4;
     } else {
-      *(c++) = *mpath;
-      mpath++;
+      *(dest++) = *(mpath++);
     }
   }
-  *c = '\0';
-  return path;
+  *dest = '\0';
+}
+
+static long long _pu_mtree_strtoll(const char *c, const char *end, int base) {
+  long long val = 0;
+  int neg = 0;
+  if (c < end && (*c == '-' || *c == '+')) { neg = (*c == '-'); c++; }
+  for (; c < end && *c >= '0' && *c < '0' + base; c++) {
+    val = val * base + (*c - '0');
+  }
+  return neg ? -val : val;
+}
+
+static void _pu_mtree_strcpy(char *dest, size_t size,
+    const char *src, const char *end) {
+  size_t len = end - src;
+  if (len >= size) { len = size - 1; }
+  memcpy(dest, src, len);
+  dest[len] = '\0';
 }
 
+#define _PU_MTREE_FIELD(f, s) \
+  (vallen == sizeof(s) - 1 && memcmp(f, s, sizeof(s) - 1) == 0)
+
+/* link targets are decoded into *linkbuf, which is reallocated as needed,
+ * or ignored if linkbuf is NULL */
+static int _pu_mtree_parse_fields(pu_mtree_t *entry, char **linkbuf,
+    const char *c, const char *end) {
+  while (c < end) {
+    const char *field, *val, *vend;
+    size_t vallen;
+
+    while (c < end && pu_iscspace((unsigned char)*c)) { c++; }
+    field = c;
+    while (c < end && !pu_iscspace((unsigned char)*c)) { c++; }
+    vend = c;
+
+    if ((val = memchr(field, '=', vend - field)) == NULL) { continue; }
+    vallen = val - field;
+    val++;
+
+    if (_PU_MTREE_FIELD(field, "type")) {
+      _pu_mtree_strcpy(entry->type, sizeof(entry->type), val, vend);
+    } else if (_PU_MTREE_FIELD(field, "uid")) {
+      entry->uid = _pu_mtree_strtoll(val, vend, 10);
+    } else if (_PU_MTREE_FIELD(field, "gid")) {
+      entry->gid = _pu_mtree_strtoll(val, vend, 10);
+    } else if (_PU_MTREE_FIELD(field, "mode")) {
+      entry->mode = _pu_mtree_strtoll(val, vend, 8);
+    } else if (_PU_MTREE_FIELD(field, "time")) {
+      entry->mtime = _pu_mtree_strtoll(val, vend, 10);
+    } else if (_PU_MTREE_FIELD(field, "link") && linkbuf) {
+      char *link = realloc(*linkbuf, vend - val + 1);
+      if (link == NULL) { return -1; }
+      _pu_mtree_unescape(link, val, vend);
+      entry->link = *linkbuf = link;
+    } else if (_PU_MTREE_FIELD(field, "size")) {
+      entry->size = _pu_mtree_strtoll(val, vend, 10);
+    } else if (_PU_MTREE_FIELD(field, "md5digest")) {
+      _pu_mtree_strcpy(entry->md5digest, sizeof(entry->md5digest), val, vend);
+    } else if (_PU_MTREE_FIELD(field, "sha256digest")) {
+      _pu_mtree_strcpy(entry->sha256digest, sizeof(entry->sha256digest),
+          val, vend);
+    } else {
+      /* ignore unknown fields */
+    }
+  }
+  return 0;
+}
+
+#undef _PU_MTREE_FIELD
+
 pu_mtree_t *pu_mtree_reader_next(pu_mtree_reader_t *reader, pu_mtree_t *dest) {
-  ssize_t len;
-  char *saveptr, *c;
-  pu_mtree_t *entry = dest;
-
-  len = getline(&reader->_buf, &reader->_buflen, reader->stream);
-  if (len == -1) { reader->eof = feof(reader->stream); return NULL; }
-  if (reader->_buf[len - 1] == '\n') { reader->_buf[len - 1] = '\0'; }
-
-  c = reader->_buf;
-  while (pu_iscspace((unsigned char)*c)) { c++; }
-
-  if (c[0] == '#') {
-    return pu_mtree_reader_next(reader, dest);
-  } else if (strncmp(c, "/set ", 5) == 0) {
-    entry = &reader->defaults;
-    c += 5;
-  } else {
-    char *sep = c, *path;
-    while (*sep && !pu_iscspace((unsigned char)*sep)) { sep++; }
-    if ((path = _pu_mtree_path(c, sep)) == NULL) { return NULL; }
-    if (entry) {
-      free(entry->path);
-    } else if ((entry = malloc(sizeof(pu_mtree_t))) == NULL) {
-      free(path);
+  const char *c, *end;
+
+  while (_pu_mtree_reader_getline(reader, &c, &end) == 1) {
+    const char *sep;
+    pu_mtree_t *entry = dest;
+    char *path, *link;
+
+    while (c < end && pu_iscspace((unsigned char)*c)) { c++; }
+
+    if (c == end || c[0] == '#') {
+      continue;
+    } else if (end - c >= 5 && memcmp(c, "/set ", 5) == 0) {
+      if (_pu_mtree_parse_fields(&reader->defaults, NULL, c + 5, end) != 0) {
+        return NULL;
+      }
+      continue;
+    }
+
+    sep = c;
+    while (sep < end && !pu_iscspace((unsigned char)*sep)) { sep++; }
+
+    /* reuse the caller's path and link allocations rather than allocating
+     * per entry */
+    if ((path = realloc(entry ? entry->path : NULL, sep - c + 1)) == NULL) {
       return NULL;
     }
+    if (entry == NULL) {
+      if ((entry = malloc(sizeof(pu_mtree_t))) == NULL) {
+        free(path);
+        return NULL;
+      }
+      entry->link = NULL;
+    }
+    link = entry->link;
     memcpy(entry, &reader->defaults, sizeof(pu_mtree_t));
     entry->path = path;
-    c = sep;
+    entry->link = NULL;
+    if (c[0] == '.' && c + 1 < sep && c[1] == '/') { c += 2; }
+    _pu_mtree_unescape(entry->path, c, sep);
+    if (_pu_mtree_parse_fields(entry, &link, sep, end) != 0) {
+      entry->link = link;
+      if (entry != dest) { pu_mtree_free(entry); }
+      return NULL;
+    }
+    if (entry->link == NULL) { free(link); }
+
+    return entry;
   }
 
-  for (c = strtok_r(c, " ", &saveptr); c; c = strtok_r(NULL, " ", &saveptr)) {
-    char *field = c, *val = strchr(field, '=');
-    if (val == NULL) { continue; }
-    *(val++) = '\0';
-    if (strcmp(field, "type") == 0) {
-      strcpy(entry->type, val);
-    } else if (strcmp(field, "uid") == 0) {
-      entry->uid = atoi(val);
-    } else if (strcmp(field, "gid") == 0) {
-      entry->gid = atoi(val);
-    } else if (strcmp(field, "mode") == 0) {
-      entry->mode = strtol(val, NULL, 8);
-    } else if (strcmp(field, "size") == 0) {
-      entry->size = strtol(val, NULL, 10);
-    } else if (strcmp(field, "md5digest") == 0) {
-      strcpy(entry->md5digest, val);
-    } else if (strcmp(field, "sha256digest") == 0) {
-      strcpy(entry->sha256digest, val);
-    } else {
-      /* ignore unknown fields */
+  return NULL;
+}
+
+mode_t pu_mtree_filetype(const pu_mtree_t *mtree) {
+  const char *type = mtree->type;
+  if (strcmp(type, "file") == 0) {
+    return S_IFREG;
+  } else if (strcmp(type, "dir") == 0) {
+    return S_IFDIR;
+  } else if (strcmp(type, "link") == 0) {
+    return S_IFLNK;
+  } else if (strcmp(type, "block") == 0) {
+    return S_IFBLK;
+  } else if (strcmp(type, "char") == 0) {
+    return S_IFCHR;
+  } else if (strcmp(type, "fifo") == 0) {
+    return S_IFIFO;
+  } else if (strcmp(type, "socket") == 0) {
+    return S_IFSOCK;
+  } else {
+    return 0;
+  }
+}
+
+static int _pu_mtree_entry_cmp(const void *e1, const void *e2) {
+  return strcmp(((const pu_mtree_t *) e1)->path,
+          ((const pu_mtree_t *) e2)->path);
+}
+
+/* compare as though repeated and trailing '/' had been removed from needle,
+ * consistent with the strcmp ordering of the (normalized) mtree paths */
+static int _pu_mtree_index_cmp(const void *needle, const void *entry) {
+  const unsigned char *p1 = needle;
+  const unsigned char *p2 = (const void *) ((const pu_mtree_t *) entry)->path;
+  while (1) {
+    int c1 = *p1;
+    if (c1 == '/') {
+      while (p1[1] == '/') { p1++; }
+      if (p1[1] == '\0') { c1 = '\0'; }
     }
+    if (c1 != *p2 || c1 == '\0') { return c1 - *p2; }
+    p1++;
+    p2++;
   }
+}
+
+/**
+ * @brief Read all remaining entries from an mtree reader into a path-sorted
+ * index.
+ *
+ * @param reader mtree reader, not freed
+ *
+ * @return new index, NULL on error
+ */
+pu_mtree_index_t *pu_mtree_index_new(pu_mtree_reader_t *reader) {
+  pu_mtree_index_t *index = calloc(1, sizeof(pu_mtree_index_t));
+  size_t size = 0;
 
-  if (entry == &reader->defaults) {
-    return pu_mtree_reader_next(reader, dest);
+  if (index == NULL) { return NULL; }
+
+  while (1) {
+    if (index->count == size) {
+      size_t newsize = size ? size * 2 : 64;
+      pu_mtree_t *newentries = realloc(index->entries,
+              newsize * sizeof(pu_mtree_t));
+      if (newentries == NULL) { goto error; }
+      memset(newentries + size, 0, (newsize - size) * sizeof(pu_mtree_t));
+      index->entries = newentries;
+      size = newsize;
+    }
+    if (pu_mtree_reader_next(reader, &index->entries[index->count]) == NULL) {
+      break;
+    }
+    index->count++;
   }
+  if (!reader->eof) { goto error; }
+
+  /* the unused slot may hold a path allocation from the failed read */
+  free(index->entries[index->count].path);
+  free(index->entries[index->count].link);
+
+  qsort(index->entries, index->count, sizeof(pu_mtree_t), _pu_mtree_entry_cmp);
+
+  return index;
+
+error:
+  index->count = size;
+  pu_mtree_index_free(index);
+  return NULL;
+}
 
-  return entry;
+pu_mtree_index_t *pu_mtree_index_load_package(alpm_handle_t *h,
+    alpm_pkg_t *p) {
+  pu_mtree_reader_t *reader;
+  pu_mtree_index_t *index;
+  if ((reader = pu_mtree_reader_open_package(h, p)) == NULL) { return NULL; }
+  index = pu_mtree_index_new(reader);
+  pu_mtree_reader_free(reader);
+  return index;
+}
+
+/**
+ * @brief Find an entry by path.
+ *
+ * @param index mtree index
+ * @param path path relative to the package root, repeated and trailing '/'
+ * are ignored
+ *
+ * @return matching entry, NULL if not found
+ */
+pu_mtree_t *pu_mtree_index_find(pu_mtree_index_t *index, const char *path) {
+  if (index == NULL || path == NULL) { return NULL; }
+  if (path[0] == '.' && path[1] == '/') { path += 2; }
+  return bsearch(path, index->entries, index->count, sizeof(pu_mtree_t),
+          _pu_mtree_index_cmp);
+}
+
+void pu_mtree_index_free(pu_mtree_index_t *index) {
+  size_t i;
+  if (index == NULL) { return; }
+  for (i = 0; i < index->count; i++) {
+    free(index->entries[i].path);
+    free(index->entries[i].link);
+  }
+  free(index->entries);
+  free(index);
 }
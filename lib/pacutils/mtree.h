@@ -34,6 +34,8 @@ typedef struct pu_mtree_t {
   off_t size;
   char md5digest[33];
   char sha256digest[65];
+  time_t mtime;
+  char *link;
 } pu_mtree_t;
 
 typedef struct {
@@ -45,8 +47,18 @@ typedef struct {
   size_t _buflen;    /* line buffer length */
   char *_stream_buf; /* buffer for in-memory streams */
   int _close_stream; /* close stream on free */
+
+  struct archive *_archive; /* package mtree, read in place */
+  const char *_block;       /* unparsed portion of the current data block */
+  size_t _blocklen;         /* unparsed data block length */
 } pu_mtree_reader_t;
 
+/* path-sorted mtree entries for repeated lookups */
+typedef struct {
+  pu_mtree_t *entries;
+  size_t count;
+} pu_mtree_index_t;
+
 __attribute__((__deprecated__))
 alpm_list_t *pu_mtree_load_pkg_mtree(alpm_handle_t *handle, alpm_pkg_t *pkg);
 
@@ -58,5 +70,12 @@ pu_mtree_t *pu_mtree_reader_next(pu_mtree_reader_t *reader, pu_mtree_t *dest);
 pu_mtree_t *pu_mtree_new(void);
 void pu_mtree_reader_free(pu_mtree_reader_t *reader);
 void pu_mtree_free(pu_mtree_t *mtree);
+mode_t pu_mtree_filetype(const pu_mtree_t *mtree);
+
+pu_mtree_index_t *pu_mtree_index_new(pu_mtree_reader_t *reader);
+pu_mtree_index_t *pu_mtree_index_load_package(alpm_handle_t *h,
+    alpm_pkg_t *p);
+pu_mtree_t *pu_mtree_index_find(pu_mtree_index_t *index, const char *path);
+void pu_mtree_index_free(pu_mtree_index_t *index);
 
 #endif /* PACUTILS_MTREE_H */
@@ -0,0 +1,356 @@
+/*
+ * Copyright 2012-2020 Andrew Gregory <andrew.gregory.8@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE /* AT_STATX_SYNC_AS_STAT, struct statx */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+/* IORING_OP_STATX is an enum value, IORING_FEAT_RW_CUR_POS was added to the
+ * headers in the same kernel release */
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(__NR_io_uring_setup)
+#define PU_STAT_URING
+#endif
+#endif
+#endif
+
+#include "statbatch.h"
+
+/* io_uring requests in flight at once */
+#define PU_STAT_DEPTH 256
+/* default number of fallback threads, and the number of entries each claims
+ * at a time */
+#define PU_STAT_THREADS 16
+#define PU_STAT_CHUNK 32
+/* smaller batches are not worth setting up a ring or threads for */
+#define PU_STAT_MIN_BATCH 8
+
+/* err value of entries that have not been handled yet */
+#define PU_STAT_PENDING -1
+
+static void _pu_lstat_entry(pu_lstat_entry_t *e) {
+  e->err = lstat(e->path, &e->st) == 0 ? 0 : errno;
+}
+
+struct _pu_stat_pool {
+  pthread_mutex_t lock;
+  pu_lstat_entry_t *entries;
+  size_t count, next;
+};
+
+static void *_pu_lstat_worker(void *arg) {
+  struct _pu_stat_pool *pool = arg;
+
+  while (1) {
+    size_t i, end;
+
+    pthread_mutex_lock(&pool->lock);
+    i = pool->next;
+    end = pool->next = i + PU_STAT_CHUNK < pool->count
+      ? i + PU_STAT_CHUNK : pool->count;
+    pthread_mutex_unlock(&pool->lock);
+    if (i == end) { break; }
+
+    for (; i < end; i++) {
+      if (pool->entries[i].err == PU_STAT_PENDING) {
+        _pu_lstat_entry(&pool->entries[i]);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/* lstat any pending entries on a pool of up to maxthreads threads, including
+ * the calling one */
+static void _pu_lstat_batch_pool(pu_lstat_entry_t *entries, size_t count,
+    unsigned int maxthreads) {
+  struct _pu_stat_pool pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .entries = entries,
+    .count = count,
+  };
+  pthread_t threads[PU_STAT_THREADS];
+  size_t n, nthreads = 0;
+
+  if (maxthreads > PU_STAT_THREADS) { maxthreads = PU_STAT_THREADS; }
+  while (nthreads + 1 < maxthreads
+      && (nthreads + 1) * PU_STAT_CHUNK < count
+      && pthread_create(&threads[nthreads], NULL,
+        _pu_lstat_worker, &pool) == 0) {
+    nthreads++;
+  }
+  /* help out, or do all of the work if no threads could be started */
+  _pu_lstat_worker(&pool);
+
+  for (n = 0; n < nthreads; n++) {
+    pthread_join(threads[n], NULL);
+  }
+  pthread_mutex_destroy(&pool.lock);
+}
+
+#ifdef PU_STAT_URING
+
+struct _pu_stat_ring {
+  int fd;
+  unsigned char *sqring, *cqring;
+  size_t sqringsize, cqringsize;
+  struct io_uring_sqe *sqes;
+  size_t sqessize;
+  unsigned int *sqhead, *sqtail, *sqmask, *sqarray;
+  unsigned int *cqhead, *cqtail, *cqmask;
+  struct io_uring_cqe *cqes;
+};
+
+static void _pu_stat_ring_close(struct _pu_stat_ring *r) {
+  if (r == NULL) { return; }
+  if (r->sqes) { munmap(r->sqes, r->sqessize); }
+  if (r->cqring && r->cqring != r->sqring) { munmap(r->cqring, r->cqringsize); }
+  if (r->sqring) { munmap(r->sqring, r->sqringsize); }
+  close(r->fd);
+  free(r);
+}
+
+static struct _pu_stat_ring *_pu_stat_ring_open(unsigned int depth) {
+  struct _pu_stat_ring *r;
+  struct io_uring_params p;
+
+  if ((r = calloc(1, sizeof(*r))) == NULL) { return NULL; }
+  memset(&p, 0, sizeof(p));
+  if ((r->fd = syscall(__NR_io_uring_setup, depth, &p)) < 0) {
+    free(r);
+    return NULL;
+  }
+
+  r->sqringsize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  r->cqringsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (r->cqringsize > r->sqringsize) { r->sqringsize = r->cqringsize; }
+    r->cqringsize = r->sqringsize;
+  }
+  r->sqessize = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  r->sqring = mmap(NULL, r->sqringsize, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  if (r->sqring == MAP_FAILED) { r->sqring = NULL; goto error; }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    r->cqring = r->sqring;
+  } else {
+    r->cqring = mmap(NULL, r->cqringsize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    if (r->cqring == MAP_FAILED) { r->cqring = NULL; goto error; }
+  }
+  r->sqes = mmap(NULL, r->sqessize, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED) { r->sqes = NULL; goto error; }
+
+  r->sqhead = (unsigned int *) (r->sqring + p.sq_off.head);
+  r->sqtail = (unsigned int *) (r->sqring + p.sq_off.tail);
+  r->sqmask = (unsigned int *) (r->sqring + p.sq_off.ring_mask);
+  r->sqarray = (unsigned int *) (r->sqring + p.sq_off.array);
+  r->cqhead = (unsigned int *) (r->cqring + p.cq_off.head);
+  r->cqtail = (unsigned int *) (r->cqring + p.cq_off.tail);
+  r->cqmask = (unsigned int *) (r->cqring + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *) (r->cqring + p.cq_off.cqes);
+
+  return r;
+
+error:
+  _pu_stat_ring_close(r);
+  return NULL;
+}
+
+static void _pu_statx_to_stat(const struct statx *stx, struct stat *st) {
+  memset(st, 0, sizeof(*st));
+  st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+  st->st_ino = stx->stx_ino;
+  st->st_mode = stx->stx_mode;
+  st->st_nlink = stx->stx_nlink;
+  st->st_uid = stx->stx_uid;
+  st->st_gid = stx->stx_gid;
+  st->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+  st->st_size = stx->stx_size;
+  st->st_blksize = stx->stx_blksize;
+  st->st_blocks = stx->stx_blocks;
+  st->st_atim.tv_sec = stx->stx_atime.tv_sec;
+  st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+  st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+  st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+  st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+  st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+/* statx as many entries as possible through the batch's ring, which is set
+ * up on first use; entries that could not be handled, including all of them
+ * if the kernel does not support io_uring or IORING_OP_STATX, are left
+ * pending */
+static void _pu_lstat_batch_uring(pu_stat_batch_t *batch,
+    pu_lstat_entry_t *entries, size_t count) {
+  struct _pu_stat_ring *r;
+  struct statx *stx;
+  size_t base;
+
+  if (batch->_uring == 0) {
+    batch->_uring = -1;
+    if ((batch->_stx = calloc(PU_STAT_DEPTH, sizeof(struct statx))) == NULL
+        || (batch->_ring = _pu_stat_ring_open(PU_STAT_DEPTH)) == NULL) {
+      return;
+    }
+    batch->_uring = 1;
+  }
+  if (batch->_uring != 1) { return; }
+  r = batch->_ring;
+  stx = batch->_stx;
+
+  for (base = 0; base < count; base += PU_STAT_DEPTH) {
+    unsigned int n, i, tail, submitted = 0, done = 0;
+
+    n = count - base < PU_STAT_DEPTH ? count - base : PU_STAT_DEPTH;
+
+    tail = *r->sqtail;
+    for (i = 0; i < n; i++) {
+      unsigned int idx = (tail + i) & *r->sqmask;
+      struct io_uring_sqe *sqe = &r->sqes[idx];
+
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_STATX;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = (unsigned long) entries[base + i].path;
+      sqe->len = STATX_BASIC_STATS;
+      sqe->off = (unsigned long) &stx[i];
+      sqe->statx_flags = AT_SYMLINK_NOFOLLOW | AT_STATX_SYNC_AS_STAT;
+      sqe->user_data = i;
+      r->sqarray[idx] = idx;
+    }
+    __atomic_store_n(r->sqtail, tail + n, __ATOMIC_RELEASE);
+
+    while (done < n) {
+      unsigned int head, cqtail;
+      long ret = syscall(__NR_io_uring_enter, r->fd, n - submitted, 1,
+          IORING_ENTER_GETEVENTS, NULL, 0);
+
+      if (ret < 0) {
+        if (errno == EINTR) { continue; }
+        /* outstanding requests are cancelled when the ring is closed, leave
+         * the buffers in place in case the kernel is still using them */
+        batch->_stx = NULL;
+        _pu_stat_ring_close(r);
+        batch->_ring = NULL;
+        batch->_uring = -1;
+        return;
+      }
+      submitted += ret;
+
+      head = *r->cqhead;
+      cqtail = __atomic_load_n(r->cqtail, __ATOMIC_ACQUIRE);
+      for (; head != cqtail; head++) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cqmask];
+        pu_lstat_entry_t *e = &entries[base + cqe->user_data];
+
+        if (cqe->res == 0) {
+          _pu_statx_to_stat(&stx[cqe->user_data], &e->st);
+          e->err = 0;
+        } else if (cqe->res != -EINVAL && cqe->res != -EOPNOTSUPP
+            && cqe->res != -EAGAIN && cqe->res != -EINTR) {
+          e->err = -cqe->res;
+        }
+        done++;
+      }
+      __atomic_store_n(r->cqhead, head, __ATOMIC_RELEASE);
+    }
+  }
+}
+
+#endif /* PU_STAT_URING */
+
+/**
+ * @brief Create a context for batches of lstat calls.
+ *
+ * The io_uring used to submit requests is set up on the first batch large
+ * enough to need it and reused for the rest.  A context must only be used
+ * by one thread at a time.
+ *
+ * @param threads maximum number of threads, including the calling one, to
+ * lstat with where io_uring is not available, 0 for the default; callers
+ * that already run in parallel should pass 1
+ *
+ * @return NULL on error
+ */
+pu_stat_batch_t *pu_stat_batch_new(unsigned int threads) {
+  pu_stat_batch_t *batch = calloc(1, sizeof(pu_stat_batch_t));
+  if (batch == NULL) { return NULL; }
+  batch->threads = threads ? threads : PU_STAT_THREADS;
+  /* the thread pool can be forced for testing */
+  if (getenv("PACUTILS_DISABLE_IO_URING") != NULL) { batch->_uring = -1; }
+  return batch;
+}
+
+/**
+ * @brief lstat a batch of paths with many requests in flight at once.
+ *
+ * Requests are submitted together through io_uring where available, falling
+ * back to a pool of threads.  Results are stored in each entry's st and err
+ * fields; entries are filled in no particular order.
+ *
+ * @param batch context from pu_stat_batch_new, NULL to lstat each entry in
+ * turn
+ * @param entries entries with path set
+ * @param count number of entries
+ */
+void pu_lstat_batch(pu_stat_batch_t *batch, pu_lstat_entry_t *entries,
+    size_t count) {
+  size_t i;
+
+  if (batch == NULL || count < PU_STAT_MIN_BATCH) {
+    for (i = 0; i < count; i++) { _pu_lstat_entry(&entries[i]); }
+    return;
+  }
+
+  for (i = 0; i < count; i++) { entries[i].err = PU_STAT_PENDING; }
+#ifdef PU_STAT_URING
+  _pu_lstat_batch_uring(batch, entries, count);
+#endif
+  for (i = 0; i < count && entries[i].err != PU_STAT_PENDING; i++);
+  if (i < count) {
+    _pu_lstat_batch_pool(entries + i, count - i, batch->threads);
+  }
+}
+
+void pu_stat_batch_free(pu_stat_batch_t *batch) {
+  if (batch == NULL) { return; }
+#ifdef PU_STAT_URING
+  _pu_stat_ring_close(batch->_ring);
+#endif
+  free(batch->_stx);
+  free(batch);
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2012-2020 Andrew Gregory <andrew.gregory.8@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef PACUTILS_STATBATCH_H
+#define PACUTILS_STATBATCH_H
+
+#include <sys/stat.h>
+
+typedef struct pu_lstat_entry_t {
+  const char *path;
+  struct stat st;
+  int err;          /* 0 on success, otherwise the errno from lstat */
+} pu_lstat_entry_t;
+
+/* reusable state for batches of lstat calls, each thread needs its own */
+typedef struct pu_stat_batch_t {
+  unsigned int threads; /* fallback threads, including the caller's */
+
+  struct _pu_stat_ring *_ring;
+  struct statx *_stx;
+  int _uring;           /* 0 if not tried yet, -1 if unavailable */
+} pu_stat_batch_t;
+
+pu_stat_batch_t *pu_stat_batch_new(unsigned int threads);
+void pu_lstat_batch(pu_stat_batch_t *batch, pu_lstat_entry_t *entries,
+    size_t count);
+void pu_stat_batch_free(pu_stat_batch_t *batch);
+
+#endif /* PACUTILS_STATBATCH_H */
@@ -0,0 +1,304 @@
+/*
+ * Copyright 2012-2020 Andrew Gregory <andrew.gregory.8@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "strmatch.h"
+
+#define NONE SIZE_MAX
+
+static unsigned char _pu_strmatch_fold(unsigned char c) {
+  return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static int _pu_strmatch_add_state(pu_strmatch_t *m) {
+  if (m->_states == m->_size) {
+    size_t newsize = m->_size ? m->_size * 2 : 64;
+    uint32_t *next = realloc(m->_next, sizeof(uint32_t) * 256 * newsize);
+    size_t *out;
+    if (next == NULL) { return -1; }
+    m->_next = next;
+    if ((out = realloc(m->_out, sizeof(size_t) * newsize)) == NULL) {
+      return -1;
+    }
+    m->_out = out;
+    m->_size = newsize;
+  }
+  memset(m->_next + 256 * m->_states, 0, sizeof(uint32_t) * 256);
+  m->_out[m->_states] = NONE;
+  return m->_states++;
+}
+
+pu_strmatch_t *pu_strmatch_new(void) {
+  pu_strmatch_t *m = calloc(1, sizeof(pu_strmatch_t));
+  if (m == NULL) { return NULL; }
+  if (_pu_strmatch_add_state(m) == -1) {
+    pu_strmatch_free(m);
+    return NULL;
+  }
+  return m;
+}
+
+/**
+ * @brief Add a pattern to search for.
+ *
+ * @param matcher matcher that has not been compiled yet
+ * @param pattern
+ *
+ * @return pattern id, -1 on error
+ */
+int pu_strmatch_add(pu_strmatch_t *m, const char *pattern) {
+  const unsigned char *c = (const unsigned char *) pattern;
+  size_t state = 0, *samenode;
+  if (m->_compiled) {
+    errno = EINVAL;
+    return -1;
+  }
+  for (; *c; c++) {
+    uint32_t *next = &m->_next[state * 256 + _pu_strmatch_fold(*c)];
+    if (*next == 0) {
+      int new = _pu_strmatch_add_state(m);
+      if (new == -1) { return -1; }
+      next = &m->_next[state * 256 + _pu_strmatch_fold(*c)];
+      *next = new;
+    }
+    state = *next;
+  }
+  if ((samenode = realloc(m->_samenode,
+              sizeof(size_t) * (m->count + 1))) == NULL) {
+    return -1;
+  }
+  m->_samenode = samenode;
+  m->_samenode[m->count] = m->_out[state];
+  m->_out[state] = m->count;
+  return m->count++;
+}
+
+/**
+ * @brief Build the automaton once all patterns have been added.
+ *
+ * @param matcher
+ *
+ * @return 0 on success, -1 on error
+ */
+int pu_strmatch_compile(pu_strmatch_t *m) {
+  uint32_t *queue;
+  size_t head = 0, tail = 0, c;
+
+  m->_fail = calloc(m->_states, sizeof(uint32_t));
+  m->_dict = calloc(m->_states, sizeof(uint32_t));
+  queue = malloc(sizeof(uint32_t) * m->_states);
+  if (!m->_fail || !m->_dict || !queue) {
+    free(queue);
+    return -1;
+  }
+
+  /* breadth-first, so failure states are complete before they are used;
+   * missing transitions are filled in from the failure state so matching
+   * never needs to follow failure links */
+  for (c = 0; c < 256; c++) {
+    if (m->_next[c]) { queue[tail++] = m->_next[c]; }
+  }
+  while (head < tail) {
+    uint32_t state = queue[head++], fail = m->_fail[state];
+    m->_dict[state] = m->_out[fail] != NONE ? fail : m->_dict[fail];
+    for (c = 0; c < 256; c++) {
+      uint32_t *next = &m->_next[state * 256 + c];
+      if (*next) {
+        m->_fail[*next] = m->_next[fail * 256 + c];
+        queue[tail++] = *next;
+      } else {
+        *next = m->_next[fail * 256 + c];
+      }
+    }
+  }
+
+  free(queue);
+  m->_compiled = 1;
+  return 0;
+}
+
+/**
+ * @brief Check whether any pattern occurs in a string.
+ *
+ * @param matcher compiled matcher
+ * @param text
+ *
+ * @return 1 if a pattern was found, 0 otherwise
+ */
+int pu_strmatch_search(pu_strmatch_t *m, const char *text) {
+  const unsigned char *c = (const unsigned char *) text;
+  uint32_t state = 0;
+  if (m->_out[0] != NONE) { return 1; } /* empty pattern */
+  for (; *c; c++) {
+    state = m->_next[state * 256 + _pu_strmatch_fold(*c)];
+    if (m->_out[state] != NONE || m->_dict[state]) { return 1; }
+  }
+  return 0;
+}
+
+/**
+ * @brief Find every pattern that occurs in a string.
+ *
+ * @param matcher compiled matcher
+ * @param text
+ * @param hits bitmap of at least matcher->count bits, the bits of patterns
+ * found are set
+ */
+void pu_strmatch_scan(pu_strmatch_t *m, const char *text, pu_bitmap_t *hits) {
+  const unsigned char *c = (const unsigned char *) text;
+  uint32_t state = 0, s;
+  size_t id;
+  for (id = m->_out[0]; id != NONE; id = m->_samenode[id]) {
+    pu_bitmap_set(hits, id);
+  }
+  for (; *c; c++) {
+    state = m->_next[state * 256 + _pu_strmatch_fold(*c)];
+    for (s = m->_out[state] != NONE ? state : m->_dict[state]; s;
+        s = m->_dict[s]) {
+      for (id = m->_out[s]; id != NONE; id = m->_samenode[id]) {
+        pu_bitmap_set(hits, id);
+      }
+    }
+  }
+}
+
+/**
+ * @brief Find a string that every match of a regex must contain.
+ *
+ * Used to filter candidates for regexec with a substring search.  Errs
+ * towards shorter literals for constructs it does not parse, so anything the
+ * regex matches always contains the result.
+ *
+ * @param regex POSIX extended regular expression, as understood by glibc
+ *
+ * @return longest literal found, NULL if there is none or on error
+ */
+char *pu_regex_literal(const char *regex) {
+  const char *c;
+  char *run, *best = NULL;
+  size_t len = 0, bestlen = 0;
+  int depth = 0;
+
+  if ((run = malloc(strlen(regex) + 1)) == NULL) { return NULL; }
+
+#define end_run() do { \
+    if (len > bestlen) { \
+      free(best); \
+      best = strndup(run, len); \
+      bestlen = len; \
+    } \
+    len = 0; \
+  } while (0)
+
+  for (c = regex; *c; c++) {
+    switch (*c) {
+      case '|':
+        if (depth == 0) {
+          /* alternatives share no required literal */
+          free(run);
+          free(best);
+          return NULL;
+        }
+        break;
+      case '(':
+        end_run();
+        depth++;
+        break;
+      case ')':
+        if (depth) {
+          depth--;
+        } else {
+          run[len++] = *c; /* unmatched, glibc takes it literally */
+        }
+        break;
+      case '[':
+        end_run();
+        c++;
+        if (*c == '^') { c++; }
+        if (*c == ']') { c++; }
+        for (; *c && *c != ']'; c++) {
+          if (*c == '[' && (c[1] == ':' || c[1] == '.' || c[1] == '=')) {
+            const char close = c[1];
+            for (c += 2; *c && !(c[0] == close && c[1] == ']'); c++);
+            if (*c) { c++; }
+          }
+        }
+        if (*c == '\0') { c--; }
+        break;
+      case '*':
+      case '?':
+        if (len) { len--; }
+        end_run();
+        break;
+      case '{':
+        if (len) { len--; }
+        end_run();
+        for (; c[1] && *c != '}'; c++);
+        break;
+      case '+':
+        if (len && c[1] && strchr("*+?{", c[1])) { len--; } /* stacked */
+        end_run();
+        break;
+      case '.':
+      case '^':
+      case '$':
+        end_run();
+        break;
+      case '\\':
+        if (c[1] == '\0') {
+          end_run();
+        } else if (isalnum((unsigned char) c[1]) || strchr("<>`'", c[1])) {
+          /* GNU extensions like \w, \< and back-references */
+          end_run();
+          c++;
+        } else if (depth == 0) {
+          run[len++] = *++c;
+        } else {
+          c++;
+        }
+        break;
+      default:
+        if (depth == 0) { run[len++] = *c; }
+        break;
+    }
+  }
+  end_run();
+
+#undef end_run
+
+  free(run);
+  return best;
+}
+
+void pu_strmatch_free(pu_strmatch_t *m) {
+  if (m == NULL) { return; }
+  free(m->_next);
+  free(m->_fail);
+  free(m->_dict);
+  free(m->_out);
+  free(m->_samenode);
+  free(m);
+}
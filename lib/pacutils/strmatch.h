@@ -0,0 +1,57 @@
+/*
+ * Copyright 2012-2020 Andrew Gregory <andrew.gregory.8@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef PACUTILS_STRMATCH_H
+#define PACUTILS_STRMATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bitmap.h"
+
+/* case-insensitive (ASCII) search for any number of substrings in a single
+ * pass over the text, using an Aho-Corasick automaton; patterns are
+ * identified by the order they were added in */
+typedef struct pu_strmatch_t {
+  size_t count;
+
+  uint32_t *_next;    /* 256 transitions per state */
+  uint32_t *_fail;
+  uint32_t *_dict;    /* nearest suffix state with matches */
+  size_t *_out;       /* first pattern ending at each state */
+  size_t *_samenode;  /* next pattern ending at the same state */
+  size_t _states;
+  size_t _size;
+  int _compiled;
+} pu_strmatch_t;
+
+pu_strmatch_t *pu_strmatch_new(void);
+int pu_strmatch_add(pu_strmatch_t *matcher, const char *pattern);
+int pu_strmatch_compile(pu_strmatch_t *matcher);
+int pu_strmatch_search(pu_strmatch_t *matcher, const char *text);
+void pu_strmatch_scan(pu_strmatch_t *matcher, const char *text,
+    pu_bitmap_t *hits);
+void pu_strmatch_free(pu_strmatch_t *matcher);
+
+char *pu_regex_literal(const char *regex);
+
+#endif /* PACUTILS_STRMATCH_H */
@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -73,6 +74,16 @@ void *_pu_list_shift(alpm_list_t **list) {
   return data;
 }
 
+/* sdbm string hash for internal lookup tables */
+unsigned long _pu_hash_sdbm(const char *str) {
+  unsigned long hash = 0;
+  int c;
+  while ((c = (unsigned char) *str++)) {
+    hash = c + (hash << 6) + (hash << 16) - hash;
+  }
+  return hash;
+}
+
 struct tm *pu_parse_datetime(const char *string, struct tm *stm) {
   const char *c, *end;
   memset(stm, 0, sizeof(struct tm));
@@ -180,6 +191,50 @@ int pu_prepend_dir_list(const char *dir, alpm_list_t *paths) {
   return 0;
 }
 
+static int _pu_mkdirs(char *path) {
+  char *c;
+  for (c = path; *c; c++) {
+    if (*c == '/' && c != path) {
+      *c = '\0';
+      if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        *c = '/';
+        return -1;
+      }
+      *c = '/';
+    }
+  }
+  return mkdir(path, 0755) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+/**
+ * @brief Get the directory to keep indexes in, creating it if necessary.
+ *
+ * @param dir directory to use, NULL for $XDG_CACHE_HOME/pacutils or
+ * ~/.cache/pacutils
+ *
+ * @return directory path, NULL on error
+ */
+char *pu_index_dir(const char *dir) {
+  const char *cachehome = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+  char *path = NULL;
+  if (dir) {
+    path = strdup(dir);
+  } else if (cachehome && cachehome[0]) {
+    path = pu_asprintf("%s/pacutils", cachehome);
+  } else if (home && home[0]) {
+    path = pu_asprintf("%s/.cache/pacutils", home);
+  } else {
+    errno = ENOENT;
+  }
+  if (path && _pu_mkdirs(path) != 0) {
+    int err = errno;
+    free(path);
+    errno = err;
+    return NULL;
+  }
+  return path;
+}
+
 FILE *pu_fopenat(int dirfd, const char *path, const char *mode) {
   int fd, flags = 0, rwflag = 0;
   FILE *stream;
@@ -35,6 +35,7 @@ char *pu_hr_size(off_t bytes, char *dest);
 struct tm *pu_parse_datetime(const char *string, struct tm *stm);
 
 void *_pu_list_shift(alpm_list_t **list);
+unsigned long _pu_hash_sdbm(const char *str);
 alpm_list_t *pu_list_append_str(alpm_list_t **list, const char *str);
 
 char *pu_vasprintf(const char *fmt, va_list args);
@@ -42,6 +43,7 @@ char *pu_asprintf(const char *fmt, ...);
 
 char *pu_prepend_dir(const char *dir, const char *path);
 int pu_prepend_dir_list(const char *dir, alpm_list_t *paths);
+char *pu_index_dir(const char *dir);
 
 FILE *pu_fopenat(int dirfd, const char *path, const char *mode);
 
@@ -0,0 +1,352 @@
+/*
+ * Copyright 2012-2020 Andrew Gregory <andrew.gregory.8@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <alpm.h>
+
+#include "util.h"
+#include "version.h"
+
+enum _pu_version_part {
+  _PU_VERSION_EPOCH,
+  _PU_VERSION_VERSION,
+  _PU_VERSION_RELEASE,
+};
+
+/* classes of the character following a segment, see _pu_version_part_cmp */
+enum _pu_version_class {
+  _PU_VERSION_END,
+  _PU_VERSION_ALPHA,
+  _PU_VERSION_OTHER,
+};
+
+/* split into alternating runs of digits or letters, separated by anything
+ * else; counts the segments if segs is NULL */
+static size_t _pu_version_tokenize(const char *p, const char *end,
+    pu_version_seg_t *segs, size_t *tail) {
+  size_t count = 0, sep;
+  while (1) {
+    const char *start;
+    int isnum;
+
+    for (sep = 0; p < end && !isalnum((unsigned char) *p); p++) { sep++; }
+    if (p == end) { break; }
+
+    start = p;
+    if ((isnum = isdigit((unsigned char) *p))) {
+      while (p < end && isdigit((unsigned char) *p)) { p++; }
+      /* leading zeros do not affect numeric comparisons */
+      while (start < p && *start == '0') { start++; }
+    } else {
+      while (p < end && isalpha((unsigned char) *p)) { p++; }
+    }
+
+    if (segs) {
+      segs[count].str = start;
+      segs[count].len = p - start;
+      segs[count].sep = sep;
+      segs[count].isnum = isnum ? 1 : 0;
+    }
+    count++;
+  }
+  if (tail) { *tail = sep; }
+  return count;
+}
+
+/**
+ * @brief Parse a version into a comparison key.
+ *
+ * Versions are split into epoch, version, and release the same way as
+ * alpm_pkg_vercmp().
+ *
+ * @param version version string
+ *
+ * @return new key, NULL on error
+ */
+pu_version_key_t *pu_version_key_new(const char *version) {
+  static const char default_epoch[] = "0";
+  const char *start[3], *end[3], *s, *se;
+  size_t len, count = 0, i;
+  pu_version_key_t *key;
+
+  if (version == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  len = strlen(version);
+  for (s = version; isdigit((unsigned char) *s); s++);
+  se = strrchr(s, '-');
+  if (*s == ':' && s != version) {
+    start[_PU_VERSION_EPOCH] = version;
+    end[_PU_VERSION_EPOCH] = s;
+  } else {
+    start[_PU_VERSION_EPOCH] = default_epoch;
+    end[_PU_VERSION_EPOCH] = default_epoch + 1;
+  }
+  start[_PU_VERSION_VERSION] = *s == ':' ? s + 1 : version;
+  end[_PU_VERSION_VERSION] = se ? se : version + len;
+  start[_PU_VERSION_RELEASE] = se ? se + 1 : version + len;
+  end[_PU_VERSION_RELEASE] = version + len;
+
+  for (i = 0; i < 3; i++) {
+    count += _pu_version_tokenize(start[i], end[i], NULL, NULL);
+  }
+
+  /* the key, its segments and a copy of the version share an allocation */
+  if ((key = malloc(sizeof(pu_version_key_t)
+              + count * sizeof(pu_version_seg_t) + len + 1)) == NULL) {
+    return NULL;
+  }
+  key->_segs = (pu_version_seg_t *) (key + 1);
+  key->str = (char *) (key->_segs + count);
+  memcpy(key->str, version, len + 1);
+  key->has_release = se != NULL;
+
+  for (count = 0, i = 0; i < 3; i++) {
+    /* segments point into the copy, the default epoch is static */
+    const char *p = start[i] == default_epoch ? start[i]
+        : key->str + (start[i] - version);
+    const char *e = start[i] == default_epoch ? end[i]
+        : key->str + (end[i] - version);
+    key->_count[i] = _pu_version_tokenize(p, e, key->_segs + count,
+            &key->_tail[i]);
+    count += key->_count[i];
+  }
+
+  return key;
+}
+
+static int _pu_version_seg_cmp(const pu_version_seg_t *s1,
+    const pu_version_seg_t *s2) {
+  int c;
+  if (s1->isnum && s1->len != s2->len) {
+    /* whichever number has more digits wins */
+    return s1->len < s2->len ? -1 : 1;
+  }
+  c = memcmp(s1->str, s2->str, s1->len < s2->len ? s1->len : s2->len);
+  if (c) { return c < 0 ? -1 : 1; }
+  return s1->len < s2->len ? -1 : s1->len > s2->len;
+}
+
+/* class of the character following segment i - 1, or following its
+ * separators as well if skipped is set */
+static int _pu_version_class(const pu_version_seg_t *segs, size_t count,
+    size_t tail, size_t i, int skipped) {
+  if (i == count) {
+    return tail && !skipped ? _PU_VERSION_OTHER : _PU_VERSION_END;
+  } else if (segs[i].sep && !skipped) {
+    return _PU_VERSION_OTHER;
+  } else {
+    return segs[i].isnum ? _PU_VERSION_OTHER : _PU_VERSION_ALPHA;
+  }
+}
+
+/* mirrors rpmvercmp as used by alpm, including its treatment of differing
+ * separators and trailing characters */
+static int _pu_version_part_cmp(const pu_version_key_t *k1,
+    const pu_version_key_t *k2, int part) {
+  const pu_version_seg_t *s1 = k1->_segs, *s2 = k2->_segs;
+  size_t c1 = k1->_count[part], c2 = k2->_count[part];
+  size_t t1 = k1->_tail[part], t2 = k2->_tail[part];
+  int cls1, cls2, skipped, c;
+  size_t i;
+
+  for (c = 0; c < part; c++) {
+    s1 += k1->_count[c];
+    s2 += k2->_count[c];
+  }
+
+  for (i = 0; ; i++) {
+    if (!((i < c1 || t1) && (i < c2 || t2))) {
+      skipped = 0;
+      break;
+    }
+    if (i == c1 || i == c2) {
+      skipped = 1;
+      break;
+    }
+    if (s1[i].sep != s2[i].sep) {
+      return s1[i].sep < s2[i].sep ? -1 : 1;
+    }
+    if (s1[i].isnum != s2[i].isnum) {
+      /* numeric segments are always newer than alpha segments */
+      return s1[i].isnum ? 1 : -1;
+    }
+    if ((c = _pu_version_seg_cmp(&s1[i], &s2[i])) != 0) {
+      return c;
+    }
+  }
+
+  cls1 = _pu_version_class(s1, c1, t1, i, skipped);
+  cls2 = _pu_version_class(s2, c2, t2, i, skipped);
+  if (cls1 == _PU_VERSION_END && cls2 == _PU_VERSION_END) {
+    return 0;
+  }
+  /* a remaining alpha segment never beats an empty string */
+  return (cls1 == _PU_VERSION_END && cls2 != _PU_VERSION_ALPHA)
+      || cls1 == _PU_VERSION_ALPHA ? -1 : 1;
+}
+
+/**
+ * @brief Compare two version keys.
+ *
+ * NULL keys compare like NULL versions in alpm_pkg_vercmp().
+ *
+ * @return -1, 0, or 1 if k1 is older, equal to, or newer than k2
+ */
+int pu_version_key_cmp(const pu_version_key_t *k1, const pu_version_key_t *k2) {
+  int ret;
+  if (k1 == k2) { return 0; }
+  if (k1 == NULL) { return -1; }
+  if (k2 == NULL) { return 1; }
+
+  if ((ret = _pu_version_part_cmp(k1, k2, _PU_VERSION_EPOCH)) == 0
+      && (ret = _pu_version_part_cmp(k1, k2, _PU_VERSION_VERSION)) == 0
+      && k1->has_release && k2->has_release) {
+    ret = _pu_version_part_cmp(k1, k2, _PU_VERSION_RELEASE);
+  }
+  return ret;
+}
+
+void pu_version_key_free(pu_version_key_t *key) {
+  free(key);
+}
+
+pu_version_cache_t *pu_version_cache_new(void) {
+  return calloc(1, sizeof(pu_version_cache_t));
+}
+
+static size_t _pu_version_cache_slot(pu_version_cache_t *cache,
+    const char *version, unsigned long hash) {
+  size_t mask = cache->_size - 1, i = hash & mask;
+  while (cache->_keys[i] != NULL) {
+    if (cache->_hashes[i] == hash && strcmp(cache->_keys[i]->str, version) == 0) {
+      break;
+    }
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+static int _pu_version_cache_grow(pu_version_cache_t *cache) {
+  size_t newsize = cache->_size ? cache->_size * 2 : 64, i;
+  pu_version_cache_t new = { ._keys = NULL };
+  if ((new._keys = calloc(newsize, sizeof(pu_version_key_t *))) == NULL
+      || (new._hashes = calloc(newsize, sizeof(unsigned long))) == NULL) {
+    free(new._keys);
+    return -1;
+  }
+  new._size = newsize;
+  new._count = cache->_count;
+  for (i = 0; i < cache->_size; i++) {
+    if (cache->_keys[i]) {
+      size_t slot = _pu_version_cache_slot(&new, cache->_keys[i]->str,
+              cache->_hashes[i]);
+      new._keys[slot] = cache->_keys[i];
+      new._hashes[slot] = cache->_hashes[i];
+    }
+  }
+  free(cache->_keys);
+  free(cache->_hashes);
+  *cache = new;
+  return 0;
+}
+
+/**
+ * @brief Look up the key for a version, parsing it if not already cached.
+ *
+ * @return cached key owned by the cache, NULL on error
+ */
+pu_version_key_t *pu_version_cache_get(pu_version_cache_t *cache,
+    const char *version) {
+  unsigned long hash;
+  size_t slot;
+
+  if (version == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if (cache->_count * 2 >= cache->_size
+      && _pu_version_cache_grow(cache) != 0) {
+    return NULL;
+  }
+
+  hash = _pu_hash_sdbm(version);
+  slot = _pu_version_cache_slot(cache, version, hash);
+  if (cache->_keys[slot] == NULL) {
+    if ((cache->_keys[slot] = pu_version_key_new(version)) == NULL) {
+      return NULL;
+    }
+    cache->_hashes[slot] = hash;
+    cache->_count++;
+  }
+  return cache->_keys[slot];
+}
+
+/**
+ * @brief Look up the key for a version without modifying the cache.
+ *
+ * Safe to call from multiple threads as long as nothing is being added.
+ *
+ * @return cached key, NULL if the version has not been cached
+ */
+pu_version_key_t *pu_version_cache_find(pu_version_cache_t *cache,
+    const char *version) {
+  size_t slot;
+  if (version == NULL || cache->_size == 0) { return NULL; }
+  slot = _pu_version_cache_slot(cache, version, _pu_hash_sdbm(version));
+  return cache->_keys[slot];
+}
+
+/**
+ * @brief Compare two versions, caching their parsed keys.
+ *
+ * @return same as alpm_pkg_vercmp()
+ */
+int pu_version_cache_vercmp(pu_version_cache_t *cache,
+    const char *v1, const char *v2) {
+  pu_version_key_t *k1, *k2;
+  if (v1 == NULL || v2 == NULL || strcmp(v1, v2) == 0) {
+    return alpm_pkg_vercmp(v1, v2);
+  }
+  if ((k1 = pu_version_cache_get(cache, v1)) == NULL
+      || (k2 = pu_version_cache_get(cache, v2)) == NULL) {
+    return alpm_pkg_vercmp(v1, v2);
+  }
+  return pu_version_key_cmp(k1, k2);
+}
+
+void pu_version_cache_free(pu_version_cache_t *cache) {
+  size_t i;
+  if (cache == NULL) { return; }
+  for (i = 0; i < cache->_size; i++) {
+    pu_version_key_free(cache->_keys[i]);
+  }
+  free(cache->_keys);
+  free(cache->_hashes);
+  free(cache);
+}
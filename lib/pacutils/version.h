@@ -0,0 +1,66 @@
+/*
+ * Copyright 2012-2020 Andrew Gregory <andrew.gregory.8@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef PACUTILS_VERSION_H
+#define PACUTILS_VERSION_H
+
+#include <stddef.h>
+
+typedef struct pu_version_seg_t {
+  const char *str; /* not terminated, numbers have leading zeros removed */
+  size_t len;
+  size_t sep;      /* number of separator characters preceding the segment */
+  int isnum;
+} pu_version_seg_t;
+
+/* a version pre-parsed into comparable segments, compares like
+ * alpm_pkg_vercmp() without re-parsing either version */
+typedef struct pu_version_key_t {
+  char *str;
+  int has_release;
+
+  pu_version_seg_t *_segs;
+  size_t _count[3]; /* epoch, version and release segment counts */
+  size_t _tail[3];  /* trailing separator characters */
+} pu_version_key_t;
+
+typedef struct pu_version_cache_t {
+  pu_version_key_t **_keys;
+  unsigned long *_hashes;
+  size_t _count;
+  size_t _size;
+} pu_version_cache_t;
+
+pu_version_key_t *pu_version_key_new(const char *version);
+int pu_version_key_cmp(const pu_version_key_t *k1, const pu_version_key_t *k2);
+void pu_version_key_free(pu_version_key_t *key);
+
+pu_version_cache_t *pu_version_cache_new(void);
+pu_version_key_t *pu_version_cache_get(pu_version_cache_t *cache,
+    const char *version);
+pu_version_key_t *pu_version_cache_find(pu_version_cache_t *cache,
+    const char *version);
+int pu_version_cache_vercmp(pu_version_cache_t *cache,
+    const char *v1, const char *v2);
+void pu_version_cache_free(pu_version_cache_t *cache);
+
+#endif /* PACUTILS_VERSION_H */
@@ -27,6 +27,7 @@
 #include <errno.h>
 #include <pwd.h>
 #include <grp.h>
+#include <pthread.h>
 
 #include <pacutils.h>
 
@@ -44,6 +45,7 @@ enum longopt_flags {
   FLAG_FILES,
   FLAG_FILE_PROPERTIES,
   FLAG_HELP,
+  FLAG_JOBS,
   FLAG_LIST_BROKEN,
   FLAG_MD5SUM,
   FLAG_SHA256SUM,
@@ -72,12 +74,32 @@ pu_config_t *config = NULL;
 alpm_handle_t *handle = NULL;
 alpm_db_t *localdb = NULL;
 alpm_list_t *pkgcache = NULL, *packages = NULL;
+pu_provider_index_t *providers = NULL;
 const char *sysroot = NULL;
-int checks = 0, recursive = 0, list_broken = 0, quiet = 0;
+int checks = 0, recursive = 0, list_broken = 0, quiet = 0, jobs = 1;
 int include_db_files = 0, require_mtree = 0;
 int skip_backups = 1, skip_noextract = 1, skip_noupgrade = 1;
 int isep = '\n';
 
+/* per-package output buffers, only set while running checks in parallel */
+static _Thread_local FILE *outstream = NULL, *errstream = NULL;
+/* each worker batches its own file checks */
+static _Thread_local pu_stat_batch_t *statbatch = NULL;
+
+struct check_job_t {
+  alpm_pkg_t *pkg;
+  int ret, done;
+  char *out, *err;
+  size_t outlen, errlen;
+};
+
+struct check_queue_t {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct check_job_t *jobs;
+  size_t count, next;
+};
+
 void usage(int ret) {
   FILE *stream = (ret ? stderr : stdout);
 #define hputs(s) fputs(s"\n", stream);
@@ -90,6 +112,7 @@ void usage(int ret) {
   hputs("   --root=<path>      set an alternate installation root");
   hputs("   --sysroot=<path>   set an alternate system root");
   hputs("   --null[=<sep>]     parse stdin as <sep> separated values (default NUL)");
+  hputs("   --jobs=<n>         check up to <n> packages in parallel");
   hputs("   --list-broken      only print packages that fail checks");
   hputs("   --quiet            only display error messages");
   hputs("   --help             display this help information");
@@ -124,6 +147,7 @@ pu_config_t *parse_opts(int argc, char **argv) {
     { "sysroot", required_argument, NULL, FLAG_SYSROOT      },
     { "quiet", no_argument, NULL, FLAG_QUIET        },
     { "null", optional_argument, NULL, FLAG_NULL         },
+    { "jobs", required_argument, NULL, FLAG_JOBS         },
 
     { "help", no_argument, NULL, FLAG_HELP         },
     { "version", no_argument, NULL, FLAG_VERSION      },
@@ -183,6 +207,16 @@ pu_config_t *parse_opts(int argc, char **argv) {
       case FLAG_NULL:
         isep = optarg ? optarg[0] : '\0';
         break;
+      case FLAG_JOBS: {
+        char *end;
+        long j = strtol(optarg, &end, 10);
+        if (*optarg == '\0' || *end != '\0' || j < 1 || j > 1024) {
+          fprintf(stderr, "error: invalid number of jobs '%s'\n", optarg);
+          exit(1);
+        }
+        jobs = j;
+        break;
+      }
       case FLAG_ROOT:
         free(config->rootdir);
         config->rootdir = strdup(optarg);
@@ -265,22 +299,35 @@ static void eprintf(const char *fmt, ...) {
   if (!list_broken) {
     va_list args;
     va_start(args, fmt);
-    vfprintf(stdout, fmt, args);
+    vfprintf(outstream ? outstream : stdout, fmt, args);
     va_end(args);
   }
 }
 
+static void ewarn(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  if (errstream) {
+    fputs("warning: ", errstream);
+    vfprintf(errstream, fmt, args);
+    fputc('\n', errstream);
+  } else {
+    pu_ui_vwarn(fmt, args);
+  }
+  va_end(args);
+}
+
 static int check_depends(alpm_pkg_t *p) {
   int ret = 0;
   alpm_list_t *i;
   for (i = alpm_pkg_get_depends(p); i; i = alpm_list_next(i)) {
-    char *depstring = alpm_dep_compute_string(i->data);
-    if (!alpm_find_satisfier(pkgcache, depstring)) {
+    if (!pu_provider_index_find_satisfier(providers, i->data)) {
+      char *depstring = alpm_dep_compute_string(i->data);
       eprintf("%s: unsatisfied dependency '%s'\n",
           alpm_pkg_get_name(p), depstring);
+      free(depstring);
       ret = 1;
     }
-    free(depstring);
   }
   if (!quiet && !ret) {
     eprintf("%s: all dependencies satisfied\n", alpm_pkg_get_name(p));
@@ -292,13 +339,13 @@ static int check_opt_depends(alpm_pkg_t *p) {
   int ret = 0;
   alpm_list_t *i;
   for (i = alpm_pkg_get_optdepends(p); i; i = alpm_list_next(i)) {
-    char *depstring = alpm_dep_compute_string(i->data);
-    if (!alpm_find_satisfier(pkgcache, depstring)) {
+    if (!pu_provider_index_find_satisfier(providers, i->data)) {
+      char *depstring = alpm_dep_compute_string(i->data);
       eprintf("%s: unsatisfied optional dependency '%s'\n",
           alpm_pkg_get_name(p), depstring);
+      free(depstring);
       ret = 1;
     }
-    free(depstring);
   }
   if (!quiet && !ret) {
     eprintf("%s: all optional dependencies satisfied\n",
@@ -307,27 +354,33 @@ static int check_opt_depends(alpm_pkg_t *p) {
   return ret;
 }
 
-static int check_file(const char *pkgname, const char *path, int isdir) {
-  struct stat buf;
-  if (lstat(path, &buf) != 0) {
-    if (errno == ENOENT) {
-      eprintf("%s: '%s' missing file\n", pkgname, path);
+static int check_file_stat(const char *pkgname, pu_lstat_entry_t *e,
+    int isdir) {
+  if (e->err != 0) {
+    if (e->err == ENOENT) {
+      eprintf("%s: '%s' missing file\n", pkgname, e->path);
     } else {
-      pu_ui_warn("%s: '%s' read error (%s)", pkgname, path, strerror(errno));
+      ewarn("%s: '%s' read error (%s)", pkgname, e->path, strerror(e->err));
     }
     return 1;
-  } else if (isdir && !S_ISDIR(buf.st_mode)) {
-    eprintf("%s: '%s' type mismatch (expected directory)\n", pkgname, path);
+  } else if (isdir && !S_ISDIR(e->st.st_mode)) {
+    eprintf("%s: '%s' type mismatch (expected directory)\n", pkgname, e->path);
     return 1;
-  } else if (!isdir && S_ISDIR(buf.st_mode)) {
-    eprintf("%s: '%s' type mismatch (expected file)\n", pkgname, path);
+  } else if (!isdir && S_ISDIR(e->st.st_mode)) {
+    eprintf("%s: '%s' type mismatch (expected file)\n", pkgname, e->path);
     return 1;
   }
   return 0;
 }
 
+static int check_file(const char *pkgname, const char *path, int isdir) {
+  pu_lstat_entry_t e = { .path = path };
+  pu_lstat_batch(statbatch, &e, 1);
+  return check_file_stat(pkgname, &e, isdir);
+}
+
 static char *get_db_path(alpm_pkg_t *pkg, const char *path) {
-  static char dbpath[PATH_MAX];
+  static _Thread_local char dbpath[PATH_MAX];
   ssize_t len = snprintf(dbpath, PATH_MAX, "%slocal/%s-%s/%s",
           alpm_option_get_dbpath(handle),
           alpm_pkg_get_name(pkg), alpm_pkg_get_version(pkg), path);
@@ -342,13 +395,13 @@ static int check_db_files(alpm_pkg_t *pkg) {
   int ret = 0;
 
   if ((dbpath = get_db_path(pkg, "desc")) == NULL) {
-    pu_ui_warn("%s: '%s' read error (%s)", pkgname, dbpath, strerror(errno));
+    ewarn("%s: '%s' read error (%s)", pkgname, dbpath, strerror(errno));
   } else if (check_file(pkgname, dbpath, 0) != 0) {
     ret = 1;
   }
 
   if ((dbpath = get_db_path(pkg, "files")) == NULL) {
-    pu_ui_warn("%s: '%s' read error (%s)", pkgname, dbpath, strerror(errno));
+    ewarn("%s: '%s' read error (%s)", pkgname, dbpath, strerror(errno));
   } else if (check_file(pkgname, dbpath, 0) != 0) {
     ret = 1;
   }
@@ -356,7 +409,7 @@ static int check_db_files(alpm_pkg_t *pkg) {
   if (!require_mtree) { return ret; }
 
   if ((dbpath = get_db_path(pkg, "mtree")) == NULL) {
-    pu_ui_warn("%s: '%s' read error (%s)", pkgname, dbpath, strerror(errno));
+    ewarn("%s: '%s' read error (%s)", pkgname, dbpath, strerror(errno));
   } else if (check_file(pkgname, dbpath, 0) != 0) {
     ret = 1;
   }
@@ -367,32 +420,51 @@ static int check_db_files(alpm_pkg_t *pkg) {
 /* verify that the filesystem matches the package database */
 static int check_files(alpm_pkg_t *pkg) {
   alpm_filelist_t *filelist = alpm_pkg_get_files(pkg);
-  char path[PATH_MAX], *rel;
+  const char *root = alpm_option_get_root(handle);
   const char *pkgname = alpm_pkg_get_name(pkg);
-  unsigned int i;
+  size_t rootlen = strlen(root), count = 0, i;
+  pu_lstat_entry_t *entries;
+  char *isdir;
   int ret = 0;
-  size_t space;
-
-  strncpy(path, alpm_option_get_root(handle), PATH_MAX);
-  rel = path + strlen(path);
-  space = PATH_MAX - (rel - path);
 
+  /* stat every file up front so the requests can be issued together */
+  entries = calloc(filelist->count, sizeof(*entries));
+  isdir = calloc(filelist->count, 1);
+  if ((entries == NULL || isdir == NULL) && filelist->count) {
+    ewarn("%s: unable to check files (%s)", pkgname, strerror(errno));
+    free(entries);
+    free(isdir);
+    return 1;
+  }
   for (i = 0; i < filelist->count; ++i) {
-    alpm_file_t file = filelist->files[i];
-    int isdir = 0;
-    size_t len;
+    const char *name = filelist->files[i].name;
+    size_t len = strlen(name);
+    char *path;
 
-    if (skip_noextract && match_noextract(handle, file.name)) { continue; }
+    if (skip_noextract && match_noextract(handle, name)) { continue; }
 
-    strncpy(rel, file.name, space);
-    len = strlen(file.name);
-    if (rel[len - 1] == '/') {
-      isdir = 1;
-      rel[len - 1] = '\0';
+    if ((path = malloc(rootlen + len + 1)) == NULL) {
+      ewarn("%s: unable to check files (%s)", pkgname, strerror(errno));
+      ret = 1;
+      break;
+    }
+    memcpy(path, root, rootlen);
+    memcpy(path + rootlen, name, len + 1);
+    if (name[len - 1] == '/') {
+      isdir[count] = 1;
+      path[rootlen + len - 1] = '\0';
     }
+    entries[count++].path = path;
+  }
+
+  pu_lstat_batch(statbatch, entries, count);
 
-    if (check_file(pkgname, path, isdir) != 0) { ret = 1; }
+  for (i = 0; i < count; ++i) {
+    if (check_file_stat(pkgname, &entries[i], isdir[i]) != 0) { ret = 1; }
+    free((char *) entries[i].path);
   }
+  free(entries);
+  free(isdir);
 
   if (include_db_files && check_db_files(pkg) != 0) {
     ret = 1;
@@ -426,8 +498,8 @@ const char *mode_str(mode_t mode) {
 }
 
 int cmp_type(alpm_pkg_t *pkg, const char *path,
-    struct archive_entry *entry, struct stat *st) {
-  const char *type = mode_str(archive_entry_filetype(entry));
+    pu_mtree_t *entry, struct stat *st) {
+  const char *type = mode_str(pu_mtree_filetype(entry));
   const char *ftype = mode_str(st->st_mode);
 
   if (type != ftype) {
@@ -440,9 +512,9 @@ int cmp_type(alpm_pkg_t *pkg, const char *path,
 }
 
 int cmp_mode(alpm_pkg_t *pkg, const char *path,
-    struct archive_entry *entry, struct stat *st) {
+    pu_mtree_t *entry, struct stat *st) {
   mode_t mask = 07777;
-  mode_t perm = archive_entry_perm(entry);
+  mode_t perm = entry->mode & mask;
 
   if (perm != (st->st_mode & mask)) {
     eprintf("%s: '%s' permission mismatch (expected %o)\n",
@@ -454,8 +526,8 @@ int cmp_mode(alpm_pkg_t *pkg, const char *path,
 }
 
 int cmp_mtime(alpm_pkg_t *pkg, const char *path,
-    struct archive_entry *entry, struct stat *st) {
-  time_t t = archive_entry_mtime(entry);
+    pu_mtree_t *entry, struct stat *st) {
+  time_t t = entry->mtime;
 
   if (t != st->st_mtime) {
     struct tm ltime;
@@ -470,11 +542,11 @@ int cmp_mtime(alpm_pkg_t *pkg, const char *path,
 }
 
 int cmp_target(alpm_pkg_t *pkg, const char *path,
-    struct archive_entry *entry) {
-  const char *ptarget = archive_entry_symlink(entry);
+    pu_mtree_t *entry) {
+  const char *ptarget = entry->link ? entry->link : "";
   char ftarget[PATH_MAX];
-  ssize_t len = readlink(path, ftarget, PATH_MAX);
-  ftarget[len] = '\0';
+  ssize_t len = readlink(path, ftarget, PATH_MAX - 1);
+  ftarget[len < 0 ? 0 : len] = '\0';
 
   if (strcmp(ptarget, ftarget) != 0) {
     eprintf("%s: '%s' symlink target mismatch (expected %s)\n",
@@ -486,11 +558,13 @@ int cmp_target(alpm_pkg_t *pkg, const char *path,
 }
 
 int cmp_uid(alpm_pkg_t *pkg, const char *path,
-    struct archive_entry *entry, struct stat *st) {
-  uid_t puid = archive_entry_uid(entry);
+    pu_mtree_t *entry, struct stat *st) {
+  uid_t puid = entry->uid;
 
   if (puid != st->st_uid) {
-    struct passwd *pw = getpwuid(puid);
+    struct passwd pwbuf, *pw = NULL;
+    char buf[1024];
+    getpwuid_r(puid, &pwbuf, buf, sizeof(buf), &pw);
     eprintf("%s: '%s' UID mismatch (expected %d/%s)\n",
         alpm_pkg_get_name(pkg), path, puid, pw ? pw->pw_name : "unknown user");
     return 1;
@@ -500,11 +574,13 @@ int cmp_uid(alpm_pkg_t *pkg, const char *path,
 }
 
 int cmp_gid(alpm_pkg_t *pkg, const char *path,
-    struct archive_entry *entry, struct stat *st) {
-  gid_t pgid = archive_entry_gid(entry);
+    pu_mtree_t *entry, struct stat *st) {
+  gid_t pgid = entry->gid;
 
   if (pgid != st->st_gid) {
-    struct group *gr = getgrgid(pgid);
+    struct group grbuf, *gr = NULL;
+    char buf[1024];
+    getgrgid_r(pgid, &grbuf, buf, sizeof(buf), &gr);
     eprintf("%s: '%s' GID mismatch (expected %d/%s)\n",
         alpm_pkg_get_name(pkg), path, pgid, gr ? gr->gr_name : "unknown group");
     return 1;
@@ -514,8 +590,8 @@ int cmp_gid(alpm_pkg_t *pkg, const char *path,
 }
 
 int cmp_size(alpm_pkg_t *pkg, const char *path,
-    struct archive_entry *entry, struct stat *st) {
-  int64_t psize = archive_entry_size(entry);
+    pu_mtree_t *entry, struct stat *st) {
+  off_t psize = entry->size;
 
   if (psize != st->st_size) {
     char hr_size[20];
@@ -529,200 +605,214 @@ int cmp_size(alpm_pkg_t *pkg, const char *path,
 
 /* check filesystem against extra mtree data if available,
  * NOT guaranteed to catch db/filesystem discrepencies */
-static int check_file_properties(alpm_pkg_t *pkg) {
-  char path[PATH_MAX], *rel;
+static int check_file_properties(alpm_pkg_t *pkg, pu_mtree_t *entry,
+    const char *fpath, struct stat *buf) {
   int ret = 0;
-  size_t space;
-  struct archive *mtree = alpm_pkg_mtree_open(pkg);
-  struct archive_entry *entry;
 
-  if (!mtree) {
-    pu_ui_warn("%s: mtree data not available (%s)",
-        alpm_pkg_get_name(pkg), strerror(errno));
-    return require_mtree;
-  }
-
-  strncpy(path, alpm_option_get_root(handle), PATH_MAX);
-  rel = path + strlen(path);
-  space = PATH_MAX - (rel - path);
+  if (cmp_type(pkg, fpath, entry, buf) != 0) { ret = 1; }
 
-  while (alpm_pkg_mtree_next(pkg, mtree, &entry) == ARCHIVE_OK) {
-    const char *ppath = archive_entry_pathname(entry);
-    const char *fpath;
-    struct stat buf;
+  if (skip_noupgrade && match_noupgrade(handle, entry->path)) { return ret; }
 
-    if (strncmp("./", ppath, 2) == 0) { ppath += 2; }
+  if (cmp_mode(pkg, fpath, entry, buf) != 0) { ret = 1; }
+  if (cmp_uid(pkg, fpath, entry, buf) != 0) { ret = 1; }
+  if (cmp_gid(pkg, fpath, entry, buf) != 0) { ret = 1; }
 
-    if (strcmp(ppath, ".INSTALL") == 0) {
-      if ((fpath = get_db_path(pkg, "install")) == NULL) {
-        continue;
-      }
-    } else if (strcmp(ppath, ".CHANGELOG") == 0) {
-      if ((fpath = get_db_path(pkg, "changelog")) == NULL) {
-        continue;
-      }
-    } else if (ppath[0] == '.') {
-      continue;
-    } else if (skip_noextract && match_noextract(handle, ppath)) {
-      continue;
-    } else {
-      strncpy(rel, ppath, space);
-      fpath = path;
-    }
+  if (skip_backups && match_backup(pkg, entry->path)) {
+    return ret;
+  }
 
-    if (lstat(fpath, &buf) != 0) {
-      if (errno == ENOENT) {
-        eprintf("%s: '%s' missing file\n", alpm_pkg_get_name(pkg), fpath);
-      } else {
-        pu_ui_warn("%s: '%s' read error (%s)",
-            alpm_pkg_get_name(pkg), fpath, strerror(errno));
-      }
-      ret = 1;
-      continue;
+  if (S_ISLNK(buf->st_mode) && pu_mtree_filetype(entry) == S_IFLNK) {
+    if (cmp_target(pkg, fpath, entry) != 0) { ret = 1; }
+  }
+  if (!S_ISDIR(buf->st_mode)) {
+    if (cmp_mtime(pkg, fpath, entry, buf) != 0) { ret = 1; }
+    if (!S_ISLNK(buf->st_mode)) {
+      /* always fails for directories and symlinks */
+      if (cmp_size(pkg, fpath, entry, buf) != 0) { ret = 1; }
     }
+  }
 
-    if (cmp_type(pkg, fpath, entry, &buf) != 0) { ret = 1; }
-
-    if (skip_noupgrade && match_noupgrade(handle, ppath)) { continue; }
-
-    if (cmp_mode(pkg, fpath, entry, &buf) != 0) { ret = 1; }
-    if (cmp_uid(pkg, fpath, entry, &buf) != 0) { ret = 1; }
-    if (cmp_gid(pkg, fpath, entry, &buf) != 0) { ret = 1; }
+  return ret;
+}
 
-    if (skip_backups && match_backup(pkg, ppath)) {
-      continue;
-    }
+/* md5 and sha256 checks share a single read of each file */
+static int check_digests(alpm_pkg_t *pkg, pu_mtree_t *entry,
+    const char *fpath, struct stat *buf, int types) {
+  pu_digest_t digest;
+  int ret = 0;
 
-    if (S_ISLNK(buf.st_mode) && S_ISLNK(archive_entry_mode(entry))) {
-      if (cmp_target(pkg, fpath, entry) != 0) { ret = 1; }
-    }
-    if (!S_ISDIR(buf.st_mode)) {
-      if (cmp_mtime(pkg, fpath, entry, &buf) != 0) { ret = 1; }
-      if (!S_ISLNK(buf.st_mode)) {
-        /* always fails for directories and symlinks */
-        if (cmp_size(pkg, fpath, entry, &buf) != 0) { ret = 1; }
-      }
+  /* symlinks are hashed through to their targets */
+  if (!S_ISREG(buf->st_mode) && !S_ISLNK(buf->st_mode)) {
+    if (!(checks & CHECK_FILE_PROPERTIES)) {
+      eprintf("%s: '%s' type mismatch (expected file)\n",
+          alpm_pkg_get_name(pkg), fpath);
     }
+    return types;
   }
-  alpm_pkg_mtree_close(pkg, mtree);
 
-  if (!quiet && !ret) {
-    eprintf("%s: all files match mtree\n", alpm_pkg_get_name(pkg));
+  if (pu_digest_file(fpath, types, &digest) != 0) {
+    ewarn("%s: '%s' read error (%s)",
+        alpm_pkg_get_name(pkg), fpath, strerror(errno));
+    return 0;
+  }
+  if ((types & PU_DIGEST_MD5) && strcmp(entry->md5digest, digest.md5) != 0) {
+    eprintf("%s: '%s' md5sum mismatch (expected %s)\n",
+        alpm_pkg_get_name(pkg), fpath, entry->md5digest);
+    ret |= PU_DIGEST_MD5;
+  }
+  if ((types & PU_DIGEST_SHA256)
+      && strcmp(entry->sha256digest, digest.sha256) != 0) {
+    eprintf("%s: '%s' sha256sum mismatch (expected %s)\n",
+        alpm_pkg_get_name(pkg), fpath, entry->sha256digest);
+    ret |= PU_DIGEST_SHA256;
   }
 
   return ret;
 }
 
-static int check_md5sum(alpm_pkg_t *pkg) {
-  int ret = 0;
-  char path[PATH_MAX], *rel;
+struct mtree_file_t {
+  pu_mtree_t *entry;
+  int check_props, types;
+};
+
+/* decode the package mtree once, lstat each file once, and pass the entry
+ * to every enabled mtree-based check; the files are stat'd together as a
+ * batch before any are compared */
+static int check_mtree(alpm_pkg_t *pkg) {
+  int props = checks & CHECK_FILE_PROPERTIES, digest_types = 0;
+  int props_ret = 0, digests_ret = 0, ret;
+  const char *root = alpm_option_get_root(handle);
+  size_t rootlen = strlen(root), count = 0, size = 0, i;
+  struct mtree_file_t *files = NULL;
+  pu_lstat_entry_t *stats = NULL;
   pu_mtree_reader_t *reader;
-  pu_mtree_t *m;
+  pu_mtree_t *entry;
+  int eof, readerr;
 
-  strcpy(path, alpm_option_get_root(handle));
-  rel = path + strlen(alpm_option_get_root(handle));
+  if (checks & CHECK_MD5SUM) { digest_types |= PU_DIGEST_MD5; }
+  if (checks & CHECK_SHA256SUM) { digest_types |= PU_DIGEST_SHA256; }
 
   if ((reader = pu_mtree_reader_open_package(handle, pkg)) == NULL) {
-    pu_ui_warn("%s: mtree data not available (%s)",
+    ewarn("%s: mtree data not available (%s)",
         alpm_pkg_get_name(pkg), strerror(errno));
     return require_mtree;
   }
 
-  if ((m = pu_mtree_new()) == NULL) {
-    pu_ui_warn("%s: error reading mtree data (%s)",
-        alpm_pkg_get_name(pkg), strerror(errno));
-    pu_mtree_reader_free(reader);
-    return require_mtree;
-  }
+  while ((entry = pu_mtree_reader_next(reader, NULL))) {
+    const char *ppath = entry->path;
+    const char *dbpath = NULL;
+    int check_props = props, types = 0;
+    char *fpath;
 
-  while (pu_mtree_reader_next(reader, m)) {
-    char *md5;
-    if (m->md5digest[0] == '\0') { continue; }
-    if (m->path[0] == '.') { continue; }
-    if (skip_backups && match_backup(pkg, m->path)) { continue; }
-    if (skip_noextract && match_noextract(handle, m->path)) { continue; }
-    if (skip_noupgrade && match_noupgrade(handle, m->path)) { continue; }
-
-    strcpy(rel, m->path);
-    if ((md5 = alpm_compute_md5sum(path)) == NULL) {
-      pu_ui_warn("%s: '%s' read error (%s)",
-          alpm_pkg_get_name(pkg), path, strerror(errno));
-    } else if (memcmp(m->md5digest, md5, 32) != 0) {
-      eprintf("%s: '%s' md5sum mismatch (expected %s)\n",
-          alpm_pkg_get_name(pkg), path, m->md5digest);
-      ret = 1;
+    if (strcmp(ppath, ".INSTALL") == 0) {
+      if ((dbpath = get_db_path(pkg, "install")) == NULL) { check_props = 0; }
+    } else if (strcmp(ppath, ".CHANGELOG") == 0) {
+      if ((dbpath = get_db_path(pkg, "changelog")) == NULL) { check_props = 0; }
+    } else if (ppath[0] == '.'
+        || (skip_noextract && match_noextract(handle, ppath))) {
+      pu_mtree_free(entry);
+      continue;
+    } else if (digest_types
+        && !(skip_backups && match_backup(pkg, ppath))
+        && !(skip_noupgrade && match_noupgrade(handle, ppath))) {
+      if (entry->md5digest[0]) { types |= digest_types & PU_DIGEST_MD5; }
+      if (entry->sha256digest[0]) {
+        types |= digest_types & PU_DIGEST_SHA256;
+      }
     }
-    free(md5);
-  }
-  pu_mtree_free(m);
-
-  if (!reader->eof) {
-    pu_ui_warn("%s: error reading mtree data (%s)",
-        alpm_pkg_get_name(pkg), strerror(errno));
-    pu_mtree_reader_free(reader);
-    return ret || require_mtree;
-  }
-  pu_mtree_reader_free(reader);
 
-  if (!quiet && !ret) {
-    eprintf("%s: all files match mtree md5sums\n", alpm_pkg_get_name(pkg));
-  }
+    if (!check_props && !types) {
+      pu_mtree_free(entry);
+      continue;
+    }
 
-  return ret;
-}
+    if (dbpath) {
+      fpath = strdup(dbpath);
+    } else if ((fpath = malloc(rootlen + strlen(ppath) + 1)) != NULL) {
+      memcpy(fpath, root, rootlen);
+      strcpy(fpath + rootlen, ppath);
+    }
 
-static int check_sha256sum(alpm_pkg_t *pkg) {
-  int ret = 0;
-  char path[PATH_MAX], *rel;
-  pu_mtree_reader_t *reader;
-  pu_mtree_t *m;
+    if (count == size) {
+      size_t newsize = size ? size * 2 : 64;
+      struct mtree_file_t *newfiles;
+      pu_lstat_entry_t *newstats;
+      if ((newfiles = realloc(files, newsize * sizeof(*files))) != NULL) {
+        files = newfiles;
+      }
+      if ((newstats = realloc(stats, newsize * sizeof(*stats))) != NULL) {
+        stats = newstats;
+      }
+      if (newfiles && newstats) { size = newsize; }
+    }
+    if (fpath == NULL || count == size) {
+      free(fpath);
+      pu_mtree_free(entry);
+      break;
+    }
 
-  if ((reader = pu_mtree_reader_open_package(handle, pkg)) == NULL) {
-    pu_ui_warn("%s: mtree data not available (%s)",
-        alpm_pkg_get_name(pkg), strerror(errno));
-    return require_mtree;
+    files[count].entry = entry;
+    files[count].check_props = check_props;
+    files[count].types = types;
+    stats[count].path = fpath;
+    count++;
   }
+  eof = reader->eof;
+  readerr = errno;
+  pu_mtree_reader_free(reader);
 
-  strcpy(path, alpm_option_get_root(handle));
-  rel = path + strlen(alpm_option_get_root(handle));
+  pu_lstat_batch(statbatch, stats, count);
 
-  if ((m = pu_mtree_new()) == NULL) {
-    pu_ui_warn("%s: error reading mtree data (%s)",
-        alpm_pkg_get_name(pkg), strerror(errno));
-    pu_mtree_reader_free(reader);
-    return require_mtree;
-  }
+  for (i = 0; i < count; i++) {
+    const char *fpath = stats[i].path;
+    struct stat *buf = &stats[i].st;
+    int check_props = files[i].check_props, types = files[i].types;
 
-  while (pu_mtree_reader_next(reader, m)) {
-    char *sha;
-    if (m->sha256digest[0] == '\0') { continue; }
-    if (m->path[0] == '.') { continue; }
-    if (skip_backups && match_backup(pkg, m->path)) { continue; }
-    if (skip_noextract && match_noextract(handle, m->path)) { continue; }
-    if (skip_noupgrade && match_noupgrade(handle, m->path)) { continue; }
-
-    strcpy(rel, m->path);
-    if ((sha = alpm_compute_sha256sum(path)) == NULL) {
-      pu_ui_warn("%s: '%s' read error (%s)",
-          alpm_pkg_get_name(pkg), path, strerror(errno));
-    } else if (memcmp(m->sha256digest, sha, 32) != 0) {
-      eprintf("%s: '%s' sha256sum mismatch (expected %s)\n",
-          alpm_pkg_get_name(pkg), path, m->sha256digest);
-      ret = 1;
+    entry = files[i].entry;
+
+    if (stats[i].err != 0) {
+      if (!check_props) {
+        ewarn("%s: '%s' read error (%s)",
+            alpm_pkg_get_name(pkg), fpath, strerror(stats[i].err));
+      } else if (stats[i].err == ENOENT) {
+        eprintf("%s: '%s' missing file\n", alpm_pkg_get_name(pkg), fpath);
+        props_ret = 1;
+      } else {
+        ewarn("%s: '%s' read error (%s)",
+            alpm_pkg_get_name(pkg), fpath, strerror(stats[i].err));
+        props_ret = 1;
+      }
+    } else {
+      if (check_props && check_file_properties(pkg, entry, fpath, buf) != 0) {
+        props_ret = 1;
+      }
+      if (types) {
+        digests_ret |= check_digests(pkg, entry, fpath, buf, types);
+      }
     }
-    free(sha);
+
+    pu_mtree_free(entry);
+    free((char *) fpath);
   }
-  pu_mtree_free(m);
+  free(files);
+  free(stats);
+  ret = props_ret || digests_ret;
 
-  if (!reader->eof) {
-    pu_ui_warn("%s: error reading mtree data (%s)",
-        alpm_pkg_get_name(pkg), strerror(errno));
-    pu_mtree_reader_free(reader);
+  if (!eof) {
+    ewarn("%s: error reading mtree data (%s)",
+        alpm_pkg_get_name(pkg), strerror(readerr));
     return ret || require_mtree;
   }
-  pu_mtree_reader_free(reader);
 
-  if (!quiet && !ret) {
+  if (!quiet && props && !props_ret) {
+    eprintf("%s: all files match mtree\n", alpm_pkg_get_name(pkg));
+  }
+  if (!quiet && (digest_types & PU_DIGEST_MD5)
+      && !(digests_ret & PU_DIGEST_MD5)) {
+    eprintf("%s: all files match mtree md5sums\n", alpm_pkg_get_name(pkg));
+  }
+  if (!quiet && (digest_types & PU_DIGEST_SHA256)
+      && !(digests_ret & PU_DIGEST_SHA256)) {
     eprintf("%s: all files match mtree sha256sums\n", alpm_pkg_get_name(pkg));
   }
 
@@ -754,27 +844,149 @@ alpm_pkg_t *load_pkg(const char *pkgname) {
 void add_deps(alpm_pkg_t *pkg) {
   alpm_list_t *i;
   for (i = alpm_pkg_get_depends(pkg); i; i = alpm_list_next(i)) {
-    char *depstring = alpm_dep_compute_string(i->data);
-    alpm_pkg_t *p = alpm_find_satisfier(pkgcache, depstring);
+    alpm_pkg_t *p = pu_provider_index_find_satisfier(providers, i->data);
     if (p && !alpm_list_find_ptr(packages, p)) {
       packages = alpm_list_add(packages, p);
       add_deps(p);
     }
-    free(depstring);
   }
   if (checks & CHECK_OPT_DEPENDS) {
     for (i = alpm_pkg_get_optdepends(pkg); i; i = alpm_list_next(i)) {
-      char *depstring = alpm_dep_compute_string(i->data);
-      alpm_pkg_t *p = alpm_find_satisfier(pkgcache, depstring);
+      alpm_pkg_t *p = pu_provider_index_find_satisfier(providers, i->data);
       if (p && !alpm_list_find_ptr(packages, p)) {
         packages = alpm_list_add(packages, p);
         add_deps(p);
       }
-      free(depstring);
     }
   }
 }
 
+static int check_pkg(alpm_pkg_t *pkg) {
+  int pkgerr = 0;
+#define RUNCHECK(t, b) if((checks & t) && b != 0) { pkgerr = 1; }
+  RUNCHECK(CHECK_DEPENDS, check_depends(pkg));
+  RUNCHECK(CHECK_OPT_DEPENDS, check_opt_depends(pkg));
+  RUNCHECK(CHECK_FILES, check_files(pkg));
+  RUNCHECK((CHECK_FILE_PROPERTIES | CHECK_MD5SUM | CHECK_SHA256SUM),
+      check_mtree(pkg));
+#undef RUNCHECK
+  return pkgerr;
+}
+
+static void *check_worker(void *arg) {
+  struct check_queue_t *q = arg;
+
+  /* the workers already stat in parallel, keep them from adding threads of
+   * their own; without a context files are checked one at a time */
+  statbatch = pu_stat_batch_new(1);
+
+  while (1) {
+    struct check_job_t *job;
+
+    pthread_mutex_lock(&q->lock);
+    job = q->next < q->count ? &q->jobs[q->next++] : NULL;
+    pthread_mutex_unlock(&q->lock);
+    if (job == NULL) { break; }
+
+    outstream = open_memstream(&job->out, &job->outlen);
+    errstream = open_memstream(&job->err, &job->errlen);
+    job->ret = check_pkg(job->pkg);
+    if (outstream) { fclose(outstream); outstream = NULL; }
+    if (errstream) { fclose(errstream); errstream = NULL; }
+
+    pthread_mutex_lock(&q->lock);
+    job->done = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+  }
+
+  pu_stat_batch_free(statbatch);
+  statbatch = NULL;
+  return NULL;
+}
+
+/* libalpm loads local package data lazily, which is not thread-safe, make
+ * sure everything the checks need has been read before starting workers */
+static void preload_pkgs(alpm_list_t *pkgs) {
+  alpm_list_t *i;
+  if (checks & (CHECK_DEPENDS | CHECK_OPT_DEPENDS)) {
+    for (i = pkgcache; i; i = alpm_list_next(i)) {
+      alpm_pkg_get_provides(i->data);
+    }
+  }
+  for (i = pkgs; i; i = alpm_list_next(i)) {
+    alpm_pkg_get_depends(i->data);
+    alpm_pkg_get_files(i->data);
+    alpm_pkg_get_backup(i->data);
+  }
+}
+
+/* run checks on a pool of threads, output is buffered per package and
+ * written in the original package order */
+static int run_checks_parallel(alpm_list_t *pkgs) {
+  struct check_queue_t q = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .count = alpm_list_count(pkgs),
+  };
+  pthread_t *threads;
+  alpm_list_t *i;
+  size_t n, nthreads = 0;
+  int ret = 0;
+
+  if ((q.jobs = calloc(q.count, sizeof(struct check_job_t))) == NULL
+      || (threads = calloc(jobs, sizeof(pthread_t))) == NULL) {
+    pu_ui_error("unable to start checks (%s)", strerror(errno));
+    free(q.jobs);
+    return 1;
+  }
+  for (n = 0, i = pkgs; i; i = alpm_list_next(i), n++) {
+    q.jobs[n].pkg = i->data;
+  }
+
+  preload_pkgs(pkgs);
+
+  while (nthreads < (size_t) jobs && nthreads < q.count) {
+    if (pthread_create(&threads[nthreads], NULL, check_worker, &q) != 0) {
+      break;
+    }
+    nthreads++;
+  }
+  if (nthreads == 0) {
+    /* could not start any threads, do the work ourselves */
+    check_worker(&q);
+  }
+
+  for (n = 0; n < q.count; n++) {
+    struct check_job_t *job = &q.jobs[n];
+
+    pthread_mutex_lock(&q.lock);
+    while (!job->done) {
+      pthread_cond_wait(&q.cond, &q.lock);
+    }
+    pthread_mutex_unlock(&q.lock);
+
+    if (job->err) { fwrite(job->err, 1, job->errlen, stderr); }
+    if (job->out) { fwrite(job->out, 1, job->outlen, stdout); }
+    if (job->ret != 0) {
+      ret = 1;
+      if (list_broken) { printf("%s\n", alpm_pkg_get_name(job->pkg)); }
+    }
+    free(job->out);
+    free(job->err);
+  }
+
+  for (n = 0; n < nthreads; n++) {
+    pthread_join(threads[n], NULL);
+  }
+
+  pthread_mutex_destroy(&q.lock);
+  pthread_cond_destroy(&q.cond);
+  free(threads);
+  free(q.jobs);
+  return ret;
+}
+
 int main(int argc, char **argv) {
   alpm_list_t *i;
   int ret = 0;
@@ -798,6 +1010,13 @@ int main(int argc, char **argv) {
   localdb = alpm_get_localdb(handle);
   pkgcache = alpm_db_get_pkgcache(localdb);
 
+  if ((recursive || checks & (CHECK_DEPENDS | CHECK_OPT_DEPENDS))
+      && !(providers = pu_provider_index_new(pkgcache))) {
+    fprintf(stderr, "error: %s\n", strerror(errno));
+    ret = 1;
+    goto cleanup;
+  }
+
   for (; optind < argc; ++optind) {
     if (load_pkg(argv[optind]) == NULL) { ret = 1; }
   }
@@ -827,21 +1046,22 @@ int main(int argc, char **argv) {
     alpm_list_free(originals);
   }
 
-  for (i = packages; i; i = alpm_list_next(i)) {
-    int pkgerr = 0;
-#define RUNCHECK(t, b) if((checks & t) && b != 0) { pkgerr = ret = 1; }
-    RUNCHECK(CHECK_DEPENDS, check_depends(i->data));
-    RUNCHECK(CHECK_OPT_DEPENDS, check_opt_depends(i->data));
-    RUNCHECK(CHECK_FILES, check_files(i->data));
-    RUNCHECK(CHECK_FILE_PROPERTIES, check_file_properties(i->data));
-    RUNCHECK(CHECK_MD5SUM, check_md5sum(i->data));
-    RUNCHECK(CHECK_SHA256SUM, check_sha256sum(i->data));
-#undef RUNCHECK
-    if (pkgerr && list_broken) { printf("%s\n", alpm_pkg_get_name(i->data)); }
+  if (jobs > 1) {
+    if (run_checks_parallel(packages) != 0) { ret = 1; }
+  } else {
+    statbatch = pu_stat_batch_new(0);
+    for (i = packages; i; i = alpm_list_next(i)) {
+      if (check_pkg(i->data) != 0) {
+        ret = 1;
+        if (list_broken) { printf("%s\n", alpm_pkg_get_name(i->data)); }
+      }
+    }
   }
 
 cleanup:
+  pu_stat_batch_free(statbatch);
   alpm_list_free(packages);
+  pu_provider_index_free(providers);
   alpm_release(handle);
   pu_config_free(config);
 
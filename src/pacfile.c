@@ -32,7 +32,7 @@
 
 const char *myname = "pacfile", *myver = BUILDVER;
 
-int checkfs = 0;
+int checkfs = 0, isep = '\n';
 alpm_list_t *pkgnames = NULL;
 const char *sysroot = NULL;
 
@@ -40,6 +40,7 @@ enum longopt_flags {
   FLAG_CONFIG = 1000,
   FLAG_DBPATH,
   FLAG_HELP,
+  FLAG_NULL,
   FLAG_PACKAGE,
   FLAG_ROOT,
   FLAG_SYSROOT,
@@ -61,6 +62,7 @@ void usage(int ret) {
   hputs("   --version          display version information");
   hputs("   --package=<pkg>    limit information to specified package(s)");
   hputs("   --check            compare database values to filesystem");
+  hputs("   --null[=sep]       parse stdin as <sep> separated values (default NUL)");
 #undef hputs
   exit(ret);
 }
@@ -81,6 +83,7 @@ pu_config_t *parse_opts(int argc, char **argv) {
     { "no-check", no_argument, &checkfs, 0                 },
     { "check", no_argument, &checkfs, 1                 },
     { "package", required_argument, NULL, FLAG_PACKAGE      },
+    { "null", optional_argument, NULL, FLAG_NULL         },
     { 0, 0, 0, 0 },
   };
 
@@ -118,6 +121,9 @@ pu_config_t *parse_opts(int argc, char **argv) {
       case FLAG_PACKAGE:
         pkgnames = alpm_list_add(pkgnames, strdup(optarg));
         break;
+      case FLAG_NULL:
+        isep = optarg ? optarg[0] : '\0';
+        break;
       case '?':
         usage(1);
         break;
@@ -153,9 +159,9 @@ const char *mode_str(mode_t mode) {
   }
 }
 
-mode_t cmp_mode(struct archive_entry *entry, struct stat *st) {
+mode_t cmp_mode(pu_mtree_t *entry, struct stat *st) {
   mode_t mask = 07777;
-  mode_t pmode = archive_entry_mode(entry);
+  mode_t pmode = pu_mtree_filetype(entry) | (entry->mode & mask);
   mode_t perm = pmode & mask;
   const char *type = mode_str(pmode);
 
@@ -178,11 +184,11 @@ mode_t cmp_mode(struct archive_entry *entry, struct stat *st) {
   return pmode;
 }
 
-void cmp_mtime(struct archive_entry *entry, struct stat *st) {
+void cmp_mtime(pu_mtree_t *entry, struct stat *st) {
   struct tm ltime;
   char time_buf[26];
 
-  time_t t = archive_entry_mtime(entry);
+  time_t t = entry->mtime;
   strftime(time_buf, 26, "%F %T", localtime_r(&t, &ltime));
   printf("mtime:  %s", time_buf);
 
@@ -194,15 +200,15 @@ void cmp_mtime(struct archive_entry *entry, struct stat *st) {
   putchar('\n');
 }
 
-void cmp_target(struct archive_entry *entry, struct stat *st,
+void cmp_target(pu_mtree_t *entry, struct stat *st,
     const char *path) {
-  const char *ptarget = archive_entry_symlink(entry);
+  const char *ptarget = entry->link ? entry->link : "";
   printf("target: %s", ptarget);
 
   if (st) {
     char ftarget[PATH_MAX];
-    ssize_t len = readlink(path, ftarget, PATH_MAX);
-    ftarget[len] = '\0';
+    ssize_t len = readlink(path, ftarget, PATH_MAX - 1);
+    ftarget[len < 0 ? 0 : len] = '\0';
     if (strcmp(ptarget, ftarget) != 0) {
       printf(" (%s on filesystem)", ftarget);
     }
@@ -211,8 +217,8 @@ void cmp_target(struct archive_entry *entry, struct stat *st,
   putchar('\n');
 }
 
-void cmp_uid(struct archive_entry *entry, struct stat *st) {
-  uid_t puid = archive_entry_uid(entry);
+void cmp_uid(pu_mtree_t *entry, struct stat *st) {
+  uid_t puid = entry->uid;
   struct passwd *pw = getpwuid(puid);
 
   printf("owner:  %d/%s", puid, pw ? pw->pw_name : "unknown user");
@@ -226,8 +232,8 @@ void cmp_uid(struct archive_entry *entry, struct stat *st) {
   putchar('\n');
 }
 
-void cmp_gid(struct archive_entry *entry, struct stat *st) {
-  gid_t pgid = archive_entry_gid(entry);
+void cmp_gid(pu_mtree_t *entry, struct stat *st) {
+  gid_t pgid = entry->gid;
   struct group *gr = getgrgid(pgid);
 
   printf("group:  %d/%s", pgid, gr ? gr->gr_name : "unknown group");
@@ -241,8 +247,8 @@ void cmp_gid(struct archive_entry *entry, struct stat *st) {
   putchar('\n');
 }
 
-void cmp_size(struct archive_entry *entry, struct stat *st) {
-  int64_t psize = archive_entry_size(entry);
+void cmp_size(pu_mtree_t *entry, struct stat *st) {
+  off_t psize = entry->size;
   char hr_size[20];
 
   printf("size:   %s", pu_hr_size(psize, hr_size));
@@ -254,111 +260,196 @@ void cmp_size(struct archive_entry *entry, struct stat *st) {
   putchar('\n');
 }
 
-void cmp_sha256sum(struct stat *st,
-    alpm_handle_t *handle, alpm_pkg_t *pkg, const char *path) {
-  pu_mtree_reader_t *reader;
-  pu_mtree_t *m;
+void cmp_digests(pu_mtree_t *entry, struct stat *st,
+    alpm_pkg_t *pkg, const char *path) {
+  pu_digest_t digest;
+  int computed = 0;
 
-  if ((reader = pu_mtree_reader_open_package(handle, pkg)) == NULL) {
-    pu_ui_warn("%s: mtree data not available", alpm_pkg_get_name(pkg));
-    return;
+  if (checkfs && st && S_ISREG(st->st_mode)) {
+    if (pu_digest_file(path, PU_DIGEST_MD5 | PU_DIGEST_SHA256, &digest) != 0) {
+      pu_ui_warn("%s: '%s' read error (%s)",
+          alpm_pkg_get_name(pkg), path, strerror(errno));
+    } else {
+      computed = 1;
+    }
   }
 
-  while ((m = pu_mtree_reader_next(reader, NULL))) {
-    char *sha = NULL;
-    if (strcmp(m->path, path) != 0) { pu_mtree_free(m); continue; }
+  printf("sha256: %s", entry->sha256digest);
+  if (computed && strcmp(digest.sha256, entry->sha256digest) != 0) {
+    printf(" (%s on filesystem)", digest.sha256);
+  }
+  putchar('\n');
 
-    if (checkfs && S_ISREG(st->st_mode)) {
-      char rpath[PATH_MAX];
-      snprintf(rpath, PATH_MAX, "%s%s", alpm_option_get_root(handle), path);
-      if ((sha = alpm_compute_sha256sum(rpath)) == NULL) {
-        pu_ui_warn("%s: '%s' read error (%s)",
-            alpm_pkg_get_name(pkg), rpath, strerror(errno));
-      }
-    }
+  printf("md5sum: %s", entry->md5digest);
+  if (computed && strcmp(digest.md5, entry->md5digest) != 0) {
+    printf(" (%s on filesystem)", digest.md5);
+  }
+  putchar('\n');
+}
 
-    printf("sha256: %s", m->sha256digest);
+/* a path to look up, matched against file lists by its normalized form */
+struct query {
+  const char *filename;
+  const char *relfname; /* filename relative to root */
+  char *path;           /* relfname without repeated or trailing '/' */
+  char *dirpath;        /* path with a trailing '/' to match directories */
+  alpm_list_t *owners;
+};
 
-    if (sha) {
-      if (strcmp(sha, m->sha256digest) != 0) {
-        printf(" (%s on filesystem)", sha);
-      }
-      free(sha);
-    }
-    putchar('\n');
+struct owner {
+  alpm_pkg_t *pkg;
+  size_t pkgidx;
+  alpm_file_t *file;
+};
 
-    pu_mtree_reader_free(reader);
-    pu_mtree_free(m);
+struct key {
+  const char *name;
+  struct query *query;
+};
 
-    return;
-  }
+/* mtree indexes are loaded on demand and reused for every file */
+struct pkg_mtree {
+  pu_mtree_index_t *index;
+  int loaded;
+};
 
-  if (!reader->eof) {
-    pu_ui_warn("%s: error reading mtree data (%s)",
-        alpm_pkg_get_name(pkg), strerror(errno));
-  } else {
-    pu_ui_warn("%s: error '%s' not found in mtree data",
-        alpm_pkg_get_name(pkg), path);
-  }
-  pu_mtree_reader_free(reader);
+int key_cmp(const void *k1, const void *k2) {
+  return strcmp(((const struct key *) k1)->name,
+          ((const struct key *) k2)->name);
 }
 
-void cmp_md5sum(struct stat *st,
-    alpm_handle_t *handle, alpm_pkg_t *pkg, const char *path) {
-  pu_mtree_reader_t *reader;
-  pu_mtree_t *m;
+struct owner_search {
+  struct key *keys;
+  alpm_pkg_t *pkg;
+  size_t pkgidx;
+};
+
+int add_owner(alpm_file_t *file, size_t idx, void *ctx) {
+  struct owner_search *search = ctx;
+  struct owner *o = malloc(sizeof(struct owner));
+  if (o == NULL
+      || alpm_list_append(&search->keys[idx].query->owners, o) == NULL) {
+    free(o);
+    return -1;
+  }
+  o->pkg = search->pkg;
+  o->pkgidx = search->pkgidx;
+  o->file = file;
+  return 0;
+}
 
-  if ((reader = pu_mtree_reader_open_package(handle, pkg)) == NULL) {
-    pu_ui_warn("%s: mtree data not available", alpm_pkg_get_name(pkg));
-    return;
+/* resolve every query in a single sweep over the packages by merging each
+ * package's sorted file list with the sorted query paths */
+int find_owners(alpm_list_t *pkgs, struct key *keys, const char **names,
+    size_t nkeys) {
+  struct owner_search search = { .keys = keys };
+  alpm_list_t *p;
+
+  for (p = pkgs; p; p = alpm_list_next(p), search.pkgidx++) {
+    search.pkg = p->data;
+    if (pu_filelist_find_paths(alpm_pkg_get_files(p->data), names, nkeys,
+            add_owner, &search) != 0) {
+      return -1;
+    }
   }
 
-  while ((m = pu_mtree_reader_next(reader, NULL))) {
-    char *md5 = NULL;
-    if (strcmp(m->path, path) != 0) { pu_mtree_free(m); continue; }
+  return 0;
+}
+
+int print_owner(alpm_handle_t *handle, struct query *q, struct owner *o,
+    struct pkg_mtree *mtrees) {
+  const char *root = alpm_option_get_root(handle);
+  alpm_pkg_t *pkg = o->pkg;
+  alpm_list_t *b;
+  pu_mtree_t *entry;
+  char full_path[PATH_MAX];
+  int ret = 0;
 
-    if (checkfs && S_ISREG(st->st_mode)) {
-      char rpath[PATH_MAX];
-      snprintf(rpath, PATH_MAX, "%s%s", alpm_option_get_root(handle), path);
-      if ((md5 = alpm_compute_md5sum(rpath)) == NULL) {
-        pu_ui_warn("%s: '%s' read error (%s)",
-            alpm_pkg_get_name(pkg), rpath, strerror(errno));
+  snprintf(full_path, PATH_MAX, "%s%s", root, o->file->name);
+
+  printf("file:   %s\n", o->file->name);
+  printf("owner:  %s\n", alpm_pkg_get_name(pkg));
+
+  /* backup file status */
+  for (b = alpm_pkg_get_backup(pkg); b; b = b->next) {
+    alpm_backup_t *bak = b->data;
+    if (pu_pathcmp(q->relfname, bak->name) == 0) {
+      fputs("backup: yes\n", stdout);
+      fprintf(stdout, "md5sum: %s", bak->hash);
+
+      if (checkfs) {
+        pu_digest_t digest;
+        if (pu_digest_file(full_path, PU_DIGEST_MD5, &digest) != 0) {
+          fprintf(stderr, "warning: could not calculate md5sum for '%s'\n",
+              full_path);
+          ret = 1;
+        } else if (strcmp(digest.md5, bak->hash) != 0) {
+          fprintf(stdout, " (%s on filesystem)", digest.md5);
+        }
       }
+
+      putchar('\n');
+      break;
     }
+  }
+  if (!b) {
+    fputs("backup: no\n", stdout);
+  }
 
-    printf("md5sum: %s", m->md5digest);
+  /* MTREE info */
+  if (!mtrees[o->pkgidx].loaded) {
+    mtrees[o->pkgidx].index = pu_mtree_index_load_package(handle, pkg);
+    mtrees[o->pkgidx].loaded = 1;
+  }
+  if ((entry = pu_mtree_index_find(mtrees[o->pkgidx].index, q->relfname))) {
+    struct stat sbuf, *st = NULL;
 
-    if (md5) {
-      if (strcmp(md5, m->md5digest) != 0) {
-        printf(" (%s on filesystem)", md5);
+    if (checkfs) {
+      if (lstat(full_path, &sbuf) != 0) {
+        fprintf(stderr, "warning: could not stat '%s' (%s)\n",
+            full_path, strerror(errno));
+        ret = 1;
+      } else {
+        st = &sbuf;
       }
-      free(md5);
     }
-    putchar('\n');
 
-    pu_mtree_reader_free(reader);
-    pu_mtree_free(m);
+    if (S_ISLNK(cmp_mode(entry, st))) {
+      cmp_target(entry, st, full_path);
+    }
+    cmp_mtime(entry, st);
+    cmp_uid(entry, st);
+    cmp_gid(entry, st);
 
-    return;
+    if (pu_mtree_filetype(entry) == S_IFREG) {
+      cmp_size(entry, st);
+      cmp_digests(entry, st, pkg, full_path);
+    }
   }
 
-  if (!reader->eof) {
-    pu_ui_warn("%s: error reading mtree data (%s)",
-        alpm_pkg_get_name(pkg), strerror(errno));
-  } else {
-    pu_ui_warn("%s: error '%s' not found in mtree data",
-        alpm_pkg_get_name(pkg), path);
-  }
-  pu_mtree_reader_free(reader);
+  return ret;
+}
+
+void free_query(struct query *q) {
+  free(q->path);
+  free(q->dirpath);
+  alpm_list_free_inner(q->owners, free);
+  alpm_list_free(q->owners);
 }
 
 int main(int argc, char **argv) {
   pu_config_t *config = NULL;
   alpm_handle_t *handle = NULL;
-  alpm_list_t *pkgs = NULL;
+  alpm_list_t *pkgs = NULL, *stdin_paths = NULL, *s;
+  struct pkg_mtree *mtrees = NULL;
+  struct query *queries = NULL;
+  struct key *keys = NULL;
+  const char **names = NULL;
+  size_t pkgcount = 0, nqueries = 0, i;
   int ret = 0;
   size_t rootlen;
   const char *root;
+  int have_stdin = !isatty(fileno(stdin)) && errno != EBADF;
 
   if (!(config = parse_opts(argc, argv))) {
     goto cleanup;
@@ -390,117 +481,99 @@ int main(int argc, char **argv) {
     pkgs = alpm_list_copy(alpm_db_get_pkgcache(alpm_get_localdb(handle)));
   }
 
-  while (optind < argc) {
-    const char *relfname, *filename = argv[optind];
+  if (have_stdin) {
+    char *buf = NULL;
+    size_t len = 0;
+    ssize_t read;
+    while ((read = getdelim(&buf, &len, isep, stdin)) != -1) {
+      if (buf[read - 1] == isep) { buf[read - 1] = '\0'; }
+      if (buf[0] && pu_list_append_str(&stdin_paths, buf) == NULL) {
+        fprintf(stderr, "error: %s\n", strerror(errno));
+        free(buf);
+        ret = 1;
+        goto cleanup;
+      }
+    }
+    free(buf);
+  }
 
-    int found = 0;
-    alpm_list_t *p;
+  pkgcount = alpm_list_count(pkgs);
+  nqueries = (argc - optind) + alpm_list_count(stdin_paths);
+  if ((mtrees = calloc(pkgcount + 1, sizeof(struct pkg_mtree))) == NULL
+      || (queries = calloc(nqueries + 1, sizeof(struct query))) == NULL
+      || (keys = calloc(nqueries * 2 + 1, sizeof(struct key))) == NULL
+      || (names = calloc(nqueries * 2 + 1, sizeof(char *))) == NULL) {
+    fprintf(stderr, "error: %s\n", strerror(errno));
+    ret = 1;
+    goto cleanup;
+  }
 
-    if (strncmp(filename, root, rootlen) == 0) {
-      relfname = filename + rootlen;
+  for (i = 0, s = stdin_paths; i < nqueries; i++) {
+    struct query *q = &queries[i];
+    if (optind + i < (size_t) argc) {
+      q->filename = argv[optind + i];
+    } else {
+      q->filename = s->data;
+      s = s->next;
+    }
+    if (strncmp(q->filename, root, rootlen) == 0) {
+      q->relfname = q->filename + rootlen;
     } else {
-      relfname = filename;
+      q->relfname = q->filename;
+    }
+    if ((q->path = pu_path_normalize(q->relfname)) == NULL
+        || (q->dirpath = pu_asprintf("%s/", q->path)) == NULL) {
+      fprintf(stderr, "error: %s\n", strerror(errno));
+      ret = 1;
+      goto cleanup;
     }
+    keys[i * 2].name = q->path;
+    keys[i * 2].query = q;
+    keys[i * 2 + 1].name = q->dirpath;
+    keys[i * 2 + 1].query = q;
+  }
 
-    for (p = pkgs; p; p = alpm_list_next(p)) {
-      alpm_file_t *pfile = pu_filelist_contains_path(
-              alpm_pkg_get_files(p->data), relfname);
-      if (pfile) {
-        alpm_list_t *b;
-        char full_path[PATH_MAX];
-        snprintf(full_path, PATH_MAX, "%s%s", root, pfile->name);
-
-        if (found++) { putchar('\n'); }
-
-        printf("file:   %s\n", pfile->name);
-        printf("owner:  %s\n", alpm_pkg_get_name(p->data));
-
-        /* backup file status */
-        for (b = alpm_pkg_get_backup(p->data); b; b = b->next) {
-          alpm_backup_t *bak = b->data;
-          if (pu_pathcmp(relfname, bak->name) == 0) {
-            fputs("backup: yes\n", stdout);
-            fprintf(stdout, "md5sum: %s", bak->hash);
-
-            if (checkfs) {
-              char *md5sum = alpm_compute_md5sum(full_path);
-              if (!md5sum) {
-                fprintf(stderr, "warning: could not calculate md5sum for '%s'\n",
-                    full_path);
-                ret = 1;
-              } else {
-                if (strcmp(md5sum, bak->hash) != 0) {
-                  fprintf(stdout, " (%s on filesystem)", md5sum);
-                }
-                free(md5sum);
-              }
-            }
-
-            putchar('\n');
-            break;
-          }
-        }
-        if (!b) {
-          fputs("backup: no\n", stdout);
-        }
+  qsort(keys, nqueries * 2, sizeof(struct key), key_cmp);
+  for (i = 0; i < nqueries * 2; i++) { names[i] = keys[i].name; }
+  if (find_owners(pkgs, keys, names, nqueries * 2) != 0) {
+    fprintf(stderr, "error: %s\n", strerror(errno));
+    ret = 1;
+    goto cleanup;
+  }
 
-        /* MTREE info */
-        struct archive *mtree = alpm_pkg_mtree_open(p->data);
-        if (mtree) {
-
-          struct archive_entry *entry;
-          while (alpm_pkg_mtree_next(p->data, mtree, &entry) == ARCHIVE_OK) {
-            struct stat sbuf, *st = NULL;
-
-            const char *ppath = archive_entry_pathname(entry);
-            if (strncmp("./", ppath, 2) == 0) { ppath += 2; }
-
-            if (pu_pathcmp(relfname, ppath) != 0) { continue; }
-
-            if (checkfs) {
-              if (lstat(full_path, &sbuf) != 0) {
-                fprintf(stderr, "warning: could not stat '%s' (%s)\n",
-                    full_path, strerror(errno));
-                ret = 1;
-              } else {
-                st = &sbuf;
-              }
-            }
-
-            if (S_ISLNK(cmp_mode(entry, st))) {
-              cmp_target(entry, st, full_path);
-            }
-            cmp_mtime(entry, st);
-            cmp_uid(entry, st);
-            cmp_gid(entry, st);
-
-            if (archive_entry_filetype(entry) == AE_IFREG) {
-              cmp_size(entry, st);
-              cmp_sha256sum(st, handle, p->data, ppath);
-              cmp_md5sum(st, handle, p->data, ppath);
-            }
-
-            break;
-          }
-          alpm_pkg_mtree_close(p->data, mtree);
-        }
-      }
+  for (i = 0; i < nqueries; i++) {
+    struct query *q = &queries[i];
+    alpm_list_t *o;
+
+    for (o = q->owners; o; o = o->next) {
+      if (o != q->owners) { putchar('\n'); }
+      if (print_owner(handle, q, o->data, mtrees) != 0) { ret = 1; }
     }
 
-    if (!found) {
-      printf("no package owns '%s'\n", filename);
+    if (!q->owners) {
+      printf("no package owns '%s'\n", q->filename);
     }
 
-    ++optind;
-    if (optind < argc) {
+    if (i + 1 < nqueries) {
       fputs("\n", stdout);
     }
   }
 
 cleanup:
+  if (mtrees) {
+    for (i = 0; i < pkgcount; i++) { pu_mtree_index_free(mtrees[i].index); }
+    free(mtrees);
+  }
+  if (queries) {
+    for (i = 0; i < nqueries; i++) { free_query(&queries[i]); }
+    free(queries);
+  }
+  free(keys);
+  free(names);
   alpm_release(handle);
   pu_config_free(config);
   alpm_list_free(pkgs);
+  FREELIST(stdin_paths);
   FREELIST(pkgnames);
 
   return ret;
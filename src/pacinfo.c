@@ -39,6 +39,9 @@ enum format {
 pu_config_t *config = NULL;
 alpm_handle_t *handle = NULL;
 alpm_list_t *allpkgs = NULL;
+pu_depgraph_t *depgraph = NULL;
+pu_depgraph_t *localgraph = NULL;
+off_t *removable_sizes = NULL;
 
 int format = FORMAT_LONG, verbosity = 1, removable_size = 0, raw = 0;
 int isep = '\n';
@@ -137,57 +140,13 @@ void printo(const char *field, off_t size) {
   printf(field, hrsize);
 }
 
-off_t _pkg_removable_size(alpm_pkg_t *pkg, alpm_list_t *pkgs,
-    alpm_list_t **seen) {
-  const char *pkgname = alpm_pkg_get_name(pkg);
-  if (alpm_list_find_ptr(*seen, pkgname))
-  { return 0; }
-
-  off_t size = alpm_pkg_get_isize(pkg);
-  *seen = alpm_list_add(*seen, (void *) pkgname);
-
-  alpm_list_t *d, *deps = alpm_pkg_get_depends(pkg);
-  for (d = deps; d; d = d->next) {
-    char *depstring = alpm_dep_compute_string(d->data);
-    alpm_pkg_t *p = alpm_find_satisfier(pkgs, depstring);
-    free(depstring);
-
-    if (!p) {
-      continue;
-    }
-
-    if (alpm_pkg_get_reason(p) == ALPM_PKG_REASON_EXPLICIT) {
-      continue;
-    }
-
-    if (alpm_list_find_ptr(*seen, p)) {
-      continue;
-    }
-
-    alpm_list_t *rb = alpm_pkg_compute_requiredby(p);
-
-    if (rb) {
-      alpm_list_t *diff = alpm_list_diff(rb, *seen,
-              (alpm_list_fn_cmp) strcmp);
-      if (diff) {
-        alpm_list_free(diff);
-        FREELIST(rb);
-        continue;
-      }
-      FREELIST(rb);
-    }
-
-    size += _pkg_removable_size(p, pkgs, seen);
+off_t pkg_removable_size(alpm_pkg_t *pkg) {
+  size_t idx;
+  /* packages that are not installed have nothing to remove */
+  if (pu_depgraph_pkg_index(localgraph, pkg, &idx) != 0) {
+    return alpm_pkg_get_isize(pkg);
   }
-
-  return size;
-}
-
-off_t pkg_removable_size(alpm_handle_t *handle, alpm_pkg_t *pkg) {
-  alpm_db_t *localdb = alpm_get_localdb(handle);
-  alpm_list_t *seen = NULL, *installed = alpm_db_get_pkgcache(localdb);
-  alpm_list_free(seen);
-  return _pkg_removable_size(pkg, installed, &seen);
+  return removable_sizes[idx];
 }
 
 void usage(int ret) {
@@ -369,22 +328,22 @@ void print_pkg_info(alpm_pkg_t *pkg) {
       printd("Replaces:       %s\n", alpm_pkg_get_replaces(pkg));
 
       if (verbosity >= 2) {
-        pu_pkg_find_requiredby(pkg, allpkgs, &i);
+        pu_depgraph_find_requiredby(depgraph, pkg, &i);
         printr("Required By:    %s\n", pkg, i, 0);
         alpm_list_free(i);
         i = NULL;
 
-        pu_pkg_find_optionalfor(pkg, allpkgs, &i);
+        pu_depgraph_find_optionalfor(depgraph, pkg, &i);
         printr("Optional For:   %s\n", pkg, i, 1);
         alpm_list_free(i);
         i = NULL;
 
-        pu_pkg_find_makedepfor(pkg, allpkgs, &i);
+        pu_depgraph_find_makedepfor(depgraph, pkg, &i);
         printr("MakeDep For:    %s\n", pkg, i, 2);
         alpm_list_free(i);
         i = NULL;
 
-        pu_pkg_find_checkdepfor(pkg, allpkgs, &i);
+        pu_depgraph_find_checkdepfor(depgraph, pkg, &i);
         printr("CheckDep For:   %s\n", pkg, i, 3);
         alpm_list_free(i);
         i = NULL;
@@ -394,7 +353,7 @@ void print_pkg_info(alpm_pkg_t *pkg) {
       printo("Download Size:  %s\n", alpm_pkg_download_size(pkg));
       printo("Installed Size: %s\n",
           removable_size
-          ? pkg_removable_size(handle, pkg)
+          ? pkg_removable_size(pkg)
           : alpm_pkg_get_isize(pkg));
       prints("Packager:       %s\n", alpm_pkg_get_packager(pkg));
       printt("Build Date:     %s\n", alpm_pkg_get_builddate(pkg));
@@ -505,6 +464,25 @@ int main(int argc, char **argv) {
             alpm_list_copy(alpm_db_get_pkgcache(i->data)));
   }
 
+  if (removable_size && (!(localgraph = pu_depgraph_new(
+                  alpm_db_get_pkgcache(alpm_get_localdb(handle)),
+                  PU_DEPTYPE_DEPEND))
+          || !(removable_sizes = malloc(sizeof(off_t)
+                  * (localgraph->pkgcount + 1)))
+          || pu_depgraph_removable_sizes(localgraph, removable_sizes) != 0)) {
+    fprintf(stderr, "error: %s\n", strerror(errno));
+    ret = 1;
+    goto cleanup;
+  }
+
+  /* resolve reverse dependencies for all packages up front */
+  if (format == FORMAT_LONG && verbosity >= 2
+      && !(depgraph = pu_depgraph_new(allpkgs, PU_DEPTYPE_ALL))) {
+    fprintf(stderr, "error: %s\n", strerror(errno));
+    ret = 1;
+    goto cleanup;
+  }
+
   for (argv += optind; *argv; ++argv) {
     if (print_pkgspec_info(*argv) != 0) { ret = 1; }
   }
@@ -521,6 +499,9 @@ int main(int argc, char **argv) {
   }
 
 cleanup:
+  pu_depgraph_free(depgraph);
+  free(removable_sizes);
+  pu_depgraph_free(localgraph);
   alpm_list_free(allpkgs);
   alpm_release(handle);
   pu_config_free(config);
@@ -20,12 +20,12 @@
  * IN THE SOFTWARE.
  */
 
-#define _XOPEN_SOURCE
-#define _XOPEN_SOURCE_EXTENDED
+#define _GNU_SOURCE /* tdestroy */
 
 #include <errno.h>
 #include <getopt.h>
 #include <regex.h>
+#include <search.h>
 #include <strings.h>
 #include <time.h>
 
@@ -314,166 +314,244 @@ void print_entry(FILE *stream, pu_log_entry_t *entry) {
   }
 }
 
-int main(int argc, char **argv) {
-  alpm_list_t *i, *entries = NULL;
-  FILE *f;
-  int ret = 0;
-  int have_stdin = !isatty(fileno(stdin)) && errno != EBADF;
+/* returns non-zero if the entry matches any of the given filters */
+int match_entry(pu_log_entry_t *e) {
+  if (after && e->timestamp.time >= after) {
+    return 1;
+  }
 
-  parse_opts(argc, argv);
-  if (color == 1 && !isatty(fileno(stdout))) {
-    color = 0;
+  if (before && e->timestamp.time <= before) {
+    return 1;
   }
 
-  if (have_stdin) {
-    free(logfile);
-    logfile = strdup("<stdin>");
-    f = stdin;
-  } else if (!(f = fopen(logfile, "r"))) {
-    fprintf(stderr, "error: could not open '%s' for reading (%s)\n",
-        logfile, strerror(errno));
-    ret = 1;
-    goto cleanup;
+  if (caller) {
+    const char *c = e->caller ? e->caller : "";
+    if (alpm_list_find_str(caller, c)) {
+      return 1;
+    }
   }
 
-  entries = pu_log_parse_file(f);
-  fclose(f);
+#define is_alpm(c) (c == NULL || (strcmp(c, "ALPM") != 0 && strcmp(c, "ALPM-SCRIPTLET") != 0))
+  if (commandline && strncasecmp(e->message, "running ", 8) == 0
+      && is_alpm(e->caller)) {
+    return 1;
+  }
+#undef is_alpm
 
-  if (!entries) {
-    fprintf(stderr, "error: could not parse '%s'\n", logfile);
-    ret = 1;
-    goto cleanup;
+  if (warnings) {
+    if (strncmp(e->message, "error: ", 7) == 0
+        || strncmp(e->message, "warning: ", 9) == 0
+        || strncmp(e->message, "note: ", 6) == 0) {
+      return 1;
+    }
   }
 
-  if (list_installed) {
-    alpm_list_t *seen = NULL;
-
-    for (i = alpm_list_last(entries); i; i = alpm_list_previous(i)) {
-      pu_log_entry_t *e = i->data;
-      pu_log_action_t *a = pu_log_action_parse(e->message);
-
-      if (a && !alpm_list_find_str(seen, a->target)) {
-        switch (a->operation) {
-          case PU_LOG_OPERATION_INSTALL:
-          case PU_LOG_OPERATION_REINSTALL:
-          case PU_LOG_OPERATION_UPGRADE:
-          case PU_LOG_OPERATION_DOWNGRADE:
-            printf("%s %s\n", a->target, a->new_version);
-          /* fall through */
-          case PU_LOG_OPERATION_REMOVE:
-            seen = alpm_list_add(seen, strdup(a->target));
-            break;
-        }
+  if (actions) {
+    pu_log_action_t *a = pu_log_action_parse(e->message);
+    if (a) {
+      const char *op = NULL;
+      switch (a->operation) {
+        case PU_LOG_OPERATION_INSTALL:
+          op = "install";
+          break;
+        case PU_LOG_OPERATION_REINSTALL:
+          op = "reinstall";
+          break;
+        case PU_LOG_OPERATION_UPGRADE:
+          op = "upgrade";
+          break;
+        case PU_LOG_OPERATION_DOWNGRADE:
+          op = "downgrade";
+          break;
+        case PU_LOG_OPERATION_REMOVE:
+          op = "remove";
+          break;
       }
       pu_log_action_free(a);
+      if (alpm_list_find_str(actions, "all")
+          || alpm_list_find_str(actions, op)) {
+        return 1;
+      }
     }
-    FREELIST(seen);
-  } else if (!after && !before && !pkgs && !caller && !actions && !warnings
-      && !commandline && !grep) {
-    for (i = entries; i; i = i->next) {
-      pu_log_entry_t *e = i->data;
-      print_entry(stdout, e);
+  }
+
+  if (grep) {
+    alpm_list_t *j;
+    for (j = grep; j; j = alpm_list_next(j)) {
+      if (regexec(j->data, e->message, 0, NULL, 0) == 0) {
+        return 1;
+      }
     }
+  }
+
+  if (pkgs) {
+    pu_log_action_t *a = pu_log_action_parse(e->message);
+    int found = (a && alpm_list_find_str(pkgs, a->target));
+    pu_log_action_free(a);
+    if (found) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+struct pkglist_entry_t {
+  char *target;
+  char *version;
+  size_t seq;
+};
+
+int pkglist_entry_cmp(const void *p1, const void *p2) {
+  const struct pkglist_entry_t *e1 = p1, *e2 = p2;
+  return strcmp(e1->target, e2->target);
+}
+
+int pkglist_entry_seq_cmp(const void *p1, const void *p2) {
+  const struct pkglist_entry_t *e1 = *(void * const *) p1;
+  const struct pkglist_entry_t *e2 = *(void * const *) p2;
+  return e1->seq < e2->seq ? 1 : e1->seq > e2->seq ? -1 : 0;
+}
+
+struct pkglist_entry_t **pkglist_sorted = NULL;
+size_t pkglist_count = 0;
+
+void pkglist_collect(const void *node, VISIT visit, int depth) {
+  (void)depth;
+  if (visit == postorder || visit == leaf) {
+    pkglist_sorted[pkglist_count++] = *(struct pkglist_entry_t * const *) node;
+  }
+}
+
+void pkglist_entry_free(void *node) {
+  struct pkglist_entry_t *e = node;
+  free(e->target);
+  free(e->version);
+  free(e);
+}
+
+/* record the most recent action for each package as entries stream past,
+ * memory use is bounded by the number of packages rather than the log */
+int pkglist_add(void **root, size_t *count, size_t seq, pu_log_action_t *a) {
+  struct pkglist_entry_t key = { .target = a->target }, **found, *e;
+  char *version = NULL;
+
+  if (a->operation != PU_LOG_OPERATION_REMOVE
+      && (version = strdup(a->new_version)) == NULL) {
+    return -1;
+  }
+
+  if ((found = tfind(&key, root, pkglist_entry_cmp))) {
+    e = *found;
+    free(e->version);
   } else {
-    for (i = entries; i; i = i->next) {
-      pu_log_entry_t *e = i->data;
+    if ((e = calloc(1, sizeof(*e))) == NULL
+        || (e->target = strdup(a->target)) == NULL
+        || tsearch(e, root, pkglist_entry_cmp) == NULL) {
+      if (e) { free(e->target); }
+      free(e);
+      free(version);
+      return -1;
+    }
+    (*count)++;
+  }
+  e->version = version;
+  e->seq = seq;
+  return 0;
+}
 
-      if (after && mktime(&e->timestamp.tm) >= after) {
-        print_entry(stdout, e);
-        continue;
-      }
+int print_pkglist(pu_log_reader_t *reader) {
+  void *root = NULL;
+  size_t count = 0, seq = 0, n;
+  pu_log_entry_t *e;
+  int ret = 0;
 
-      if (before && mktime(&e->timestamp.tm) <= before) {
-        print_entry(stdout, e);
-        continue;
-      }
+  while ((e = pu_log_reader_next_view(reader))) {
+    pu_log_action_t *a = pu_log_action_parse(e->message);
+    if (a && pkglist_add(&root, &count, seq, a) != 0) {
+      fprintf(stderr, "error: %s\n", strerror(errno));
+      ret = 1;
+    }
+    pu_log_action_free(a);
+    seq++;
+  }
+  if (!reader->eof || seq == 0) {
+    fprintf(stderr, "error: could not parse '%s'\n", logfile);
+    ret = 1;
+  }
 
-      if (caller) {
-        const char *c = e->caller ? e->caller : "";
-        if (alpm_list_find_str(caller, c)) {
-          print_entry(stdout, e);
-          continue;
-        }
+  /* print the most recently changed packages first */
+  if ((pkglist_sorted = calloc(count + 1, sizeof(*pkglist_sorted))) == NULL) {
+    fprintf(stderr, "error: %s\n", strerror(errno));
+    ret = 1;
+  } else {
+    twalk(root, pkglist_collect);
+    qsort(pkglist_sorted, pkglist_count, sizeof(*pkglist_sorted),
+        pkglist_entry_seq_cmp);
+    for (n = 0; n < pkglist_count; n++) {
+      if (pkglist_sorted[n]->version) {
+        printf("%s %s\n", pkglist_sorted[n]->target,
+            pkglist_sorted[n]->version);
       }
+    }
+    free(pkglist_sorted);
+  }
 
-#define is_alpm(c) (c == NULL || (strcmp(c, "ALPM") != 0 && strcmp(c, "ALPM-SCRIPTLET") != 0))
-      if (commandline && strncasecmp(e->message, "running ", 8) == 0
-          && is_alpm(e->caller)) {
-        print_entry(stdout, e);
-        continue;
-      }
-#undef is_alpm
+  tdestroy(root, pkglist_entry_free);
+  return ret;
+}
 
-      if (warnings) {
-        if (strncmp(e->message, "error: ", 7) == 0
-            || strncmp(e->message, "warning: ", 9) == 0
-            || strncmp(e->message, "note: ", 6) == 0) {
-          print_entry(stdout, e);
-          continue;
-        }
-      }
+int main(int argc, char **argv) {
+  pu_log_reader_t *reader = NULL;
+  pu_log_entry_t *e;
+  size_t count = 0;
+  int ret = 0, filter;
+  int have_stdin = !isatty(fileno(stdin)) && errno != EBADF;
 
-      if (actions) {
-        pu_log_action_t *a = pu_log_action_parse(e->message);
-        if (a) {
-          const char *op = NULL;
-          switch (a->operation) {
-            case PU_LOG_OPERATION_INSTALL:
-              op = "install";
-              break;
-            case PU_LOG_OPERATION_REINSTALL:
-              op = "reinstall";
-              break;
-            case PU_LOG_OPERATION_UPGRADE:
-              op = "upgrade";
-              break;
-            case PU_LOG_OPERATION_DOWNGRADE:
-              op = "downgrade";
-              break;
-            case PU_LOG_OPERATION_REMOVE:
-              op = "remove";
-              break;
-          }
-          pu_log_action_free(a);
-          if (alpm_list_find_str(actions, "all")
-              || alpm_list_find_str(actions, op)) {
-            print_entry(stdout, e);
-            continue;
-          }
-        }
-      }
+  parse_opts(argc, argv);
+  if (color == 1 && !isatty(fileno(stdout))) {
+    color = 0;
+  }
 
-      if (grep) {
-        alpm_list_t *j;
-        for (j = grep; j; j = alpm_list_next(j)) {
-          if (regexec(j->data, e->message, 0, NULL, 0) == 0) {
-            print_entry(stdout, e);
-            break;
-          }
-        }
-        if (j) {
-          continue;
-        }
-      }
+  if (have_stdin) {
+    free(logfile);
+    logfile = strdup("<stdin>");
+    reader = pu_log_reader_open_stream(stdin);
+  } else {
+    reader = pu_log_reader_open_file(logfile);
+  }
+  if (reader == NULL) {
+    fprintf(stderr, "error: could not open '%s' for reading (%s)\n",
+        logfile, strerror(errno));
+    ret = 1;
+    goto cleanup;
+  }
 
-      if (pkgs) {
-        pu_log_action_t *a = pu_log_action_parse(e->message);
-        int found = (a && alpm_list_find_str(pkgs, a->target));
-        pu_log_action_free(a);
-        if (found) {
-          print_entry(stdout, e);
-          continue;
-        }
-      }
+  if (list_installed) {
+    ret = print_pkglist(reader);
+    goto cleanup;
+  }
+
+  filter = after || before || pkgs || caller || actions || warnings
+    || commandline || grep;
+
+  /* entries are filtered and printed as they are read */
+  while ((e = pu_log_reader_next_view(reader))) {
+    if (!filter || match_entry(e)) {
+      print_entry(stdout, e);
     }
+    count++;
+  }
+  if (!reader->eof || count == 0) {
+    fprintf(stderr, "error: could not parse '%s'\n", logfile);
+    ret = 1;
   }
 
 cleanup:
   FREELIST(pkgs);
   FREELIST(actions);
   FREELIST(caller);
-  alpm_list_free_inner(entries, (alpm_list_fn_free) pu_log_entry_free);
-  alpm_list_free(entries);
+  pu_log_reader_free(reader);
   alpm_list_free_inner(grep, (alpm_list_fn_free) regfree);
   FREELIST(grep);
   free(logfile);
@@ -20,7 +20,6 @@
  * IN THE SOFTWARE.
  */
 
-#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
@@ -216,132 +215,313 @@ void free_pkg(alpm_pkg_t *p) {
   alpm_pkg_free(p);
 }
 
-alpm_list_t *load_cache_pkgs(alpm_handle_t *handle) {
-  alpm_list_t *i, *cache_pkgs = NULL;
-  puts("Loading cache packages...");
+/* a cache file indexed by the name-version it contains, according to its
+ * filename unless its metadata has been read */
+struct cache_file {
+  char *path;
+  char *key;           /* "<name>-<version>", NULL until known */
+  char *arch;
+  unsigned long hash;
+  alpm_pkg_t *pkg;     /* loaded on demand */
+  int used;
+  int unusable;        /* could not be loaded */
+  struct cache_file *next;
+};
+
+struct cache_index {
+  struct cache_file **buckets;
+  size_t bucketcount;
+  alpm_list_t *files;
+  int unnamed;         /* files whose names could not be parsed */
+};
+
+int arch_is_allowed(const char *want, const char *have) {
+  alpm_list_t *allowed_arch = alpm_option_get_architectures(handle);
+  if (want) {
+    return have && strcmp(want, have) == 0;
+  } else if (have && allowed_arch && !alpm_list_find_str(allowed_arch, have)
+      && strcmp(have, "any") != 0) {
+    /* needle has no architecture and package is not installable */
+    return 0;
+  }
+  return 1;
+}
+
+void cache_index_add(struct cache_index *index, struct cache_file *cf) {
+  size_t slot;
+  cf->hash = _pu_hash_sdbm(cf->key);
+  slot = cf->hash & (index->bucketcount - 1);
+  cf->next = index->buckets[slot];
+  index->buckets[slot] = cf;
+}
+
+void cache_index_remove(struct cache_index *index, struct cache_file *cf) {
+  struct cache_file **c = &index->buckets[cf->hash & (index->bucketcount - 1)];
+  for (; *c; c = &(*c)->next) {
+    if (*c == cf) {
+      *c = cf->next;
+      break;
+    }
+  }
+}
+
+void free_cache_file(struct cache_file *cf) {
+  if (cf == NULL) { return; }
+  if (!cf->used) { alpm_pkg_free(cf->pkg); }
+  free(cf->path);
+  free(cf->key);
+  free(cf->arch);
+  free(cf);
+}
+
+void free_cache_index(struct cache_index *index) {
+  if (index == NULL) { return; }
+  alpm_list_free_inner(index->files, (alpm_list_fn_free) free_cache_file);
+  alpm_list_free(index->files);
+  free(index->buckets);
+  free(index);
+}
+
+struct cache_file *new_cache_file(const char *dir, pu_cache_entry_t *entry) {
+  struct cache_file *cf = calloc(1, sizeof(struct cache_file));
+  if (cf == NULL
+      || (cf->path = pu_asprintf("%s%s", dir, entry->filename)) == NULL) {
+    free_cache_file(cf);
+    return NULL;
+  }
+  if (entry->name && entry->version
+      && ((cf->key = pu_asprintf("%s-%s", entry->name, entry->version)) == NULL
+        || (entry->arch && (cf->arch = strdup(entry->arch)) == NULL))) {
+    free_cache_file(cf);
+    return NULL;
+  }
+  return cf;
+}
+
+struct cache_index *index_cache_dirs(alpm_handle_t *handle) {
+  struct cache_index *index;
+  alpm_list_t *i;
+  char *indexdir = pu_index_dir(NULL);
+  size_t count = 0;
+
+  if ((index = calloc(1, sizeof(struct cache_index))) == NULL) {
+    pu_ui_error("%s", strerror(errno));
+    free(indexdir);
+    return NULL;
+  }
+
+  puts("Reading cache directories...");
   for (i = alpm_option_get_cachedirs(handle); i; i = i->next) {
     const char *path = i->data;
-    DIR *dir = opendir(path);
-    struct dirent *entry;
-    if (!dir) {
-      pu_ui_warn("could not open cache dir '%s' (%s)", path, strerror(errno));
+    char *idxpath = indexdir ? pu_cache_index_path(indexdir, path) : NULL;
+    pu_cache_index_t *cidx = pu_cache_index_update(idxpath, path);
+    size_t n;
+
+    free(idxpath);
+    if (cidx == NULL) {
+      pu_ui_warn("could not read cache dir '%s' (%s)", path, strerror(errno));
       continue;
     }
-    errno = 0;
-    while ((entry = readdir(dir))) {
-      size_t path_len;
-      char *filename, *name = entry->d_name;
-      alpm_pkg_t *pkg = NULL;
+    for (n = 0; n < cidx->count; n++) {
+      pu_cache_entry_t *entry = &cidx->entries[n];
+      const char *name = entry->filename;
+      struct cache_file *cf;
 
-      if (strcmp(".", name) == 0 || strcmp("..", name) == 0) {
+      if (entry->isdir) {
         continue;
       }
       if (strlen(name) >= 4 && strcmp(name + strlen(name) - 4, ".sig") == 0) {
         continue;
       }
 
-      path_len = strlen(path) + strlen(name);
-      filename = malloc(path_len + 1);
-      sprintf(filename, "%s%s", path, entry->d_name);
-      if (alpm_pkg_load(handle, filename, 1, 0, &pkg) == 0) {
-        alpm_list_append(&cache_pkgs, pkg);
-      } else {
-        pu_ui_warn("could not load package '%s' (%s)",
-            filename, alpm_strerror(alpm_errno(handle)));
+      if ((cf = new_cache_file(path, entry)) == NULL
+          || alpm_list_append(&index->files, cf) == NULL) {
+        pu_ui_error("%s", strerror(errno));
+        free_cache_file(cf);
+        pu_cache_index_close(cidx);
+        free_cache_index(index);
+        free(indexdir);
+        return NULL;
       }
-      free(filename);
-    }
-    if (errno != 0) {
-      pu_ui_warn("could not read cache dir '%s' (%s)", path, strerror(errno));
+      if (cf->key == NULL) {
+        index->unnamed++;
+      }
+      count++;
     }
-    closedir(dir);
+    pu_cache_index_close(cidx);
+  }
+  free(indexdir);
+
+  /* keep the load factor at or below one half */
+  for (index->bucketcount = 16; index->bucketcount < count * 2;
+      index->bucketcount *= 2);
+  if ((index->buckets = calloc(index->bucketcount,
+              sizeof(struct cache_file *))) == NULL) {
+    pu_ui_error("%s", strerror(errno));
+    free_cache_index(index);
+    return NULL;
+  }
+  for (i = index->files; i; i = i->next) {
+    struct cache_file *cf = i->data;
+    if (cf->key) { cache_index_add(index, cf); }
   }
-  return cache_pkgs;
+
+  return index;
 }
 
-alpm_list_t *find_cached_pkg(alpm_pkg_t *pkg, alpm_list_t *cache_pkgs) {
-  const char *name = alpm_pkg_get_name(pkg), *ver = alpm_pkg_get_version(pkg);
-  alpm_list_t *i, *found = NULL;
-  alpm_list_t *allowed_arch = alpm_option_get_architectures(handle);
-  for (i = cache_pkgs; i; i = i->next) {
-    if (strcmp(name, alpm_pkg_get_name(i->data)) != 0
-        || strcmp(ver, alpm_pkg_get_version(i->data)) != 0) {
-      /* name/version don't match */
-      continue;
-    } else if (alpm_pkg_get_arch(pkg)
-        && strcmp(alpm_pkg_get_arch(pkg), alpm_pkg_get_arch(i->data)) != 0) {
-      /* architecture doesn't match */
-      continue;
-    } else if (alpm_pkg_get_arch(pkg) == NULL
-        && alpm_pkg_get_arch(i->data) != NULL
-        && allowed_arch
-        && !alpm_list_find_str(allowed_arch, alpm_pkg_get_arch(i->data))
-        && strcmp(alpm_pkg_get_arch(i->data), "any") != 0) {
-      /* needle has no architecture and package is not installable */
+int load_cache_file(alpm_handle_t *handle, struct cache_file *cf) {
+  if (cf->pkg) { return 0; }
+  if (alpm_pkg_load(handle, cf->path, 1, 0, &cf->pkg) != 0) {
+    pu_ui_warn("could not load package '%s' (%s)",
+        cf->path, alpm_strerror(alpm_errno(handle)));
+    cf->pkg = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+/* (re)index a loaded file by its contents rather than its filename */
+int index_loaded_file(struct cache_index *index, struct cache_file *cf) {
+  const char *arch = alpm_pkg_get_arch(cf->pkg);
+  free(cf->key);
+  free(cf->arch);
+  cf->arch = NULL;
+  if ((cf->key = pu_asprintf("%s-%s", alpm_pkg_get_name(cf->pkg),
+              alpm_pkg_get_version(cf->pkg))) == NULL
+      || (arch && (cf->arch = strdup(arch)) == NULL)) {
+    pu_ui_error("%s", strerror(errno));
+    cf->unusable = 1;
+    return -1;
+  }
+  cache_index_add(index, cf);
+  return 0;
+}
+
+/* files that don't follow the package naming scheme can only be matched by
+ * their contents, load them all the first time they are needed */
+void index_unnamed_files(alpm_handle_t *handle, struct cache_index *index) {
+  alpm_list_t *i;
+  for (i = index->files; i && index->unnamed; i = i->next) {
+    struct cache_file *cf = i->data;
+    if (cf->key) { continue; }
+    index->unnamed--;
+    if (load_cache_file(handle, cf) != 0) { continue; }
+    index_loaded_file(index, cf);
+  }
+}
+
+alpm_list_t *find_cache_files(struct cache_index *index, const char *key,
+    const char *arch) {
+  unsigned long hash = _pu_hash_sdbm(key);
+  struct cache_file *cf = index->buckets[hash & (index->bucketcount - 1)];
+  alpm_list_t *found = NULL;
+  for (; cf; cf = cf->next) {
+    if (cf->used || cf->unusable
+        || cf->hash != hash || strcmp(cf->key, key) != 0
+        || !arch_is_allowed(arch, cf->arch)) {
       continue;
-    } else if (alpm_list_append(&found, i) == NULL) {
-      /* package matched but we ran out of memory */
+    } else if (alpm_list_append(&found, cf) == NULL) {
       pu_ui_error("%s", strerror(errno));
       alpm_list_free(found);
       return NULL;
     }
   }
-  switch (alpm_list_count(found)) {
-    case 0:
+  return found;
+}
+
+alpm_pkg_t *find_cached_pkg(alpm_handle_t *handle, struct cache_index *index,
+    alpm_pkg_t *pkg) {
+  const char *name = alpm_pkg_get_name(pkg), *ver = alpm_pkg_get_version(pkg);
+  const char *arch = alpm_pkg_get_arch(pkg);
+  struct cache_file *cf;
+  alpm_list_t *i, *found;
+  char *key;
+
+  if ((key = pu_asprintf("%s-%s", name, ver)) == NULL) {
+    pu_ui_error("%s", strerror(errno));
+    return NULL;
+  }
+  /* files that can't be loaded or hold a different package than their name
+   * says are set aside and the search repeated, falling back to the files
+   * that can only be matched by their contents */
+  while (1) {
+    int retry = 0;
+
+    if ((found = find_cache_files(index, key, arch)) == NULL
+        && index->unnamed) {
+      index_unnamed_files(handle, index);
+      found = find_cache_files(index, key, arch);
+    }
+    if (found == NULL) {
       pu_ui_warn("unable to locate cached package for '%s-%s'", name, ver);
+      free(key);
       return NULL;
-    case 1:
-      i = found->data;
+    }
+
+    for (i = found; i; i = i->next) {
+      cf = i->data;
+      if (load_cache_file(handle, cf) != 0) {
+        cf->unusable = 1;
+        retry = 1;
+      } else if (strcmp(name, alpm_pkg_get_name(cf->pkg)) != 0
+          || strcmp(ver, alpm_pkg_get_version(cf->pkg)) != 0
+          || !arch_is_allowed(arch, alpm_pkg_get_arch(cf->pkg))) {
+        pu_ui_warn("cached package '%s' does not match its filename",
+            cf->path);
+        cache_index_remove(index, cf);
+        index_loaded_file(index, cf);
+        retry = 1;
+      }
+    }
+    if (retry) {
       alpm_list_free(found);
-      return i;
-    default:
+      continue;
+    }
+
+    if (found->next) {
       pu_ui_warn("multiple packages found for '%s-%s'", name, ver);
       for (i = found; i; i = i->next) {
-        alpm_list_t *j = i->data;
-        fprintf(stderr, "  %s\n", alpm_pkg_get_filename(j->data));
+        cf = i->data;
+        fprintf(stderr, "  %s\n", cf->path);
       }
       alpm_list_free(found);
+      free(key);
       return NULL;
-  }
-}
-
-void _pu_list_append_item(alpm_list_t **list, alpm_list_t *item) {
-  item->next = NULL;
+    }
 
-  /* Special case: the input list is empty */
-  if (*list == NULL) {
-    *list = item;
-    item->prev = item;
-  } else {
-    alpm_list_t *lp = alpm_list_last(*list);
-    lp->next = item;
-    item->prev = lp;
-    (*list)->prev = item;
+    cf = found->data;
+    alpm_list_free(found);
+    free(key);
+    cf->used = 1;
+    return cf->pkg;
   }
 }
 
 alpm_list_t *find_cached_pkgs(alpm_handle_t *handle, alpm_list_t *pkgnames) {
-  alpm_list_t *i, *packages = NULL, *cache_files = load_cache_pkgs(handle);
+  alpm_list_t *i, *packages = NULL;
+  struct cache_index *index = index_cache_dirs(handle);
   int error = 0;
 
-  if (cache_files == NULL) {
+  if (index == NULL) {
+    return NULL;
+  } else if (index->files == NULL) {
     pu_ui_error("no cached packages found");
+    free_cache_index(index);
     return NULL;
   }
 
   for (i = pkgnames; i; i = i->next) {
-    alpm_list_t *match = find_cached_pkg(i->data, cache_files);
+    alpm_pkg_t *match = find_cached_pkg(handle, index, i->data);
     if (match == NULL) {
       error = 1;
-      continue;
-    } else {
-      cache_files = alpm_list_remove_item(cache_files, match);
-      _pu_list_append_item(&packages, match);
+    } else if (alpm_list_append(&packages, match) == NULL) {
+      pu_ui_error("%s", strerror(errno));
+      alpm_pkg_free(match);
+      error = 1;
     }
   }
 
-  alpm_list_free_inner(cache_files, (alpm_list_fn_free) free_pkg);
-  alpm_list_free(cache_files);
+  free_cache_index(index);
   if (!error) {
     return packages;
   } else {
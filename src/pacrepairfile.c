@@ -50,6 +50,7 @@ enum longopt_flags {
 pu_config_t *config = NULL;
 alpm_handle_t *handle = NULL;
 alpm_list_t *packages = NULL;
+pu_mtree_index_t **mtrees = NULL;
 int _fix_gid = 0, _fix_mode = 0, _fix_mtime = 0, _fix_uid = 0;
 int verbose = 1;
 const char *sysroot = NULL;
@@ -175,8 +176,8 @@ int _fchmodat(int fd, const char *path, mode_t mode, int flag) {
   return ret;
 }
 
-int fix_mode(const char *path, struct archive_entry *entry) {
-  mode_t m = archive_entry_perm(entry);
+int fix_mode(const char *path, pu_mtree_t *entry) {
+  mode_t m = entry->mode & 07777;
   if (_fchmodat(AT_FDCWD, path, m, AT_SYMLINK_NOFOLLOW) != 0) {
     pu_ui_warn("%s: unable to set permissions (%s)", path, strerror(errno));
     return 1;
@@ -186,8 +187,8 @@ int fix_mode(const char *path, struct archive_entry *entry) {
   return 0;
 }
 
-int fix_mtime(const char *path, struct archive_entry *entry) {
-  time_t t = archive_entry_mtime(entry);
+int fix_mtime(const char *path, pu_mtree_t *entry) {
+  time_t t = entry->mtime;
   struct timespec times[2] = { { 0, UTIME_OMIT }, { t, 0 } };
 
   if (utimensat(AT_FDCWD, path, times, AT_SYMLINK_NOFOLLOW) != 0) {
@@ -201,8 +202,8 @@ int fix_mtime(const char *path, struct archive_entry *entry) {
   return 0;
 }
 
-int fix_uid(const char *path, struct archive_entry *entry) {
-  uid_t u = archive_entry_uid(entry);
+int fix_uid(const char *path, pu_mtree_t *entry) {
+  uid_t u = entry->uid;
   if (fchownat(AT_FDCWD, path, u, -1, AT_SYMLINK_NOFOLLOW) != 0) {
     pu_ui_warn("%s: unable to set uid (%s)", path, strerror(errno));
     return 1;
@@ -213,8 +214,8 @@ int fix_uid(const char *path, struct archive_entry *entry) {
   return 0;
 }
 
-int fix_gid(const char *path, struct archive_entry *entry) {
-  gid_t g = archive_entry_gid(entry);
+int fix_gid(const char *path, pu_mtree_t *entry) {
+  gid_t g = entry->gid;
   if (fchownat(AT_FDCWD, path, -1, g, AT_SYMLINK_NOFOLLOW) != 0) {
     pu_ui_warn("%s: unable to set gid (%s)", path, strerror(errno));
     return 1;
@@ -286,6 +287,7 @@ char *lrealpath(const char *path, char *resolved_path) {
 
 int fix_file(const char *file) {
   alpm_list_t *i;
+  size_t pkgidx;
   char *rpath = lrealpath(file, NULL);
   const char *root = alpm_option_get_root(handle);
   size_t rootlen = strlen(root);
@@ -307,29 +309,24 @@ int fix_file(const char *file) {
     return 1;
   }
 
-  for (i = packages; i; i = alpm_list_next(i)) {
+  for (i = packages, pkgidx = 0; i; i = alpm_list_next(i), pkgidx++) {
     alpm_filelist_t *filelist = alpm_pkg_get_files(i->data);
     if (pu_filelist_contains_path(filelist, rpath + rootlen)) {
-      struct archive *mtree = alpm_pkg_mtree_open(i->data);
-      if (mtree) {
-        struct archive_entry *entry;
-        while (alpm_pkg_mtree_next(i->data, mtree, &entry) == ARCHIVE_OK) {
-          int ret = 0;
-          const char *ppath = archive_entry_pathname(entry);
-          if (strncmp("./", ppath, 2) == 0) { ppath += 2; }
-
-          if (pu_pathcmp(rpath + rootlen, ppath) != 0) { continue; }
-
-          if (_fix_uid && fix_uid(rpath, entry) != 0) { ret = 1; }
-          if (_fix_gid && fix_gid(rpath, entry) != 0) { ret = 1; }
-          if (_fix_mode && fix_mode(rpath, entry) != 0) { ret = 1; }
-          if (_fix_mtime && fix_mtime(rpath, entry) != 0) { ret = 1; }
-
-          alpm_pkg_mtree_close(i->data, mtree);
-          free(rpath);
-          return ret;
-        }
-        alpm_pkg_mtree_close(i->data, mtree);
+      pu_mtree_t *entry;
+      int ret = 0;
+
+      /* load each package's mtree once and reuse it for later files */
+      if (mtrees[pkgidx] == NULL) {
+        mtrees[pkgidx] = pu_mtree_index_load_package(handle, i->data);
+      }
+      if ((entry = pu_mtree_index_find(mtrees[pkgidx], rpath + rootlen))) {
+        if (_fix_uid && fix_uid(rpath, entry) != 0) { ret = 1; }
+        if (_fix_gid && fix_gid(rpath, entry) != 0) { ret = 1; }
+        if (_fix_mode && fix_mode(rpath, entry) != 0) { ret = 1; }
+        if (_fix_mtime && fix_mtime(rpath, entry) != 0) { ret = 1; }
+
+        free(rpath);
+        return ret;
       }
     }
   }
@@ -341,6 +338,7 @@ int fix_file(const char *file) {
 
 int main(int argc, char **argv) {
   int ret = 0;
+  size_t pkgcount = 0;
   int have_stdin = !isatty(fileno(stdin)) && errno != EBADF;
 
   if (!(config = parse_opts(argc, argv))) {
@@ -378,6 +376,9 @@ int main(int argc, char **argv) {
     goto cleanup;
   }
 
+  pkgcount = alpm_list_count(packages);
+  ASSERT(mtrees = calloc(pkgcount, sizeof(pu_mtree_index_t *)));
+
   while (optind < argc) {
     if (fix_file(argv[optind++]) != 0 ) { ret = 1; }
   }
@@ -397,6 +398,11 @@ int main(int argc, char **argv) {
   }
 
 cleanup:
+  if (mtrees) {
+    size_t n;
+    for (n = 0; n < pkgcount; n++) { pu_mtree_index_free(mtrees[n]); }
+    free(mtrees);
+  }
   alpm_list_free(packages);
   alpm_release(handle);
   pu_config_free(config);
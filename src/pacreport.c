@@ -29,6 +29,8 @@
 #include <math.h>
 #include <fnmatch.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 
 #include <pacutils.h>
 
@@ -43,17 +45,26 @@ alpm_handle_t *handle;
 alpm_list_t *groups = NULL, *ignore = NULL, *pkg_ignore = NULL;
 int missing_files = 0, backup_files = 0, orphan_files = 0, optional_deps = 0;
 int show_optional_for = 0;
+int jobs = 0;
+int cache_keep = 3;
 char *dbext = NULL;
 const char *sysroot = NULL;
+const char **owned_files = NULL;
+size_t owned_files_count = 0;
+pu_provider_index_t *localprovs = NULL;
+pu_depgraph_t *localgraph = NULL;
+off_t *chain_sizes = NULL;
 
 enum longopt_flags {
   FLAG_BACKUPS = 1000,
   FLAG_CACHEDIR,
+  FLAG_CACHE_KEEP,
   FLAG_CONFIG,
   FLAG_DBEXT,
   FLAG_DBPATH,
   FLAG_GROUP,
   FLAG_HELP,
+  FLAG_JOBS,
   FLAG_MISSING_FILES,
   FLAG_OPTIONAL_DEPS,
   FLAG_ORPHANS,
@@ -106,75 +117,18 @@ struct pkg_file_t *pkg_file_new(alpm_pkg_t *pkg, alpm_file_t *file) {
  *
  * @param handle
  * @param pkg
- * @param depchain list of already processed packages
  *
  * @return size in bytes
  */
 off_t get_pkg_chain_size(alpm_handle_t *handle, alpm_pkg_t *pkg) {
-  alpm_db_t *localdb = alpm_get_localdb(handle);
-  alpm_list_t *localpkgs = alpm_db_get_pkgcache(localdb);
-  alpm_list_t *depchain = alpm_list_add(NULL, pkg);
-  off_t size = 0;
-  alpm_list_t *d;
-
-
-  for (d = depchain; d; d = d->next) {
-    alpm_pkg_t *p = d->data;
-    alpm_list_t *dep, *deps = alpm_list_copy(alpm_pkg_get_depends(p));
-    alpm_list_t *r, *rb;
-
-    if (optional_deps) {
-      deps = alpm_list_join(deps, alpm_list_copy(alpm_pkg_get_optdepends(p)));
-    }
-
-    size += alpm_pkg_get_isize(p);
-
-    for (dep = deps; dep; dep = dep->next) {
-      char *depstring = alpm_dep_compute_string(dep->data);
-      alpm_pkg_t *satisfier = alpm_find_satisfier(localpkgs, depstring);
-      free(depstring);
-
-      /* move on if the dependency was installed explicitly or already
-       * processed */
-      if (!satisfier
-          || alpm_pkg_get_reason(satisfier) == ALPM_PKG_REASON_EXPLICIT
-          || alpm_list_find_ptr(depchain, satisfier)) {
-        continue;
-      }
-
-      /* check if the dependency is required outside the chain */
-      int required = 0;
-      rb = alpm_pkg_compute_requiredby(satisfier);
-      for (r = rb; r; r = r->next) {
-        alpm_pkg_t *p = alpm_db_get_pkg(localdb, r->data);
-        if (!alpm_list_find_ptr(depchain, p)) {
-          required = 1;
-          break;
-        }
-      }
-      FREELIST(rb);
-
-      /* check if the dependency is optionally required outside the chain */
-      if (!required && optional_deps) {
-        rb = alpm_pkg_compute_optionalfor(satisfier);
-        for (r = rb; r; r = r->next) {
-          alpm_pkg_t *p = alpm_db_get_pkg(localdb, r->data);
-          if (!alpm_list_find_ptr(depchain, p)) {
-            required = 1;
-            break;
-          }
-        }
-        FREELIST(rb);
-      }
-
-      if (!required) {
-        depchain = alpm_list_add(depchain, satisfier);
-      }
-    }
+  size_t idx;
+  (void)handle;
+  /* packages that are not installed, such as missing group members, have
+   * no dependency chain of their own */
+  if (pu_depgraph_pkg_index(localgraph, pkg, &idx) != 0) {
+    return alpm_pkg_get_isize(pkg);
   }
-
-  alpm_list_free(depchain);
-  return size;
+  return chain_sizes[idx];
 }
 
 void print_pkg_info(alpm_handle_t *handle, alpm_pkg_t *pkg,
@@ -234,61 +188,121 @@ void print_pkglist(alpm_handle_t *handle, alpm_list_t *pkgs) {
   }
 }
 
-int _pu_pkg_depends_on(alpm_pkg_t *pkg, alpm_pkg_t *dpkg) {
-  return pu_pkg_depends_on(pkg, dpkg)
-      || (optional_deps && pu_pkg_optdepends_on(pkg, dpkg));
+/* group packages that are only needed by a dependency cycle; each group
+ * holds a cycle nothing else depends on and the packages it pulls in */
+static size_t group_cycles(pu_depgraph_t *graph, const unsigned char *needed,
+    size_t *queue, size_t *group) {
+  size_t ngroups = 0, i, j;
+  unsigned char *source;
+
+  if ((source = malloc(graph->pkgcount + 1)) == NULL
+      || pu_depgraph_find_sources(graph, needed, source) != 0) {
+    free(source);
+    return SIZE_MAX;
+  }
+
+  for (i = 0; i < graph->pkgcount; i++) { group[i] = SIZE_MAX; }
+
+  for (i = 0; i < graph->pkgcount; i++) {
+    size_t head = 0, tail = 0;
+    if (needed[i] || group[i] != SIZE_MAX || !source[i]) { continue; }
+
+    /* claim the cycle and everything only it depends on */
+    group[i] = ngroups;
+    queue[tail++] = i;
+    while (head < tail) {
+      size_t count;
+      pu_depgraph_edge_t *e = pu_depgraph_get_deps(graph, queue[head++], &count);
+      for (j = 0; j < count; j++) {
+        if (!needed[e[j].to] && group[e[j].to] == SIZE_MAX) {
+          group[e[j].to] = ngroups;
+          queue[tail++] = e[j].to;
+        }
+      }
+    }
+    ngroups++;
+  }
+
+  free(source);
+  return ngroups;
 }
 
 void print_unneeded_packages(alpm_handle_t *handle) {
   alpm_db_t *localdb = alpm_get_localdb(handle);
-  alpm_list_t *leaves_e = NULL, *leaves_d = NULL;
-  alpm_list_t *connected = NULL, *disconnected = NULL;
+  alpm_list_t *leaves_e = NULL, *leaves_d = NULL, **cycles = NULL;
   alpm_list_t *p, *pkgs = alpm_db_get_pkgcache(localdb);
+  pu_depgraph_t *graph = localgraph;
+  unsigned char *needed = NULL;
+  size_t *queue = NULL, *group = NULL, ngroups = 0, head = 0, tail = 0, i, j;
+
+  if ((needed = calloc(graph->pkgcount + 1, 1)) == NULL
+      || (queue = malloc(sizeof(size_t) * (graph->pkgcount + 1))) == NULL
+      || (group = malloc(sizeof(size_t) * (graph->pkgcount + 1))) == NULL) {
+    fprintf(stderr, "error: %s\n", strerror(errno));
+    goto cleanup;
+  }
 
-  for (p = pkgs; p; p = p->next) {
-    alpm_list_t *rb = alpm_pkg_compute_requiredby(p->data);
-    if (rb == NULL && optional_deps) {
-      rb = alpm_pkg_compute_optionalfor(p->data);
-    }
-    if (rb == NULL) {
+  /* everything reachable from a package nothing depends on is needed */
+  for (i = 0, p = pkgs; p; p = p->next, i++) {
+    size_t count;
+    pu_depgraph_get_rdeps(graph, i, &count);
+    if (count == 0) {
       if (alpm_pkg_get_reason(p->data) == ALPM_PKG_REASON_EXPLICIT) {
         leaves_e = alpm_list_add(leaves_e, p->data);
       } else {
         leaves_d = alpm_list_add(leaves_d, p->data);
       }
+      needed[i] = 1;
+      queue[tail++] = i;
+    }
+  }
+  while (head < tail) {
+    size_t count;
+    pu_depgraph_edge_t *e = pu_depgraph_get_deps(graph, queue[head++], &count);
+    for (j = 0; j < count; j++) {
+      if (!needed[e[j].to]) {
+        needed[e[j].to] = 1;
+        queue[tail++] = e[j].to;
+      }
     }
-    FREELIST(rb);
-  }
-
-  connected = alpm_list_join(alpm_list_copy(leaves_e), alpm_list_copy(leaves_d));
-  disconnected = alpm_list_copy(pkgs);
-  for (p = connected; p; p = p->next) {
-    alpm_list_t *l, *next = NULL;
-    for (l = disconnected; l; l = next) {
-      next = l->next;
-      if (p->data == l->data) {
-        disconnected = alpm_list_remove_item(disconnected, l);
-        free(l);
-      } else if (_pu_pkg_depends_on(p->data, l->data)) {
-        connected = alpm_list_add(connected, l->data);
-        disconnected = alpm_list_remove_item(disconnected, l);
-        free(l);
+  }
+
+  if (tail < graph->pkgcount) {
+    if ((ngroups = group_cycles(graph, needed, queue, group)) == SIZE_MAX
+        || (cycles = calloc(ngroups + 1, sizeof(alpm_list_t *))) == NULL) {
+      fprintf(stderr, "error: %s\n", strerror(errno));
+      ngroups = 0;
+      goto cleanup;
+    }
+    for (i = 0; i < graph->pkgcount; i++) {
+      if (!needed[i]) {
+        cycles[group[i]] = alpm_list_add(cycles[group[i]], graph->pkgs[i]);
       }
     }
   }
 
   printf("Unneeded Packages Installed Explicitly:\n");
   print_pkglist(handle, leaves_e);
-  alpm_list_free(leaves_e);
 
   printf("Unneeded Packages Installed As Dependencies:\n");
   print_pkglist(handle, leaves_d);
-  alpm_list_free(leaves_d);
 
   printf("Unneeded Packages In A Dependency Cycle:\n");
-  print_pkglist(handle, disconnected);
-  alpm_list_free(disconnected);
-  alpm_list_free(connected);
+  for (i = 0; i < ngroups; i++) {
+    if (i) { putchar('\n'); }
+    print_pkglist(handle, cycles[i]);
+  }
+
+cleanup:
+  for (i = 0; i < ngroups; i++) {
+    alpm_list_free(cycles[i]);
+  }
+  free(cycles);
+  alpm_list_free(leaves_e);
+  alpm_list_free(leaves_d);
+  free(needed);
+  free(queue);
+  free(group);
 }
 
 int pkg_is_foreign(alpm_handle_t *handle, alpm_pkg_t *pkg) {
@@ -317,8 +331,6 @@ void print_foreign(alpm_handle_t *handle) {
 }
 
 void print_group_missing(alpm_handle_t *handle, alpm_list_t *groups) {
-  alpm_db_t *localdb = alpm_get_localdb(handle);
-  alpm_list_t *localpkgs = alpm_db_get_pkgcache(localdb);
   alpm_list_t *matches = NULL;
   alpm_list_t *i;
 
@@ -328,8 +340,9 @@ void print_group_missing(alpm_handle_t *handle, alpm_list_t *groups) {
     pkgs = alpm_find_group_pkgs(alpm_get_syncdbs(handle), group);
     for (p = pkgs; p; p = p->next) {
       const char *pkgname = alpm_pkg_get_name(p->data);
+      size_t count;
       if (!alpm_list_find_ptr(matches, p->data)
-          && !alpm_find_satisfier(localpkgs, pkgname)) {
+          && !pu_provider_index_find(localprovs, pkgname, &count)) {
         matches = alpm_list_add(matches, p->data);
       }
     }
@@ -362,28 +375,57 @@ void print_filelist(alpm_handle_t *handle, alpm_list_t *files) {
 void print_missing_files(alpm_handle_t *handle) {
   alpm_db_t *localdb = alpm_get_localdb(handle);
   alpm_list_t *matches = NULL, *p, *pkgs = alpm_db_get_pkgcache(localdb);
-  char path[PATH_MAX], *tail;
-  strncpy(path, alpm_option_get_root(handle), PATH_MAX);
-  size_t len = strlen(path);
-  size_t max = PATH_MAX - len;
-  struct stat sbuf;
-  tail = path + len;
+  const char *root = alpm_option_get_root(handle);
+  size_t rootlen = strlen(root), size = 0;
+  pu_stat_batch_t *batch = pu_stat_batch_new(0);
+  pu_lstat_entry_t *stats = NULL;
+  char *paths = NULL;
 
+  /* stat each package's files together as a single batch */
   for (p = pkgs; p; p = p->next) {
     alpm_filelist_t *files = alpm_pkg_get_files(p->data);
-    size_t i;
+    size_t i, pathsize = 0;
+    char *c;
+
     for (i = 0; i < files->count; ++i) {
-      strncpy(tail, files->files[i].name, max);
-      if (lstat(path, &sbuf) != 0) {
-        if(errno == ENOENT) {
-          struct pkg_file_t *mf = pkg_file_new(p->data, &files->files[i]);
-          matches = alpm_list_add(matches, mf);
-        } else {
-          pu_ui_warn("unable to stat '%s' (%s)", path, strerror(errno));
-        }
+      pathsize += rootlen + strlen(files->files[i].name) + 1;
+    }
+    if (files->count > size) {
+      pu_lstat_entry_t *newstats = realloc(stats,
+          files->count * sizeof(*stats));
+      if (newstats == NULL) {
+        pu_ui_warn("unable to check files (%s)", strerror(errno));
+        break;
+      }
+      stats = newstats;
+      size = files->count;
+    }
+    free(paths);
+    if ((paths = malloc(pathsize)) == NULL && pathsize) {
+      pu_ui_warn("unable to check files (%s)", strerror(errno));
+      break;
+    }
+
+    for (i = 0, c = paths; i < files->count; ++i) {
+      stats[i].path = c;
+      c = stpcpy(stpcpy(c, root), files->files[i].name) + 1;
+    }
+    pu_lstat_batch(batch, stats, files->count);
+
+    for (i = 0; i < files->count; ++i) {
+      if (stats[i].err == ENOENT) {
+        struct pkg_file_t *mf = pkg_file_new(p->data, &files->files[i]);
+        matches = alpm_list_add(matches, mf);
+      } else if (stats[i].err != 0) {
+        pu_ui_warn("unable to stat '%s' (%s)",
+            stats[i].path, strerror(stats[i].err));
       }
     }
   }
+  pu_stat_batch_free(batch);
+  free(paths);
+  free(stats);
+
   puts("Missing Package Files:");
   print_filelist(handle, matches);
   FREELIST(matches);
@@ -456,10 +498,163 @@ off_t get_cache_size(alpm_handle_t *handle, int fd, const char *path,
   return bytes;
 }
 
+int is_cache_entry_installed(alpm_handle_t *handle, pu_cache_entry_t *entry) {
+  alpm_pkg_t *lp;
+  if (entry->name == NULL || entry->version == NULL) {
+    return is_cache_file_installed(handle, entry->filename);
+  }
+  lp = alpm_db_get_pkg(alpm_get_localdb(handle), entry->name);
+  return lp && alpm_pkg_vercmp(alpm_pkg_get_version(lp), entry->version) == 0;
+}
+
+int is_cache_entry_current(alpm_handle_t *handle, pu_cache_entry_t *entry) {
+  alpm_list_t *d;
+  for (d = alpm_get_syncdbs(handle); d; d = d->next) {
+    alpm_pkg_t *sp = alpm_db_get_pkg(d->data, entry->name);
+    if (sp && alpm_pkg_vercmp(alpm_pkg_get_version(sp), entry->version) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* a cached package along with its signature */
+struct cache_pkg {
+  pu_cache_entry_t *entry;
+  pu_version_key_t *version;
+  off_t size;
+};
+
+struct cache_report {
+  off_t total;
+  off_t uninstalled;
+  off_t cleanmethod; /* reclaimable under the configured CleanMethod */
+  off_t keep;        /* reclaimable keeping cache_keep versions */
+};
+
+/* group by name and arch, newest versions first */
+int cache_pkg_cmp(const void *p1, const void *p2) {
+  const struct cache_pkg *c1 = p1, *c2 = p2;
+  int cmp = strcmp(c1->entry->name, c2->entry->name);
+  if (cmp == 0) {
+    cmp = strcmp(c1->entry->arch ? c1->entry->arch : "",
+            c2->entry->arch ? c2->entry->arch : "");
+  }
+  return cmp ? cmp : pu_version_key_cmp(c2->version, c1->version);
+}
+
+int cache_pkg_is_kept(alpm_handle_t *handle, struct cache_pkg *pkg) {
+  int method = config->cleanmethod;
+  return ((method & PU_CONFIG_CLEANMETHOD_KEEP_INSTALLED)
+          && is_cache_entry_installed(handle, pkg->entry))
+      || ((method & PU_CONFIG_CLEANMETHOD_KEEP_CURRENT)
+          && is_cache_entry_current(handle, pkg->entry));
+}
+
+/* sizes of the top level of the cache directory come from its index, which
+ * is only rebuilt if the directory has changed; signatures count towards the
+ * package they belong to when estimating what could be removed */
+int analyze_cache_dir(alpm_handle_t *handle, const char *indexdir,
+    const char *path, pu_version_cache_t *versions, struct cache_report *r) {
+  char *idxpath = indexdir ? pu_cache_index_path(indexdir, path) : NULL;
+  pu_cache_index_t *index = pu_cache_index_update(idxpath, path);
+  struct cache_pkg *pkgs = NULL;
+  size_t *slots = NULL, count = 0, group = 0, i;
+
+  free(idxpath);
+  if (index == NULL) {
+    pu_ui_warn("unable to open cachedir '%s' (%s)", path, strerror(errno));
+    return 0;
+  }
+  if (index->count == 0) {
+    pu_cache_index_close(index);
+    return 0;
+  }
+  if ((pkgs = calloc(index->count, sizeof(struct cache_pkg))) == NULL
+      || (slots = malloc(index->count * sizeof(size_t))) == NULL) {
+    goto error;
+  }
+
+  for (i = 0; i < index->count; i++) {
+    pu_cache_entry_t *entry = &index->entries[i];
+    size_t len = strlen(entry->filename);
+    slots[i] = SIZE_MAX;
+    if (entry->isdir) {
+      char *subdir = pu_asprintf("%s%s%s", path,
+              path[strlen(path) - 1] == '/' ? "" : "/", entry->filename);
+      if (subdir == NULL) { goto error; }
+      r->total += get_cache_size(handle, AT_FDCWD, subdir, &r->uninstalled);
+      free(subdir);
+      continue;
+    }
+
+    r->total += entry->filesize;
+    if (!is_cache_entry_installed(handle, entry)) {
+      r->uninstalled += entry->filesize;
+    }
+
+    if (entry->name && entry->version) {
+      struct cache_pkg *pkg = &pkgs[count];
+      pkg->entry = entry;
+      pkg->size = entry->filesize;
+      if ((pkg->version = pu_version_cache_get(versions,
+                  entry->version)) == NULL) {
+        goto error;
+      }
+      slots[i] = count++;
+    } else if (len > 4 && strcmp(entry->filename + len - 4, ".sig") == 0) {
+      /* packages sort before their signatures */
+      char *pkgfile = strndup(entry->filename, len - 4);
+      pu_cache_entry_t *pe;
+      if (pkgfile == NULL) { goto error; }
+      pe = pu_cache_index_find(index, pkgfile);
+      free(pkgfile);
+      if (pe && slots[pe - index->entries] != SIZE_MAX) {
+        pkgs[slots[pe - index->entries]].size += entry->filesize;
+      }
+    }
+  }
+
+  qsort(pkgs, count, sizeof(struct cache_pkg), cache_pkg_cmp);
+  for (i = 0; i < count; i++) {
+    if (i > 0 && (strcmp(pkgs[i].entry->name, pkgs[i - 1].entry->name) != 0
+            || strcmp(pkgs[i].entry->arch ? pkgs[i].entry->arch : "",
+              pkgs[i - 1].entry->arch ? pkgs[i - 1].entry->arch : "") != 0)) {
+      group = i;
+    }
+    if (i - group >= (size_t) cache_keep) {
+      r->keep += pkgs[i].size;
+    }
+    if (!cache_pkg_is_kept(handle, &pkgs[i])) {
+      r->cleanmethod += pkgs[i].size;
+    }
+  }
+
+  free(pkgs);
+  free(slots);
+  pu_cache_index_close(index);
+  return 0;
+
+error:
+  pu_ui_error("%s", strerror(errno));
+  free(pkgs);
+  free(slots);
+  pu_cache_index_close(index);
+  return -1;
+}
+
 void print_cache_sizes(alpm_handle_t *handle) {
   alpm_list_t *c, *cache_dirs = alpm_option_get_cachedirs(handle);
+  pu_version_cache_t *versions = pu_version_cache_new();
+  char *indexdir = pu_index_dir(NULL);
   size_t pathlen = 0;
 
+  if (versions == NULL) {
+    pu_ui_error("%s", strerror(errno));
+    free(indexdir);
+    return;
+  }
+
   for (c = cache_dirs; c; c = c->next) {
     size_t len = strlen(c->data);
     if (len > pathlen) {
@@ -469,49 +664,187 @@ void print_cache_sizes(alpm_handle_t *handle) {
 
   puts("Package Cache Size:");
   for (c = cache_dirs; c; c = c->next) {
-    off_t uninstalled = 0;
-    char size[10], usize[10];
-    pu_hr_size(get_cache_size(handle, AT_FDCWD, c->data, &uninstalled), size);
-    pu_hr_size(uninstalled, usize);
+    struct cache_report r = { 0, 0, 0, 0 };
+    char size[10], usize[10], csize[10], ksize[10];
+    if (analyze_cache_dir(handle, indexdir, c->data, versions, &r) != 0) {
+      continue;
+    }
+    pu_hr_size(r.total, size);
+    pu_hr_size(r.uninstalled, usize);
+    pu_hr_size(r.cleanmethod, csize);
+    pu_hr_size(r.keep, ksize);
     printf("  %*s %s (%s not installed)\n",
         (int) pathlen, (char *) c->data, size, usize);
+    printf("  %*s %s reclaimable with CleanMethod =%s%s\n",
+        (int) pathlen, "", csize,
+        config->cleanmethod & PU_CONFIG_CLEANMETHOD_KEEP_INSTALLED
+        ? " KeepInstalled" : "",
+        config->cleanmethod & PU_CONFIG_CLEANMETHOD_KEEP_CURRENT
+        ? " KeepCurrent" : "");
+    printf("  %*s %s reclaimable keeping %d version%s of each package\n",
+        (int) pathlen, "", ksize, cache_keep, cache_keep == 1 ? "" : "s");
   }
+
+  pu_version_cache_free(versions);
+  free(indexdir);
 }
 
-int should_ignore_file(alpm_handle_t *handle, const char *path) {
-  const char *root = alpm_option_get_root(handle);
-  size_t rootlen = strlen(root);
+/**
+ * @brief Collects the ignore patterns that apply to the current system.
+ *
+ * Package-specific patterns are only included if the package is installed so
+ * that the filesystem walk does not need to query the database.
+ *
+ * @param handle
+ *
+ * @return list of patterns, which should be freed with alpm_list_free
+ */
+alpm_list_t *get_ignore_patterns(alpm_handle_t *handle) {
   alpm_db_t *ldb = alpm_get_localdb(handle);
-  alpm_list_t *p;
+  alpm_list_t *p, *patterns = alpm_list_copy(ignore);
 
-  for (p = ignore; p; p = p->next) {
-    if (fnmatch(p->data, path + rootlen, 0) == 0) {
-      return 1;
-    }
-  }
   for (p = pkg_ignore; p; p = p->next) {
     struct pkg_ignore_t *pi = p->data;
-    alpm_pkg_t *pkg = alpm_db_get_pkg(ldb, pi->pkgname);
-    if (pkg && fnmatch(pi->ignore, path + rootlen, 0) == 0) {
+    if (alpm_db_get_pkg(ldb, pi->pkgname)) {
+      patterns = alpm_list_add(patterns, pi->ignore);
+    }
+  }
+  return patterns;
+}
+
+int should_ignore_file(alpm_list_t *patterns, const char *path) {
+  alpm_list_t *p;
+  for (p = patterns; p; p = p->next) {
+    if (fnmatch(p->data, path, 0) == 0) {
       return 1;
     }
   }
   return 0;
 }
 
-int file_is_unowned(alpm_handle_t *handle, const char *path) {
+static int _owned_file_cmp(const void *p1, const void *p2) {
+  return strcmp(*(const char **) p1, *(const char **) p2);
+}
+
+/**
+ * @brief Builds a sorted, deduplicated index of every path owned by an
+ * installed package.
+ *
+ * Paths point directly into the local packages' file lists, so the index is
+ * only valid as long as the handle remains open.
+ *
+ * @param handle
+ *
+ * @return 0 on success, -1 on error
+ */
+int load_owned_files(alpm_handle_t *handle) {
   alpm_db_t *ldb = alpm_get_localdb(handle);
   alpm_list_t *p, *pkgs = alpm_db_get_pkgcache(ldb);
+  size_t count = 0, i, j;
+
   for (p = pkgs; p; p = p->next) {
-    if (alpm_filelist_contains(alpm_pkg_get_files(p->data), path + 1)) {
-      return 0;
+    count += alpm_pkg_get_files(p->data)->count;
+  }
+
+  if (count && (owned_files = malloc(count * sizeof(char *))) == NULL) {
+    return -1;
+  }
+
+  for (p = pkgs; p; p = p->next) {
+    alpm_filelist_t *files = alpm_pkg_get_files(p->data);
+    for (i = 0; i < files->count; i++) {
+      owned_files[owned_files_count++] = files->files[i].name;
     }
   }
-  return 1;
+
+  if (owned_files_count == 0) { return 0; }
+
+  qsort(owned_files, owned_files_count, sizeof(char *), _owned_file_cmp);
+
+  /* directories are commonly shared between packages, drop duplicates */
+  for (i = 1, j = 0; i < owned_files_count; i++) {
+    if (strcmp(owned_files[j], owned_files[i]) != 0) {
+      owned_files[++j] = owned_files[i];
+    }
+  }
+  owned_files_count = j + 1;
+
+  return 0;
 }
 
-void _scan_filesystem(alpm_handle_t *handle, const char *dir, int backups,
-    int orphans, alpm_list_t **backups_found, alpm_list_t **orphans_found) {
+int file_is_unowned(const char *path) {
+  const char *relpath = path + 1;
+  return bsearch(&relpath, owned_files, owned_files_count, sizeof(char *),
+          _owned_file_cmp) == NULL;
+}
+
+struct scan_dir_t {
+  char *path;
+  int backups, orphans;
+};
+
+struct scan_ctx_t {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  alpm_list_t *queue;
+  int idle, nthreads;
+  alpm_list_t *ignore;
+  size_t rootlen;
+};
+
+struct scan_worker_t {
+  struct scan_ctx_t *ctx;
+  pthread_t thread;
+  alpm_list_t *backups_found, *orphans_found;
+};
+
+static int scan_queue_push(struct scan_ctx_t *ctx, const char *path,
+    int backups, int orphans) {
+  struct scan_dir_t *sd = malloc(sizeof(struct scan_dir_t));
+  if (sd == NULL || (sd->path = strdup(path)) == NULL) {
+    free(sd);
+    return -1;
+  }
+  sd->backups = backups;
+  sd->orphans = orphans;
+  pthread_mutex_lock(&ctx->lock);
+  ctx->queue = alpm_list_add(ctx->queue, sd);
+  pthread_cond_signal(&ctx->cond);
+  pthread_mutex_unlock(&ctx->lock);
+  return 0;
+}
+
+/* hand a directory off to another thread only if one is waiting for work,
+ * otherwise the current thread descends into it directly */
+static int scan_queue_offer(struct scan_ctx_t *ctx, const char *path,
+    int backups, int orphans) {
+  int starved;
+  pthread_mutex_lock(&ctx->lock);
+  starved = ctx->idle > 0 && ctx->queue == NULL;
+  pthread_mutex_unlock(&ctx->lock);
+  return starved && scan_queue_push(ctx, path, backups, orphans) == 0;
+}
+
+static struct scan_dir_t *scan_queue_pop(struct scan_ctx_t *ctx) {
+  struct scan_dir_t *sd = NULL;
+  pthread_mutex_lock(&ctx->lock);
+  ctx->idle++;
+  while (ctx->queue == NULL && ctx->idle < ctx->nthreads) {
+    pthread_cond_wait(&ctx->cond, &ctx->lock);
+  }
+  if (ctx->queue) {
+    sd = _pu_list_shift(&ctx->queue);
+    ctx->idle--;
+  } else {
+    /* every thread is idle and there is nothing left to do */
+    pthread_cond_broadcast(&ctx->cond);
+  }
+  pthread_mutex_unlock(&ctx->lock);
+  return sd;
+}
+
+static void _scan_filesystem(struct scan_worker_t *w, int dirfd, char *path,
+    size_t len, int backups, int orphans) {
   static char *skip[] = {
     "/etc/ssl/certs",
     "/dev",
@@ -531,62 +864,86 @@ void _scan_filesystem(alpm_handle_t *handle, const char *dir, int backups,
     NULL
   };
 
-  char path[PATH_MAX];
-  char *filename = path + strlen(dir);
-  strcpy(path, dir);
+  struct scan_ctx_t *ctx = w->ctx;
+  char *filename = path + len;
+  struct dirent *entry;
+  DIR *dirp;
 
-  DIR *dirp = opendir(dir);
-  if (!dirp) {
-    fprintf(stderr, "Error opening '%s' (%s).\n", dir, strerror(errno));
+  if ((dirp = fdopendir(dirfd)) == NULL) {
+    fprintf(stderr, "Error opening '%s' (%s).\n", path, strerror(errno));
+    close(dirfd);
     return;
   }
 
-  struct dirent *entry;
   while ((entry = readdir(dirp))) {
-    struct stat buf;
+    size_t namelen;
     char **s;
-    int need_skip = 0;
+    int need_skip = 0, isdir;
 
-    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ) {
+    if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0'
+            || (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) {
       continue;
     }
 
-    strcpy(filename, entry->d_name);
+    namelen = strlen(entry->d_name);
+    if (len + namelen + 2 > PATH_MAX) {
+      fprintf(stderr, "Error reading '%s%s' (%s).\n",
+          path, entry->d_name, strerror(ENAMETOOLONG));
+      continue;
+    }
+    memcpy(filename, entry->d_name, namelen + 1);
 
     for (s = skip; *s && !need_skip; s++) {
       if (strcmp(path, *s) == 0) {
         need_skip = 1;
       }
     }
-    if (need_skip || should_ignore_file(handle, path)) {
+    if (need_skip || should_ignore_file(ctx->ignore, path + ctx->rootlen)) {
       continue;
     }
 
-    if (lstat(path, &buf) != 0) {
-      fprintf(stderr, "Error reading '%s' (%s).\n", path, strerror(errno));
-      continue;
+    if (entry->d_type != DT_UNKNOWN) {
+      isdir = entry->d_type == DT_DIR;
+    } else {
+      struct stat buf;
+      if (fstatat(dirfd, entry->d_name, &buf, AT_SYMLINK_NOFOLLOW) != 0) {
+        fprintf(stderr, "Error reading '%s' (%s).\n", path, strerror(errno));
+        continue;
+      }
+      isdir = S_ISDIR(buf.st_mode);
     }
 
-    if (S_ISDIR(buf.st_mode)) {
-      strcat(filename, "/");
-      if (orphans && file_is_unowned(handle, path)) {
-        *orphans_found = alpm_list_add(*orphans_found, strdup(path));
-        if (backups) {
-          _scan_filesystem(handle, path, backups, 0, backups_found, orphans_found);
+    if (isdir) {
+      int subfd, suborphans = orphans;
+      filename[namelen] = '/';
+      filename[namelen + 1] = '\0';
+      if (orphans && file_is_unowned(path)) {
+        w->orphans_found = alpm_list_add(w->orphans_found, strdup(path));
+        if (!backups) {
+          continue;
         }
-      } else {
-        _scan_filesystem(handle, path, backups, orphans, backups_found, orphans_found);
+        suborphans = 0;
+      }
+      if (scan_queue_offer(ctx, path, backups, suborphans)) {
+        continue;
       }
+      subfd = openat(dirfd, entry->d_name,
+              O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if (subfd < 0) {
+        fprintf(stderr, "Error opening '%s' (%s).\n", path, strerror(errno));
+        continue;
+      }
+      _scan_filesystem(w, subfd, path, len + namelen + 1, backups, suborphans);
     } else {
-      if (orphans && file_is_unowned(handle, path)) {
-        *orphans_found = alpm_list_add(*orphans_found, strdup(path));
+      if (orphans && file_is_unowned(path)) {
+        w->orphans_found = alpm_list_add(w->orphans_found, strdup(path));
       }
 
       if (backups) {
         if (strstr(filename, ".pacnew")
             || strstr(filename, ".pacsave")
             || strstr(filename, ".pacorig")) {
-          *backups_found = alpm_list_add(*backups_found, strdup(path));
+          w->backups_found = alpm_list_add(w->backups_found, strdup(path));
         }
       }
     }
@@ -594,6 +951,89 @@ void _scan_filesystem(alpm_handle_t *handle, const char *dir, int backups,
   closedir(dirp);
 }
 
+static void *scan_worker(void *arg) {
+  struct scan_worker_t *w = arg;
+  struct scan_dir_t *sd;
+  char path[PATH_MAX];
+
+  while ((sd = scan_queue_pop(w->ctx))) {
+    size_t len = strlen(sd->path);
+    int fd = open(sd->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+      fprintf(stderr, "Error opening '%s' (%s).\n", sd->path, strerror(errno));
+    } else if (len + 1 > PATH_MAX) {
+      fprintf(stderr, "Error opening '%s' (%s).\n",
+          sd->path, strerror(ENAMETOOLONG));
+      close(fd);
+    } else {
+      memcpy(path, sd->path, len + 1);
+      _scan_filesystem(w, fd, path, len, sd->backups, sd->orphans);
+    }
+    free(sd->path);
+    free(sd);
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Walks the filesystem from @a dir using up to @a jobs threads.
+ *
+ * Each thread descends depth-first on its own and only hands directories off
+ * to the shared queue while other threads are waiting for work.
+ */
+void walk_filesystem(alpm_handle_t *handle, const char *dir, int backups,
+    int orphans, alpm_list_t **backups_found, alpm_list_t **orphans_found) {
+  struct scan_ctx_t ctx = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .nthreads = jobs,
+    .ignore = get_ignore_patterns(handle),
+    .rootlen = strlen(alpm_option_get_root(handle)),
+  };
+  struct scan_worker_t *workers;
+  int i;
+
+  if ((workers = calloc(jobs, sizeof(struct scan_worker_t))) == NULL) {
+    pu_ui_error("unable to scan filesystem (%s)", strerror(errno));
+    alpm_list_free(ctx.ignore);
+    return;
+  }
+  if (scan_queue_push(&ctx, dir, backups, orphans) != 0) {
+    pu_ui_error("unable to scan filesystem (%s)", strerror(errno));
+    alpm_list_free(ctx.ignore);
+    free(workers);
+    return;
+  }
+
+  /* the calling thread acts as the first worker */
+  for (i = 1; i < jobs; i++) {
+    workers[i].ctx = &ctx;
+    if (pthread_create(&workers[i].thread, NULL, scan_worker, &workers[i])) {
+      pthread_mutex_lock(&ctx.lock);
+      ctx.nthreads = i;
+      pthread_cond_broadcast(&ctx.cond);
+      pthread_mutex_unlock(&ctx.lock);
+      break;
+    }
+  }
+  workers[0].ctx = &ctx;
+  scan_worker(&workers[0]);
+
+  for (i = 0; i < ctx.nthreads; i++) {
+    if (i > 0) {
+      pthread_join(workers[i].thread, NULL);
+    }
+    *backups_found = alpm_list_join(*backups_found, workers[i].backups_found);
+    *orphans_found = alpm_list_join(*orphans_found, workers[i].orphans_found);
+  }
+
+  pthread_mutex_destroy(&ctx.lock);
+  pthread_cond_destroy(&ctx.cond);
+  alpm_list_free(ctx.ignore);
+  free(workers);
+}
+
 void find_backups(alpm_handle_t *handle, alpm_list_t **backups) {
   alpm_list_t *p;
   for (p = alpm_db_get_pkgcache(alpm_get_localdb(handle)); p; p = p->next) {
@@ -619,12 +1059,16 @@ void find_backups(alpm_handle_t *handle, alpm_list_t **backups) {
 void scan_filesystem(alpm_handle_t *handle, int backups, int orphans) {
   char *base_dir = "/etc/";
   alpm_list_t *orphans_found = NULL, *backups_found = NULL;
+  if (orphans && load_owned_files(handle) != 0) {
+    pu_ui_error("unable to index package files (%s)", strerror(errno));
+    return;
+  }
   if (backups > 1 || orphans) {
     base_dir = "/";
   } else {
     find_backups(handle, &backups_found);
   }
-  _scan_filesystem(handle, base_dir, backups, orphans, &backups_found,
+  walk_filesystem(handle, base_dir, backups, orphans, &backups_found,
       &orphans_found);
 
   if (orphans) {
@@ -640,6 +1084,9 @@ void scan_filesystem(alpm_handle_t *handle, int backups, int orphans) {
       }
       FREELIST(orphans_found);
     }
+    free(owned_files);
+    owned_files = NULL;
+    owned_files_count = 0;
   }
 
   if (backups) {
@@ -675,7 +1122,10 @@ void usage(int ret) {
   hputs("");
   hputs("   --backups          list .pac{save,orig,new} files");
   hputs("                      (pass twice for extended search outside /etc)");
+  hputs("   --cache-keep=<n>   versions to keep when estimating reclaimable");
+  hputs("                      cache space (default: 3)");
   hputs("   --group=<GROUP>    list missing group packages");
+  hputs("   --jobs=<n>         number of threads to scan the filesystem with");
   hputs("   --missing-files    list missing package files");
   hputs("   --unowned-files    list unowned files");
   hputs("   --optional-for     list what optionally requires packages");
@@ -702,7 +1152,9 @@ pu_config_t *parse_opts(int argc, char **argv) {
     { "sysroot", required_argument, NULL, FLAG_SYSROOT       },
 
     {"backups", no_argument, NULL, FLAG_BACKUPS       },
+    {"cache-keep", required_argument, NULL, FLAG_CACHE_KEEP    },
     {"group", required_argument, NULL, FLAG_GROUP         },
+    {"jobs", required_argument, NULL, FLAG_JOBS          },
     {"missing-files", no_argument, NULL, FLAG_MISSING_FILES },
     {"unowned-files", no_argument, NULL, FLAG_ORPHANS       },
     {"optional-deps", no_argument, NULL, FLAG_OPTIONAL_DEPS },
@@ -735,9 +1187,29 @@ pu_config_t *parse_opts(int argc, char **argv) {
       case FLAG_BACKUPS:
         ++backup_files;
         break;
+      case FLAG_CACHE_KEEP: {
+        char *end;
+        long k = strtol(optarg, &end, 10);
+        if (*optarg == '\0' || *end != '\0' || k < 0 || k > INT_MAX) {
+          fprintf(stderr, "error: invalid number of versions '%s'\n", optarg);
+          exit(1);
+        }
+        cache_keep = k;
+        break;
+      }
       case FLAG_GROUP:
         groups = alpm_list_add(groups, strdup(optarg));
         break;
+      case FLAG_JOBS: {
+        char *end;
+        long j = strtol(optarg, &end, 10);
+        if (*optarg == '\0' || *end != '\0' || j < 1 || j > 1024) {
+          fprintf(stderr, "error: invalid number of jobs '%s'\n", optarg);
+          exit(1);
+        }
+        jobs = j;
+        break;
+      }
       case FLAG_CACHEDIR:
         FREELIST(config->cachedirs);
         config->cachedirs = alpm_list_add(NULL, strdup(optarg));
@@ -772,6 +1244,11 @@ pu_config_t *parse_opts(int argc, char **argv) {
     }
   }
 
+  if (jobs == 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    jobs = ncpu > 0 ? ncpu : 1;
+  }
+
   if (!pu_ui_config_load_sysroot(config, config_file, sysroot)) {
     fprintf(stderr, "error: could not parse '%s'\n", config_file);
     return NULL;
@@ -840,6 +1317,25 @@ int main(int argc, char **argv) {
   }
   pu_register_syncdbs(handle, config->repos);
 
+  localprovs = pu_provider_index_new(
+          alpm_db_get_pkgcache(alpm_get_localdb(handle)));
+  if (localprovs == NULL) {
+    fprintf(stderr, "error: %s\n", strerror(errno));
+    ret = 1;
+    goto cleanup;
+  }
+
+  localgraph = pu_depgraph_new(alpm_db_get_pkgcache(alpm_get_localdb(handle)),
+          PU_DEPTYPE_DEPEND | (optional_deps ? PU_DEPTYPE_OPTIONAL : 0));
+  if (localgraph == NULL
+      || (chain_sizes = malloc(sizeof(off_t) * (localgraph->pkgcount + 1)))
+      == NULL
+      || pu_depgraph_removable_sizes(localgraph, chain_sizes) != 0) {
+    fprintf(stderr, "error: %s\n", strerror(errno));
+    ret = 1;
+    goto cleanup;
+  }
+
   if (parse_config(SYSCONFDIR "/pacreport.conf") != 0) {
     ret = -1;
     goto cleanup;
@@ -865,6 +1361,9 @@ cleanup:
   FREELIST(ignore);
   alpm_list_free_inner(pkg_ignore, (alpm_list_fn_free) pkg_ignore_free);
   alpm_list_free(pkg_ignore);
+  pu_provider_index_free(localprovs);
+  pu_depgraph_free(localgraph);
+  free(chain_sizes);
   alpm_release(handle);
   pu_config_free(config);
 
@@ -26,8 +26,10 @@
 #include <dirent.h>
 #include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <regex.h>
 #include <math.h>
+#include <unistd.h>
 
 #include <pacutils.h>
 
@@ -42,23 +44,31 @@ alpm_loglevel_t log_level = ALPM_LOG_ERROR | ALPM_LOG_WARNING;
 int srch_cache = 0, srch_local = 0, srch_sync = 0;
 int invert = 0, re = 0, exact = 0, any = 0, exists = 0;
 int osep = '\n', isep = '\n';
-const char *dbext = NULL, *sysroot = NULL;
+long jobs = 0;
+const char *dbext = NULL, *sysroot = NULL, *indexdir = NULL;
 alpm_list_t *repo = NULL, *name = NULL, *description = NULL, *packager = NULL;
 alpm_list_t *base = NULL, *arch = NULL, *url = NULL;
 alpm_list_t *group = NULL, *license = NULL;
 alpm_list_t *ownsfile = NULL;
+alpm_list_t *files_indexes = NULL;
 alpm_list_t *requiredby = NULL;
 alpm_list_t *provides = NULL, *depends = NULL, *optdepends = NULL,
              *conflicts = NULL, *replaces = NULL;
 alpm_list_t *satisfies = NULL;
+pu_version_cache_t *versions = NULL;
 alpm_list_t *isize = NULL, *size = NULL, *dsize = NULL;
 alpm_list_t *builddate = NULL, *installdate = NULL;
 
-typedef off_t (size_accessor) (alpm_pkg_t *pkg);
-typedef alpm_time_t (date_accessor) (alpm_pkg_t *pkg);
-typedef const char *(str_accessor) (alpm_pkg_t *pkg);
-typedef alpm_list_t *(strlist_accessor) (alpm_pkg_t *pkg);
-typedef alpm_list_t *(deplist_accessor) (alpm_pkg_t *pkg);
+struct pkg {
+  alpm_pkg_t *pkg;
+  pu_cache_pkg_t *cached; /* package file read from a cache directory */
+};
+
+typedef off_t (size_accessor) (struct pkg *pkg);
+typedef alpm_time_t (date_accessor) (struct pkg *pkg);
+typedef const char *(str_accessor) (struct pkg *pkg);
+typedef alpm_list_t *(strlist_accessor) (struct pkg *pkg);
+typedef alpm_list_t *(deplist_accessor) (struct pkg *pkg);
 
 enum longopt_flags {
   FLAG_CONFIG = 1000,
@@ -70,6 +80,8 @@ enum longopt_flags {
   FLAG_ROOT,
   FLAG_SYSROOT,
   FLAG_VERSION,
+  FLAG_INDEXDIR,
+  FLAG_JOBS,
 
   FLAG_ARCH,
   FLAG_BASE,
@@ -116,6 +128,17 @@ struct date_cmp {
   enum cmp cmp;
 };
 
+struct files_index {
+  char *repo;
+  pu_files_index_t *index;
+};
+
+void files_index_free(struct files_index *fi) {
+  pu_files_index_close(fi->index);
+  free(fi->repo);
+  free(fi);
+}
+
 void cleanup(int ret) {
   alpm_release(handle);
   pu_config_free(config);
@@ -131,9 +154,12 @@ void cleanup(int ret) {
   FREELIST(license);
 
   FREELIST(ownsfile);
+  alpm_list_free_inner(files_indexes, (alpm_list_fn_free) files_index_free);
+  alpm_list_free(files_indexes);
 
   FREELIST(provides);
   FREELIST(satisfies);
+  pu_version_cache_free(versions);
   FREELIST(url);
   FREELIST(depends);
   FREELIST(optdepends);
@@ -313,8 +339,64 @@ const char *get_dbname(alpm_pkg_t *pkg) {
   return alpm_db_get_name(alpm_pkg_get_db(pkg));
 }
 
-int ptr_cmp(const void *p1, const void *p2) {
-  return p1 < p2 ? -1 : p1 > p2;
+/* field accessors for both alpm packages and cached package files */
+#define PKG_FIELD(type, field, getter, cached) \
+  type pkg_get_##field(struct pkg *p) { \
+    return p->pkg ? getter(p->pkg) : cached; \
+  }
+
+PKG_FIELD(const char *, name, alpm_pkg_get_name, p->cached->name)
+PKG_FIELD(const char *, base, alpm_pkg_get_base, p->cached->base)
+PKG_FIELD(const char *, desc, alpm_pkg_get_desc, p->cached->desc)
+PKG_FIELD(const char *, packager, alpm_pkg_get_packager, p->cached->packager)
+PKG_FIELD(const char *, dbname, get_dbname, NULL)
+PKG_FIELD(const char *, arch, alpm_pkg_get_arch, p->cached->arch)
+PKG_FIELD(const char *, url, alpm_pkg_get_url, p->cached->url)
+PKG_FIELD(alpm_list_t *, groups, alpm_pkg_get_groups, p->cached->groups)
+PKG_FIELD(alpm_list_t *, licenses, alpm_pkg_get_licenses, p->cached->licenses)
+PKG_FIELD(off_t, isize, alpm_pkg_get_isize, p->cached->isize)
+PKG_FIELD(off_t, dsize, alpm_pkg_download_size, 0)
+PKG_FIELD(off_t, size, alpm_pkg_get_size, p->cached->filesize)
+PKG_FIELD(alpm_time_t, builddate, alpm_pkg_get_builddate,
+    p->cached->builddate)
+PKG_FIELD(alpm_time_t, installdate, alpm_pkg_get_installdate, 0)
+PKG_FIELD(alpm_list_t *, provides, alpm_pkg_get_provides, p->cached->provides)
+PKG_FIELD(alpm_list_t *, depends, alpm_pkg_get_depends, p->cached->depends)
+PKG_FIELD(alpm_list_t *, optdepends, alpm_pkg_get_optdepends,
+    p->cached->optdepends)
+PKG_FIELD(alpm_list_t *, conflicts, alpm_pkg_get_conflicts,
+    p->cached->conflicts)
+PKG_FIELD(alpm_list_t *, replaces, alpm_pkg_get_replaces, p->cached->replaces)
+PKG_FIELD(alpm_filelist_t *, files, alpm_pkg_get_files,
+    pu_cache_pkg_get_files(p->cached))
+
+#undef PKG_FIELD
+
+struct pkg *new_pkg(alpm_pkg_t *pkg, pu_cache_pkg_t *cached) {
+  struct pkg *p = malloc(sizeof(struct pkg));
+  if (p == NULL) {
+    fprintf(stderr, "error: %s\n", strerror(errno));
+    cleanup(1);
+  }
+  p->pkg = pkg;
+  p->cached = cached;
+  return p;
+}
+
+void free_pkg(struct pkg *p) {
+  if (p->pkg) { alpm_pkg_free(p->pkg); }
+  pu_cache_pkg_free(p->cached);
+  free(p);
+}
+
+int print_pkgspec(struct pkg *p) {
+  char *real;
+  int ret;
+  if (p->pkg) { return pu_fprint_pkgspec(stdout, p->pkg); }
+  real = realpath(p->cached->filename, NULL);
+  ret = printf("file://%s", real ? real : p->cached->filename);
+  free(real);
+  return ret;
 }
 
 /* regcmp wrapper with error handling */
@@ -328,47 +410,37 @@ void _regcomp(regex_t *preg, const char *regex, int cflags) {
   }
 }
 
-alpm_list_t *filter_filelist(alpm_list_t **pkgs, const char *str,
-    const char *root, const size_t rootlen) {
-  alpm_list_t *p, *matches = NULL;
-  if (re) {
-    regex_t preg;
-    _regcomp(&preg, str, REG_EXTENDED | REG_ICASE | REG_NOSUB);
-    for (p = *pkgs; p; p = p->next) {
-      alpm_filelist_t *files = alpm_pkg_get_files(p->data);
-      size_t i;
-      for (i = 0; i < files->count; ++i) {
-        if (regexec(&preg, files->files[i].name, 0, NULL, 0) == 0) {
-          matches = alpm_list_add(matches, p->data);
-          break;
-        }
-      }
-    }
-    regfree(&preg);
-  } else if (exact) {
-    if (strncmp(str, root, rootlen) == 0) { str += rootlen; }
-    for (p = *pkgs; p; p = p->next) {
-      if (alpm_filelist_contains(alpm_pkg_get_files(p->data), str)) {
-        matches = alpm_list_add(matches, p->data);
-      }
-    }
-  } else {
-    for (p = *pkgs; p; p = p->next) {
-      alpm_filelist_t *files = alpm_pkg_get_files(p->data);
-      size_t i;
-      for (i = 0; i < files->count; ++i) {
-        if (strcasestr(files->files[i].name, str)) {
-          matches = alpm_list_add(matches, p->data);
-          break;
-        }
-      }
-    }
-  }
-  for (p = matches; p; p = p->next) {
-    *pkgs = alpm_list_remove(*pkgs, p->data, ptr_cmp, NULL);
-  }
-  return matches;
-}
+enum term_type {
+  TERM_SIZE,
+  TERM_DATE,
+  TERM_STR,
+  TERM_STRLIST,
+  TERM_DEPLIST,
+  TERM_SATISFIES,
+  TERM_FILELIST,
+};
+
+/* all of the values given for a single field, which are OR'd together */
+struct term {
+  enum term_type type;
+  int cost;
+  union {
+    size_accessor *size;
+    date_accessor *date;
+    str_accessor *str;
+    strlist_accessor *strlist;
+    deplist_accessor *deplist;
+  } func;
+  alpm_list_t *values;
+  size_t count;
+  const char **strs;
+  alpm_depend_t **deps;
+  regex_t *pregs;
+  int *required; /* literal each regex needs to match, -1 if none */
+  pu_strmatch_t *literals; /* substrings, or the literals regexes require */
+  pu_bitmap_t *found; /* literals found in the current string */
+  pu_bitmap_t **owners; /* by files index, once looked up */
+};
 
 int match_date(struct date_cmp *date, alpm_time_t time) {
   switch (date->cmp) {
@@ -408,68 +480,62 @@ int match_size(struct size_cmp *size, off_t bytes) {
   }
 }
 
-alpm_list_t *filter_date(alpm_list_t **pkgs, struct date_cmp *date,
-    date_accessor *func) {
-  alpm_list_t *p, *matches = NULL;
-  for (p = *pkgs; p; p = p->next) {
-    alpm_time_t time = func(p->data);
-    if (match_date(date, time)) {
-      matches = alpm_list_add(matches, p->data);
+int match_str(struct term *t, const char *s) {
+  size_t i;
+  if (s == NULL) {
+    return 0;
+  } else if (t->pregs) {
+    /* one pass for every required literal, regexec only runs for
+     * expressions that can still match */
+    if (t->literals) {
+      pu_bitmap_zero(t->found);
+      pu_strmatch_scan(t->literals, s, t->found);
     }
+    for (i = 0; i < t->count; i++) {
+      if (t->required[i] != -1 && !pu_bitmap_test(t->found, t->required[i])) {
+        continue;
+      }
+      if (regexec(&t->pregs[i], s, 0, NULL, 0) == 0) { return 1; }
+    }
+    return 0;
+  } else if (exact) {
+    for (i = 0; i < t->count; i++) {
+      if (strcasecmp(s, t->strs[i]) == 0) { return 1; }
+    }
+    return 0;
+  } else {
+    return pu_strmatch_search(t->literals, s);
   }
-  for (p = matches; p; p = p->next) {
-    *pkgs = alpm_list_remove(*pkgs, p->data, ptr_cmp, NULL);
-  }
-  return matches;
 }
 
-alpm_list_t *filter_size(alpm_list_t **pkgs, struct size_cmp *size,
-    size_accessor *func) {
-  alpm_list_t *p, *matches = NULL;
-  for (p = *pkgs; p; p = p->next) {
-    off_t bytes = func(p->data);
-    if (match_size(size, bytes)) {
-      matches = alpm_list_add(matches, p->data);
+int match_strlist(struct term *t, alpm_list_t *haystack) {
+  if (exact && !t->pregs) {
+    size_t i;
+    for (i = 0; i < t->count; i++) {
+      if (alpm_list_find_str(haystack, t->strs[i])) { return 1; }
     }
+    return 0;
   }
-  for (p = matches; p; p = p->next) {
-    *pkgs = alpm_list_remove(*pkgs, p->data, ptr_cmp, NULL);
+  for (; haystack; haystack = haystack->next) {
+    if (match_str(t, haystack->data)) { return 1; }
   }
-  return matches;
+  return 0;
 }
 
-alpm_list_t *filter_str(alpm_list_t **pkgs, const char *str,
-    str_accessor *func) {
-  alpm_list_t *p, *matches = NULL;
-  if (re) {
-    regex_t preg;
-    _regcomp(&preg, str, REG_EXTENDED | REG_ICASE | REG_NOSUB);
-    for (p = *pkgs; p; p = p->next) {
-      const char *s = func(p->data);
-      if (s && regexec(&preg, s, 0, NULL, 0) == 0) {
-        matches = alpm_list_add(matches, p->data);
-      }
-    }
-    regfree(&preg);
-  } else if (exact) {
-    for (p = *pkgs; p; p = p->next) {
-      const char *s = func(p->data);
-      if (s && strcasecmp(s, str) == 0) {
-        matches = alpm_list_add(matches, p->data);
-      }
-    }
-  } else {
-    for (p = *pkgs; p; p = p->next) {
-      const char *s = func(p->data);
-      if (s && strcasestr(s, str)) {
-        matches = alpm_list_add(matches, p->data);
-      }
+int match_filelist(struct term *t, alpm_filelist_t *files) {
+  size_t i;
+  if (files == NULL) {
+    return 0;
+  } else if (exact && !t->pregs) {
+    for (i = 0; i < t->count; i++) {
+      if (alpm_filelist_contains(files, t->strs[i])) { return 1; }
     }
+    return 0;
   }
-  for (p = matches; p; p = p->next) {
-    *pkgs = alpm_list_remove(*pkgs, p->data, ptr_cmp, NULL);
+  for (i = 0; i < files->count; ++i) {
+    if (match_str(t, files->files[i].name)) { return 1; }
   }
-  return matches;
+  return 0;
 }
 
 int depcmp(alpm_depend_t *d, alpm_depend_t *needle) {
@@ -480,138 +546,367 @@ int depcmp(alpm_depend_t *d, alpm_depend_t *needle) {
   if (!exact && !needle->version) { return 0; }
 
   if (needle->mod == d->mod
-      && alpm_pkg_vercmp(needle->version, d->version) == 0) {
+      && pu_version_cache_vercmp(versions, needle->version, d->version) == 0) {
     return 0;
   }
 
   return 1;
 }
 
-alpm_list_t *filter_satisfies(alpm_list_t **pkgs, const char *depstr) {
-  alpm_list_t *matches = NULL;
-  alpm_pkg_t *pkg;
-  while ((pkg = alpm_find_satisfier(*pkgs, depstr))) {
-    *pkgs = alpm_list_remove(*pkgs, pkg, ptr_cmp, NULL);
-    matches = alpm_list_add(matches, pkg);
+int match_deplist(struct term *t, alpm_list_t *deps) {
+  size_t i;
+  for (i = 0; i < t->count; i++) {
+    if (alpm_list_find(deps, t->deps[i], (alpm_list_fn_cmp) depcmp)) {
+      return 1;
+    }
   }
-  return matches;
+  return 0;
 }
 
-alpm_list_t *filter_deplist(alpm_list_t **pkgs, const char *str,
-    deplist_accessor *func) {
-  alpm_list_t *p, *matches = NULL;
-  alpm_depend_t *needle = alpm_dep_from_string(str);
-  if (needle == NULL) {
-    fprintf(stderr, "error: invalid dependency '%s'\n", str);
+int match_path(const char *path, void *t) {
+  return match_str(t, path);
+}
+
+/* look a term up in every files index at once */
+void find_owners(struct term *t) {
+  alpm_list_t *i;
+  size_t n = 0;
+  if ((t->owners = calloc(alpm_list_count(files_indexes) + 1,
+              sizeof(pu_bitmap_t *))) == NULL) {
+    fprintf(stderr, "error: %s\n", strerror(errno));
     cleanup(1);
   }
-  for (p = *pkgs; p; p = p->next) {
-    alpm_list_t *deps = func(p->data);
-    if (alpm_list_find(deps, needle, (alpm_list_fn_cmp) depcmp)) {
-      matches = alpm_list_add(matches, p->data);
+  for (i = files_indexes; i; i = i->next, n++) {
+    struct files_index *fi = i->data;
+    int err = 0;
+    if ((t->owners[n] = pu_bitmap_new(fi->index->pkgcount)) == NULL) {
+      fprintf(stderr, "error: %s\n", strerror(errno));
+      cleanup(1);
+    }
+    if (exact && !t->pregs) {
+      size_t v;
+      for (v = 0; v < t->count && err == 0; v++) {
+        err = pu_files_index_find(fi->index, t->strs[v], t->owners[n]);
+      }
+    } else {
+      err = pu_files_index_match(fi->index, match_path, t, t->owners[n]);
+    }
+    if (err != 0) {
+      fprintf(stderr, "error: could not read file index for '%s' (%s)\n",
+          fi->repo, strerror(errno));
+      cleanup(1);
     }
   }
-  for (p = matches; p; p = p->next) {
-    *pkgs = alpm_list_remove(*pkgs, p->data, ptr_cmp, NULL);
-  }
-  alpm_dep_free(needle);
-  return matches;
 }
 
-alpm_list_t *filter_strlist(alpm_list_t **pkgs, const char *str,
-    strlist_accessor *func) {
-  alpm_list_t *p, *matches = NULL;
-  if (re) {
-    regex_t preg;
-    _regcomp(&preg, str, REG_EXTENDED | REG_ICASE | REG_NOSUB);
-    for (p = *pkgs; p; p = p->next) {
-      alpm_list_t *h = func(p->data);
-      for (; h; h = h->next ) {
-        if (regexec(&preg, h->data, 0, NULL, 0) == 0) {
-          matches = alpm_list_add(matches, p->data);
-          break;
+int match_owner(struct term *t, struct pkg *p) {
+  if (files_indexes && p->pkg
+      && alpm_pkg_get_origin(p->pkg) == ALPM_PKG_FROM_SYNCDB) {
+    const char *dbname = get_dbname(p->pkg);
+    alpm_list_t *i;
+    size_t n = 0, id;
+    if (t->owners == NULL) { find_owners(t); }
+    for (i = files_indexes; i; i = i->next, n++) {
+      struct files_index *fi = i->data;
+      if (strcmp(fi->repo, dbname) == 0) {
+        const char *pkgname = alpm_pkg_get_name(p->pkg);
+        /* the sync database may have been updated since the files database
+         * the index was built from */
+        if (pu_files_index_pkg_id(fi->index, pkgname, &id) == 0
+            && strcmp(pu_files_index_pkgver(fi->index, id),
+                alpm_pkg_get_version(p->pkg)) == 0) {
+          return pu_bitmap_test(t->owners[n], id);
         }
+        break;
       }
     }
-    regfree(&preg);
-  } else if (exact) {
-    for (p = *pkgs; p; p = p->next) {
-      if (alpm_list_find_str(func(p->data), str)) {
-        matches = alpm_list_add(matches, p->data);
+  }
+  return match_filelist(t, pkg_get_files(p));
+}
+
+int match_satisfies(struct pkg *p, alpm_depend_t *dep) {
+  alpm_depend_t self = { 0 };
+  alpm_list_t *i;
+  if (p->pkg) { return pu_pkg_satisfies_dep_cached(versions, p->pkg, dep); }
+  self.name = p->cached->name;
+  self.version = p->cached->version;
+  self.mod = ALPM_DEP_MOD_EQ;
+  if (pu_provision_satisfies_dep_cached(versions, &self, dep)) { return 1; }
+  for (i = p->cached->provides; i; i = i->next) {
+    if (pu_provision_satisfies_dep_cached(versions, i->data, dep)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int match_term(struct term *t, struct pkg *pkg) {
+  alpm_list_t *v;
+  size_t i;
+  switch (t->type) {
+    case TERM_SIZE:
+      for (v = t->values; v; v = v->next) {
+        if (match_size(v->data, t->func.size(pkg))) { return 1; }
+      }
+      return 0;
+    case TERM_DATE:
+      for (v = t->values; v; v = v->next) {
+        if (match_date(v->data, t->func.date(pkg))) { return 1; }
+      }
+      return 0;
+    case TERM_STR:
+      return match_str(t, t->func.str(pkg));
+    case TERM_STRLIST:
+      return match_strlist(t, t->func.strlist(pkg));
+    case TERM_DEPLIST:
+      return match_deplist(t, t->func.deplist(pkg));
+    case TERM_SATISFIES:
+      for (i = 0; i < t->count; i++) {
+        if (match_satisfies(pkg, t->deps[i])) {
+          return 1;
+        }
+      }
+      return 0;
+    case TERM_FILELIST:
+      return match_owner(t, pkg);
+    default:
+      return 0;
+  }
+}
+
+/* rough cost of checking a term against one package, cheap terms are
+ * checked first so expensive ones only see the packages that are left */
+int term_cost(struct term *t) {
+  static const int costs[] = {
+    [TERM_SIZE] = 0,
+    [TERM_DATE] = 0,
+    [TERM_STR] = 2,
+    [TERM_STRLIST] = 3,
+    [TERM_DEPLIST] = 4,
+    [TERM_SATISFIES] = 5,
+    [TERM_FILELIST] = 10,
+  };
+  int cost = costs[t->type];
+  if (t->pregs) { cost += 2; } /* regexec is much slower than a scan */
+  if (exact && t->type == TERM_STR) { cost--; } /* and matches less */
+  return cost;
+}
+
+int term_cmp(const void *p1, const void *p2) {
+  const struct term *t1 = p1, *t2 = p2;
+  return t1->cost - t2->cost;
+}
+
+struct term *parse_terms(struct term *terms, size_t *count, alpm_list_t *values,
+    enum term_type type, void (*func)(void)) {
+  alpm_list_t *v;
+  struct term *t;
+  size_t i;
+
+  if (values == NULL) { return terms; }
+  if ((terms = realloc(terms, sizeof(struct term) * (*count + 1))) == NULL) {
+    fprintf(stderr, "error: %s\n", strerror(errno));
+    cleanup(1);
+  }
+  t = &terms[(*count)++];
+  memset(t, 0, sizeof(struct term));
+  t->type = type;
+  t->values = values;
+  t->count = alpm_list_count(values);
+
+  switch (type) {
+    case TERM_SIZE:
+      t->func.size = (size_accessor *) func;
+      break;
+    case TERM_DATE:
+      t->func.date = (date_accessor *) func;
+      break;
+    case TERM_STR:
+      t->func.str = (str_accessor *) func;
+      break;
+    case TERM_STRLIST:
+      t->func.strlist = (strlist_accessor *) func;
+      break;
+    case TERM_DEPLIST:
+      t->func.deplist = (deplist_accessor *) func;
+    /* fall through */
+    case TERM_SATISFIES:
+      if ((t->deps = calloc(t->count, sizeof(alpm_depend_t *))) == NULL) {
+        fprintf(stderr, "error: %s\n", strerror(errno));
+        cleanup(1);
+      }
+      for (i = 0, v = values; v; v = v->next, i++) {
+        if ((t->deps[i] = alpm_dep_from_string(v->data)) == NULL) {
+          fprintf(stderr, "error: invalid dependency '%s'\n",
+              (const char *) v->data);
+          cleanup(1);
+        }
       }
+      break;
+    case TERM_FILELIST:
+      break;
+  }
+
+  if (type == TERM_STR || type == TERM_STRLIST || type == TERM_FILELIST) {
+    if ((t->strs = calloc(t->count, sizeof(char *))) == NULL
+        || (!(exact && !re) && (t->literals = pu_strmatch_new()) == NULL)) {
+      fprintf(stderr, "error: %s\n", strerror(errno));
+      cleanup(1);
     }
-  } else {
-    for (p = *pkgs; p; p = p->next) {
-      alpm_list_t *h = func(p->data);
-      for (; h; h = h->next) {
-        if (strcasestr(h->data, str)) {
-          matches = alpm_list_add(matches, p->data);
-          break;
+    if (re && ((t->pregs = calloc(t->count, sizeof(regex_t))) == NULL
+            || (t->required = calloc(t->count, sizeof(int))) == NULL)) {
+      fprintf(stderr, "error: %s\n", strerror(errno));
+      cleanup(1);
+    }
+    for (i = 0, v = values; v; v = v->next, i++) {
+      t->strs[i] = v->data;
+      if (re) {
+        char *literal = pu_regex_literal(v->data);
+        _regcomp(&t->pregs[i], v->data, REG_EXTENDED | REG_ICASE | REG_NOSUB);
+        t->required[i] = -1;
+        if (literal && (t->required[i] = pu_strmatch_add(t->literals,
+                    literal)) == -1) {
+          fprintf(stderr, "error: %s\n", strerror(errno));
+          cleanup(1);
         }
+        free(literal);
+      } else if (t->literals && pu_strmatch_add(t->literals, v->data) == -1) {
+        fprintf(stderr, "error: %s\n", strerror(errno));
+        cleanup(1);
       }
     }
+    if (t->literals && t->literals->count == 0) {
+      pu_strmatch_free(t->literals); /* no regex has a required literal */
+      t->literals = NULL;
+    }
+    if (t->literals && (pu_strmatch_compile(t->literals) != 0
+            || (t->found = pu_bitmap_new(t->literals->count)) == NULL)) {
+      fprintf(stderr, "error: %s\n", strerror(errno));
+      cleanup(1);
+    }
   }
-  for (p = matches; p; p = p->next) {
-    *pkgs = alpm_list_remove(*pkgs, p->data, ptr_cmp, NULL);
-  }
-  return matches;
+
+  t->cost = term_cost(t);
+  return terms;
+}
+
+void free_term(struct term *t) {
+  size_t i;
+  for (i = 0; t->pregs && i < t->count; i++) { regfree(&t->pregs[i]); }
+  for (i = 0; t->deps && i < t->count; i++) { alpm_dep_free(t->deps[i]); }
+  for (i = 0; t->owners && t->owners[i]; i++) { pu_bitmap_free(t->owners[i]); }
+  free(t->strs);
+  free(t->deps);
+  free(t->pregs);
+  free(t->required);
+  free(t->owners);
+  pu_strmatch_free(t->literals);
+  pu_bitmap_free(t->found);
 }
 
-#define match(list, filter) \
-  if(list) { \
-    alpm_list_t *lp; \
-    for(lp = list; lp; lp = alpm_list_next(lp)) { \
-      void *i = lp->data; \
-      matches = alpm_list_join(matches, filter); \
-    } \
-    if(!any) { \
-      alpm_list_free(haystack); \
-      haystack = matches; \
-      matches = NULL; \
-    } \
+/* set the bits in hits of the packages selected by candidates matching t */
+void filter_term(struct term *t, struct pkg **pkgs,
+    const pu_bitmap_t *candidates, pu_bitmap_t *hits) {
+  size_t i;
+  pu_bitmap_zero(hits);
+  for (i = 0; pu_bitmap_next(candidates, i, &i) == 0; i++) {
+    if (match_term(t, pkgs[i])) { pu_bitmap_set(hits, i); }
   }
+}
+
+#define add_terms(values, type, func) \
+  terms = parse_terms(terms, &count, values, type, (void (*)(void)) func)
 
 alpm_list_t *filter_pkgs(alpm_handle_t *handle, alpm_list_t *pkgs) {
-  alpm_list_t *matches = NULL, *haystack = alpm_list_copy(pkgs);
+  alpm_list_t *p, *matches = NULL;
+  struct pkg **pkgv = NULL;
+  struct term *terms = NULL;
+  size_t count = 0, npkgs = alpm_list_count(pkgs), i, j;
+  pu_bitmap_t *result, *candidates, *hits;
   const char *root = alpm_option_get_root(handle);
   const size_t rootlen = strlen(root);
 
-  match(name, filter_str(&haystack, i, alpm_pkg_get_name));
-  match(base, filter_str(&haystack, i, alpm_pkg_get_base));
-  match(description, filter_str(&haystack, i, alpm_pkg_get_desc));
-  match(packager, filter_str(&haystack, i, alpm_pkg_get_packager));
-  match(repo, filter_str(&haystack, i, get_dbname));
-  match(arch, filter_str(&haystack, i, alpm_pkg_get_arch));
-  match(group, filter_strlist(&haystack, i, alpm_pkg_get_groups));
-  match(license, filter_strlist(&haystack, i, alpm_pkg_get_licenses));
-  match(ownsfile, filter_filelist(&haystack, i, root, rootlen));
-  match(url, filter_str(&haystack, i, alpm_pkg_get_url));
-
-  match(isize, filter_size(&haystack, i, alpm_pkg_get_isize));
-  match(dsize, filter_size(&haystack, i, alpm_pkg_download_size));
-  match(size, filter_size(&haystack, i, alpm_pkg_get_size));
-
-  match(builddate, filter_date(&haystack, i, alpm_pkg_get_builddate));
-  match(installdate, filter_date(&haystack, i, alpm_pkg_get_installdate));
-
-  match(provides, filter_deplist(&haystack, i, alpm_pkg_get_provides));
-  match(depends, filter_deplist(&haystack, i, alpm_pkg_get_depends));
-  match(optdepends, filter_deplist(&haystack, i, alpm_pkg_get_optdepends));
-  match(conflicts, filter_deplist(&haystack, i, alpm_pkg_get_conflicts));
-  match(replaces, filter_deplist(&haystack, i, alpm_pkg_get_replaces));
-
-  match(satisfies, filter_satisfies(&haystack, i));
-
-  if (invert) {
-    matches = alpm_list_diff(pkgs, haystack, ptr_cmp);
-    alpm_list_free(haystack);
-    return matches;
+  add_terms(name, TERM_STR, pkg_get_name);
+  add_terms(base, TERM_STR, pkg_get_base);
+  add_terms(description, TERM_STR, pkg_get_desc);
+  add_terms(packager, TERM_STR, pkg_get_packager);
+  add_terms(repo, TERM_STR, pkg_get_dbname);
+  add_terms(arch, TERM_STR, pkg_get_arch);
+  add_terms(group, TERM_STRLIST, pkg_get_groups);
+  add_terms(license, TERM_STRLIST, pkg_get_licenses);
+  add_terms(ownsfile, TERM_FILELIST, NULL);
+  add_terms(url, TERM_STR, pkg_get_url);
+
+  add_terms(isize, TERM_SIZE, pkg_get_isize);
+  add_terms(dsize, TERM_SIZE, pkg_get_dsize);
+  add_terms(size, TERM_SIZE, pkg_get_size);
+
+  add_terms(builddate, TERM_DATE, pkg_get_builddate);
+  add_terms(installdate, TERM_DATE, pkg_get_installdate);
+
+  add_terms(provides, TERM_DEPLIST, pkg_get_provides);
+  add_terms(depends, TERM_DEPLIST, pkg_get_depends);
+  add_terms(optdepends, TERM_DEPLIST, pkg_get_optdepends);
+  add_terms(conflicts, TERM_DEPLIST, pkg_get_conflicts);
+  add_terms(replaces, TERM_DEPLIST, pkg_get_replaces);
+
+  add_terms(satisfies, TERM_SATISFIES, NULL);
+
+  for (i = 0; i < count; i++) {
+    if (terms[i].type != TERM_FILELIST || terms[i].pregs || !exact) {
+      continue;
+    }
+    for (j = 0; j < terms[i].count; j++) {
+      if (strncmp(terms[i].strs[j], root, rootlen) == 0) {
+        terms[i].strs[j] += rootlen;
+      }
+    }
+  }
+  qsort(terms, count, sizeof(struct term), term_cmp);
+
+  result = pu_bitmap_new(npkgs);
+  candidates = pu_bitmap_new(npkgs);
+  hits = pu_bitmap_new(npkgs);
+  pkgv = malloc(sizeof(struct pkg *) * (npkgs + 1));
+  if (!result || !candidates || !hits || !pkgv) {
+    fprintf(stderr, "error: %s\n", strerror(errno));
+    cleanup(1);
+  }
+  for (i = 0, p = pkgs; p; p = p->next, i++) { pkgv[i] = p->data; }
+
+  if (any) {
+    /* each term only needs to check packages nothing has matched yet */
+    pu_bitmap_fill(candidates);
+    for (i = 0; i < count; i++) {
+      filter_term(&terms[i], pkgv, candidates, hits);
+      pu_bitmap_or(result, hits);
+      pu_bitmap_andnot(candidates, hits);
+    }
   } else {
-    return any ? matches : haystack;
+    pu_bitmap_fill(result);
+    for (i = 0; i < count; i++) {
+      filter_term(&terms[i], pkgv, result, hits);
+      pu_bitmap_copy(result, hits);
+    }
+  }
+
+  if (invert) { pu_bitmap_not(result); }
+
+  for (i = 0; pu_bitmap_next(result, i, &i) == 0; i++) {
+    matches = alpm_list_add(matches, pkgv[i]);
   }
+
+  for (i = 0; i < count; i++) { free_term(&terms[i]); }
+  free(terms);
+  free(pkgv);
+  pu_bitmap_free(result);
+  pu_bitmap_free(candidates);
+  pu_bitmap_free(hits);
+
+  return matches;
 }
 
-#undef match
+#undef add_terms
 
 void usage(int ret) {
   FILE *stream = (ret ? stderr : stdout);
@@ -628,6 +923,8 @@ void usage(int ret) {
   hputs("   --null[=sep]         use <sep> to separate values (default NUL)");
   hputs("   --help               display this help information");
   hputs("   --version            display version information");
+  hputs("   --index-dir=<path>   set an alternate file list index location");
+  hputs("   --jobs=<n>           read up to <n> cached packages in parallel");
 
   hputs("   --exists             exit with a non-zero value if no matches were found");
   hputs("   --not-exists         exit with a non-zero value if matches were found");
@@ -695,6 +992,8 @@ pu_config_t *parse_opts(int argc, char **argv) {
     { "help", no_argument, NULL, FLAG_HELP          },
     { "sysroot", required_argument, NULL, FLAG_SYSROOT       },
     { "version", no_argument, NULL, FLAG_VERSION       },
+    { "index-dir", required_argument, NULL, FLAG_INDEXDIR      },
+    { "jobs", required_argument, NULL, FLAG_JOBS          },
 
     { "cache", no_argument, NULL, FLAG_CACHE         },
     { "local", no_argument, NULL, 'Q'                },
@@ -780,6 +1079,18 @@ pu_config_t *parse_opts(int argc, char **argv) {
         pu_print_version(myname, myver);
         cleanup(0);
         break;
+      case FLAG_INDEXDIR:
+        indexdir = optarg;
+        break;
+      case FLAG_JOBS: {
+        char *end;
+        jobs = strtol(optarg, &end, 10);
+        if (*optarg == '\0' || *end != '\0' || jobs < 1 || jobs > 1024) {
+          fprintf(stderr, "error: invalid number of jobs '%s'\n", optarg);
+          cleanup(1);
+        }
+        break;
+      }
 
       case 'Q':
         srch_local = 1;
@@ -865,6 +1176,10 @@ pu_config_t *parse_opts(int argc, char **argv) {
     }
   }
 
+  if (jobs == 0 && (jobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1) {
+    jobs = 1;
+  }
+
   if (!pu_ui_config_load_sysroot(config, config_file, sysroot)) {
     fprintf(stderr, "error: could not parse '%s'\n", config_file);
     return NULL;
@@ -873,6 +1188,208 @@ pu_config_t *parse_opts(int argc, char **argv) {
   return config;
 }
 
+int build_files_index(alpm_handle_t **fhandle, const char *repo,
+    const char *dbfile, const char *path) {
+  alpm_list_t *i;
+  if (*fhandle == NULL) {
+    if ((*fhandle = pu_initialize_handle_from_config(config)) == NULL
+        || alpm_option_set_dbext(*fhandle, FILESDBEXT) != 0) {
+      return -1;
+    }
+    pu_register_syncdbs(*fhandle, config->repos);
+  }
+  for (i = alpm_get_syncdbs(*fhandle); i; i = i->next) {
+    if (strcmp(alpm_db_get_name(i->data), repo) == 0) {
+      return pu_files_index_write(i->data, dbfile, path);
+    }
+  }
+  errno = ENOENT;
+  return -1;
+}
+
+/* open an index of the file lists in each sync database, (re)building any
+ * that are missing or out of date; returns -1 if any database could not be
+ * indexed */
+int load_files_indexes(void) {
+  alpm_handle_t *fhandle = NULL;
+  size_t dblen = strlen(config->dbpath);
+  const char *dbsep = dblen && config->dbpath[dblen - 1] == '/' ? "" : "/";
+  char *dir = pu_index_dir(indexdir);
+  alpm_list_t *r;
+  int ret = 0;
+
+  if (dir == NULL) { return -1; }
+
+  for (r = config->repos; r && ret == 0; r = r->next) {
+    pu_repo_t *repo = r->data;
+    char *dbfile = pu_asprintf("%s%ssync/%s%s", config->dbpath, dbsep,
+            repo->name, FILESDBEXT);
+    char *path = pu_asprintf("%s/%s%s.idx", dir, repo->name, FILESDBEXT);
+    pu_files_index_t *index = NULL;
+    struct files_index *fi;
+
+    if (dbfile && path && (index = pu_files_index_open(path))
+        && pu_files_index_is_current(index, dbfile) != 1) {
+      pu_files_index_close(index);
+      index = NULL;
+    }
+    if (index == NULL && dbfile && path
+        && build_files_index(&fhandle, repo->name, dbfile, path) == 0) {
+      index = pu_files_index_open(path);
+    }
+
+    if (index == NULL) {
+      if (errno != ENOENT) {
+        fprintf(stderr, "warning: could not index file lists for '%s' (%s)\n",
+            repo->name, strerror(errno));
+      }
+      ret = -1;
+    } else if ((fi = malloc(sizeof(struct files_index))) == NULL
+        || (fi->repo = strdup(repo->name)) == NULL) {
+      free(fi);
+      pu_files_index_close(index);
+      ret = -1;
+    } else {
+      fi->index = index;
+      files_indexes = alpm_list_add(files_indexes, fi);
+    }
+
+    free(dbfile);
+    free(path);
+  }
+
+  alpm_release(fhandle);
+  free(dir);
+  return ret;
+}
+
+struct cache_job {
+  char *path;
+  pu_cache_pkg_t *pkg;
+  int err;
+};
+
+struct cache_queue {
+  pthread_mutex_t lock;
+  struct cache_job **jobs;
+  size_t count, next;
+  int needfiles;
+};
+
+void *cache_worker(void *arg) {
+  struct cache_queue *q = arg;
+
+  while (1) {
+    struct cache_job *job;
+
+    pthread_mutex_lock(&q->lock);
+    job = q->next < q->count ? q->jobs[q->next++] : NULL;
+    pthread_mutex_unlock(&q->lock);
+    if (job == NULL) { break; }
+
+    if ((job->pkg = pu_cache_pkg_load(job->path, q->needfiles)) == NULL) {
+      job->err = errno;
+    }
+  }
+
+  return NULL;
+}
+
+/* read package files on a pool of threads */
+void load_cache_pkgs(struct cache_queue *q) {
+  pthread_t *threads;
+  size_t n, nthreads = 0;
+
+  if (q->count == 0) { return; }
+  if ((threads = calloc(jobs, sizeof(pthread_t))) != NULL) {
+    while (nthreads < (size_t) jobs && nthreads < q->count) {
+      if (pthread_create(&threads[nthreads], NULL, cache_worker, q) != 0) {
+        break;
+      }
+      nthreads++;
+    }
+  }
+  /* help out, or do it all if no threads could be started */
+  cache_worker(q);
+  for (n = 0; n < nthreads; n++) {
+    pthread_join(threads[n], NULL);
+  }
+  free(threads);
+}
+
+/* add the packages in a cache directory to the haystack; packages that have
+ * not changed since they were last read are taken from the directory's index
+ * instead of being opened again, the index is updated with any that were
+ * read */
+alpm_list_t *load_cache_dir(alpm_list_t *haystack, const char *path,
+    const char *dir) {
+  struct cache_queue q = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .needfiles = ownsfile ? 1 : 0,
+  };
+  struct cache_job *cjobs = NULL;
+  pu_cache_pkg_t **pkgs = NULL;
+  pu_cache_index_t *index;
+  char *idxpath = dir ? pu_cache_index_path(dir, path) : NULL;
+  size_t count = 0, npkgs = 0, size, n;
+
+  if ((index = pu_cache_index_update(idxpath, path)) == NULL) {
+    fprintf(stderr, "warning: could not read cache dir '%s' (%s)\n",
+        path, strerror(errno));
+    free(idxpath);
+    return haystack;
+  }
+
+  size = index->count + 1;
+  if ((cjobs = calloc(size, sizeof(struct cache_job))) == NULL
+      || (q.jobs = malloc(sizeof(struct cache_job *) * size)) == NULL
+      || (pkgs = malloc(sizeof(pu_cache_pkg_t *) * size)) == NULL) {
+    fprintf(stderr, "error: %s\n", strerror(errno));
+    cleanup(1);
+  }
+  for (n = 0; n < index->count; n++) {
+    pu_cache_entry_t *entry = &index->entries[n];
+    struct cache_job *job = &cjobs[count];
+    /* signatures, partial downloads, and anything else not named like a
+     * package are never read */
+    if (entry->isdir || entry->name == NULL) { continue; }
+    if ((job->path = pu_asprintf("%s%s", path, entry->filename)) == NULL) {
+      fprintf(stderr, "error: %s\n", strerror(errno));
+      cleanup(1);
+    }
+    if ((job->pkg = pu_cache_index_get(index, entry, q.needfiles)) == NULL) {
+      q.jobs[q.count++] = job;
+    }
+    count++;
+  }
+  load_cache_pkgs(&q);
+
+  for (n = 0; n < count; n++) {
+    struct cache_job *job = &cjobs[n];
+    if (job->pkg) {
+      haystack = alpm_list_add(haystack, new_pkg(NULL, job->pkg));
+      pkgs[npkgs++] = job->pkg;
+    } else {
+      fprintf(stderr, "warning: could not load package '%s' (%s)\n",
+          job->path, strerror(job->err));
+    }
+  }
+
+  if (idxpath && npkgs > count - q.count
+      && pu_cache_index_write(idxpath, index, pkgs, npkgs) != 0) {
+    fprintf(stderr, "warning: could not write cache index '%s' (%s)\n",
+        idxpath, strerror(errno));
+  }
+
+  for (n = 0; n < count; n++) { free(cjobs[n].path); }
+  free(cjobs);
+  free(q.jobs);
+  free(pkgs);
+  pu_cache_index_close(index);
+  free(idxpath);
+  return haystack;
+}
+
 void parse_pkg_spec(char *spec, char **pkgname, char **dbname) {
   char *c;
   if ((c = strchr(spec, '/'))) {
@@ -885,11 +1402,6 @@ void parse_pkg_spec(char *spec, char **pkgname, char **dbname) {
   }
 }
 
-/* gcc8's cast-function-type warning is a bit overzealous */
-void free_pkg(alpm_pkg_t *p) {
-  alpm_pkg_free(p);
-}
-
 int main(int argc, char **argv) {
   alpm_list_t *haystack = NULL, *matches = NULL, *i;
   int ret = 0;
@@ -905,7 +1417,11 @@ int main(int argc, char **argv) {
     goto cleanup;
   }
 
-  if (ownsfile && dbext == NULL) {
+  /* file lists are only loaded for sync packages that cannot be indexed */
+  if (ownsfile && dbext == NULL && load_files_indexes() != 0) {
+    alpm_list_free_inner(files_indexes, (alpm_list_fn_free) files_index_free);
+    alpm_list_free(files_indexes);
+    files_indexes = NULL;
     dbext = FILESDBEXT;
   }
 
@@ -922,6 +1438,12 @@ int main(int argc, char **argv) {
     goto cleanup;
   }
 
+  if ((versions = pu_version_cache_new()) == NULL) {
+    fprintf(stderr, "error: %s\n", strerror(errno));
+    ret = 1;
+    goto cleanup;
+  }
+
   if (have_stdin) {
     char *buf = NULL;
     size_t len = 0;
@@ -938,7 +1460,7 @@ int main(int argc, char **argv) {
       alpm_pkg_t *pkg;
       if (buf[read - 1] == isep) { buf[read - 1] = '\0'; }
       if ((pkg = pu_find_pkgspec(handle, buf))) {
-        haystack = alpm_list_add(haystack, pkg);
+        haystack = alpm_list_add(haystack, new_pkg(pkg, NULL));
       } else {
         fprintf(stderr, "warning: could not locate pkg '%s'\n", buf);
       }
@@ -955,56 +1477,28 @@ int main(int argc, char **argv) {
 
     if (srch_local) {
       for (p = alpm_db_get_pkgcache(alpm_get_localdb(handle)); p; p = p->next) {
-        haystack = alpm_list_add(haystack, p->data);
+        haystack = alpm_list_add(haystack, new_pkg(p->data, NULL));
       }
     }
     if (srch_sync) {
       for (s = alpm_get_syncdbs(handle); s; s = s->next) {
         for (p = alpm_db_get_pkgcache(s->data); p; p = p->next) {
-          haystack = alpm_list_add(haystack, p->data);
+          haystack = alpm_list_add(haystack, new_pkg(p->data, NULL));
         }
       }
     }
     if (srch_cache) {
+      char *dir = pu_index_dir(indexdir);
       for (i = alpm_option_get_cachedirs(handle); i; i = i->next) {
-        const char *path = i->data;
-        DIR *dir = opendir(path);
-        struct dirent *entry;
-        if (!dir) {
-          fprintf(stderr, "warning: could not open cache dir '%s' (%s)\n",
-              path, strerror(errno));
-          continue;
-        }
-        errno = 0;
-        while ((entry = readdir(dir))) {
-          if (strcmp(".", entry->d_name) == 0 || strcmp("..", entry->d_name) == 0) {
-            continue;
-          }
-          size_t path_len = strlen(path) + strlen(entry->d_name);
-          char *filename = malloc(path_len + 1);
-          int needfiles = ownsfile ? 1 : 0;
-          alpm_pkg_t *pkg = NULL;
-          sprintf(filename, "%s%s", path, entry->d_name);
-          if (alpm_pkg_load(handle, filename, needfiles, 0, &pkg) == 0) {
-            haystack = alpm_list_add(haystack, pkg);
-          } else {
-            fprintf(stderr, "warning: could not load package '%s' (%s)\n",
-                filename, alpm_strerror(alpm_errno(handle)));
-          }
-          free(filename);
-        }
-        if (errno != 0) {
-          fprintf(stderr, "warning: could not read cache dir '%s' (%s)\n",
-              path, strerror(errno));
-        }
-        closedir(dir);
+        haystack = load_cache_dir(haystack, i->data, dir);
       }
+      free(dir);
     }
   }
 
   matches = filter_pkgs(handle, haystack);
   for (i = matches; i; i = i->next) {
-    pu_fprint_pkgspec(stdout, i->data);
+    print_pkgspec(i->data);
     fputc(osep, stdout);
   }
   if ((exists == FLAG_EXISTS && matches == NULL)
@@ -0,0 +1,63 @@
+#include "pacutils.h"
+
+#include "pacutils_test.h"
+
+int main(void) {
+  pu_bitmap_t *b, *c;
+  size_t bit;
+
+  tap_plan(19);
+
+  ASSERT(b = pu_bitmap_new(130));
+  tap_is_int(pu_bitmap_count(b), 0, "new bitmap is empty");
+  tap_is_int(pu_bitmap_next(b, 0, &bit), -1, "no set bits in new bitmap");
+
+  pu_bitmap_set(b, 0);
+  pu_bitmap_set(b, 64);
+  pu_bitmap_set(b, 129);
+  tap_ok(pu_bitmap_test(b, 64), "set bit");
+  tap_ok(!pu_bitmap_test(b, 63), "unset bit");
+  tap_is_int(pu_bitmap_count(b), 3, "count");
+
+  tap_ok(pu_bitmap_next(b, 1, &bit) == 0 && bit == 64, "next across words");
+  tap_ok(pu_bitmap_next(b, 129, &bit) == 0 && bit == 129, "next at start");
+  tap_is_int(pu_bitmap_next(b, 130, &bit), -1, "next past end");
+
+  pu_bitmap_clear(b, 64);
+  tap_ok(!pu_bitmap_test(b, 64), "clear bit");
+
+  pu_bitmap_not(b);
+  tap_is_int(pu_bitmap_count(b), 128, "not ignores bits past the end");
+  tap_ok(pu_bitmap_test(b, 64) && !pu_bitmap_test(b, 129), "not");
+
+  ASSERT(c = pu_bitmap_new(130));
+  pu_bitmap_set(c, 1);
+  pu_bitmap_set(c, 129);
+  pu_bitmap_or(c, b);
+  tap_is_int(pu_bitmap_count(c), 129, "or");
+  pu_bitmap_and(c, b);
+  tap_is_int(pu_bitmap_count(c), 128, "and");
+  pu_bitmap_zero(c);
+  pu_bitmap_set(c, 1);
+  pu_bitmap_set(c, 2);
+  pu_bitmap_andnot(b, c);
+  tap_is_int(pu_bitmap_count(b), 126, "andnot");
+  tap_ok(pu_bitmap_next(b, 1, &bit) == 0 && bit == 3, "andnot bits");
+
+  pu_bitmap_fill(c);
+  tap_is_int(pu_bitmap_count(c), 130, "fill");
+  pu_bitmap_free(c);
+
+  ASSERT(c = pu_bitmap_dup(b));
+  tap_is_int(pu_bitmap_count(c), 126, "dup");
+  pu_bitmap_free(c);
+  pu_bitmap_free(b);
+
+  ASSERT(b = pu_bitmap_new(0));
+  pu_bitmap_fill(b);
+  tap_is_int(pu_bitmap_count(b), 0, "fill empty bitmap");
+  tap_is_int(pu_bitmap_next(b, 0, &bit), -1, "next in empty bitmap");
+  pu_bitmap_free(b);
+
+  return tap_finish();
+}
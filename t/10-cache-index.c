@@ -0,0 +1,221 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "pacutils_test.h"
+
+#include "pacutils.h"
+
+char *tmpdir = NULL, template[] = "/tmp/10-cache-index.c-XXXXXX";
+char *cachedir = NULL, *pkgfile = NULL, *idxfile = NULL, *sigfile = NULL;
+pu_cache_pkg_t *pkg = NULL, *files = NULL, *got = NULL;
+pu_cache_index_t *cidx = NULL;
+
+const char pkginfo[] =
+  "# Generated by makepkg\n"
+  "pkgname = foo\n"
+  "pkgbase = foo-base\n"
+  "pkgver = 1.0-1\n"
+  "pkgdesc = a package = with equals\n"
+  "builddate = 1453283269\n"
+  "size = 4096\n"
+  "arch = x86_64\n"
+  "group = bar\n"
+  "group = baz\n"
+  "depend = glibc\n"
+  "depend = bash>=4\n";
+
+void cleanup(void) {
+  pu_cache_pkg_free(pkg);
+  pu_cache_pkg_free(files);
+  pu_cache_pkg_free(got);
+  pu_cache_index_close(cidx);
+  free(cachedir);
+  free(pkgfile);
+  free(idxfile);
+  free(sigfile);
+  if (tmpdir) { rmrfat(AT_FDCWD, tmpdir); }
+}
+
+static void add_entry(struct archive *a, const char *path, const char *data) {
+  struct archive_entry *e;
+  ASSERT(e = archive_entry_new());
+  archive_entry_set_pathname(e, path);
+  archive_entry_set_perm(e, 0644);
+  if (data) {
+    archive_entry_set_filetype(e, AE_IFREG);
+    archive_entry_set_size(e, strlen(data));
+  } else {
+    archive_entry_set_filetype(e, AE_IFDIR);
+  }
+  ASSERT(archive_write_header(a, e) == ARCHIVE_OK);
+  if (data) {
+    ASSERT(archive_write_data(a, data, strlen(data)) == (ssize_t) strlen(data));
+  }
+  archive_entry_free(e);
+}
+
+static void touch(const char *dir, const char *name) {
+  char *path;
+  FILE *f;
+  ASSERT(path = pu_asprintf("%s/%s", dir, name));
+  ASSERT(f = fopen(path, "w"));
+  fclose(f);
+  free(path);
+}
+
+static void set_mtime(const char *path, time_t mtime) {
+  struct timespec times[2] = { { mtime, 0 }, { mtime, 0 } };
+  ASSERT(utimensat(AT_FDCWD, path, times, 0) == 0);
+}
+
+static void update(void) {
+  pu_cache_index_close(cidx);
+  ASSERT(cidx = pu_cache_index_update(idxfile, cachedir));
+}
+
+static pu_cache_entry_t *find(const char *filename) {
+  return pu_cache_index_find(cidx, filename);
+}
+
+static pu_cache_pkg_t *get(int needfiles) {
+  pu_cache_pkg_free(got);
+  return got = pu_cache_index_get(cidx, find("foo-1.0-1-x86_64.pkg.tar"),
+              needfiles);
+}
+
+int main(void) {
+  struct archive *a;
+  alpm_filelist_t *fl;
+  pu_cache_entry_t *e;
+  char *path;
+  FILE *f;
+
+  ASSERT(atexit(cleanup) == 0);
+  ASSERT(tmpdir = mkdtemp(template));
+  ASSERT(cachedir = pu_asprintf("%s/cache", tmpdir));
+  ASSERT(mkdir(cachedir, 0755) == 0);
+  ASSERT(pkgfile = pu_asprintf("%s/foo-1.0-1-x86_64.pkg.tar", cachedir));
+  ASSERT(sigfile = pu_asprintf("%s.sig", pkgfile));
+  ASSERT(idxfile = pu_asprintf("%s/cache.idx", tmpdir));
+
+  ASSERT(a = archive_write_new());
+  ASSERT(archive_write_set_format_pax_restricted(a) == ARCHIVE_OK);
+  ASSERT(archive_write_open_filename(a, pkgfile) == ARCHIVE_OK);
+  add_entry(a, ".PKGINFO", pkginfo);
+  add_entry(a, ".MTREE", "not a file");
+  add_entry(a, "usr/", NULL);
+  add_entry(a, "usr/bin/", NULL);
+  add_entry(a, "usr/bin/foo", "#!/bin/sh\n");
+  add_entry(a, "etc/foo.conf", "");
+  ASSERT(archive_write_free(a) == ARCHIVE_OK);
+  ASSERT(f = fopen(sigfile, "w"));
+  fputs("not a package", f);
+  fclose(f);
+  touch(cachedir, "bar-baz-1:2.0-3-any.pkg.tar.zst");
+  touch(cachedir, "bar-baz-1:2.0-3-any.pkg.tar.zst.part");
+  touch(cachedir, "pkg-1-any.pkg.tar.zst");
+  ASSERT(path = pu_asprintf("%s/download-XXXX", cachedir));
+  ASSERT(mkdir(path, 0755) == 0);
+  free(path);
+
+  tap_plan(35);
+  ASSERT(pkg = pu_cache_pkg_load(pkgfile, 0));
+  tap_is_str(pkg->name, "foo", "name");
+  tap_is_str(pkg->base, "foo-base", "base");
+  tap_is_str(pkg->version, "1.0-1", "version");
+  tap_is_str(pkg->desc, "a package = with equals", "desc with separator");
+  tap_is_int(pkg->isize, 4096, "isize");
+  tap_is_int(pkg->builddate, 1453283269, "builddate");
+  tap_is_int(alpm_list_count(pkg->groups), 2, "groups");
+  tap_ok(alpm_list_count(pkg->depends) == 2
+      && strcmp(((alpm_depend_t *) pkg->depends->data)->name, "glibc") == 0,
+      "depends");
+  tap_ok(pu_cache_pkg_get_files(pkg) == NULL, "no file list unless loaded");
+
+  ASSERT(files = pu_cache_pkg_load(pkgfile, 1));
+  ASSERT(fl = pu_cache_pkg_get_files(files));
+  tap_ok(fl->count == 4
+      && strcmp(fl->files[0].name, "etc/foo.conf") == 0
+      && strcmp(fl->files[3].name, "usr/bin/foo") == 0,
+      "file list is sorted and skips metadata");
+
+  errno = 0;
+  tap_ok(pu_cache_pkg_load(sigfile, 0) == NULL && errno == EINVAL,
+      "invalid package");
+
+  path = pu_cache_index_path("/idx", "/var/cache/pacman/pkg/");
+  tap_is_str(path, "/idx/pkgcache_var_cache_pacman_pkg_.idx", "index path");
+  free(path);
+
+  update();
+  tap_is_str(cidx->cachedir, cachedir, "cachedir");
+  tap_is_int(cidx->count, 6, "count");
+  tap_ok((e = find("download-XXXX")) && e->isdir, "directory");
+  tap_ok((e = find("foo-1.0-1-x86_64.pkg.tar")) && !e->isdir
+      && e->filesize > 0 && strcmp(e->name, "foo") == 0
+      && strcmp(e->version, "1.0-1") == 0 && strcmp(e->arch, "x86_64") == 0,
+      "package file");
+  tap_ok((e = find("bar-baz-1:2.0-3-any.pkg.tar.zst"))
+      && strcmp(e->name, "bar-baz") == 0
+      && strcmp(e->version, "1:2.0-3") == 0 && strcmp(e->arch, "any") == 0,
+      "package file with epoch");
+  tap_ok((e = find("bar-baz-1:2.0-3-any.pkg.tar.zst.part")) && !e->name
+      && !e->version && !e->arch, "partial download");
+  tap_ok((e = find("pkg-1-any.pkg.tar.zst")) && !e->name, "missing pkgrel");
+  tap_ok((e = find("foo-1.0-1-x86_64.pkg.tar.sig")) && !e->name, "signature");
+  tap_ok(find("foo") == NULL, "find missing file");
+  tap_ok(get(0) == NULL && errno == ENOENT, "get unread package");
+
+  tap_is_int(pu_cache_index_write(idxfile, cidx, &pkg, 1), 0, "write index");
+  update();
+  tap_is_int(cidx->count, 6, "count after write");
+  tap_ok(get(0) && strcmp(got->name, "foo") == 0
+      && alpm_list_count(got->depends) == 2, "get");
+  tap_ok(got && strcmp(got->filename, pkgfile) == 0, "get filename");
+  tap_ok(get(1) == NULL && errno == ENOENT, "get without file list");
+
+  ASSERT(pu_cache_index_write(idxfile, cidx, &files, 1) == 0);
+  update();
+  tap_ok(get(1) && (fl = pu_cache_pkg_get_files(got)) && fl->count == 4,
+      "get file list");
+
+  /* rewriting without the file list keeps it */
+  ASSERT(pu_cache_index_write(idxfile, cidx, &pkg, 1) == 0);
+  update();
+  tap_ok(get(1) && (fl = pu_cache_pkg_get_files(got)) && fl->count == 4,
+      "file list carried over");
+
+  ASSERT(f = fopen(pkgfile, "a"));
+  fputc('\0', f);
+  fclose(f);
+  update();
+  tap_ok(get(0) == NULL && errno == ENOENT, "changed file is out of date");
+  tap_ok((e = find("foo-1.0-1-x86_64.pkg.tar"))
+      && strcmp(e->name, "foo") == 0, "changed file is still listed");
+
+  /* the directory is only read again once its modification time changes */
+  set_mtime(cachedir, 1000000000);
+  update();
+  touch(cachedir, "baz-1-1-any.pkg.tar");
+  set_mtime(cachedir, 1000000000);
+  update();
+  tap_ok(find("baz-1-1-any.pkg.tar") == NULL, "unchanged directory");
+  set_mtime(cachedir, 1000000001);
+  update();
+  tap_ok(find("baz-1-1-any.pkg.tar") != NULL, "changed directory");
+
+  pu_cache_index_close(cidx);
+  ASSERT(cidx = pu_cache_index_update(NULL, cachedir));
+  tap_is_int(cidx->count, 7, "update without an index file");
+
+  errno = 0;
+  tap_ok(pu_cache_index_open(sigfile) == NULL && errno == EINVAL,
+      "invalid index");
+
+  return tap_finish();
+}
@@ -0,0 +1,71 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "pacutils.h"
+
+#include "pacutils_test.h"
+
+static void check(const char *buf, size_t len, const char *md5,
+    const char *sha256, const char *desc) {
+  pu_digest_t digest;
+  FILE *f = tmpfile();
+  ASSERT(f != NULL);
+  ASSERT(fwrite(buf, 1, len, f) == len);
+  ASSERT(fflush(f) == 0);
+  ASSERT(lseek(fileno(f), 0, SEEK_SET) == 0);
+
+  memset(&digest, 0, sizeof(digest));
+  tap_ok(pu_digest_fd(fileno(f), PU_DIGEST_MD5 | PU_DIGEST_SHA256,
+          &digest) == 0, "%s - pu_digest_fd", desc);
+  tap_is_str(digest.md5, md5, "%s - md5", desc);
+  tap_is_str(digest.sha256, sha256, "%s - sha256", desc);
+
+  ASSERT(lseek(fileno(f), 0, SEEK_SET) == 0);
+  memset(&digest, 0, sizeof(digest));
+  pu_digest_fd(fileno(f), PU_DIGEST_SHA256, &digest);
+  tap_is_str(digest.md5, "", "%s - md5 not requested", desc);
+  tap_is_str(digest.sha256, sha256, "%s - sha256 only", desc);
+
+  fclose(f);
+}
+
+static void check_vectors(const char *big) {
+  check("", 0,
+      "d41d8cd98f00b204e9800998ecf8427e",
+      "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+      "empty");
+  check("abc", 3,
+      "900150983cd24fb0d6963f7d28e17f72",
+      "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+      "abc");
+  check("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56,
+      "8215ef0796a20bcaaae116d3876c664a",
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+      "two block padding");
+  check(big, 1000000,
+      "7707d6ae4e027c70eea2a935c2296f21",
+      "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+      "multiple reads");
+}
+
+int main(void) {
+  char *big = malloc(1000000);
+  ASSERT(big != NULL);
+  memset(big, 'a', 1000000);
+
+  tap_plan(41);
+
+  /* the SHA extensions are used if the CPU supports them, check the
+   * portable implementation as well */
+  check_vectors(big);
+  ASSERT(setenv("PACUTILS_DISABLE_SHA_NI", "1", 1) == 0);
+  check_vectors(big);
+  ASSERT(unsetenv("PACUTILS_DISABLE_SHA_NI") == 0);
+
+  tap_is_int(pu_digest_file("/nonexistent/pacutils", PU_DIGEST_MD5, NULL), -1,
+      "missing file");
+
+  free(big);
+  return tap_finish();
+}
@@ -0,0 +1,115 @@
+#include <alpm.h>
+
+#include "pacutils.h"
+
+#include "pacutils_test.h"
+
+#define MAXFOUND 16
+
+struct found {
+  const char *files[MAXFOUND];
+  size_t idx[MAXFOUND];
+  size_t count, stop;
+};
+
+static int record(alpm_file_t *file, size_t idx, void *ctx) {
+  struct found *f = ctx;
+  ASSERT(f->count < MAXFOUND);
+  f->files[f->count] = file->name;
+  f->idx[f->count] = idx;
+  return ++f->count == f->stop ? -1 : 0;
+}
+
+static void check_norm(const char *in, const char *exp) {
+  char *norm = pu_path_normalize(in);
+  tap_is_str(norm, exp, "normalize '%s'", in);
+  free(norm);
+}
+
+int main(void) {
+  alpm_file_t files[200];
+  alpm_filelist_t filelist = { .files = files, .count = 0 };
+  char names[200][16];
+  struct found f;
+  size_t i;
+
+  /* a long list so that both sides have to be skipped over */
+  files[filelist.count++].name = "etc/";
+  files[filelist.count++].name = "etc/foo";
+  for (i = 0; i < 190; i++) {
+    snprintf(names[i], sizeof(names[i]), "usr/a%03zu", i);
+    files[filelist.count++].name = names[i];
+  }
+  files[filelist.count++].name = "usr/bin/";
+  files[filelist.count++].name = "usr/bin/foo";
+  files[filelist.count++].name = "usr/lib";
+
+  tap_plan(18);
+
+  check_norm("usr//bin/", "usr/bin");
+  check_norm("usr/bin///foo", "usr/bin/foo");
+  check_norm("/", "/");
+  check_norm("", "");
+
+  {
+    /* path and directory keys, as pacfile queries them */
+    const char *paths[] = { "usr/bin", "usr/bin/", "usr/lib", "usr/lib/" };
+    memset(&f, 0, sizeof(f));
+    tap_is_int(pu_filelist_find_paths(&filelist, paths, 4, record, &f), 0,
+        "directory and file keys");
+    tap_is_int(f.count, 2, "one match per path");
+    tap_ok(f.idx[0] == 1 && strcmp(f.files[0], "usr/bin/") == 0,
+        "directory matched by its directory key");
+    tap_ok(f.idx[1] == 2 && strcmp(f.files[1], "usr/lib") == 0,
+        "file matched by its path key");
+  }
+
+  {
+    const char *paths[] = { "a", "etc/foo", "usr/a000", "usr/a189",
+      "usr/a500", "usr/bin/foo", "zzz" };
+    memset(&f, 0, sizeof(f));
+    pu_filelist_find_paths(&filelist, paths, 7, record, &f);
+    tap_is_int(f.count, 4, "matches across skipped ranges");
+    tap_ok(f.idx[0] == 1 && f.idx[1] == 2 && f.idx[2] == 3 && f.idx[3] == 5,
+        "matches in order");
+    tap_is_str(f.files[2], "usr/a189", "last file in skipped range");
+  }
+
+  {
+    const char *paths[] = { "etc/foo", "etc/foo", "usr/a100" };
+    memset(&f, 0, sizeof(f));
+    pu_filelist_find_paths(&filelist, paths, 3, record, &f);
+    tap_ok(f.count == 3 && f.idx[0] == 0 && f.idx[1] == 1,
+        "repeated paths each match");
+  }
+
+  {
+    const char *paths[] = { "aaa", "bbb", "usr/a0", "usr/b", "zzz" };
+    memset(&f, 0, sizeof(f));
+    pu_filelist_find_paths(&filelist, paths, 5, record, &f);
+    tap_is_int(f.count, 0, "no matches");
+  }
+
+  {
+    const char *paths[] = { "etc/", "etc/foo", "usr/lib" };
+    memset(&f, 0, sizeof(f));
+    f.stop = 2;
+    tap_is_int(pu_filelist_find_paths(&filelist, paths, 3, record, &f), -1,
+        "callback error returned");
+    tap_is_int(f.count, 2, "search stopped");
+  }
+
+  {
+    alpm_filelist_t empty = { .files = NULL, .count = 0 };
+    const char *paths[] = { "etc/" };
+    memset(&f, 0, sizeof(f));
+    tap_is_int(pu_filelist_find_paths(&empty, paths, 1, record, &f), 0,
+        "empty file list");
+    tap_is_int(pu_filelist_find_paths(NULL, paths, 1, record, &f), 0,
+        "NULL file list");
+    tap_is_int(pu_filelist_find_paths(&filelist, paths, 0, record, &f), 0,
+        "no paths");
+  }
+
+  return tap_finish();
+}
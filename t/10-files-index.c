@@ -0,0 +1,120 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "pacutils_test.h"
+
+#include "pacutils.h"
+
+char *tmpdir = NULL, template[] = "/tmp/10-files-index.c-XXXXXX";
+char *dbfile = NULL, *idxfile = NULL;
+pu_files_index_t *fidx = NULL;
+pu_bitmap_t *owners = NULL;
+
+void cleanup(void) {
+  pu_files_index_close(fidx);
+  pu_bitmap_free(owners);
+  free(dbfile);
+  free(idxfile);
+  if (tmpdir) { rmrfat(AT_FDCWD, tmpdir); }
+}
+
+static int has_substr(const char *path, void *needle) {
+  return strstr(path, needle) != NULL;
+}
+
+static void add_file(alpm_filelist_t *files, const char *path) {
+  ASSERT(files->files[files->count++].name = strdup(path));
+}
+
+static void check_owners(const char *desc, int bash, int coreutils, int zlib) {
+  tap_ok(pu_bitmap_count(owners) == (size_t) (bash + coreutils + zlib)
+      && pu_bitmap_test(owners, 0) == bash
+      && pu_bitmap_test(owners, 1) == coreutils
+      && pu_bitmap_test(owners, 2) == zlib, "%s", desc);
+  pu_bitmap_zero(owners);
+}
+
+int main(void) {
+  const char *names[] = { "zlib", "bash", "coreutils" };
+  const char *vers[] = { "1.3-1", "5.2.026-2", "9.4-3" };
+  alpm_filelist_t lists[3], *filelists[] = { &lists[0], &lists[1], &lists[2] };
+  size_t i, id;
+  FILE *f;
+  int n;
+
+  ASSERT(atexit(cleanup) == 0);
+  ASSERT(tmpdir = mkdtemp(template));
+  ASSERT(dbfile = pu_asprintf("%s/%s", tmpdir, "core.files"));
+  ASSERT(idxfile = pu_asprintf("%s/%s", tmpdir, "core.files.idx"));
+  ASSERT(f = fopen(dbfile, "w"));
+  fclose(f);
+
+  for (i = 0; i < 3; i++) {
+    lists[i].count = 0;
+    ASSERT(lists[i].files = calloc(64, sizeof(alpm_file_t)));
+    add_file(&lists[i], "usr/");
+    add_file(&lists[i], "usr/share/");
+    for (n = 0; n < 20; n++) {
+      char path[64];
+      snprintf(path, sizeof(path), "usr/share/doc/%s/file%02d", names[i], n);
+      add_file(&lists[i], path);
+    }
+  }
+  add_file(&lists[1], "usr/bin/bash");
+  add_file(&lists[2], "usr/bin/ls");
+
+  tap_plan(17);
+
+  tap_is_int(pu_files_index_write_filelists(dbfile, names, vers, filelists,
+          3, idxfile), 0, "write index");
+  ASSERT(fidx = pu_files_index_open(idxfile));
+  ASSERT(owners = pu_bitmap_new(fidx->pkgcount));
+  tap_is_int(fidx->pkgcount, 3, "pkgcount");
+  tap_is_int(fidx->pathcount, 64, "pathcount");
+  tap_is_str(pu_files_index_pkgname(fidx, 0), "bash", "ids in name order");
+  tap_ok(pu_files_index_pkg_id(fidx, "zlib", &id) == 0 && id == 2,
+      "pkg id");
+  tap_is_int(pu_files_index_pkg_id(fidx, "glibc", &id), -1, "missing pkg");
+  tap_is_str(pu_files_index_pkgver(fidx, 2), "1.3-1", "pkg version");
+
+  pu_files_index_find(fidx, "usr/", owners);
+  check_owners("find shared directory", 1, 1, 1);
+  pu_files_index_find(fidx, "usr/bin/bash", owners);
+  check_owners("find file", 1, 0, 0);
+  pu_files_index_find(fidx, "usr/share/doc/zlib/file19", owners);
+  check_owners("find last file in block", 0, 0, 1);
+  pu_files_index_find(fidx, "usr/bin/ba", owners);
+  check_owners("find missing file", 0, 0, 0);
+  pu_files_index_find_prefix(fidx, "usr/share/doc/coreutils/", owners);
+  check_owners("find prefix", 0, 1, 0);
+  pu_files_index_match(fidx, has_substr, "bin/", owners);
+  check_owners("match substring", 1, 1, 0);
+
+  tap_is_int(pu_files_index_is_current(fidx, dbfile), 1, "index is current");
+  ASSERT(f = fopen(dbfile, "w"));
+  fputs("changed", f);
+  fclose(f);
+  tap_is_int(pu_files_index_is_current(fidx, dbfile), 0, "index is stale");
+  pu_files_index_close(fidx);
+
+  ASSERT(pu_files_index_write_filelists(NULL, names, vers, filelists, 0,
+          idxfile) == 0);
+  ASSERT(fidx = pu_files_index_open(idxfile));
+  tap_is_int(pu_files_index_find(fidx, "usr/", owners), 0, "empty index");
+  pu_files_index_close(fidx);
+
+  ASSERT(f = fopen(idxfile, "w"));
+  fputs("not an index, but long enough to hold an index header. "
+      "not an index, but long enough to hold an index header.", f);
+  fclose(f);
+  fidx = pu_files_index_open(idxfile);
+  tap_ok(fidx == NULL && errno == EINVAL, "invalid index");
+
+  for (i = 0; i < 3; i++) {
+    for (n = 0; n < (int) lists[i].count; n++) { free(lists[i].files[n].name); }
+    free(lists[i].files);
+  }
+
+  return tap_finish();
+}
@@ -0,0 +1,69 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "pacutils/log.h"
+
+#include "pacutils_test.h"
+
+#define ENTRIES 2000
+
+int main(void) {
+  pu_log_reader_t *reader;
+  pu_log_entry_t *e, *copy = NULL;
+  char longmsg[100000];
+  FILE *stream;
+  int i, ok = 1;
+
+  ASSERT(stream = tmpfile());
+
+  /* long enough to span several reads and to exceed the initial buffer */
+  memset(longmsg, 'x', sizeof(longmsg) - 1);
+  longmsg[sizeof(longmsg) - 1] = '\0';
+  fprintf(stream, "[2016-10-23 11:12] [caller] %s\n", longmsg);
+  for (i = 0; i < ENTRIES; i++) {
+    fprintf(stream, "[2016-10-24T11:23:45+0100] [c%d] message %d\n"
+        "continued %d\n", i, i, i);
+  }
+  fputs("[2016-10-25 10:00] [last] no trailing newline", stream);
+  rewind(stream);
+
+  ASSERT(reader = pu_log_reader_open_stream(stream));
+
+  tap_plan(11);
+
+  tap_ok((e = pu_log_reader_next_view(reader)) != NULL, "long entry");
+  tap_is_str(e->caller, "caller", "long entry caller");
+  tap_ok(e->message && strlen(e->message) == sizeof(longmsg)
+      && e->message[sizeof(longmsg) - 1] == '\n', "long entry message");
+
+  for (i = 0; i < ENTRIES && ok; i++) {
+    char caller[20], message[60];
+    sprintf(caller, "c%d", i);
+    sprintf(message, "message %d\ncontinued %d\n", i, i);
+    if ((e = pu_log_reader_next_view(reader)) == NULL
+        || strcmp(e->caller, caller) != 0
+        || strcmp(e->message, message) != 0
+        || e->timestamp.tm.tm_mday != 24) {
+      ok = 0;
+    }
+    if (i == 10) { copy = pu_log_entry_copy(e); }
+  }
+  tap_ok(ok, "multi-line entries across buffer refills");
+
+  tap_ok(copy != NULL, "copy");
+  tap_is_str(copy->caller, "c10", "copy caller");
+  tap_is_str(copy->message, "message 10\ncontinued 10\n", "copy message");
+  pu_log_entry_free(copy);
+
+  tap_ok((e = pu_log_reader_next_view(reader)) != NULL, "final entry");
+  tap_is_str(e->message, "no trailing newline", "final entry message");
+
+  tap_ok(pu_log_reader_next_view(reader) == NULL, "next");
+  tap_ok(reader->eof, "eof");
+
+  pu_log_reader_free(reader);
+  fclose(stream);
+
+  return tap_finish();
+}
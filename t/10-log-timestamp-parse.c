@@ -0,0 +1,67 @@
+#include "pacutils/log.c"
+#include <limits.h>
+#include <stdlib.h>
+
+#include "pacutils_test.h"
+
+#define PARSE(s, ts) _pu_log_parse_timestamp(s, s + strlen(s), ts)
+
+int main(void) {
+  pu_log_timestamp_t ts;
+  const char *s;
+  char *p;
+
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  tap_plan(24);
+
+  s = "[2016-10-23 11:12] message";
+  tap_ok((p = PARSE(s, &ts)) == s + 18, "legacy: end");
+  tap_is_int(ts.tm.tm_year, 116, "legacy: year");
+  tap_is_int(ts.tm.tm_mon, 9, "legacy: month");
+  tap_is_int(ts.tm.tm_mday, 23, "legacy: day");
+  tap_is_int(ts.tm.tm_hour, 11, "legacy: hour");
+  tap_is_int(ts.tm.tm_min, 12, "legacy: minute");
+  tap_ok(!ts.has_seconds && !ts.has_gmtoff, "legacy: flags");
+
+  s = "[2016-10-24T01:23:45-0130] message";
+  tap_ok((p = PARSE(s, &ts)) == s + 26, "iso8601: end");
+  tap_is_int(ts.tm.tm_hour, 1, "iso8601: hour");
+  tap_is_int(ts.tm.tm_min, 23, "iso8601: minute");
+  tap_is_int(ts.tm.tm_sec, 45, "iso8601: second");
+  tap_is_int(ts.gmtoff, -130, "iso8601: gmtoff");
+  tap_ok(ts.has_seconds && ts.has_gmtoff, "iso8601: flags");
+
+  tap_ok(PARSE("continued message", &ts) == NULL, "reject: text");
+  tap_ok(PARSE("[2016-10-23 11:12", &ts) == NULL, "reject: truncated");
+  tap_ok(PARSE("[2016-13-23 11:12] x", &ts) == NULL, "reject: month");
+  tap_ok(PARSE("[2016-10-23 24:00] x", &ts) == NULL, "reject: hour");
+  tap_ok(PARSE("[2016-10-23T11:12:00] x", &ts) == NULL, "reject: no offset");
+  tap_ok(PARSE("[2016-10-23T11:12:00+01] x", &ts) == NULL,
+      "reject: short offset");
+  tap_ok(_pu_log_parse_timestamp(s, s + 20, &ts) == NULL, "reject: bounds");
+
+  {
+    char buf[] =
+        "[2016-10-23 11:12] a\n"
+        "[2016-10-23 11:59] b\n"
+        "[2016-10-23T12:00:01+0000] c\n";
+    FILE *stream = fmemopen(buf, strlen(buf), "r");
+    pu_log_reader_t *reader = pu_log_reader_open_stream(stream);
+    pu_log_entry_t *e;
+
+    e = pu_log_reader_next_view(reader);
+    tap_ok(e && e->timestamp.time == 1477221120, "time");
+    e = pu_log_reader_next_view(reader);
+    tap_ok(e && e->timestamp.time == 1477221120 + 47 * 60, "cached time");
+    e = pu_log_reader_next_view(reader);
+    tap_ok(e && e->timestamp.time == 1477224001, "next hour");
+    tap_ok(pu_log_reader_next_view(reader) == NULL && reader->eof, "eof");
+
+    pu_log_reader_free(reader);
+    fclose(stream);
+  }
+
+  return tap_finish();
+}
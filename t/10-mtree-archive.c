@@ -0,0 +1,80 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "pacutils/mtree.c"
+
+#include "pacutils_test.h"
+
+char buf[] =
+    "#mtree\n"
+    "/set type=file uid=0 gid=0 mode=644\n"
+    "./.PKGINFO time=1453283269.864514835 size=410 md5digest=b90ee962592f6c66c2ccbfa3718ebdce sha256digest=863dfa105c333a4e91d70b7332931e99fc5561a35685039e098e4b261466eae0\n"
+    "/set mode=755\n"
+    "./usr time=1453283269.234514817 type=dir\n"
+    "./usr/bin/pac\\040check time=1453283269.447848157 uid=1 gid=2 size=23712 md5digest=adeb5af3c33e76f0e663394c88272c14\n"
+    "./usr/bin/link type=link time=1453283269.447848157 link=pac\\040check\n"
+    "./usr/bin/noeol size=7";
+
+/* read the same data with different libarchive block sizes so that lines
+ * both fit within and span data blocks */
+void check(size_t blocksize) {
+  struct archive *a;
+  struct archive_entry *ae;
+  pu_mtree_reader_t *reader;
+  pu_mtree_t *e;
+
+  ASSERT(a = archive_read_new());
+  ASSERT(archive_read_support_format_raw(a) == ARCHIVE_OK);
+  ASSERT(archive_read_open_memory2(a, buf, strlen(buf), blocksize) == ARCHIVE_OK);
+  ASSERT(archive_read_next_header(a, &ae) == ARCHIVE_OK);
+  ASSERT(reader = _pu_mtree_reader_open_archive(a));
+  ASSERT(e = pu_mtree_new());
+
+  tap_ok(pu_mtree_reader_next(reader, e) == e, "%zu: next", blocksize);
+  tap_is_str(e->path, ".PKGINFO", "%zu: path", blocksize);
+  tap_is_int(e->mode, 0644, "%zu: mode", blocksize);
+  tap_is_int(e->size, 410, "%zu: size", blocksize);
+  tap_is_str(e->sha256digest,
+      "863dfa105c333a4e91d70b7332931e99fc5561a35685039e098e4b261466eae0",
+      "%zu: sha256", blocksize);
+
+  tap_ok(pu_mtree_reader_next(reader, e) == e, "%zu: next", blocksize);
+  tap_is_str(e->path, "usr", "%zu: path", blocksize);
+  tap_is_str(e->type, "dir", "%zu: type", blocksize);
+  tap_is_str(e->sha256digest, "", "%zu: sha256 reset", blocksize);
+
+  tap_ok(pu_mtree_reader_next(reader, e) == e, "%zu: next", blocksize);
+  tap_is_str(e->path, "usr/bin/pac check", "%zu: escaped path", blocksize);
+  tap_is_int(e->uid, 1, "%zu: uid", blocksize);
+  tap_is_int(e->gid, 2, "%zu: gid", blocksize);
+  tap_is_int(e->mode, 0755, "%zu: mode", blocksize);
+  tap_is_str(e->md5digest, "adeb5af3c33e76f0e663394c88272c14",
+      "%zu: md5", blocksize);
+
+  tap_ok(pu_mtree_reader_next(reader, e) == e, "%zu: next", blocksize);
+  tap_is_str(e->path, "usr/bin/link", "%zu: path", blocksize);
+  tap_is_str(e->type, "link", "%zu: type", blocksize);
+  tap_is_int(e->mtime, 1453283269, "%zu: mtime", blocksize);
+  tap_is_str(e->link, "pac check", "%zu: link", blocksize);
+
+  tap_ok(pu_mtree_reader_next(reader, e) == e, "%zu: next", blocksize);
+  tap_is_str(e->path, "usr/bin/noeol", "%zu: path", blocksize);
+  tap_ok(e->link == NULL, "%zu: link reset", blocksize);
+  tap_is_int(e->size, 7, "%zu: size", blocksize);
+
+  tap_ok(pu_mtree_reader_next(reader, e) == NULL, "%zu: next", blocksize);
+  tap_ok(reader->eof, "%zu: eof", blocksize);
+
+  pu_mtree_free(e);
+  pu_mtree_reader_free(reader);
+}
+
+int main(void) {
+  tap_plan(26 * 4);
+  check(1);
+  check(7);
+  check(64);
+  check(sizeof(buf));
+  return tap_finish();
+}
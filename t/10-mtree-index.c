@@ -0,0 +1,56 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "pacutils.h"
+
+#include "pacutils_test.h"
+
+char buf[] =
+    "#mtree\n"
+    "/set type=file uid=0 gid=0 mode=644\n"
+    "./usr/bin/pacfile size=3\n"
+    "./usr time=1453283269.234514817 mode=755 type=dir\n"
+    "./usr-local size=2\n"
+    "./usr/bin mode=755 type=dir\n"
+    "./usr/bin/paccheck size=1\n"
+    "";
+
+int main(void) {
+  FILE *stream;
+  pu_mtree_reader_t *reader;
+  pu_mtree_index_t *index;
+  pu_mtree_t *e;
+
+  ASSERT(stream = fmemopen(buf, strlen(buf), "r"));
+  ASSERT(reader = pu_mtree_reader_open_stream(stream));
+
+  tap_plan(13);
+
+  tap_ok((index = pu_mtree_index_new(reader)) != NULL, "pu_mtree_index_new");
+  tap_is_int(index->count, 5, "count");
+  tap_is_str(index->entries[0].path, "usr", "sorted");
+  tap_is_str(index->entries[4].path, "usr/bin/pacfile", "sorted");
+
+  e = pu_mtree_index_find(index, "usr/bin/paccheck");
+  tap_ok(e && e->size == 1, "find file");
+  e = pu_mtree_index_find(index, "usr/bin/pacfile");
+  tap_ok(e && e->size == 3, "find file");
+  e = pu_mtree_index_find(index, "usr");
+  tap_ok(e && pu_mtree_filetype(e) == S_IFDIR, "find directory");
+  e = pu_mtree_index_find(index, "usr/");
+  tap_ok(e && strcmp(e->path, "usr") == 0, "trailing slash");
+  e = pu_mtree_index_find(index, "usr//bin///");
+  tap_ok(e && strcmp(e->path, "usr/bin") == 0, "repeated slashes");
+  e = pu_mtree_index_find(index, "./usr-local");
+  tap_ok(e && e->size == 2, "leading ./");
+  tap_ok(pu_mtree_index_find(index, "usr/bin/pac") == NULL, "missing prefix");
+  tap_ok(pu_mtree_index_find(index, "usr/bin/paccheck2") == NULL, "missing");
+  tap_ok(pu_mtree_index_find(NULL, "usr") == NULL, "NULL index");
+
+  pu_mtree_index_free(index);
+  pu_mtree_reader_free(reader);
+  fclose(stream);
+
+  return tap_finish();
+}
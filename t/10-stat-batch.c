@@ -0,0 +1,123 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "pacutils_test.h"
+
+#include "pacutils.h"
+
+#define COUNT 600
+
+char *tmpdir = NULL, template[] = "/tmp/10-stat-batch.c-XXXXXX";
+char *paths[COUNT];
+pu_lstat_entry_t entries[COUNT];
+pu_stat_batch_t *batch = NULL;
+
+void cleanup(void) {
+  size_t i;
+  pu_stat_batch_free(batch);
+  for (i = 0; i < COUNT; i++) { free(paths[i]); }
+  if (tmpdir) { rmrfat(AT_FDCWD, tmpdir); }
+}
+
+/* every fourth path is a file, a symlink, a directory, or missing */
+static void make_paths(void) {
+  size_t i;
+  for (i = 0; i < COUNT; i++) {
+    FILE *f;
+    ASSERT(paths[i] = pu_asprintf("%s/%zu", tmpdir, i));
+    switch (i % 4) {
+      case 0:
+        ASSERT(f = fopen(paths[i], "w"));
+        fprintf(f, "%*s", (int) i, "");
+        fclose(f);
+        break;
+      case 1:
+        ASSERT(symlink(tmpdir, paths[i]) == 0);
+        break;
+      case 2:
+        ASSERT(mkdir(paths[i], 0700) == 0);
+        break;
+    }
+  }
+}
+
+static int entries_match(void) {
+  size_t i;
+  for (i = 0; i < COUNT; i++) {
+    struct stat st;
+    pu_lstat_entry_t *e = &entries[i];
+    if (lstat(paths[i], &st) != 0) {
+      if (e->err != errno) { return 0; }
+    } else if (e->err != 0
+        || e->st.st_mode != st.st_mode
+        || e->st.st_ino != st.st_ino
+        || e->st.st_dev != st.st_dev
+        || e->st.st_size != st.st_size
+        || e->st.st_uid != st.st_uid
+        || e->st.st_mtim.tv_sec != st.st_mtim.tv_sec
+        || e->st.st_mtim.tv_nsec != st.st_mtim.tv_nsec) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void reset_entries(int err) {
+  size_t i;
+  memset(entries, 0, sizeof(entries));
+  for (i = 0; i < COUNT; i++) {
+    entries[i].path = paths[i];
+    entries[i].err = err;
+  }
+}
+
+int main(void) {
+  ASSERT(atexit(cleanup) == 0);
+  ASSERT(tmpdir = mkdtemp(template));
+  make_paths();
+
+  tap_plan(9);
+
+  ASSERT(batch = pu_stat_batch_new(0));
+  reset_entries(0);
+  pu_lstat_batch(batch, entries, 3);
+  tap_ok(entries[0].err == 0 && S_ISREG(entries[0].st.st_mode)
+      && entries[1].err == 0 && S_ISLNK(entries[1].st.st_mode)
+      && entries[2].err == 0 && S_ISDIR(entries[2].st.st_mode),
+      "small batch");
+
+  reset_entries(0);
+  pu_lstat_batch(batch, entries, COUNT);
+  tap_ok(entries_match(), "batch matches lstat");
+  tap_is_int(entries[3].err, ENOENT, "missing file");
+  tap_ok(S_ISLNK(entries[5].st.st_mode), "symlinks are not followed");
+  tap_is_int(entries[COUNT - 4].st.st_size, COUNT - 4, "file size");
+
+  reset_entries(0);
+  pu_lstat_batch(batch, entries, COUNT);
+  tap_ok(entries_match(), "batch reused");
+  pu_stat_batch_free(batch);
+  batch = NULL;
+
+  reset_entries(0);
+  pu_lstat_batch(NULL, entries, COUNT);
+  tap_ok(entries_match(), "no batch matches lstat");
+
+  setenv("PACUTILS_DISABLE_IO_URING", "1", 1);
+  ASSERT(batch = pu_stat_batch_new(0));
+  reset_entries(0);
+  pu_lstat_batch(batch, entries, COUNT);
+  tap_ok(entries_match(), "thread pool matches lstat");
+  pu_stat_batch_free(batch);
+  batch = NULL;
+
+  ASSERT(batch = pu_stat_batch_new(1));
+  reset_entries(0);
+  pu_lstat_batch(batch, entries, COUNT);
+  tap_ok(entries_match(), "single thread matches lstat");
+  unsetenv("PACUTILS_DISABLE_IO_URING");
+
+  return tap_finish();
+}
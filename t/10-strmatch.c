@@ -0,0 +1,92 @@
+#define _GNU_SOURCE /* strcasestr */
+
+#include <regex.h>
+
+#include "pacutils.h"
+
+#include "pacutils_test.h"
+
+const char *patterns[] = { "he", "she", "his", "hers", "LIB", "x", "" };
+const char *texts[] = {
+  "ushers", "SHE", "this", "libalpm", "glibc", "python-six", "abc", "", NULL
+};
+
+/* regex, literal, text it matches */
+const char *regexes[][3] = {
+  { "^lib.*alpm$", "alpm", "libfooalpm" },
+  { "ab)cd", "ab)cd", "xAB)CD" },
+  { "py(thon)?-six", "-six", "py-six" },
+  { "abc+d", "abc", "abcccd" },
+  { "ab*c", "a", "ac" },
+  { "x{2}yz", "yz", "xxyz" },
+  { "a\\.b", "a.b", "a.b" },
+  { "\\<foo", "foo", "a foo" },
+  { "foo\\>-bars?", "-bar", "foo-bar" },
+  { "[]ab]cd[[:digit:]]", "cd", "]cd1" },
+  { "(a|b)c", "c", "bc" },
+  { "ab|cd", NULL, "cd" },
+  { NULL, NULL, NULL },
+};
+
+static void check_literal(const char **r) {
+  regex_t preg;
+  char *literal = pu_regex_literal(r[0]);
+  ASSERT(regcomp(&preg, r[0], REG_EXTENDED | REG_ICASE | REG_NOSUB) == 0);
+  tap_ok((literal == NULL ? r[1] == NULL : r[1] && strcmp(literal, r[1]) == 0)
+      && regexec(&preg, r[2], 0, NULL, 0) == 0
+      && (literal == NULL || strcasestr(r[2], literal) != NULL),
+      "regex literal %s", r[0]);
+  regfree(&preg);
+  free(literal);
+}
+
+int main(void) {
+  pu_strmatch_t *m;
+  pu_bitmap_t *hits;
+  size_t i, j;
+
+  tap_plan(25);
+
+  ASSERT(m = pu_strmatch_new());
+  for (i = 0; i < 6; i++) {
+    ASSERT(pu_strmatch_add(m, patterns[i]) == (int) i);
+  }
+  ASSERT(pu_strmatch_compile(m) == 0);
+  tap_is_int(pu_strmatch_add(m, "late"), -1, "add after compile fails");
+
+  ASSERT(hits = pu_bitmap_new(m->count));
+  for (i = 0; texts[i]; i++) {
+    int ok = 1, any = 0;
+    pu_bitmap_zero(hits);
+    pu_strmatch_scan(m, texts[i], hits);
+    for (j = 0; j < m->count; j++) {
+      int found = strcasestr(texts[i], patterns[j]) != NULL;
+      any |= found;
+      if (found != pu_bitmap_test(hits, j)) { ok = 0; }
+    }
+    tap_ok(ok && pu_strmatch_search(m, texts[i]) == any, "%s", texts[i]);
+  }
+  pu_bitmap_free(hits);
+  pu_strmatch_free(m);
+
+  ASSERT(m = pu_strmatch_new());
+  ASSERT(pu_strmatch_add(m, "abc") == 0);
+  ASSERT(pu_strmatch_add(m, "") == 1);
+  ASSERT(pu_strmatch_compile(m) == 0);
+  tap_ok(pu_strmatch_search(m, ""), "empty pattern matches empty text");
+  ASSERT(hits = pu_bitmap_new(m->count));
+  pu_strmatch_scan(m, "xabcx", hits);
+  tap_is_int(pu_bitmap_count(hits), 2, "empty pattern scanned");
+  pu_bitmap_free(hits);
+  pu_strmatch_free(m);
+
+  ASSERT(m = pu_strmatch_new());
+  ASSERT(pu_strmatch_compile(m) == 0);
+  tap_ok(!pu_strmatch_search(m, "anything"), "no patterns matches nothing");
+  tap_is_int(m->count, 0, "no patterns");
+  pu_strmatch_free(m);
+
+  for (i = 0; regexes[i][0]; i++) { check_literal(regexes[i]); }
+
+  return tap_finish();
+}
@@ -0,0 +1,96 @@
+#include "pacutils.h"
+
+#include "pacutils_test.h"
+
+pu_version_cache_t *cache = NULL;
+
+static void check(const char *v1, const char *v2, int exp) {
+  pu_version_key_t *k1 = pu_version_key_new(v1);
+  pu_version_key_t *k2 = pu_version_key_new(v2);
+  ASSERT(k1 != NULL && k2 != NULL);
+  tap_is_int(pu_version_key_cmp(k1, k2), exp, "%s <=> %s", v1, v2);
+  tap_is_int(pu_version_key_cmp(k2, k1), -exp, "%s <=> %s", v2, v1);
+  tap_ok(pu_version_key_cmp(pu_version_cache_get(cache, v1),
+          pu_version_cache_get(cache, v2)) == exp, "%s <=> %s (cached)", v1, v2);
+  pu_version_key_free(k1);
+  pu_version_key_free(k2);
+}
+
+int main(void) {
+  ASSERT(cache = pu_version_cache_new());
+
+  tap_plan(3 * 48 + 3);
+
+  /* same cases as pacman's vercmptest */
+  check("1.5.0", "1.5.0", 0);
+  check("1.5.1", "1.5.0", 1);
+  check("1.5.1", "1.5", 1);
+
+  check("1.5.0-1", "1.5.0-1", 0);
+  check("1.5.0-1", "1.5.0-2", -1);
+  check("1.5.0-1", "1.5.1-1", -1);
+  check("1.5.0-2", "1.5.1-1", -1);
+
+  check("1.5-1", "1.5.1-1", -1);
+  check("1.5-2", "1.5.1-1", -1);
+  check("1.5-2", "1.5.1-2", -1);
+
+  check("1.5", "1.5-1", 0);
+  check("1.5-1", "1.5", 0);
+  check("1.1-1", "1.1", 0);
+  check("1.0-1", "1.1", -1);
+  check("1.1-1", "1.0", 1);
+
+  check("1.5b-1", "1.5-1", -1);
+  check("1.5b", "1.5", -1);
+  check("1.5b-1", "1.5", -1);
+  check("1.5b", "1.5.1", -1);
+
+  check("1.0a", "1.0alpha", -1);
+  check("1.0alpha", "1.0b", -1);
+  check("1.0b", "1.0beta", -1);
+  check("1.0beta", "1.0rc", -1);
+  check("1.0rc", "1.0", -1);
+
+  check("1.5.a", "1.5", 1);
+  check("1.5.b", "1.5.a", 1);
+  check("1.5.1", "1.5.b", 1);
+
+  check("1.5.b-1", "1.5.b", 0);
+  check("1.5-1", "1.5.b", -1);
+
+  check("2.0", "2_0", 0);
+  check("2.0_a", "2_0.a", 0);
+  check("2.0a", "2.0.a", -1);
+  check("2___a", "2_a", 1);
+
+  check("0:1.0", "0:1.0", 0);
+  check("0:1.0", "0:1.1", -1);
+  check("1:1.0", "0:1.0", 1);
+  check("1:1.0", "0:1.1", 1);
+  check("1:1.0", "2:1.1", -1);
+
+  check("1:1.0", "0:1.0-1", 1);
+  check("1:1.0-1", "0:1.1-1", 1);
+
+  check("0:1.0", "1.0", 0);
+  check("0:1.0", "1.1", -1);
+  check("0:1.1", "1.0", 1);
+  check("1:1.0", "1.0", 1);
+  check("1:1.0", "1.1", 1);
+  check("1:1.1", "1.1", 1);
+
+  /* leading zeros and trailing separators */
+  check("1.010", "1.10", 0);
+  check("1.0.", "1.0", 1);
+
+  tap_ok(pu_version_cache_get(cache, "1.5.0") == pu_version_cache_get(cache,
+          "1.5.0"), "cached keys are reused");
+  tap_ok(pu_version_cache_find(cache, "9.9") == NULL, "find does not parse");
+  tap_ok(pu_version_key_cmp(NULL, pu_version_cache_get(cache, "1.0")) == -1,
+      "NULL sorts first");
+
+  pu_version_cache_free(cache);
+
+  return tap_finish();
+}